@@ -1443,6 +1443,207 @@ ZTS_API int ZTCALL zts_init_allow_roots_cache(unsigned int allowed);
  */
 ZTS_API int ZTCALL zts_init_allow_id_cache(unsigned int allowed);
 
+/**
+ * @brief Enable or disable UDP segmentation and receive offload (GSO/GRO) for
+ * wire traffic (disabled by default.) Only has an effect on Linux kernels that
+ * support `UDP_SEGMENT`/`UDP_GRO`; support is probed when the node starts and
+ * the node falls back to ordinary sends if the kernel or NIC rejects
+ * segmentation. Must be called before `zts_node_start()`.
+ *
+ * @param allowed Whether or not this feature is enabled
+ * @return `ZTS_ERR_OK` if successful, `ZTS_ERR_SERVICE` if the node
+ *     experiences a problem, `ZTS_ERR_ARG` if invalid argument.
+ */
+ZTS_API int ZTCALL zts_init_allow_udp_offload(unsigned int allowed);
+
+/**
+ * @brief Set the number of additional threads receiving wire traffic on the
+ * primary port (0 by default.) Each thread reads its own `SO_REUSEPORT`
+ * socket and the kernel keeps each peer on one of them. Only has an effect
+ * on Linux. Must be called before `zts_node_start()`.
+ *
+ * @param count Number of receive threads per bound address, up to 16
+ * @return `ZTS_ERR_OK` if successful, `ZTS_ERR_SERVICE` if the node
+ *     experiences a problem, `ZTS_ERR_ARG` if invalid argument.
+ */
+ZTS_API int ZTCALL zts_init_set_wire_rx_threads(unsigned int count);
+
+/**
+ * I/O engine used for the node's wire (UDP) sockets
+ */
+typedef enum {
+    /**
+     * Portable poll loop, with batched recvmmsg/sendmmsg on Linux
+     */
+    ZTS_IO_ENGINE_DEFAULT = 0,
+    /**
+     * io_uring with multishot receive into registered buffers (Linux 6.0+).
+     * Falls back to the default engine if the kernel does not allow it.
+     */
+    ZTS_IO_ENGINE_URING = 1
+} zts_io_engine_t;
+
+/**
+ * @brief Select the I/O engine for wire traffic (`ZTS_IO_ENGINE_DEFAULT` by
+ * default.) Must be called before `zts_node_start()`.
+ *
+ * @param engine One of `zts_io_engine_t`
+ * @return `ZTS_ERR_OK` if successful, `ZTS_ERR_SERVICE` if the node
+ *     experiences a problem, `ZTS_ERR_ARG` if invalid argument.
+ */
+ZTS_API int ZTCALL zts_init_set_io_engine(int engine);
+
+/**
+ * @brief Size the network stack's memory allocator. All of the stack's
+ * buffers and control structures are served from size classes that are
+ * carved from reserved memory and never returned to the system. Reserving
+ * enough objects up front avoids allocating at all once traffic is flowing.
+ * Must be called before `zts_node_start()`.
+ *
+ * @param reserve Number of objects to preallocate in each size class (0 by default)
+ * @param limit_mb Largest amount of memory reserved for objects in megabytes,
+ *     or 0 for no limit (default)
+ * @return `ZTS_ERR_OK` if successful, `ZTS_ERR_SERVICE` if the node
+ *     experiences a problem, `ZTS_ERR_ARG` if invalid argument or the
+ *     reservation does not fit in the limit.
+ */
+ZTS_API int ZTCALL zts_init_set_mem_slab(unsigned int reserve, unsigned int limit_mb);
+
+/**
+ * Named sets of network stack tuning values
+ */
+typedef enum {
+    /**
+     * 1 MB receive window, 176 KB send buffer, unbounded out-of-order
+     * queues
+     */
+    ZTS_TUNING_DEFAULT = 0,
+    /**
+     * 8 MB receive window and send buffer for high bandwidth-delay
+     * paths, 1024 objects reserved per allocator size class
+     */
+    ZTS_TUNING_HIGH_BDP = 1,
+    /**
+     * 22 KB receive window, 11 KB send buffer and out-of-order queues
+     * limited to 8 segments, for memory-constrained devices
+     */
+    ZTS_TUNING_SMALL_FOOTPRINT = 2
+} zts_tuning_profile_t;
+
+/**
+ * @brief Select a named set of TCP and memory tuning values (`ZTS_TUNING_DEFAULT`
+ * by default.) Replaces values set with `zts_init_set_tcp_*()` so should be called
+ * before them. Values are applied when `zts_node_start()` starts the network stack
+ * and are then fixed for its lifetime, individual sockets may still override their
+ * buffers with `zts_set_send_buf_size()` and `zts_set_recv_buf_size()`.
+ *
+ * @param profile One of `zts_tuning_profile_t`
+ * @return `ZTS_ERR_OK` if successful, `ZTS_ERR_SERVICE` if the node
+ *     experiences a problem, `ZTS_ERR_ARG` if invalid argument.
+ */
+ZTS_API int ZTCALL zts_init_set_tuning_profile(int profile);
+
+/**
+ * @brief Set the TCP receive window of new connections. Must be called before
+ * `zts_node_start()`.
+ *
+ * The window scale announced to peers is fixed at 7, so windows of up to 8 MB
+ * may be set. Connections to peers that do not scale windows are limited to
+ * 64 KB.
+ *
+ * @param size Receive window in bytes, at least two segments
+ * @param scale Window scale shift (0-7). `size` shifted right by `scale` must
+ *     fit in 16 bits.
+ * @return `ZTS_ERR_OK` if successful, `ZTS_ERR_SERVICE` if the node
+ *     experiences a problem, `ZTS_ERR_ARG` if invalid argument.
+ */
+ZTS_API int ZTCALL zts_init_set_tcp_window(unsigned int size, unsigned int scale);
+
+/**
+ * @brief Set the TCP send buffer of new connections. Must be called before
+ * `zts_node_start()`.
+ *
+ * @param size Send buffer in bytes, from two segments to 64 MB
+ * @return `ZTS_ERR_OK` if successful, `ZTS_ERR_SERVICE` if the node
+ *     experiences a problem, `ZTS_ERR_ARG` if invalid argument.
+ */
+ZTS_API int ZTCALL zts_init_set_tcp_send_buf(unsigned int size);
+
+/**
+ * @brief Limit the out-of-order data each TCP connection may queue while
+ * waiting for a retransmission. Must be called before `zts_node_start()`.
+ *
+ * @param max_bytes Largest number of bytes queued, or 0 for no limit (default)
+ * @param max_pbufs Largest number of buffers queued (up to 65535), or 0 for
+ *     no limit (default)
+ * @return `ZTS_ERR_OK` if successful, `ZTS_ERR_SERVICE` if the node
+ *     experiences a problem, `ZTS_ERR_ARG` if invalid argument.
+ */
+ZTS_API int ZTCALL zts_init_set_tcp_ooseq_limit(unsigned int max_bytes, unsigned int max_pbufs);
+
+/**
+ * @brief Set how inbound frames are batched before being handed to the network stack.
+ * Must be called before `zts_node_start()`.
+ *
+ * Frames received from the ZeroTier virtual wire are queued per network and fed into
+ * the stack in bursts under a single acquisition of the stack's core lock. A queue is
+ * flushed as soon as it holds `burst_size` frames, at the end of each pass of the
+ * service's I/O loop, or once its oldest frame has waited `flush_latency_ms`.
+ *
+ * @param burst_size Number of queued frames that triggers a flush (1-256, default 32).
+ *     A value of 1 disables batching.
+ * @param flush_latency_ms Longest time (ms) a frame may remain queued (default 2)
+ * @return `ZTS_ERR_OK` if successful, `ZTS_ERR_SERVICE` if the node
+ *     experiences a problem, `ZTS_ERR_ARG` if invalid argument.
+ */
+ZTS_API int ZTCALL zts_init_set_rx_burst(unsigned int burst_size, unsigned int flush_latency_ms);
+
+/**
+ * @brief Decouple outbound traffic from the network stack with a per-network
+ * transmit queue and sender thread. Must be called before `zts_node_start()`.
+ *
+ * By default outbound frames are encrypted and sent by whichever thread holds the
+ * stack's core lock (often the application thread calling `zts_bsd_send()`). When a
+ * queue length is set, frames are instead pushed onto a lock-free queue and handed to
+ * ZeroTier by a dedicated thread so that stack processing and encryption overlap.
+ * When the queue is full the stack is told to back off and will retry.
+ *
+ * @param len Maximum number of frames queued per network, 0 disables queuing (default)
+ * @return `ZTS_ERR_OK` if successful, `ZTS_ERR_SERVICE` if the node
+ *     experiences a problem, `ZTS_ERR_ARG` if invalid argument.
+ */
+ZTS_API int ZTCALL zts_init_set_tx_queue(unsigned int len);
+
+/**
+ * @brief Set the number of threads that encrypt and authenticate outbound traffic
+ * for each network. Must be called before `zts_node_start()`.
+ *
+ * Outbound frames are sharded across the threads by destination so that frames
+ * bound for the same peer keep their order while work for different peers runs
+ * on separate cores. Enabling this implies a transmit queue (see
+ * `zts_init_set_tx_queue()`), 1024 frames per thread unless set otherwise.
+ *
+ * @param count Number of threads (0-64), 0 disables the pool (default)
+ * @return `ZTS_ERR_OK` if successful, `ZTS_ERR_SERVICE` if the node
+ *     experiences a problem, `ZTS_ERR_ARG` if invalid argument.
+ */
+ZTS_API int ZTCALL zts_init_set_crypto_threads(unsigned int count);
+
+/**
+ * @brief Limit how many sockets may be open at once. Must be called before
+ * `zts_node_start()`.
+ *
+ * The stack's connections and control blocks are allocated on demand, so this
+ * is what bounds their memory. Beyond the limit `zts_bsd_socket()` fails with
+ * `ZTS_ENFILE` and `zts_bsd_accept()` leaves connections queued on the listener.
+ *
+ * @param count Largest number of open sockets, up to `ZTS_MAX_SOCKETS`. 0 for
+ *     no limit other than `ZTS_MAX_SOCKETS` (default)
+ * @return `ZTS_ERR_OK` if successful, `ZTS_ERR_SERVICE` if the node
+ *     experiences a problem, `ZTS_ERR_ARG` if invalid argument.
+ */
+ZTS_API int ZTCALL zts_init_set_max_sockets(unsigned int count);
+
 /**
  * @brief Return whether an address of the given family has been assigned by the network
  *
@@ -1663,6 +1864,24 @@ ZTS_API int ZTCALL zts_net_get_status(uint64_t net_id);
  */
 ZTS_API int ZTCALL zts_net_get_type(uint64_t net_id);
 
+/**
+ * @brief Treat the network as a trusted link. ZeroTier already authenticates
+ * every frame, so the network stack stops generating IPv4 header, TCP and
+ * IPv4 UDP checksums for traffic to other endpoints on the network, saving a
+ * pass over every byte sent. Frames leaving the network (to hosts bridged
+ * onto it, or multicast) still get their checksums.
+ *
+ * Only enable this when the other ZeroTier endpoints on the network do not
+ * verify these checksums, for example when they all run libzt. May be called
+ * before or after joining, and is remembered until the node stops.
+ *
+ * @param net_id Network ID
+ * @param enabled Whether the link is trusted (0 by default)
+ * @return `ZTS_ERR_OK` if successful, `ZTS_ERR_SERVICE` if the node
+ *     experiences a problem, `ZTS_ERR_ARG` if invalid argument.
+ */
+ZTS_API int ZTCALL zts_net_set_trusted_link(uint64_t net_id, unsigned int enabled);
+
 /**
  * @brief Return whether a managed route of the given address family has been assigned by the
  * network
@@ -1872,6 +2091,69 @@ typedef struct {
  */
 ZTS_API int ZTCALL zts_stats_get_all(zts_stats_counter_t* dst);
 
+/**
+ * Structure containing counters for the node's physical (wire) UDP traffic
+ */
+typedef struct {
+    /** Number of UDP packets received from the physical network */
+    uint64_t wire_rx_packets;
+    /** Number of receive system calls used to read them */
+    uint64_t wire_rx_syscalls;
+    /** Number of UDP packets sent to the physical network */
+    uint64_t wire_tx_packets;
+    /** Number of send system calls used to write them */
+    uint64_t wire_tx_syscalls;
+} zts_stats_wire_t;
+
+/**
+ * @brief Get counters for the node's physical (wire) UDP traffic.
+ *
+ * On Linux datagrams are read and written in batches (`recvmmsg()` / `sendmmsg()`),
+ * comparing the packet and system call counts shows how effective batching is.
+ *
+ * @param dst Pointer to structure that will be populated with statistics
+ *
+ * @return `ZTS_ERR_OK` if successful, `ZTS_ERR_SERVICE` if the node
+ *     experiences a problem, `ZTS_ERR_ARG` if invalid argument.
+ */
+ZTS_API int ZTCALL zts_stats_get_wire(zts_stats_wire_t* dst);
+
+/**
+ * Number of size classes in the network stack's memory allocator
+ */
+#define ZTS_SLAB_CLASSES 8
+
+/**
+ * Structure containing statistics for the network stack's memory allocator
+ */
+typedef struct {
+    /** Object size of each class */
+    uint32_t object_size[ZTS_SLAB_CLASSES];
+    /** Number of objects carved from reserved memory */
+    uint64_t objects_total[ZTS_SLAB_CLASSES];
+    /** Number of objects in the shared free list (excludes per-thread caches) */
+    uint64_t objects_free[ZTS_SLAB_CLASSES];
+    /** Number of objects allocated and not yet freed */
+    uint64_t objects_in_use[ZTS_SLAB_CLASSES];
+    /** High-water mark of objects allocated and not yet freed */
+    uint64_t objects_peak[ZTS_SLAB_CLASSES];
+    /** Bytes of memory reserved for objects */
+    uint64_t bytes_reserved;
+    /** Number of outstanding allocations too large for any class */
+    uint64_t large_allocs;
+    /** Number of allocations that failed */
+    uint64_t alloc_failures;
+} zts_stats_slab_t;
+
+/**
+ * @brief Get statistics for the network stack's memory allocator.
+ *
+ * @param dst Pointer to structure that will be populated with statistics
+ *
+ * @return `ZTS_ERR_OK` if successful, `ZTS_ERR_ARG` if invalid argument.
+ */
+ZTS_API int ZTCALL zts_stats_get_slab(zts_stats_slab_t* dst);
+
 //----------------------------------------------------------------------------//
 // Socket API                                                                 //
 //----------------------------------------------------------------------------//
@@ -1952,7 +2234,7 @@ struct zts_linger {
 
 #define ZTS_SO_DONTLINGER   ((int)(~ZTS_SO_LINGER))
 #define ZTS_SO_OOBINLINE    0x0100   // NOT YET SUPPORTED
-#define ZTS_SO_REUSEPORT    0x0200   // NOT YET SUPPORTED
+#define ZTS_SO_REUSEPORT    0x0200   // TCP listeners only, see zts_set_reuse_port()
 #define ZTS_SO_SNDBUF       0x1001   // NOT YET SUPPORTED
 #define ZTS_SO_RCVBUF       0x1002
 #define ZTS_SO_SNDLOWAT     0x1003   // NOT YET SUPPORTED
@@ -1974,6 +2256,8 @@ struct zts_linger {
 #define ZTS_TCP_KEEPIDLE  0x0003
 #define ZTS_TCP_KEEPINTVL 0x0004
 #define ZTS_TCP_KEEPCNT   0x0005
+// Congestion control algorithm name, "reno" (default), "cubic" or "bbr"
+#define ZTS_TCP_CONGESTION 0x000d
 // IPPROTO_IPV6 options
 #define ZTS_IPV6_CHECKSUM                                                                                              \
     0x0007 /* RFC3542: calculate and insert the ICMPv6 checksum for raw                                                \
@@ -2117,20 +2401,27 @@ ZTS_API int ZTCALL zts_bsd_close(int fd);
 /* FD_SET used for lwip_select */
 
 #define LWIP_SOCKET_OFFSET 0
-#define MEMP_NUM_NETCONN   1024
+/*
+ * Largest number of sockets open at once, the size of lwIP's socket table the
+ * library was built with (CMake option ZTS_MAX_SOCKETS). Descriptors are taken
+ * from a table of their own and reused once closed, so they stay small.
+ */
+#ifndef ZTS_MAX_SOCKETS
+#define ZTS_MAX_SOCKETS 65536
+#endif
 
 #ifndef ZTS_FD_SET
 #undef ZTS_FD_SETSIZE
-// Make FD_SETSIZE match NUM_SOCKETS in socket.c
-#define ZTS_FD_SETSIZE MEMP_NUM_NETCONN
+// Descriptors zts_bsd_select() can wait on, use zts_bsd_poll() or zts_epoll_wait() for others
+#define ZTS_FD_SETSIZE 1024
 #define ZTS_FDSETSAFESET(n, code)                                                                                      \
     do {                                                                                                               \
-        if (((n)-LWIP_SOCKET_OFFSET < MEMP_NUM_NETCONN) && (((int)(n)-LWIP_SOCKET_OFFSET) >= 0)) {                     \
+        if (((n)-LWIP_SOCKET_OFFSET < ZTS_FD_SETSIZE) && (((int)(n)-LWIP_SOCKET_OFFSET) >= 0)) {                       \
             code;                                                                                                      \
         }                                                                                                              \
     } while (0)
 #define ZTS_FDSETSAFEGET(n, code)                                                                                      \
-    (((n)-LWIP_SOCKET_OFFSET < MEMP_NUM_NETCONN) && (((int)(n)-LWIP_SOCKET_OFFSET) >= 0) ? (code) : 0)
+    (((n)-LWIP_SOCKET_OFFSET < ZTS_FD_SETSIZE) && (((int)(n)-LWIP_SOCKET_OFFSET) >= 0) ? (code) : 0)
 #define ZTS_FD_SET(n, p)                                                                                               \
     ZTS_FDSETSAFESET(n, (p)->fd_bits[((n)-LWIP_SOCKET_OFFSET) / 8] |= (1 << (((n)-LWIP_SOCKET_OFFSET) & 7)))
 #define ZTS_FD_CLR(n, p)                                                                                               \
@@ -2141,8 +2432,6 @@ ZTS_API int ZTCALL zts_bsd_close(int fd);
 
 #elif LWIP_SOCKET_OFFSET
 #error LWIP_SOCKET_OFFSET does not work with external FD_SET!
-#elif ZTS_FD_SETSIZE < MEMP_NUM_NETCONN
-#error "external ZTS_FD_SETSIZE too small for number of sockets"
 #endif   // FD_SET
 
 typedef struct zts_fd_set {
@@ -2157,6 +2446,10 @@ typedef struct zts_timeval {
 /**
  * @brief Monitor multiple file descriptors for "readiness"
  *
+ * Only descriptors below `ZTS_FD_SETSIZE` (1024) fit in a `zts_fd_set`. An
+ * application with more sockets open should use `zts_bsd_poll()` or the
+ * `zts_epoll_*()` functions.
+ *
  * @param nfds Set to the highest numbered file descriptor in any of the given
  * sets
  * @param readfds Set of file descriptors to monitor for READ readiness
@@ -2223,6 +2516,222 @@ struct zts_pollfd {
  */
 ZTS_API int ZTCALL zts_bsd_poll(struct zts_pollfd* fds, zts_nfds_t nfds, int timeout);
 
+#define ZTS_EPOLLIN  0x001
+#define ZTS_EPOLLOUT 0x002
+#define ZTS_EPOLLERR 0x004
+/* Both directions of the connection are shut down, or it was reset */
+#define ZTS_EPOLLHUP 0x010
+/* The peer shut down writing (sent a FIN), reported only when requested */
+#define ZTS_EPOLLRDHUP 0x2000
+/* Report a socket once, until it is rearmed with ZTS_EPOLL_CTL_MOD */
+#define ZTS_EPOLLONESHOT (1u << 30)
+/* Edge-triggered: report a socket only when it becomes ready */
+#define ZTS_EPOLLET (1u << 31)
+
+#define ZTS_EPOLL_CTL_ADD 1
+#define ZTS_EPOLL_CTL_DEL 2
+#define ZTS_EPOLL_CTL_MOD 3
+
+typedef union zts_epoll_data {
+    void* ptr;
+    int fd;
+    uint32_t u32;
+    uint64_t u64;
+} zts_epoll_data_t;
+
+struct zts_epoll_event {
+    uint32_t events;
+    zts_epoll_data_t data;
+};
+
+/**
+ * @brief Create an epoll instance for waiting on many sockets at once
+ *
+ * Unlike `zts_bsd_poll()` and `zts_bsd_select()`, which look at every socket
+ * on each call, sockets are registered once and the stack queues them on the
+ * instance as their state changes, so waiting costs time in proportion to the
+ * number of ready sockets rather than registered ones. The descriptor is not
+ * a socket, release it with `zts_epoll_close()`.
+ *
+ * @return Epoll descriptor if successful, `ZTS_ERR_SERVICE` if the node
+ *     experiences a problem.
+ */
+ZTS_API int ZTCALL zts_epoll_create();
+
+/**
+ * @brief Register, change or remove a socket on an epoll instance
+ *
+ * Sockets are removed from every instance when closed.
+ *
+ * @param epfd Epoll descriptor
+ * @param op `ZTS_EPOLL_CTL_ADD`, `ZTS_EPOLL_CTL_MOD` or `ZTS_EPOLL_CTL_DEL`
+ * @param fd Socket file descriptor
+ * @param event Events of interest (`ZTS_EPOLLIN`, `ZTS_EPOLLOUT`,
+ *     `ZTS_EPOLLRDHUP`, optionally with `ZTS_EPOLLET` or `ZTS_EPOLLONESHOT`)
+ *     and data reported with them.
+ *     `ZTS_EPOLLERR` (also raised by completed zero-copy sends, see
+ *     `zts_send_zc_complete()`) and `ZTS_EPOLLHUP` are always reported.
+ *     Ignored by `ZTS_EPOLL_CTL_DEL`.
+ * @return `ZTS_ERR_OK` if successful, `ZTS_ERR_SERVICE` if the node
+ *     experiences a problem, `ZTS_ERR_ARG` if invalid argument,
+ *     `ZTS_ERR_SOCKET` if fd is not a socket (`ZTS_EBADF`), is already
+ *     registered (`ZTS_EEXIST`) or is not registered (`ZTS_ENOENT`). Sets
+ *     `zts_errno`
+ */
+ZTS_API int ZTCALL zts_epoll_ctl(int epfd, int op, int fd, struct zts_epoll_event* event);
+
+/**
+ * @brief Wait for registered sockets to become ready
+ *
+ * @param epfd Epoll descriptor
+ * @param events Destination array of ready events
+ * @param maxevents Number of elements in the events array
+ * @param timeout_ms How long to wait (ms), 0 to return immediately, -1 to
+ *     wait indefinitely
+ * @return Number of events written (0 on timeout) if successful,
+ *     `ZTS_ERR_SERVICE` if the node experiences a problem, `ZTS_ERR_ARG` if
+ *     invalid argument or if the instance is closed while waiting.
+ */
+ZTS_API int ZTCALL zts_epoll_wait(int epfd, struct zts_epoll_event* events, int maxevents, int timeout_ms);
+
+/**
+ * @brief Get an operating system descriptor to wait on an epoll instance from
+ * another event loop (epoll, kqueue, io_uring, libuv, asio, tokio)
+ *
+ * The descriptor (an eventfd on Linux, otherwise the read end of a pipe) is
+ * readable while sockets are queued on the instance. When it is, collect them
+ * with `zts_epoll_wait()` and a timeout of 0, which also drains it once
+ * nothing is left. Never read from or close it directly, it is closed by
+ * `zts_epoll_close()`. To follow a single socket, register it alone on its
+ * own instance. Not available on Windows.
+ *
+ * @param epfd Epoll descriptor
+ * @return Operating system file descriptor if successful, `ZTS_ERR_SERVICE`
+ *     if the node experiences a problem, `ZTS_ERR_ARG` if invalid argument,
+ *     `ZTS_ERR_GENERAL` if it could not be created.
+ */
+ZTS_API int ZTCALL zts_epoll_get_os_fd(int epfd);
+
+/**
+ * @brief Release an epoll instance, waking any thread waiting on it
+ *
+ * @param epfd Epoll descriptor
+ * @return `ZTS_ERR_OK` if successful, `ZTS_ERR_ARG` if invalid argument.
+ */
+ZTS_API int ZTCALL zts_epoll_close(int epfd);
+
+//----------------------------------------------------------------------------//
+// Asynchronous TCP (callbacks on the stack thread)                           //
+//----------------------------------------------------------------------------//
+
+/**
+ * Callbacks of an asynchronous TCP connection or listener. Any of them may be
+ * `NULL`. They are called from the network stack's own thread and must not
+ * block, nor call any `zts_bsd_*` function. Calls to `zts_async_tcp_*` are
+ * allowed from them.
+ */
+struct zts_async_tcp_callbacks {
+    /** A listener accepted `conn`, which inherits the listener's callbacks */
+    void (*on_accept)(int listener, int conn, void* arg);
+    /** An outgoing connection was established */
+    void (*on_connect)(int conn, int err, void* arg);
+    /**
+     * Data arrived, a `len` of 0 means the peer has finished sending. Returns
+     * how much of it was consumed and may be acknowledged to the peer right
+     * away, the rest is acknowledged later with `zts_async_tcp_recved()`
+     */
+    size_t (*on_data)(int conn, const void* data, size_t len, void* arg);
+    /** The peer acknowledged `len` bytes, which frees as much send buffer */
+    void (*on_sent)(int conn, size_t len, void* arg);
+    /** The connection failed or was reset, `conn` is no longer valid */
+    void (*on_error)(int conn, int err, void* arg);
+};
+
+/**
+ * @brief Listen for TCP connections without a socket or accepting thread
+ *
+ * Each accepted connection is reported to `on_accept` and is then driven by
+ * the same callbacks. Received data is acknowledged to the peer, reopening
+ * its window, as far as `on_data` reports it consumed.
+ *
+ * @param ipstr Local address to listen on, `NULL` for any IPv4 or IPv6 address
+ * @param port Local port
+ * @param backlog Maximum number of connections not yet accepted (at most 255)
+ * @param cb Callbacks for the listener and its connections
+ * @param arg Passed to every callback
+ * @return Listener handle if successful, `ZTS_ERR_SERVICE` if the node
+ *     experiences a problem, `ZTS_ERR_ARG` if invalid argument,
+ *     `ZTS_ERR_GENERAL` if out of memory, `ZTS_ERR_SOCKET` if it could not be
+ *     bound. Sets `zts_errno`
+ */
+ZTS_API int ZTCALL zts_async_tcp_listen(
+    const char* ipstr,
+    unsigned short port,
+    int backlog,
+    const struct zts_async_tcp_callbacks* cb,
+    void* arg);
+
+/**
+ * @brief Start connecting to a remote TCP host without blocking
+ *
+ * Completion is reported to `on_connect`, failure to `on_error`.
+ *
+ * @param ipstr Remote IPv4 or IPv6 address
+ * @param port Remote port
+ * @param cb Callbacks for the connection
+ * @param arg Passed to every callback
+ * @return Connection handle if successful, `ZTS_ERR_SERVICE` if the node
+ *     experiences a problem, `ZTS_ERR_ARG` if invalid argument,
+ *     `ZTS_ERR_GENERAL` if out of memory, `ZTS_ERR_SOCKET` if the connection
+ *     could not be started. Sets `zts_errno`
+ */
+ZTS_API int ZTCALL
+zts_async_tcp_connect(const char* ipstr, unsigned short port, const struct zts_async_tcp_callbacks* cb, void* arg);
+
+/**
+ * @brief Queue data on an asynchronous TCP connection
+ *
+ * Data is copied. Only as much as fits in the send buffer is queued, the rest
+ * can be written again once `on_sent` reports free space.
+ *
+ * @param conn Connection handle
+ * @param data Data to send
+ * @param len Length of data
+ * @param flags `ZTS_MSG_MORE` to hold the data back for more to follow
+ * @return Number of bytes queued if successful, `ZTS_ERR_SERVICE` if the node
+ *     experiences a problem, `ZTS_ERR_ARG` if invalid argument,
+ *     `ZTS_ERR_SOCKET` if nothing could be queued. Sets `zts_errno`
+ *     (`ZTS_EWOULDBLOCK` when the send buffer is full)
+ */
+ZTS_API int ZTCALL zts_async_tcp_write(int conn, const void* data, size_t len, int flags);
+
+/**
+ * @brief Acknowledge data that `on_data` left unconsumed, once the
+ * application has caught up with it
+ *
+ * Until then it stays outside the receive window, which holds the peer back.
+ *
+ * @param conn Connection handle
+ * @param len Number of bytes, at most as many as are outstanding are
+ *     acknowledged
+ * @return `ZTS_ERR_OK` if successful, `ZTS_ERR_SERVICE` if the node
+ *     experiences a problem, `ZTS_ERR_ARG` if invalid argument.
+ */
+ZTS_API int ZTCALL zts_async_tcp_recved(int conn, size_t len);
+
+/**
+ * @brief Close an asynchronous TCP connection or listener
+ *
+ * No callback is called for the handle after this returns. Queued data is
+ * still sent, and data not yet acknowledged with `zts_async_tcp_recved()` is
+ * acknowledged so that the connection is closed rather than reset.
+ *
+ * @param conn Connection or listener handle
+ * @return `ZTS_ERR_OK` if successful, `ZTS_ERR_SERVICE` if the node
+ *     experiences a problem, `ZTS_ERR_ARG` if invalid argument.
+ */
+ZTS_API int ZTCALL zts_async_tcp_close(int conn);
+
 /**
  * @brief Control a device
  *
@@ -2330,6 +2839,46 @@ zts_bsd_recvfrom(int fd, void* buf, size_t len, int flags, struct zts_sockaddr*
  */
 ZTS_API ssize_t ZTCALL zts_bsd_recvmsg(int fd, struct zts_msghdr* msg, int flags);
 
+/* One message of a batched send or receive */
+struct zts_mmsghdr {
+    struct zts_msghdr msg_hdr;
+    unsigned int msg_len;   // Bytes sent or received for this message
+};
+
+/**
+ * @brief Send several datagrams on a UDP socket with one call. All messages
+ * are handed to the stack under a single acquisition of its lock, which is
+ * cheaper than one `zts_bsd_sendmsg()` per datagram.
+ *
+ * @param fd Socket file descriptor
+ * @param msgvec Messages to send. Each `msg_len` is set to the bytes sent
+ * @param vlen Number of messages in `msgvec`
+ * @param flags `ZTS_MSG_DONTWAIT` or 0. UDP sends never wait, other flags are
+ *     rejected with `ZTS_EINVAL`
+ * @return Number of messages sent if successful (fewer than `vlen` if a later
+ *     message failed), `ZTS_ERR_SERVICE` if the node experiences a problem,
+ *     `ZTS_ERR_ARG` if invalid argument, `ZTS_ERR_SOCKET` if the first message
+ *     could not be sent. Sets `zts_errno`
+ */
+ZTS_API int ZTCALL zts_bsd_sendmmsg(int fd, struct zts_mmsghdr* msgvec, unsigned int vlen, int flags);
+
+/**
+ * @brief Receive several datagrams from a UDP socket with one call. Waits
+ * (subject to the socket's blocking mode and `ZTS_MSG_DONTWAIT`) for the first
+ * datagram only, then takes whatever else is already queued.
+ *
+ * @param fd Socket file descriptor
+ * @param msgvec Messages to fill. Each `msg_len` is set to the bytes received
+ *     and `msg_flags` to `ZTS_MSG_TRUNC` if the datagram did not fit
+ * @param vlen Number of messages in `msgvec`
+ * @param flags `ZTS_MSG_DONTWAIT` or 0, other flags (such as `ZTS_MSG_PEEK`)
+ *     are rejected with `ZTS_EINVAL`
+ * @return Number of messages received if successful, `ZTS_ERR_SERVICE` if the
+ *     node experiences a problem, `ZTS_ERR_ARG` if invalid argument,
+ *     `ZTS_ERR_SOCKET` if nothing could be received. Sets `zts_errno`
+ */
+ZTS_API int ZTCALL zts_bsd_recvmmsg(int fd, struct zts_mmsghdr* msgvec, unsigned int vlen, int flags);
+
 /**
  * @brief Read data from socket onto buffer
  *
@@ -2418,25 +2967,52 @@ ZTS_API int ZTCALL zts_socket(int family, int type, int protocol);
  * This convenience function exists because ZeroTier uses transport-triggered
  * links. This means that links between peers do not exist until peers try to
  * talk to each other. This can be a problem during connection procedures since
- * some of the initial packets are lost. To alleviate the need to try
- * `zts_bsd_connect` many times, this function will keep re-trying for you, even if
- * no known routes exist. However, if the socket is set to `non-blocking` mode
- * it will behave identically to `zts_bsd_connect` and return immediately upon
- * failure.
+ * some of the initial packets are lost. The connection is started without
+ * blocking and the stack keeps retransmitting the SYN while this function
+ * waits for the handshake, returning as soon as it completes or the timeout
+ * expires. While there is no route to the host yet, the connection is retried
+ * until the timeout. However, if the socket is set to `non-blocking` mode it
+ * will behave identically to `zts_bsd_connect` and return immediately.
  *
  * @param fd Socket file descriptor
  * @param ipstr Human-readable IP string
  * @param port Port
- * @param timeout_ms (Approximate) amount of time in milliseconds before
- *     connection attempt is aborted. Will block for `30 seconds` if timeout is
- *     set to `0`.
+ * @param timeout_ms Amount of time in milliseconds before the connection
+ *     attempt is abandoned. Will block for `30 seconds` if timeout is set to
+ *     `0`. A handshake still under way when it expires carries on, calling
+ *     this again on the same socket resumes waiting for it.
  *
  * @return `ZTS_ERR_OK` if successful, `ZTS_ERR_SOCKET` if the function times
- *     out with no connection made, `ZTS_ERR_SERVICE` if the node experiences a
+ *     out with no connection made (`zts_errno` is `ZTS_ETIMEDOUT`) or the
+ *     connection is refused, `ZTS_ERR_SERVICE` if the node experiences a
  *     problem, `ZTS_ERR_ARG` if invalid argument. Sets `zts_errno`
  */
 ZTS_API int ZTCALL zts_connect(int fd, const char* ipstr, unsigned short port, int timeout_ms);
 
+/**
+ * @brief Connect to whichever of several addresses of a remote host answers
+ * first (Happy Eyeballs, RFC 8305)
+ *
+ * Addresses are tried alternating between IPv6 and IPv4, starting with the
+ * family of the first address given. Each attempt gets a 250 ms head start
+ * before the next one begins, or hands over immediately if it fails. As with
+ * `zts_connect()`, addresses there is no route to yet (as shortly after
+ * joining a network) are tried again every 250 ms until the timeout. The
+ * first connection to complete is kept and every other attempt is closed.
+ *
+ * @param ipstrs Human-readable IP strings of the remote host
+ * @param count Number of strings in `ipstrs`
+ * @param port Port
+ * @param timeout_ms Amount of time in milliseconds before all attempts are
+ *     abandoned. Will block for `30 seconds` if timeout is set to `0`.
+ *
+ * @return File descriptor of a new connected (blocking) socket if successful,
+ *     `ZTS_ERR_SOCKET` if no address could be connected to, `ZTS_ERR_SERVICE`
+ *     if the node experiences a problem, `ZTS_ERR_ARG` if invalid argument.
+ *     Sets `zts_errno`
+ */
+ZTS_API int ZTCALL zts_connect_multi(const char** ipstrs, unsigned int count, unsigned short port, int timeout_ms);
+
 /**
  * @brief Bind a socket to a local address
  *
@@ -2517,6 +3093,80 @@ ZTS_API ssize_t ZTCALL zts_read(int fd, void* buf, size_t len);
  */
 ZTS_API ssize_t ZTCALL zts_write(int fd, const void* buf, size_t len);
 
+/**
+ * @brief Send data on a connected TCP socket without copying it
+ *
+ * The stack sends straight from `buf` rather than from its own send buffer,
+ * so the data must neither be modified nor freed until the send is reported
+ * complete by `zts_send_zc_complete()`, which happens once the peer has
+ * acknowledged it or the connection is gone. Never blocks: as much as fits
+ * in the socket's send buffer is queued and the caller sends the remainder
+ * later (e.g. once `zts_bsd_poll()` reports the socket writable). Each call
+ * that queues data produces exactly one completion. Closing the socket while
+ * sends are still outstanding resets the connection, and their buffers are
+ * no longer in use once `zts_bsd_close()` returns, with no completion
+ * reported. To close gracefully, shut the socket down for writing and wait
+ * for every completion first.
+ *
+ * @param fd Socket file descriptor
+ * @param buf Pointer to data buffer
+ * @param len Length of buffer to send
+ * @param cookie Value reported by `zts_send_zc_complete()` for this send
+ * @return Number of bytes queued if successful, `ZTS_ERR_SERVICE` if the node
+ *     experiences a problem, `ZTS_ERR_ARG` if invalid argument,
+ *     `ZTS_ERR_SOCKET` if nothing could be queued. Sets `zts_errno`
+ *     (`ZTS_EWOULDBLOCK` when the send buffer is full)
+ */
+ZTS_API ssize_t ZTCALL zts_send_zc(int fd, const void* buf, size_t len, uint64_t cookie);
+
+/**
+ * @brief Collect the cookies of zero-copy sends that have completed
+ *
+ * Cookies are reported in the order the sends were made. Their buffers may
+ * be reused. While completions wait to be collected, the socket reports
+ * `ZTS_EPOLLERR` to the epoll instances it is registered on, as Linux does for
+ * its error queue.
+ *
+ * @param fd Socket file descriptor
+ * @param cookies Destination array of cookies
+ * @param max Number of elements in the cookies array
+ * @return Number of cookies written (0 if none completed) if successful,
+ *     `ZTS_ERR_SERVICE` if the node experiences a problem, `ZTS_ERR_ARG` if
+ *     invalid argument.
+ */
+ZTS_API int ZTCALL zts_send_zc_complete(int fd, uint64_t* cookies, unsigned int max);
+
+/**
+ * @brief Receive data on a TCP socket by borrowing the stack's buffers
+ *
+ * Instead of copying, points `iov` straight at the received buffers, which
+ * are read-only and stay valid until handed back with `zts_recv_return()`.
+ * The receive window reopens as buffers are returned, so holding on to them
+ * throttles the peer. Blocks like `zts_bsd_recv()` unless the socket is
+ * non-blocking. Buffers that do not fit in `iov` are left for the next read.
+ *
+ * @param fd Socket file descriptor
+ * @param iov Destination array of buffer descriptions
+ * @param count Number of elements in the iov array, set to the number filled in
+ * @param token Set to the loan to pass to `zts_recv_return()`, or NULL if
+ *     nothing was received
+ * @return Number of bytes received, `0` if the peer has closed the connection,
+ *     `ZTS_ERR_SERVICE` if the node experiences a problem, `ZTS_ERR_ARG` if
+ *     invalid argument, `ZTS_ERR_SOCKET` if nothing could be received. Sets
+ *     `zts_errno`
+ */
+ZTS_API ssize_t ZTCALL zts_recv_loan(int fd, struct zts_iovec* iov, unsigned int* count, void** token);
+
+/**
+ * @brief Return buffers borrowed with `zts_recv_loan()` to the stack
+ *
+ * May be called after the socket has been closed.
+ *
+ * @param token Loan returned by `zts_recv_loan()`
+ * @return `ZTS_ERR_OK` if successful, `ZTS_ERR_ARG` if invalid argument.
+ */
+ZTS_API int ZTCALL zts_recv_return(void* token);
+
 /**
  * @brief Shut down `read` aspect of a socket
  *
@@ -2726,6 +3376,31 @@ ZTS_API int ZTCALL zts_set_reuse_addr(int fd, int enabled);
  */
 ZTS_API int ZTCALL zts_get_reuse_addr(int fd);
 
+/**
+ * @brief Enable or disable `SO_REUSEPORT`, which also enables `SO_REUSEADDR`
+ *
+ * TCP sockets with this option bound to the same address and port may all
+ * listen on it. New connections are spread over them by a hash of the remote
+ * address and port, so that each can be accepted from on its own thread.
+ * Connections still queued on a socket are dropped when it is closed, the
+ * others keep listening. Must be set before `zts_bsd_bind()`.
+ *
+ * @param fd Socket file descriptor
+ * @param enabled `[0, 1]` integer value
+ * @return `ZTS_ERR_OK` if successful, `ZTS_ERR_SERVICE` if the node
+ *     experiences a problem, `ZTS_ERR_ARG` if invalid argument. Sets `zts_errno`
+ */
+ZTS_API int ZTCALL zts_set_reuse_port(int fd, int enabled);
+
+/**
+ * @brief Return whether `SO_REUSEPORT` is enabled
+ *
+ * @param fd Socket file descriptor
+ * @return `1` if enabled, `0` if disabled, `ZTS_ERR_SERVICE` if the node
+ *     experiences a problem, `ZTS_ERR_ARG` if invalid argument. Sets `zts_errno`
+ */
+ZTS_API int ZTCALL zts_get_reuse_port(int fd);
+
 /**
  * @brief Set the value of `SO_RCVTIMEO`
  *
@@ -2767,7 +3442,8 @@ ZTS_API int ZTCALL zts_set_send_timeout(int fd, int seconds, int microseconds);
 ZTS_API int ZTCALL zts_get_send_timeout(int fd);
 
 /**
- * @brief Set the value of `SO_SNDBUF`
+ * @brief Set the value of `SO_SNDBUF`. For TCP sockets this replaces the send
+ * buffer set by the stack's tuning (see `zts_init_set_tuning_profile()`)
  *
  * @param fd Socket file descriptor
  * @param size Size of buffer
@@ -2786,7 +3462,10 @@ ZTS_API int ZTCALL zts_set_send_buf_size(int fd, int size);
 ZTS_API int ZTCALL zts_get_send_buf_size(int fd);
 
 /**
- * @brief Set the value of `SO_RCVBUF`
+ * @brief Set the value of `SO_RCVBUF`. For TCP sockets this also sets the
+ * receive window, up to the window set by the stack's tuning (see
+ * `zts_init_set_tuning_profile()`). If set before connecting the window is
+ * applied once a blocking `zts_bsd_connect()` completes.
  *
  * @param fd Socket file descriptor
  * @param size Size of buffer
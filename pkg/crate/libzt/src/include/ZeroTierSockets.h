@@ -1909,7 +1909,7 @@ struct zts_linger {
 
 #define ZTS_SO_DONTLINGER   ((int)(~ZTS_SO_LINGER))
 #define ZTS_SO_OOBINLINE    0x0100   // NOT YET SUPPORTED
-#define ZTS_SO_REUSEPORT    0x0200   // NOT YET SUPPORTED
+#define ZTS_SO_REUSEPORT    0x0200   // TCP listeners only
 #define ZTS_SO_SNDBUF       0x1001   // NOT YET SUPPORTED
 #define ZTS_SO_RCVBUF       0x1002
 #define ZTS_SO_SNDLOWAT     0x1003   // NOT YET SUPPORTED
@@ -2074,20 +2074,27 @@ ZTS_API int ZTCALL zts_bsd_close(int fd);
 /* FD_SET used for lwip_select */
 
 #define LWIP_SOCKET_OFFSET 0
-#define MEMP_NUM_NETCONN   1024
+/*
+ * Largest number of sockets open at once, the size of lwIP's socket table the
+ * library was built with (CMake option ZTS_MAX_SOCKETS). Descriptors are taken
+ * from a table of their own and reused once closed, so they stay small.
+ */
+#ifndef ZTS_MAX_SOCKETS
+#define ZTS_MAX_SOCKETS 65536
+#endif
 
 #ifndef ZTS_FD_SET
 #undef ZTS_FD_SETSIZE
-// Make FD_SETSIZE match NUM_SOCKETS in socket.c
-#define ZTS_FD_SETSIZE MEMP_NUM_NETCONN
+// Descriptors zts_bsd_select() can wait on, use zts_bsd_poll() or zts_epoll_wait() for others
+#define ZTS_FD_SETSIZE 1024
 #define ZTS_FDSETSAFESET(n, code)                                                                                      \
     do {                                                                                                               \
-        if (((n)-LWIP_SOCKET_OFFSET < MEMP_NUM_NETCONN) && (((int)(n)-LWIP_SOCKET_OFFSET) >= 0)) {                     \
+        if (((n)-LWIP_SOCKET_OFFSET < ZTS_FD_SETSIZE) && (((int)(n)-LWIP_SOCKET_OFFSET) >= 0)) {                       \
             code;                                                                                                      \
         }                                                                                                              \
     } while (0)
 #define ZTS_FDSETSAFEGET(n, code)                                                                                      \
-    (((n)-LWIP_SOCKET_OFFSET < MEMP_NUM_NETCONN) && (((int)(n)-LWIP_SOCKET_OFFSET) >= 0) ? (code) : 0)
+    (((n)-LWIP_SOCKET_OFFSET < ZTS_FD_SETSIZE) && (((int)(n)-LWIP_SOCKET_OFFSET) >= 0) ? (code) : 0)
 #define ZTS_FD_SET(n, p)                                                                                               \
     ZTS_FDSETSAFESET(n, (p)->fd_bits[((n)-LWIP_SOCKET_OFFSET) / 8] |= (1 << (((n)-LWIP_SOCKET_OFFSET) & 7)))
 #define ZTS_FD_CLR(n, p)                                                                                               \
@@ -2098,8 +2105,6 @@ ZTS_API int ZTCALL zts_bsd_close(int fd);
 
 #elif LWIP_SOCKET_OFFSET
 #error LWIP_SOCKET_OFFSET does not work with external FD_SET!
-#elif ZTS_FD_SETSIZE < MEMP_NUM_NETCONN
-#error "external ZTS_FD_SETSIZE too small for number of sockets"
 #endif   // FD_SET
 
 typedef struct zts_fd_set {
@@ -2287,6 +2292,46 @@ zts_bsd_recvfrom(int fd, void* buf, size_t len, int flags, struct zts_sockaddr*
  */
 ZTS_API ssize_t ZTCALL zts_bsd_recvmsg(int fd, struct zts_msghdr* msg, int flags);
 
+/* One message of a batched send or receive */
+struct zts_mmsghdr {
+    struct zts_msghdr msg_hdr;
+    unsigned int msg_len;   // Bytes sent or received for this message
+};
+
+/**
+ * @brief Send several datagrams on a UDP socket with one call. All messages
+ * are handed to the stack under a single acquisition of its lock, which is
+ * cheaper than one `zts_bsd_sendmsg()` per datagram.
+ *
+ * @param fd Socket file descriptor
+ * @param msgvec Messages to send. Each `msg_len` is set to the bytes sent
+ * @param vlen Number of messages in `msgvec`
+ * @param flags `ZTS_MSG_DONTWAIT` or 0. UDP sends never wait, other flags are
+ *     rejected with `ZTS_EINVAL`
+ * @return Number of messages sent if successful (fewer than `vlen` if a later
+ *     message failed), `ZTS_ERR_SERVICE` if the node experiences a problem,
+ *     `ZTS_ERR_ARG` if invalid argument, `ZTS_ERR_SOCKET` if the first message
+ *     could not be sent. Sets `zts_errno`
+ */
+ZTS_API int ZTCALL zts_bsd_sendmmsg(int fd, struct zts_mmsghdr* msgvec, unsigned int vlen, int flags);
+
+/**
+ * @brief Receive several datagrams from a UDP socket with one call. Waits
+ * (subject to the socket's blocking mode and `ZTS_MSG_DONTWAIT`) for the first
+ * datagram only, then takes whatever else is already queued.
+ *
+ * @param fd Socket file descriptor
+ * @param msgvec Messages to fill. Each `msg_len` is set to the bytes received
+ *     and `msg_flags` to `ZTS_MSG_TRUNC` if the datagram did not fit
+ * @param vlen Number of messages in `msgvec`
+ * @param flags `ZTS_MSG_DONTWAIT` or 0, other flags (such as `ZTS_MSG_PEEK`)
+ *     are rejected with `ZTS_EINVAL`
+ * @return Number of messages received if successful, `ZTS_ERR_SERVICE` if the
+ *     node experiences a problem, `ZTS_ERR_ARG` if invalid argument,
+ *     `ZTS_ERR_SOCKET` if nothing could be received. Sets `zts_errno`
+ */
+ZTS_API int ZTCALL zts_bsd_recvmmsg(int fd, struct zts_mmsghdr* msgvec, unsigned int vlen, int flags);
+
 /**
  * @brief Read data from socket onto buffer
  *
@@ -16,7 +16,9 @@ use std::ffi::{c_void, CString};
 use std::io::{self /*, Error, ErrorKind*/};
 use std::net::{/*Ipv4Addr, Ipv6Addr,*/ SocketAddr, ToSocketAddrs};
 use std::os::raw::c_int;
+use std::ptr;
 use std::time::Duration;
+use std::mem;
 //use std::cmp;
 
 use crate::socket::Socket;
@@ -99,6 +101,88 @@ impl UdpSocketImpl {
         }
     */
 
+    pub fn send_to_many(&self, msgs: &[(&[u8], SocketAddr)]) -> io::Result<usize> {
+        let mut addrs: Vec<(zts_sockaddr_storage, zts_socklen_t)> =
+            msgs.iter().map(|(_, addr)| addr_to_sockaddr(addr)).collect();
+        let mut iovs: Vec<zts_iovec> = msgs
+            .iter()
+            .map(|(buf, _)| zts_iovec {
+                iov_base: buf.as_ptr() as *mut c_void,
+                iov_len: buf.len().try_into().unwrap(),
+            })
+            .collect();
+        let mut hdrs: Vec<zts_mmsghdr> = addrs
+            .iter_mut()
+            .zip(iovs.iter_mut())
+            .map(|((storage, len), iov)| zts_mmsghdr {
+                msg_hdr: zts_msghdr {
+                    msg_name: storage as *mut _ as *mut c_void,
+                    msg_namelen: *len,
+                    msg_iov: iov,
+                    msg_iovlen: 1,
+                    msg_control: ptr::null_mut(),
+                    msg_controllen: 0,
+                    msg_flags: 0,
+                },
+                msg_len: 0,
+            })
+            .collect();
+        let n = cvt_zts(unsafe {
+            zts_bsd_sendmmsg(
+                *self.inner.as_inner(),
+                hdrs.as_mut_ptr(),
+                hdrs.len().try_into().unwrap(),
+                0,
+            )
+        })?;
+        Ok(n as usize)
+    }
+
+    pub fn recv_from_many(&self, bufs: &mut [&mut [u8]]) -> io::Result<Vec<(usize, SocketAddr)>> {
+        let mut addrs: Vec<zts_sockaddr_storage> = vec![unsafe { mem::zeroed() }; bufs.len()];
+        let mut iovs: Vec<zts_iovec> = bufs
+            .iter_mut()
+            .map(|buf| zts_iovec {
+                iov_base: buf.as_mut_ptr() as *mut c_void,
+                iov_len: buf.len().try_into().unwrap(),
+            })
+            .collect();
+        let mut hdrs: Vec<zts_mmsghdr> = addrs
+            .iter_mut()
+            .zip(iovs.iter_mut())
+            .map(|(storage, iov)| zts_mmsghdr {
+                msg_hdr: zts_msghdr {
+                    msg_name: storage as *mut _ as *mut c_void,
+                    msg_namelen: mem::size_of::<zts_sockaddr_storage>() as zts_socklen_t,
+                    msg_iov: iov,
+                    msg_iovlen: 1,
+                    msg_control: ptr::null_mut(),
+                    msg_controllen: 0,
+                    msg_flags: 0,
+                },
+                msg_len: 0,
+            })
+            .collect();
+        let n = cvt_zts(unsafe {
+            zts_bsd_recvmmsg(
+                *self.inner.as_inner(),
+                hdrs.as_mut_ptr(),
+                hdrs.len().try_into().unwrap(),
+                0,
+            )
+        })?;
+        hdrs.iter()
+            .zip(addrs.iter())
+            .take(n as usize)
+            .map(|(hdr, storage)| {
+                Ok((
+                    hdr.msg_len as usize,
+                    sockaddr_to_addr(storage, hdr.msg_hdr.msg_namelen as usize)?,
+                ))
+            })
+            .collect()
+    }
+
     pub fn set_read_timeout(&self, dur: Option<Duration>) -> io::Result<()> {
         self.inner.set_timeout(dur, ZTS_SO_RCVTIMEO as i32)
     }
@@ -326,6 +410,14 @@ impl UdpSocket {
             }
         }
     */
+    pub fn send_to_many(&self, msgs: &[(&[u8], SocketAddr)]) -> io::Result<usize> {
+        self.0.send_to_many(msgs)
+    }
+
+    pub fn recv_from_many(&self, bufs: &mut [&mut [u8]]) -> io::Result<Vec<(usize, SocketAddr)>> {
+        self.0.recv_from_many(bufs)
+    }
+
     pub fn peer_addr(&self) -> io::Result<SocketAddr> {
         self.0.peer_addr()
     }
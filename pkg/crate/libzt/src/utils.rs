@@ -62,6 +62,17 @@ pub fn cvt<T: IsMinusOne>(t: T) -> std::io::Result<T> {
     }
 }
 
+// Like cvt() for calls that also return libzt's own negative error codes
+pub fn cvt_zts(t: c_int) -> std::io::Result<c_int> {
+    if t == -1 {
+        Err(std::io::Error::last_os_error())
+    } else if t < 0 {
+        Err(Error::new(ErrorKind::Other, format!("libzt error {}", t)))
+    } else {
+        Ok(t)
+    }
+}
+
 pub fn cvt_r<T, F>(mut f: F) -> std::io::Result<T>
 where
     T: IsMinusOne,
@@ -200,6 +211,31 @@ pub fn sockaddr_to_addr(storage: &zts_sockaddr_storage, len: usize) -> io::Resul
     }
 }
 
+pub fn addr_to_sockaddr(addr: &SocketAddr) -> (zts_sockaddr_storage, zts_socklen_t) {
+    let mut storage: zts_sockaddr_storage = unsafe { mem::zeroed() };
+    let len = match addr {
+        SocketAddr::V4(a) => {
+            let sin: &mut zts_sockaddr_in = unsafe { &mut *(&mut storage as *mut _ as *mut zts_sockaddr_in) };
+            sin.sin_len = mem::size_of::<zts_sockaddr_in>() as u8;
+            sin.sin_family = ZTS_AF_INET as zts_sa_family_t;
+            sin.sin_port = htons(a.port());
+            sin.sin_addr.s_addr = u32::from_ne_bytes(a.ip().octets());
+            mem::size_of::<zts_sockaddr_in>()
+        }
+        SocketAddr::V6(a) => {
+            let sin6: &mut zts_sockaddr_in6 = unsafe { &mut *(&mut storage as *mut _ as *mut zts_sockaddr_in6) };
+            sin6.sin6_len = mem::size_of::<zts_sockaddr_in6>() as u8;
+            sin6.sin6_family = ZTS_AF_INET6 as zts_sa_family_t;
+            sin6.sin6_port = htons(a.port());
+            sin6.sin6_flowinfo = a.flowinfo().to_be();
+            sin6.sin6_addr.un.u8_addr = a.ip().octets();
+            sin6.sin6_scope_id = a.scope_id();
+            mem::size_of::<zts_sockaddr_in6>()
+        }
+    };
+    (storage, len as zts_socklen_t)
+}
+
 pub fn sockname<F>(f: F) -> io::Result<SocketAddr>
 where
     F: FnOnce(*mut zts_sockaddr, *mut zts_socklen_t) -> c_int,
@@ -0,0 +1,428 @@
+/*
+ * Copyright (c)2013-2021 ZeroTier, Inc.
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file in the project's root directory.
+ *
+ * Change Date: 2026-01-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2.0 of the Apache License.
+ */
+/****/
+
+/**
+ * @file
+ *
+ * Callback-driven TCP connections on lwIP's raw API (zts_async_tcp_*())
+ *
+ * These connections bypass the netconn and sockets layers entirely: their
+ * pcbs are driven from the application's callbacks, which lwIP invokes on the
+ * tcpip thread while it holds the core lock. Calls made from the application's
+ * own threads take the core lock, and calls made from inside a callback run
+ * directly since the lock is already held there.
+ *
+ * Handles are small integers separate from socket descriptors. They, and the
+ * table mapping them to pcbs, are only touched with the core lock held.
+ *
+ * Received data is only acknowledged, reopening the receive window, as far as
+ * on_data() reports it consumed or zts_async_tcp_recved() is called for it
+ * later, so a slow consumer holds back its peer. What is still outstanding
+ * at close is acknowledged then, as lwIP resets a connection closed with
+ * unacknowledged data.
+ */
+
+#include "Debug.hpp"
+#include "Events.hpp"
+#include "ZeroTierSockets.h"
+#include "lwip/tcp.h"
+#include "lwip/tcpip.h"
+#include "lwip_hooks.h"
+
+#include <limits.h>
+#include <unordered_map>
+
+namespace ZeroTier {
+
+struct zts_async_conn {
+    int id;
+    struct tcp_pcb* pcb;
+    bool listening;
+    struct zts_async_tcp_callbacks cb;
+    void* arg;
+    size_t unacked;   // Delivered to on_data() but not acknowledged yet
+};
+
+static std::unordered_map<int, zts_async_conn*> _async_conns;
+static int _async_next;
+
+// Depth of application callbacks on this thread, when non-zero the core lock
+// is already held by the tcpip thread
+static thread_local int _async_depth;
+// The pcb aborted from inside the callback that is being dispatched
+static thread_local struct tcp_pcb* _async_aborted;
+
+static void zts_async_lock()
+{
+    if (! _async_depth) {
+        LOCK_TCPIP_CORE();
+    }
+}
+
+static void zts_async_unlock()
+{
+    if (! _async_depth) {
+        UNLOCK_TCPIP_CORE();
+    }
+}
+
+// Result for lwIP of a callback that was dispatched on pcb
+static err_t zts_async_result(struct tcp_pcb* pcb)
+{
+    struct tcp_pcb* aborted = _async_aborted;
+    _async_aborted = NULL;
+    return (aborted == pcb) ? ERR_ABRT : ERR_OK;
+}
+
+static zts_async_conn* zts_async_find(int id)
+{
+    auto it = _async_conns.find(id);
+    return (it != _async_conns.end()) ? it->second : NULL;
+}
+
+static zts_async_conn*
+zts_async_new(struct tcp_pcb* pcb, bool listening, const struct zts_async_tcp_callbacks* cb, void* arg)
+{
+    while (_async_conns.count(_async_next)) {
+        _async_next = (_async_next + 1) & INT_MAX;
+    }
+    zts_async_conn* conn = new zts_async_conn();
+    conn->id = _async_next;
+    conn->pcb = pcb;
+    conn->listening = listening;
+    conn->cb = *cb;
+    conn->arg = arg;
+    _async_next = (_async_next + 1) & INT_MAX;
+    _async_conns[conn->id] = conn;
+    return conn;
+}
+
+static void zts_async_free(zts_async_conn* conn)
+{
+    _async_conns.erase(conn->id);
+    delete conn;
+}
+
+// Acknowledge up to n bytes delivered to the application
+static void zts_async_ack(zts_async_conn* conn, size_t n)
+{
+    n = LWIP_MIN(n, conn->unacked);
+    conn->unacked -= n;
+    while (n) {
+        const u16_t len = (u16_t)LWIP_MIN(n, (size_t)0xffff);
+        tcp_recved(conn->pcb, len);
+        n -= len;
+    }
+}
+
+static void zts_async_detach(struct tcp_pcb* pcb, bool listening)
+{
+    tcp_arg(pcb, NULL);
+    if (listening) {
+        tcp_accept(pcb, NULL);
+        return;
+    }
+    tcp_recv(pcb, NULL);
+    tcp_sent(pcb, NULL);
+    tcp_err(pcb, NULL);
+}
+
+static err_t zts_async_recv_cb(void* arg, struct tcp_pcb* pcb, struct pbuf* p, err_t err)
+{
+    // lwIP only ever passes ERR_OK, errors arrive through zts_async_err_cb()
+    ZTS_UNUSED_ARG(err);
+    zts_async_conn* conn = (zts_async_conn*)arg;
+    if (! conn) {
+        if (p) {
+            tcp_recved(pcb, p->tot_len);
+            pbuf_free(p);
+        }
+        return ERR_OK;
+    }
+    const int id = conn->id;
+    if (p) {
+        // Counted before on_data runs, so that a close from it acknowledges the data
+        conn->unacked += p->tot_len;
+    }
+    _async_depth++;
+    if (! p) {
+        // A length of zero reports the peer's FIN
+        if (conn->cb.on_data) {
+            conn->cb.on_data(id, NULL, 0, conn->arg);
+        }
+    }
+    else if (! conn->cb.on_data) {
+        zts_async_ack(conn, p->tot_len);
+    }
+    else {
+        for (struct pbuf* q = p; q && zts_async_find(id) == conn; q = q->next) {
+            const size_t n = conn->cb.on_data(id, q->payload, q->len, conn->arg);
+            if (zts_async_find(id) == conn) {
+                zts_async_ack(conn, LWIP_MIN(n, (size_t)q->len));
+            }
+        }
+    }
+    _async_depth--;
+    if (zts_async_result(pcb) == ERR_ABRT) {
+        if (p) {
+            pbuf_free(p);
+        }
+        return ERR_ABRT;
+    }
+    if (p) {
+        pbuf_free(p);
+    }
+    return ERR_OK;
+}
+
+static err_t zts_async_sent_cb(void* arg, struct tcp_pcb* pcb, u16_t len)
+{
+    zts_async_conn* conn = (zts_async_conn*)arg;
+    if (conn && conn->cb.on_sent) {
+        _async_depth++;
+        conn->cb.on_sent(conn->id, len, conn->arg);
+        _async_depth--;
+    }
+    return zts_async_result(pcb);
+}
+
+static void zts_async_err_cb(void* arg, err_t err)
+{
+    // The pcb has already been freed by lwIP
+    zts_async_conn* conn = (zts_async_conn*)arg;
+    if (! conn) {
+        return;
+    }
+    const int id = conn->id;
+    struct zts_async_tcp_callbacks cb = conn->cb;
+    void* user_arg = conn->arg;
+    zts_async_free(conn);
+    if (cb.on_error) {
+        _async_depth++;
+        cb.on_error(id, err_to_errno(err), user_arg);
+        _async_depth--;
+    }
+}
+
+static void zts_async_attach(zts_async_conn* conn)
+{
+    tcp_arg(conn->pcb, conn);
+    tcp_recv(conn->pcb, zts_async_recv_cb);
+    tcp_sent(conn->pcb, zts_async_sent_cb);
+    tcp_err(conn->pcb, zts_async_err_cb);
+}
+
+static err_t zts_async_connected_cb(void* arg, struct tcp_pcb* pcb, err_t err)
+{
+    zts_async_conn* conn = (zts_async_conn*)arg;
+    if (conn && conn->cb.on_connect) {
+        _async_depth++;
+        conn->cb.on_connect(conn->id, err_to_errno(err), conn->arg);
+        _async_depth--;
+    }
+    return zts_async_result(pcb);
+}
+
+static err_t zts_async_accept_cb(void* arg, struct tcp_pcb* newpcb, err_t err)
+{
+    zts_async_conn* listener = (zts_async_conn*)arg;
+    if (err != ERR_OK || ! newpcb) {
+        return ERR_VAL;
+    }
+    if (! listener) {
+        tcp_abort(newpcb);
+        return ERR_ABRT;
+    }
+    zts_async_conn* conn = zts_async_new(newpcb, false, &listener->cb, listener->arg);
+    zts_async_attach(conn);
+    if (listener->cb.on_accept) {
+        _async_depth++;
+        listener->cb.on_accept(listener->id, conn->id, listener->arg);
+        _async_depth--;
+    }
+    return zts_async_result(newpcb);
+}
+
+}   // namespace ZeroTier
+
+using namespace ZeroTier;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+int zts_async_tcp_listen(
+    const char* ipstr,
+    unsigned short port,
+    int backlog,
+    const struct zts_async_tcp_callbacks* cb,
+    void* arg)
+{
+    if (! transport_ok()) {
+        return ZTS_ERR_SERVICE;
+    }
+    ip_addr_t ip = *IP_ANY_TYPE;
+    if (! cb || (ipstr && ! ipaddr_aton(ipstr, &ip))) {
+        return ZTS_ERR_ARG;
+    }
+    if (backlog <= 0 || backlog > 0xff) {
+        backlog = 0xff;
+    }
+    int ret = ZTS_ERR_GENERAL;
+    zts_async_lock();
+    struct tcp_pcb* pcb = tcp_new_ip_type(IP_GET_TYPE(&ip));
+    if (pcb) {
+        zts_tcp_tune(pcb);
+        err_t err = tcp_bind(pcb, &ip, port);
+        struct tcp_pcb* lpcb = NULL;
+        if (err == ERR_OK) {
+            lpcb = tcp_listen_with_backlog_and_err(pcb, (u8_t)backlog, &err);
+        }
+        if (! lpcb) {
+            tcp_close(pcb);
+            zts_errno = err_to_errno(err);
+            ret = ZTS_ERR_SOCKET;
+        }
+        else {
+            zts_async_conn* conn = zts_async_new(lpcb, true, cb, arg);
+            tcp_arg(lpcb, conn);
+            tcp_accept(lpcb, zts_async_accept_cb);
+            ret = conn->id;
+        }
+    }
+    zts_async_unlock();
+    return ret;
+}
+
+int zts_async_tcp_connect(
+    const char* ipstr,
+    unsigned short port,
+    const struct zts_async_tcp_callbacks* cb,
+    void* arg)
+{
+    if (! transport_ok()) {
+        return ZTS_ERR_SERVICE;
+    }
+    ip_addr_t ip;
+    if (! ipstr || ! cb || ! ipaddr_aton(ipstr, &ip)) {
+        return ZTS_ERR_ARG;
+    }
+    int ret = ZTS_ERR_GENERAL;
+    zts_async_lock();
+    struct tcp_pcb* pcb = tcp_new_ip_type(IP_GET_TYPE(&ip));
+    if (pcb) {
+        zts_tcp_tune(pcb);
+        zts_async_conn* conn = zts_async_new(pcb, false, cb, arg);
+        zts_async_attach(conn);
+        err_t err = tcp_connect(pcb, &ip, port, zts_async_connected_cb);
+        if (err != ERR_OK) {
+            zts_async_detach(pcb, false);
+            tcp_abort(pcb);
+            zts_async_free(conn);
+            zts_errno = err_to_errno(err);
+            ret = ZTS_ERR_SOCKET;
+        }
+        else {
+            ret = conn->id;
+        }
+    }
+    zts_async_unlock();
+    return ret;
+}
+
+int zts_async_tcp_write(int conn_id, const void* data, size_t len, int flags)
+{
+    if (! transport_ok()) {
+        return ZTS_ERR_SERVICE;
+    }
+    if (! data && len) {
+        return ZTS_ERR_ARG;
+    }
+    int ret = ZTS_ERR_ARG;
+    zts_async_lock();
+    zts_async_conn* conn = zts_async_find(conn_id);
+    if (conn && ! conn->listening) {
+        size_t n = LWIP_MIN(len, (size_t)tcp_sndbuf(conn->pcb));
+        n = LWIP_MIN(n, (size_t)0xffff);
+        err_t err = ERR_MEM;
+        if (n || ! len) {
+            u8_t apiflags = TCP_WRITE_FLAG_COPY;
+            if (flags & ZTS_MSG_MORE) {
+                apiflags |= TCP_WRITE_FLAG_MORE;
+            }
+            err = n ? tcp_write(conn->pcb, data, (u16_t)n, apiflags) : ERR_OK;
+        }
+        if (err == ERR_OK && ! (flags & ZTS_MSG_MORE)) {
+            err = tcp_output(conn->pcb);
+            // Queued data is sent once the peer opens its window
+            err = (err == ERR_MEM) ? ERR_OK : err;
+        }
+        if (err == ERR_OK) {
+            ret = (int)n;
+        }
+        else {
+            zts_errno = (err == ERR_MEM) ? ZTS_EWOULDBLOCK : err_to_errno(err);
+            ret = ZTS_ERR_SOCKET;
+        }
+    }
+    zts_async_unlock();
+    return ret;
+}
+
+int zts_async_tcp_recved(int conn_id, size_t len)
+{
+    if (! transport_ok()) {
+        return ZTS_ERR_SERVICE;
+    }
+    int ret = ZTS_ERR_ARG;
+    zts_async_lock();
+    zts_async_conn* conn = zts_async_find(conn_id);
+    if (conn && ! conn->listening) {
+        zts_async_ack(conn, len);
+        ret = ZTS_ERR_OK;
+    }
+    zts_async_unlock();
+    return ret;
+}
+
+int zts_async_tcp_close(int conn_id)
+{
+    if (! transport_ok()) {
+        return ZTS_ERR_SERVICE;
+    }
+    int ret = ZTS_ERR_ARG;
+    zts_async_lock();
+    zts_async_conn* conn = zts_async_find(conn_id);
+    if (conn) {
+        struct tcp_pcb* pcb = conn->pcb;
+        if (! conn->listening) {
+            zts_async_ack(conn, conn->unacked);
+        }
+        zts_async_detach(pcb, conn->listening);
+        zts_async_free(conn);
+        zts_tcp_untune(pcb);
+        if (tcp_close(pcb) != ERR_OK) {
+            tcp_abort(pcb);
+            if (_async_depth) {
+                _async_aborted = pcb;
+            }
+        }
+        ret = ZTS_ERR_OK;
+    }
+    zts_async_unlock();
+    return ret;
+}
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,327 @@
+/*
+ * Copyright (c)2013-2021 ZeroTier, Inc.
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file in the project's root directory.
+ *
+ * Change Date: 2026-01-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2.0 of the Apache License.
+ */
+/****/
+
+/**
+ * @file
+ *
+ * Internet checksum routines for lwIP
+ *
+ * The one's complement sum of 16-bit words is independent of byte order as
+ * long as the words are loaded and the result stored in the same order, and
+ * wider words may be summed as long as the carries are folded back in. Each
+ * implementation therefore sums native words of the widest size it can and
+ * folds once at the end. The vector versions widen 16-bit lanes into 32-bit
+ * accumulators which are drained periodically so that they cannot overflow.
+ * The implementation is chosen once for the running CPU.
+ */
+
+#include "Checksum.hpp"
+
+#include <stddef.h>
+#include <string.h>
+
+#if ! defined(ZTS_DISABLE_SIMD_CHKSUM)
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define ZTS_CHKSUM_X86 1
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define ZTS_CHKSUM_NEON 1
+#include <arm_neon.h>
+#endif
+#endif
+
+#if defined(__GNUC__) || defined(__clang__)
+#define ZTS_CHKSUM_TARGET(isa) __attribute__((target(isa)))
+#else
+#define ZTS_CHKSUM_TARGET(isa)
+#endif
+
+// Number of vector blocks summed before the 32-bit lanes are drained
+#define ZTS_CHKSUM_DRAIN_BLOCKS 16384
+
+namespace ZeroTier {
+
+static inline uint16_t zts_chksum_fold(uint64_t sum)
+{
+    sum = (sum & 0xffffffffULL) + (sum >> 32);
+    sum = (sum & 0xffffffffULL) + (sum >> 32);
+    sum = (sum & 0xffff) + (sum >> 16);
+    sum = (sum & 0xffff) + (sum >> 16);
+    return (uint16_t)sum;
+}
+
+// Unfolded sum of len bytes as native 32-bit words, the last odd byte is
+// summed as if followed by a zero byte
+static inline uint64_t zts_chksum_sum(const uint8_t* p, size_t len)
+{
+    uint64_t sum = 0;
+    uint32_t w;
+    while (len >= 16) {
+        uint32_t w4[4];
+        memcpy(w4, p, 16);
+        sum += (uint64_t)w4[0] + w4[1] + w4[2] + w4[3];
+        p += 16;
+        len -= 16;
+    }
+    while (len >= 4) {
+        memcpy(&w, p, 4);
+        sum += w;
+        p += 4;
+        len -= 4;
+    }
+    uint16_t t = 0;
+    if (len >= 2) {
+        memcpy(&t, p, 2);
+        sum += t;
+        p += 2;
+        len -= 2;
+    }
+    if (len) {
+        t = 0;
+        memcpy(&t, p, 1);
+        sum += t;
+    }
+    return sum;
+}
+
+uint16_t zts_chksum_portable(const void* data, int len)
+{
+    return zts_chksum_fold(zts_chksum_sum((const uint8_t*)data, len > 0 ? (size_t)len : 0));
+}
+
+static uint16_t zts_chksum_copy_portable(void* dst, const void* src, uint16_t len)
+{
+    memcpy(dst, src, len);
+    return zts_chksum_fold(zts_chksum_sum((const uint8_t*)dst, len));
+}
+
+#if ZTS_CHKSUM_X86
+
+ZTS_CHKSUM_TARGET("sse2")
+static uint64_t zts_chksum_sum_sse2(const uint8_t* src, uint8_t* dst, size_t len)
+{
+    const __m128i zero = _mm_setzero_si128();
+    uint64_t sum = 0;
+    size_t blocks = len / 16;
+    while (blocks) {
+        const size_t n = blocks < ZTS_CHKSUM_DRAIN_BLOCKS ? blocks : ZTS_CHKSUM_DRAIN_BLOCKS;
+        __m128i acc = _mm_setzero_si128();
+        for (size_t i = 0; i < n; ++i) {
+            const __m128i v = _mm_loadu_si128((const __m128i*)src);
+            if (dst) {
+                _mm_storeu_si128((__m128i*)dst, v);
+                dst += 16;
+            }
+            acc = _mm_add_epi32(acc, _mm_unpacklo_epi16(v, zero));
+            acc = _mm_add_epi32(acc, _mm_unpackhi_epi16(v, zero));
+            src += 16;
+        }
+        uint32_t lanes[4];
+        _mm_storeu_si128((__m128i*)lanes, acc);
+        sum += (uint64_t)lanes[0] + lanes[1] + lanes[2] + lanes[3];
+        blocks -= n;
+    }
+    len %= 16;
+    if (dst) {
+        memcpy(dst, src, len);
+    }
+    return sum + zts_chksum_sum(src, len);
+}
+
+ZTS_CHKSUM_TARGET("avx2")
+static uint64_t zts_chksum_sum_avx2(const uint8_t* src, uint8_t* dst, size_t len)
+{
+    const __m256i zero = _mm256_setzero_si256();
+    uint64_t sum = 0;
+    size_t blocks = len / 32;
+    while (blocks) {
+        const size_t n = blocks < ZTS_CHKSUM_DRAIN_BLOCKS ? blocks : ZTS_CHKSUM_DRAIN_BLOCKS;
+        __m256i acc = _mm256_setzero_si256();
+        for (size_t i = 0; i < n; ++i) {
+            const __m256i v = _mm256_loadu_si256((const __m256i*)src);
+            if (dst) {
+                _mm256_storeu_si256((__m256i*)dst, v);
+                dst += 32;
+            }
+            acc = _mm256_add_epi32(acc, _mm256_unpacklo_epi16(v, zero));
+            acc = _mm256_add_epi32(acc, _mm256_unpackhi_epi16(v, zero));
+            src += 32;
+        }
+        uint32_t lanes[8];
+        _mm256_storeu_si256((__m256i*)lanes, acc);
+        for (unsigned int i = 0; i < 8; ++i) {
+            sum += lanes[i];
+        }
+        blocks -= n;
+    }
+    // Finish here rather than in the SSE2 version, calling legacy SSE code
+    // with the upper halves of the registers in use is expensive
+    len %= 32;
+    if (len >= 16) {
+        const __m128i v = _mm_loadu_si128((const __m128i*)src);
+        if (dst) {
+            _mm_storeu_si128((__m128i*)dst, v);
+            dst += 16;
+        }
+        const __m128i z = _mm_setzero_si128();
+        const __m128i acc = _mm_add_epi32(_mm_unpacklo_epi16(v, z), _mm_unpackhi_epi16(v, z));
+        uint32_t lanes[4];
+        _mm_storeu_si128((__m128i*)lanes, acc);
+        sum += (uint64_t)lanes[0] + lanes[1] + lanes[2] + lanes[3];
+        src += 16;
+        len -= 16;
+    }
+    if (dst) {
+        memcpy(dst, src, len);
+    }
+    return sum + zts_chksum_sum(src, len);
+}
+
+static uint16_t zts_chksum_sse2(const void* data, int len)
+{
+    return zts_chksum_fold(zts_chksum_sum_sse2((const uint8_t*)data, NULL, len > 0 ? (size_t)len : 0));
+}
+
+static uint16_t zts_chksum_copy_sse2(void* dst, const void* src, uint16_t len)
+{
+    return zts_chksum_fold(zts_chksum_sum_sse2((const uint8_t*)src, (uint8_t*)dst, len));
+}
+
+static uint16_t zts_chksum_avx2(const void* data, int len)
+{
+    return zts_chksum_fold(zts_chksum_sum_avx2((const uint8_t*)data, NULL, len > 0 ? (size_t)len : 0));
+}
+
+static uint16_t zts_chksum_copy_avx2(void* dst, const void* src, uint16_t len)
+{
+    return zts_chksum_fold(zts_chksum_sum_avx2((const uint8_t*)src, (uint8_t*)dst, len));
+}
+
+static bool zts_cpu_has_sse2()
+{
+#if defined(_MSC_VER)
+    int info[4];
+    __cpuid(info, 1);
+    return (info[3] & (1 << 26)) != 0;
+#else
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("sse2");
+#endif
+}
+
+static bool zts_cpu_has_avx2()
+{
+#if defined(_MSC_VER)
+    int info[4];
+    __cpuid(info, 1);
+    const bool osxsave = (info[2] & (1 << 27)) != 0;
+    if (! osxsave || (_xgetbv(0) & 0x6) != 0x6) {
+        return false;
+    }
+    __cpuidex(info, 7, 0);
+    return (info[1] & (1 << 5)) != 0;
+#else
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2");
+#endif
+}
+
+#endif   // ZTS_CHKSUM_X86
+
+#if ZTS_CHKSUM_NEON
+
+static uint64_t zts_chksum_sum_neon(const uint8_t* src, uint8_t* dst, size_t len)
+{
+    uint64_t sum = 0;
+    size_t blocks = len / 16;
+    while (blocks) {
+        const size_t n = blocks < ZTS_CHKSUM_DRAIN_BLOCKS ? blocks : ZTS_CHKSUM_DRAIN_BLOCKS;
+        uint32x4_t acc = vdupq_n_u32(0);
+        for (size_t i = 0; i < n; ++i) {
+            const uint8x16_t v = vld1q_u8(src);
+            if (dst) {
+                vst1q_u8(dst, v);
+                dst += 16;
+            }
+            acc = vpadalq_u16(acc, vreinterpretq_u16_u8(v));
+            src += 16;
+        }
+        const uint64x2_t s = vpaddlq_u32(acc);
+        sum += vgetq_lane_u64(s, 0) + vgetq_lane_u64(s, 1);
+        blocks -= n;
+    }
+    len %= 16;
+    if (dst) {
+        memcpy(dst, src, len);
+    }
+    return sum + zts_chksum_sum(src, len);
+}
+
+static uint16_t zts_chksum_neon(const void* data, int len)
+{
+    return zts_chksum_fold(zts_chksum_sum_neon((const uint8_t*)data, NULL, len > 0 ? (size_t)len : 0));
+}
+
+static uint16_t zts_chksum_copy_neon(void* dst, const void* src, uint16_t len)
+{
+    return zts_chksum_fold(zts_chksum_sum_neon((const uint8_t*)src, (uint8_t*)dst, len));
+}
+
+#endif   // ZTS_CHKSUM_NEON
+
+struct zts_chksum_ops {
+    const char* name;
+    uint16_t (*chksum)(const void* data, int len);
+    uint16_t (*copy)(void* dst, const void* src, uint16_t len);
+};
+
+static zts_chksum_ops zts_chksum_select()
+{
+#if ZTS_CHKSUM_X86
+    if (zts_cpu_has_avx2()) {
+        return { "avx2", zts_chksum_avx2, zts_chksum_copy_avx2 };
+    }
+    if (zts_cpu_has_sse2()) {
+        return { "sse2", zts_chksum_sse2, zts_chksum_copy_sse2 };
+    }
+#endif
+#if ZTS_CHKSUM_NEON
+    return { "neon", zts_chksum_neon, zts_chksum_copy_neon };
+#else
+    return { "portable", zts_chksum_portable, zts_chksum_copy_portable };
+#endif
+}
+
+static const zts_chksum_ops _chksum_ops = zts_chksum_select();
+
+const char* zts_chksum_impl()
+{
+    return _chksum_ops.name;
+}
+
+}   // namespace ZeroTier
+
+using namespace ZeroTier;
+
+extern "C" uint16_t zts_chksum(const void* data, int len)
+{
+    return _chksum_ops.chksum(data, len);
+}
+
+extern "C" uint16_t zts_chksum_copy(void* dst, const void* src, uint16_t len)
+{
+    return _chksum_ops.copy(dst, src, len);
+}
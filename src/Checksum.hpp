@@ -0,0 +1,56 @@
+/*
+ * Copyright (c)2013-2021 ZeroTier, Inc.
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file in the project's root directory.
+ *
+ * Change Date: 2026-01-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2.0 of the Apache License.
+ */
+/****/
+
+/**
+ * @file
+ *
+ * Internet checksum routines for lwIP, see LWIP_CHKSUM in lwipopts.h
+ */
+
+#ifndef ZTS_CHECKSUM_HPP
+#define ZTS_CHECKSUM_HPP
+
+#include <stdint.h>
+
+namespace ZeroTier {
+
+/**
+ * @brief Portable version of zts_chksum(), used when the CPU has no
+ * supported vector unit and for the end of each buffer
+ */
+uint16_t zts_chksum_portable(const void* data, int len);
+
+/**
+ * @brief Name of the implementation selected for this CPU ("avx2", "sse2",
+ * "neon" or "portable")
+ */
+const char* zts_chksum_impl();
+
+}   // namespace ZeroTier
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Both return the folded 16-bit one's complement sum of the data in network
+ * byte order, not inverted, as lwip_standard_chksum() and lwip_chksum_copy().
+ */
+uint16_t zts_chksum(const void* data, int len);
+uint16_t zts_chksum_copy(void* dst, const void* src, uint16_t len);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -20,6 +20,8 @@
 #include "Events.hpp"
 #include "NodeService.hpp"
 #include "Signals.hpp"
+#include "Slab.hpp"
+#include "Sockets.hpp"
 #include "VirtualTap.hpp"
 
 #include <string.h>
@@ -210,6 +212,78 @@ int zts_init_allow_id_cache(unsigned int allowed)
     return zts_service->allowIdentityCaching(allowed);
 }
 
+int zts_init_allow_udp_offload(unsigned int allowed)
+{
+    ACQUIRE_SERVICE_OFFLINE();
+    return zts_service->allowUdpOffload(allowed);
+}
+
+int zts_init_set_wire_rx_threads(unsigned int count)
+{
+    ACQUIRE_SERVICE_OFFLINE();
+    return zts_service->setWireRxThreads(count);
+}
+
+int zts_init_set_io_engine(int engine)
+{
+    ACQUIRE_SERVICE_OFFLINE();
+    return zts_service->setIoEngine(engine);
+}
+
+int zts_init_set_mem_slab(unsigned int reserve, unsigned int limit_mb)
+{
+    ACQUIRE_SERVICE_OFFLINE();
+    return zts_slab_configure(reserve, limit_mb);
+}
+
+int zts_init_set_tuning_profile(int profile)
+{
+    ACQUIRE_SERVICE_OFFLINE();
+    return zts_lwip_set_tuning_profile(profile);
+}
+
+int zts_init_set_tcp_window(unsigned int size, unsigned int scale)
+{
+    ACQUIRE_SERVICE_OFFLINE();
+    return zts_lwip_set_tcp_window(size, scale);
+}
+
+int zts_init_set_tcp_send_buf(unsigned int size)
+{
+    ACQUIRE_SERVICE_OFFLINE();
+    return zts_lwip_set_tcp_send_buf(size);
+}
+
+int zts_init_set_tcp_ooseq_limit(unsigned int max_bytes, unsigned int max_pbufs)
+{
+    ACQUIRE_SERVICE_OFFLINE();
+    return zts_lwip_set_tcp_ooseq_limit(max_bytes, max_pbufs);
+}
+
+int zts_init_set_rx_burst(unsigned int burst_size, unsigned int flush_latency_ms)
+{
+    ACQUIRE_SERVICE_OFFLINE();
+    return zts_lwip_set_rx_burst(burst_size, flush_latency_ms);
+}
+
+int zts_init_set_tx_queue(unsigned int len)
+{
+    ACQUIRE_SERVICE_OFFLINE();
+    return zts_lwip_set_tx_queue(len);
+}
+
+int zts_init_set_crypto_threads(unsigned int count)
+{
+    ACQUIRE_SERVICE_OFFLINE();
+    return zts_lwip_set_tx_threads(count);
+}
+
+int zts_init_set_max_sockets(unsigned int count)
+{
+    ACQUIRE_SERVICE_OFFLINE();
+    return zts_sockets_set_max(count);
+}
+
 int zts_addr_compute_6plane(const uint64_t net_id, const uint64_t node_id, struct zts_sockaddr_storage* addr)
 {
     if (! addr || ! net_id || ! node_id) {
@@ -519,6 +593,12 @@ int zts_net_get_type(uint64_t net_id)
     return zts_service->getNetworkType(net_id);
 }
 
+int zts_net_set_trusted_link(uint64_t net_id, unsigned int enabled)
+{
+    ACQUIRE_SERVICE(ZTS_ERR_SERVICE);
+    return zts_service->setTrustedLink(net_id, enabled);
+}
+
 int zts_route_is_assigned(uint64_t net_id, unsigned int family)
 {
     ACQUIRE_SERVICE(ZTS_ERR_SERVICE);
@@ -624,6 +704,7 @@ int zts_node_stop()
     ACQUIRE_SERVICE(ZTS_ERR_SERVICE);
     zts_events->clrState(ZTS_STATE_NODE_RUNNING);
     zts_service->terminate();
+    zts_sockets_reset();
 #if defined(__WINDOWS__)
     WSACleanup();
 #endif
@@ -636,6 +717,7 @@ int zts_node_free()
     zts_events->setState(ZTS_STATE_FREE_CALLED);
     zts_events->clrState(ZTS_STATE_NODE_RUNNING);
     zts_service->terminate();
+    zts_sockets_reset();
 #if defined(__WINDOWS__)
     WSACleanup();
 #endif
@@ -742,6 +824,25 @@ int zts_stats_get_all(zts_stats_counter_t* dst)
 #undef lws
 }
 
+int zts_stats_get_wire(zts_stats_wire_t* dst)
+{
+    if (! dst) {
+        return ZTS_ERR_ARG;
+    }
+    ACQUIRE_SERVICE(ZTS_ERR_SERVICE);
+    zts_service->getWireStats(dst);
+    return ZTS_ERR_OK;
+}
+
+int zts_stats_get_slab(zts_stats_slab_t* dst)
+{
+    if (! dst) {
+        return ZTS_ERR_ARG;
+    }
+    zts_slab_get_stats(dst);
+    return ZTS_ERR_OK;
+}
+
 #ifdef __cplusplus
 }
 #endif
@@ -49,6 +49,8 @@
 #define ZT_RESET
 #endif
 
+#define ZTS_UNUSED_ARG(x) (void)x
+
 #define ZT_FILENAME (strrchr(__FILE__, '/') ? strrchr(__FILE__, '/') + 1 : __FILE__)   // short
 
 #if defined(__ANDROID__)
@@ -0,0 +1,514 @@
+/*
+ * Copyright (c)2013-2021 ZeroTier, Inc.
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file in the project's root directory.
+ *
+ * Change Date: 2026-01-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2.0 of the Apache License.
+ */
+/****/
+
+/**
+ * @file
+ *
+ * Readiness notification for many sockets (zts_epoll_*())
+ *
+ * lwIP reports every change in a socket's state through a callback on its
+ * netconn, from which its sockets layer maintains the counters that select()
+ * and poll() scan. Sockets registered on an epoll instance have that callback
+ * wrapped so that each change which may make a socket ready also queues it on
+ * the instances watching it. Waiting then only looks at queued sockets, and
+ * reads their readiness from the same counters. Connections accepted from a
+ * wrapped listening socket inherit the wrapper but are not watched until
+ * registered themselves.
+ *
+ * An instance can also be given an OS descriptor (an eventfd, or a pipe where
+ * there is none) that is readable while sockets are queued on it, so that it
+ * can be waited on from the application's own event loop.
+ */
+
+#include "Epoll.hpp"
+
+#include "Events.hpp"
+#include "Sockets.hpp"
+#include "ZeroTierSockets.h"
+#include "lwip/priv/sockets_priv.h"
+#include "lwip/priv/tcp_priv.h"
+#include "lwip/sys.h"
+#include "lwip/tcpip.h"
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <limits.h>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+#if defined(__linux__)
+#include <sys/eventfd.h>
+#endif
+#if ! defined(_WIN32)
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace ZeroTier {
+
+struct zts_epoll;
+
+// A socket registered on an instance
+struct zts_epoll_item {
+    zts_epoll* ep;
+    int fd;
+    struct netconn* conn;
+    struct zts_epoll_event ev;
+    bool queued;
+    uint32_t hup;    // ZTS_EPOLLHUP and ZTS_EPOLLRDHUP seen, kept since the pcb may be gone by then
+    bool errqueue;   // Zero-copy send completions wait to be collected
+};
+
+struct zts_epoll {
+    std::unordered_map<int, zts_epoll_item*> items;   // By fd
+    std::deque<zts_epoll_item*> ready;                // Possibly ready, in order of notification
+    std::condition_variable cv;
+    unsigned int waiters;
+    bool closed;
+    int os_fd[2];   // Read and write ends, -1 if none
+    bool signaled;
+};
+
+// Taken after the core lock when both are needed
+static std::mutex _epoll_m;
+static std::unordered_map<int, zts_epoll*> _epolls;
+static int _epoll_next;
+static std::unordered_multimap<struct netconn*, zts_epoll_item*> _epoll_watched;
+// lwIP's own callback, that every socket is created with
+static netconn_callback _lwip_event_callback;
+
+// Make the OS descriptor readable, sockets have been queued
+static void zts_epoll_signal(zts_epoll* ep)
+{
+    if (ep->os_fd[1] < 0 || ep->signaled) {
+        return;
+    }
+    ep->signaled = true;
+#if defined(__linux__)
+    const uint64_t one = 1;
+    const ssize_t r = write(ep->os_fd[1], &one, sizeof(one));
+    (void)r;
+#elif ! defined(_WIN32)
+    const char c = 0;
+    const ssize_t r = write(ep->os_fd[1], &c, 1);
+    (void)r;
+#endif
+}
+
+// Drain the OS descriptor once nothing is queued anymore
+static void zts_epoll_unsignal(zts_epoll* ep)
+{
+    if (! ep->signaled || ! ep->ready.empty()) {
+        return;
+    }
+    ep->signaled = false;
+#if defined(__linux__)
+    uint64_t count;
+    const ssize_t r = read(ep->os_fd[0], &count, sizeof(count));
+    (void)r;
+#elif ! defined(_WIN32)
+    char c;
+    const ssize_t r = read(ep->os_fd[0], &c, 1);
+    (void)r;
+#endif
+}
+
+static void zts_epoll_close_os_fd(zts_epoll* ep)
+{
+#if ! defined(_WIN32)
+    if (ep->os_fd[0] >= 0) {
+        close(ep->os_fd[0]);
+    }
+    if (ep->os_fd[1] >= 0 && ep->os_fd[1] != ep->os_fd[0]) {
+        close(ep->os_fd[1]);
+    }
+#endif
+    ep->os_fd[0] = ep->os_fd[1] = -1;
+    ep->signaled = false;
+}
+
+static void zts_epoll_queue(zts_epoll_item* item)
+{
+    if (! item->queued) {
+        item->queued = true;
+        item->ep->ready.push_back(item);
+        item->ep->cv.notify_all();
+        zts_epoll_signal(item->ep);
+    }
+}
+
+// How far a TCP connection is shut down: ZTS_EPOLLRDHUP once the peer has
+// sent a FIN, and ZTS_EPOLLHUP as well once this side has also shut down
+// writing, or the connection was reset and lwIP has freed its pcb. Called
+// with the core lock held.
+static uint32_t zts_epoll_hangup(struct netconn* conn)
+{
+    if (NETCONNTYPE_GROUP(netconn_type(conn)) != NETCONN_TCP) {
+        return 0;
+    }
+    const struct tcp_pcb* pcb = conn->pcb.tcp;
+    if (! pcb || pcb->state == LAST_ACK || pcb->state == CLOSING || pcb->state == TIME_WAIT) {
+        return ZTS_EPOLLHUP | ZTS_EPOLLRDHUP;
+    }
+    return (pcb->state == CLOSE_WAIT) ? ZTS_EPOLLRDHUP : 0;
+}
+
+static void zts_epoll_event_callback(struct netconn* conn, enum netconn_evt evt, u16_t len)
+{
+    _lwip_event_callback(conn, evt, len);
+    // Only the other events can make a socket ready
+    if (evt == NETCONN_EVT_RCVMINUS || evt == NETCONN_EVT_SENDMINUS) {
+        return;
+    }
+    const uint32_t hup = zts_epoll_hangup(conn);
+    std::lock_guard<std::mutex> _l(_epoll_m);
+    auto range = _epoll_watched.equal_range(conn);
+    for (auto it = range.first; it != range.second; ++it) {
+        it->second->hup |= hup;
+        zts_epoll_queue(it->second);
+    }
+}
+
+// Current readiness of a socket, as lwip_poll() sees it
+static uint32_t zts_epoll_poll(const zts_epoll_item* item)
+{
+    struct lwip_sock* sock = lwip_socket_dbg_get_socket(item->fd);
+    if (! sock) {
+        return 0;
+    }
+    // The counters are updated by lwIP's event callback on the tcpip thread,
+    // read them under the same protection as lwip_poll() does
+    SYS_ARCH_DECL_PROTECT(lev);
+    SYS_ARCH_PROTECT(lev);
+    const bool same = (sock->conn == item->conn);
+    const bool readable = sock->lastdata.pbuf || sock->rcvevent > 0;
+    const bool writable = sock->sendevent != 0;
+    const bool error = sock->errevent != 0;
+    SYS_ARCH_UNPROTECT(lev);
+    if (! same) {
+        return 0;
+    }
+    uint32_t events = 0;
+    if (readable) {
+        events |= ZTS_EPOLLIN;
+    }
+    if (writable) {
+        events |= ZTS_EPOLLOUT;
+    }
+    if (error || item->errqueue) {
+        events |= ZTS_EPOLLERR;
+    }
+    return events | item->hup;
+}
+
+static void zts_epoll_remove(zts_epoll_item* item)
+{
+    zts_epoll* ep = item->ep;
+    ep->items.erase(item->fd);
+    auto range = _epoll_watched.equal_range(item->conn);
+    for (auto it = range.first; it != range.second; ++it) {
+        if (it->second == item) {
+            _epoll_watched.erase(it);
+            break;
+        }
+    }
+    if (item->queued) {
+        ep->ready.erase(std::find(ep->ready.begin(), ep->ready.end(), item));
+        zts_epoll_unsignal(ep);
+    }
+    delete item;
+}
+
+// Report the queued sockets that are ready. Level-triggered ones go back on
+// the queue and are looked at again by the next wait.
+static int zts_epoll_collect(zts_epoll* ep, struct zts_epoll_event* events, int maxevents)
+{
+    int n = 0;
+    for (size_t left = ep->ready.size(); left && n < maxevents; left--) {
+        zts_epoll_item* item = ep->ready.front();
+        ep->ready.pop_front();
+        item->queued = false;
+        const uint32_t want = item->ev.events;
+        const uint32_t mask =
+            want ? (want & (ZTS_EPOLLIN | ZTS_EPOLLOUT | ZTS_EPOLLRDHUP)) | ZTS_EPOLLERR | ZTS_EPOLLHUP : 0;
+        const uint32_t revents = zts_epoll_poll(item) & mask;
+        if (! revents) {
+            continue;
+        }
+        events[n].events = revents;
+        events[n].data = item->ev.data;
+        n++;
+        if (want & ZTS_EPOLLONESHOT) {
+            item->ev.events = 0;   // Until rearmed
+        }
+        else if (! (want & ZTS_EPOLLET)) {
+            item->queued = true;
+            ep->ready.push_back(item);
+        }
+    }
+    zts_epoll_unsignal(ep);
+    return n;
+}
+
+void zts_epoll_forget(int fd)
+{
+    std::lock_guard<std::mutex> _l(_epoll_m);
+    if (_epoll_watched.empty()) {
+        return;
+    }
+    // Found through the socket's netconn, without visiting every instance
+    struct lwip_sock* sock = lwip_socket_dbg_get_socket(fd);
+    if (! sock || ! sock->conn) {
+        return;
+    }
+    auto range = _epoll_watched.equal_range(sock->conn);
+    std::vector<zts_epoll_item*> items;
+    for (auto it = range.first; it != range.second; ++it) {
+        if (it->second->fd == fd) {
+            items.push_back(it->second);
+        }
+    }
+    for (zts_epoll_item* item : items) {
+        zts_epoll_remove(item);
+    }
+}
+
+void zts_epoll_shutdown(int fd)
+{
+    LOCK_TCPIP_CORE();
+    struct lwip_sock* sock = lwip_socket_dbg_get_socket(fd);
+    if (sock && sock->conn) {
+        const uint32_t hup = zts_epoll_hangup(sock->conn);
+        std::lock_guard<std::mutex> _l(_epoll_m);
+        auto range = _epoll_watched.equal_range(sock->conn);
+        for (auto it = range.first; it != range.second; ++it) {
+            it->second->hup |= hup;
+            zts_epoll_queue(it->second);
+        }
+    }
+    UNLOCK_TCPIP_CORE();
+}
+
+void zts_epoll_errqueue(struct netconn* conn, bool pending)
+{
+    std::lock_guard<std::mutex> _l(_epoll_m);
+    auto range = _epoll_watched.equal_range(conn);
+    for (auto it = range.first; it != range.second; ++it) {
+        it->second->errqueue = pending;
+        if (pending) {
+            zts_epoll_queue(it->second);
+        }
+    }
+}
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+int zts_epoll_create()
+{
+    if (! transport_ok()) {
+        return ZTS_ERR_SERVICE;
+    }
+    std::lock_guard<std::mutex> _l(_epoll_m);
+    while (_epolls.count(_epoll_next)) {
+        _epoll_next = (_epoll_next + 1) & INT_MAX;
+    }
+    const int epfd = _epoll_next;
+    _epoll_next = (_epoll_next + 1) & INT_MAX;
+    zts_epoll* ep = new zts_epoll();
+    ep->os_fd[0] = ep->os_fd[1] = -1;
+    _epolls[epfd] = ep;
+    return epfd;
+}
+
+int zts_epoll_ctl(int epfd, int op, int fd, struct zts_epoll_event* event)
+{
+    if (! transport_ok()) {
+        return ZTS_ERR_SERVICE;
+    }
+    if (op < ZTS_EPOLL_CTL_ADD || op > ZTS_EPOLL_CTL_MOD || (op != ZTS_EPOLL_CTL_DEL && ! event)) {
+        return ZTS_ERR_ARG;
+    }
+    int ret = ZTS_ERR_OK;
+    int err = 0;
+    // The socket's callback is only changed under the core lock
+    LOCK_TCPIP_CORE();
+    {
+        std::lock_guard<std::mutex> _l(_epoll_m);
+        auto e = _epolls.find(epfd);
+        // Registrations are kept by lwIP's socket number, which is what zts_epoll_forget() gets
+        fd = zts_lwip_fd(fd);
+        struct lwip_sock* sock = lwip_socket_dbg_get_socket(fd);
+        if (e == _epolls.end()) {
+            ret = ZTS_ERR_ARG;
+        }
+        else if (! sock || ! sock->conn || ! sock->conn->callback) {
+            err = ZTS_EBADF;
+        }
+        else {
+            zts_epoll* ep = e->second;
+            auto it = ep->items.find(fd);
+            zts_epoll_item* item = (it != ep->items.end()) ? it->second : NULL;
+            if (op == ZTS_EPOLL_CTL_ADD) {
+                if (item) {
+                    err = ZTS_EEXIST;
+                }
+                else {
+                    item = new zts_epoll_item();
+                    item->ep = ep;
+                    item->fd = fd;
+                    item->conn = sock->conn;
+                    item->ev = *event;
+                    item->hup = zts_epoll_hangup(sock->conn);
+                    item->errqueue = zts_zc_has_completions(fd);
+                    ep->items[fd] = item;
+                    _epoll_watched.insert(std::make_pair(sock->conn, item));
+                    if (sock->conn->callback != zts_epoll_event_callback) {
+                        _lwip_event_callback = sock->conn->callback;
+                        sock->conn->callback = zts_epoll_event_callback;
+                    }
+                    // It may be ready already
+                    zts_epoll_queue(item);
+                }
+            }
+            else if (! item) {
+                err = ZTS_ENOENT;
+            }
+            else if (op == ZTS_EPOLL_CTL_MOD) {
+                item->ev = *event;
+                zts_epoll_queue(item);
+            }
+            else {
+                zts_epoll_remove(item);
+            }
+        }
+    }
+    UNLOCK_TCPIP_CORE();
+    if (err) {
+        zts_errno = err;
+        return ZTS_ERR_SOCKET;
+    }
+    return ret;
+}
+
+int zts_epoll_wait(int epfd, struct zts_epoll_event* events, int maxevents, int timeout_ms)
+{
+    if (! transport_ok()) {
+        return ZTS_ERR_SERVICE;
+    }
+    if (! events || maxevents <= 0) {
+        return ZTS_ERR_ARG;
+    }
+    std::unique_lock<std::mutex> _l(_epoll_m);
+    auto e = _epolls.find(epfd);
+    if (e == _epolls.end()) {
+        return ZTS_ERR_ARG;
+    }
+    zts_epoll* ep = e->second;
+    const auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms > 0 ? timeout_ms : 0);
+    int n = 0;
+    ep->waiters++;
+    while (! ep->closed) {
+        n = zts_epoll_collect(ep, events, maxevents);
+        if (n || ! timeout_ms) {
+            break;
+        }
+        if (timeout_ms < 0) {
+            ep->cv.wait(_l);
+        }
+        else if (ep->cv.wait_until(_l, deadline) == std::cv_status::timeout) {
+            n = ep->closed ? 0 : zts_epoll_collect(ep, events, maxevents);
+            break;
+        }
+    }
+    const bool closed = ep->closed;
+    if (! --ep->waiters && closed) {
+        delete ep;
+    }
+    return closed ? ZTS_ERR_ARG : n;
+}
+
+int zts_epoll_get_os_fd(int epfd)
+{
+    if (! transport_ok()) {
+        return ZTS_ERR_SERVICE;
+    }
+    std::lock_guard<std::mutex> _l(_epoll_m);
+    auto e = _epolls.find(epfd);
+    if (e == _epolls.end()) {
+        return ZTS_ERR_ARG;
+    }
+    zts_epoll* ep = e->second;
+    if (ep->os_fd[0] >= 0) {
+        return ep->os_fd[0];
+    }
+#if defined(__linux__)
+    const int fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (fd < 0) {
+        return ZTS_ERR_GENERAL;
+    }
+    ep->os_fd[0] = ep->os_fd[1] = fd;
+#elif ! defined(_WIN32)
+    int fds[2];
+    if (pipe(fds) < 0) {
+        return ZTS_ERR_GENERAL;
+    }
+    for (int i = 0; i < 2; i++) {
+        fcntl(fds[i], F_SETFL, fcntl(fds[i], F_GETFL) | O_NONBLOCK);
+        fcntl(fds[i], F_SETFD, FD_CLOEXEC);
+    }
+    ep->os_fd[0] = fds[0];
+    ep->os_fd[1] = fds[1];
+#else
+    return ZTS_ERR_GENERAL;
+#endif
+    // Sockets may be queued already
+    if (! ep->ready.empty()) {
+        zts_epoll_signal(ep);
+    }
+    return ep->os_fd[0];
+}
+
+int zts_epoll_close(int epfd)
+{
+    std::lock_guard<std::mutex> _l(_epoll_m);
+    auto e = _epolls.find(epfd);
+    if (e == _epolls.end()) {
+        return ZTS_ERR_ARG;
+    }
+    zts_epoll* ep = e->second;
+    _epolls.erase(e);
+    while (! ep->items.empty()) {
+        zts_epoll_remove(ep->items.begin()->second);
+    }
+    zts_epoll_close_os_fd(ep);
+    // Freed by the last thread waiting on it
+    ep->closed = true;
+    if (ep->waiters) {
+        ep->cv.notify_all();
+    }
+    else {
+        delete ep;
+    }
+    return ZTS_ERR_OK;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+}   // namespace ZeroTier
@@ -0,0 +1,48 @@
+/*
+ * Copyright (c)2013-2021 ZeroTier, Inc.
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file in the project's root directory.
+ *
+ * Change Date: 2026-01-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2.0 of the Apache License.
+ */
+/****/
+
+/**
+ * @file
+ *
+ * Readiness notification for many sockets (zts_epoll_*())
+ */
+
+#ifndef ZTS_EPOLL_HPP
+#define ZTS_EPOLL_HPP
+
+struct netconn;
+
+namespace ZeroTier {
+
+/**
+ * @brief Remove a socket that is being closed from every epoll instance.
+ * Must be called with the core lock held.
+ */
+void zts_epoll_forget(int fd);
+
+/**
+ * @brief Requeue a socket that was shut down, which lwIP raises no event for
+ * but may hang it up.
+ */
+void zts_epoll_shutdown(int fd);
+
+/**
+ * @brief Mark whether a socket has zero-copy send completions waiting to be
+ * collected, which is reported as `ZTS_EPOLLERR` (as Linux reports its error
+ * queue). Must be called with the core lock held.
+ */
+void zts_epoll_errqueue(struct netconn* conn, bool pending);
+
+}   // namespace ZeroTier
+
+#endif
@@ -17,6 +17,7 @@
  * ZeroTier Node Service
  */
 
+#include <algorithm>
 #include <stdlib.h>
 
 #include "NodeService.hpp"
@@ -28,6 +29,15 @@
 #include "Utilities.hpp"
 #include "VirtualTap.hpp"
 
+#if ZTS_WIRE_MMSG
+#include <errno.h>
+#include <unistd.h>
+#endif
+
+#if ZTS_WIRE_URING
+#include <sys/eventfd.h>
+#endif
+
 #if defined(__WINDOWS__)
 #include <iphlpapi.h>
 #include <netioapi.h>
@@ -200,6 +210,10 @@ NodeService::NodeService()
     , _homePath("")
     , _events(NULL)
 {
+#if ZTS_WIRE_MMSG
+    _wireTxQueue = new WireTxSlot[ZTS_WIRE_BATCH];
+    _wireRxBuf = new char[ZTS_WIRE_BATCH * ZTS_WIRE_RX_SLOT_LEN];
+#endif
 }
 
 NodeService::~NodeService()
@@ -208,11 +222,22 @@ NodeService::~NodeService()
 #ifdef ZT_USE_MINIUPNPC
     delete _portMapper;
 #endif
+#if ZTS_WIRE_MMSG
+    delete[] _wireTxQueue;
+    delete[] _wireRxBuf;
+#endif
 }
 
 NodeService::ReasonForTermination NodeService::run()
 {
     _run = true;
+    _serviceThreadId = std::this_thread::get_id();
+#if ZTS_WIRE_MMSG
+    probeUdpOffload();
+#endif
+#if ZTS_WIRE_URING
+    startUring();
+#endif
     try {
         // Create home path (if necessary)
         // By default, _homePath is empty and nothing is written to storage
@@ -412,6 +437,23 @@ NodeService::ReasonForTermination NodeService::run()
                     // Only bother binding UDP ports if we aren't forcing TCP-relay mode
                     _binder.refresh(_phy, p, pc, explicitBind, *this);
                 }
+#if ZTS_WIRE_MMSG
+                // The binder keeps the sockets of addresses that are still
+                // present. Stop only the shards of the ones it closed, so they
+                // no longer hold the port when the address is bound again.
+                pruneWireRxShards(false);
+                for (std::map<PhySocket*, WireRxIdle>::iterator i(_wireRxIdle.begin()); i != _wireRxIdle.end();) {
+                    if (_binder.isUdpSocketValid(i->first)) {
+                        ++i;
+                    }
+                    else {
+                        _wireRxIdle.erase(i++);
+                    }
+                }
+#endif
+#if ZTS_WIRE_URING
+                pruneUringSockets();
+#endif
             }
 
             // Generate callback messages for user application
@@ -420,7 +462,12 @@ NodeService::ReasonForTermination NodeService::run()
             // Run background task processor in core if it's time to do so
             int64_t dl = _nextBackgroundTaskDeadline;
             if (dl <= now) {
-                _node->processBackgroundTasks((void*)0, now, &_nextBackgroundTaskDeadline);
+                volatile int64_t ndl = dl;
+                _node->processBackgroundTasks((void*)0, now, &ndl);
+                // Keep an earlier deadline set by another thread meanwhile
+                if (! _nextBackgroundTaskDeadline.compare_exchange_strong(dl, ndl)) {
+                    updateBackgroundTaskDeadline(ndl);
+                }
                 dl = _nextBackgroundTaskDeadline;
             }
 
@@ -498,8 +545,22 @@ NodeService::ReasonForTermination NodeService::run()
 
             const unsigned long delay = (dl > now) ? (unsigned long)(dl - now) : 100;
             clockShouldBe = now + (uint64_t)delay;
+            // Nothing queued by this thread may wait while we block in poll()
+            flushWirePackets();
             _phy.poll(delay);
+            flushWirePackets();
+
+            // Hand frames received during this poll to the stack in one burst per tap
+            {
+                Mutex::Lock _l(_nets_m);
+                for (std::map<uint64_t, NetworkState>::iterator n(_nets.begin()); n != _nets.end(); ++n) {
+                    if (n->second.tap) {
+                        n->second.tap->flush();
+                    }
+                }
+            }
         }
+        flushWirePackets();
     }
     catch (std::exception& e) {
         Mutex::Lock _l(_termReason_m);
@@ -512,6 +573,13 @@ NodeService::ReasonForTermination NodeService::run()
         _fatalErrorMessage = "unexpected exception in main thread: unknown exception";
     }
 
+#if ZTS_WIRE_MMSG
+    pruneWireRxShards(true);
+#endif
+#if ZTS_WIRE_URING
+    stopUring();
+#endif
+
     {
         Mutex::Lock _l(_nets_m);
         for (std::map<uint64_t, NetworkState>::iterator n(_nets.begin()); n != _nets.end(); ++n) {
@@ -639,9 +707,436 @@ void NodeService::phyOnDatagram(
         return;
     }
     ZTS_UNUSED_ARG(uptr);
-    ZTS_UNUSED_ARG(localAddr);
+    _wireRxPackets++;
+    _wireRxSyscalls++;
+    handleDatagram(sock, from, data, len);
+#if ZTS_WIRE_MMSG
+    if (_wireRxThreads && (localAddr->sa_family == AF_INET || localAddr->sa_family == AF_INET6)
+        && (ntohs(((const struct sockaddr_in*)localAddr)->sin_port) == _ports[0])) {
+        bool sharded = false;
+        for (size_t i = 0; i < _wireRxShardedSockets.size(); ++i) {
+            if (_wireRxShardedSockets[i].first == sock) {
+                sharded = true;
+                break;
+            }
+        }
+        if (! sharded) {
+            addWireRxShards(sock, localAddr);
+        }
+    }
+    // Phy hands us the first datagram of what is often a burst, read the
+    // remainder of it here in batches rather than one recvfrom() each
+    drainDatagrams(sock);
+#endif
+#if ZTS_WIRE_URING
+    // From now on the socket is read through io_uring rather than by Phy
+    const uint64_t tag = (uint64_t)(uintptr_t)sock;
+    if (_uring && ! _uring->isArmed(tag)) {
+        int fd = (int)_phy.getDescriptor(sock);
+        if (_uring->armRecv(fd, tag)) {
+            _phy.setNotifyReadable(sock, false);
+            _uringSockets.push_back(std::pair<PhySocket*, int>(sock, fd));
+            enableUdpGro(fd);
+        }
+    }
+#endif
+}
+
+void NodeService::phyOnFileDescriptorActivity(PhySocket* sock, void** uptr, bool readable, bool writable)
+{
+    ZTS_UNUSED_ARG(uptr);
+    ZTS_UNUSED_ARG(writable);
+#if ZTS_WIRE_URING
+    if (_uring && (sock == _uringEventSock) && readable) {
+        uint64_t n = 0;
+        if (read((int)_phy.getDescriptor(sock), &n, sizeof(n)) > 0) {
+            _wireRxSyscalls++;
+        }
+        _uring->reap(&NodeService::uringRecvFunction, this);
+    }
+#else
+    ZTS_UNUSED_ARG(sock);
+    ZTS_UNUSED_ARG(readable);
+#endif
+}
+
+#if ZTS_WIRE_URING
+void NodeService::startUring()
+{
+    if (_ioEngine != ZTS_IO_ENGINE_URING) {
+        return;
+    }
+    int efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (efd < 0) {
+        return;
+    }
+    _uring = new WireUring();
+    if (! _uring->init(efd, _udpGro)) {
+        // Unsupported kernel or forbidden by policy, stay on the default engine
+        delete _uring;
+        _uring = NULL;
+        close(efd);
+        return;
+    }
+    _uringEventSock = _phy.wrapSocket(efd, NULL);
+}
+
+void NodeService::stopUring()
+{
+    if (! _uring) {
+        return;
+    }
+    delete _uring;   // Closing the rings cancels all receives
+    _uring = NULL;
+    _uringSockets.clear();
+    _phy.close(_uringEventSock, false);
+    _uringEventSock = NULL;
+}
+
+void NodeService::pruneUringSockets()
+{
+    for (std::vector<std::pair<PhySocket*, int> >::iterator i(_uringSockets.begin()); i != _uringSockets.end();) {
+        if (_binder.isUdpSocketValid(i->first) && ((int)_phy.getDescriptor(i->first) == i->second)) {
+            ++i;
+            continue;
+        }
+        _uring->cancelRecv((uint64_t)(uintptr_t)i->first);
+        i = _uringSockets.erase(i);
+    }
+}
+
+void NodeService::uringRecvFunction(
+    void* arg,
+    uint64_t tag,
+    const struct sockaddr* from,
+    void* data,
+    unsigned int len,
+    unsigned int segSize)
+{
+    NodeService* s = reinterpret_cast<NodeService*>(arg);
+    PhySocket* sock = reinterpret_cast<PhySocket*>((uintptr_t)tag);
+    if (s->_forceTcpRelay) {
+        return;
+    }
+    if (segSize && (len > segSize)) {
+        s->handleCoalesced(sock, from, (char*)data, len, segSize);
+    }
+    else {
+        s->_wireRxPackets++;
+        s->handleDatagram(sock, from, data, len);
+    }
+}
+#endif
+
+#if ZTS_WIRE_MMSG
+void NodeService::probeUdpOffload()
+{
+    _udpGso = false;
+    _udpGro = false;
+    if (! _allowUdpOffload) {
+        return;
+    }
+    int fd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (fd < 0) {
+        return;
+    }
+    _udpGso = zts_wire_gso_supported(fd);
+    _udpGro = zts_wire_gro_enable(fd);
+    close(fd);
+}
+
+bool NodeService::enableUdpGro(int fd)
+{
+    return _udpGro && zts_wire_gro_enable(fd);
+}
+
+void WireRxShard::threadMain() throw()
+{
+    while (run) {
+        // Blocks until at least one datagram arrives or the socket is shut down
+        if ((service->recvDatagrams(parent, fd, buf, MSG_WAITFORONE, gro) < 0) && (errno != EINTR)) {
+            break;
+        }
+    }
+}
+
+void NodeService::addWireRxShards(PhySocket* sock, const struct sockaddr* localAddr)
+{
+    int pfd = (int)_phy.getDescriptor(sock);
+    _wireRxShardedSockets.push_back(std::pair<PhySocket*, int>(sock, pfd));
+    // Sockets may only share a port if every one of them has SO_REUSEPORT set.
+    // The kernel forms the group when the next socket binds, so setting it on
+    // the already bound binder socket is sufficient.
+    int one = 1;
+    if (setsockopt(pfd, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one)) != 0) {
+        return;
+    }
+    int rcvbuf = 0;
+    socklen_t rcvbuflen = sizeof(rcvbuf);
+    if (getsockopt(pfd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, &rcvbuflen) == 0) {
+        rcvbuf /= 2;   // Linux reports twice what was set
+    }
+    const socklen_t addrlen =
+        (localAddr->sa_family == AF_INET6) ? sizeof(struct sockaddr_in6) : sizeof(struct sockaddr_in);
+    for (unsigned int i = 0; i < _wireRxThreads; ++i) {
+        int fd = socket(localAddr->sa_family, SOCK_DGRAM, 0);
+        if (fd < 0) {
+            break;
+        }
+        setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one));
+        if (localAddr->sa_family == AF_INET6) {
+            setsockopt(fd, IPPROTO_IPV6, IPV6_V6ONLY, &one, sizeof(one));
+        }
+        if (rcvbuf > 0) {
+            setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+        }
+        if (bind(fd, localAddr, addrlen) != 0) {
+            close(fd);
+            break;
+        }
+        WireRxShard* shard = new WireRxShard();
+        shard->service = this;
+        shard->parent = sock;
+        shard->fd = fd;
+        shard->gro = enableUdpGro(fd);
+        shard->buf = new char[ZTS_WIRE_BATCH * ZTS_WIRE_RX_SLOT_LEN];
+        shard->run = true;
+        shard->thread = Thread::start(shard);
+        _wireRxShards.push_back(shard);
+    }
+}
+
+void NodeService::pruneWireRxShards(bool all)
+{
+    for (std::vector<std::pair<PhySocket*, int> >::iterator i(_wireRxShardedSockets.begin());
+         i != _wireRxShardedSockets.end();) {
+        bool valid = ! all && _binder.isUdpSocketValid(i->first) && ((int)_phy.getDescriptor(i->first) == i->second);
+        if (valid) {
+            ++i;
+            continue;
+        }
+        for (std::vector<WireRxShard*>::iterator s(_wireRxShards.begin()); s != _wireRxShards.end();) {
+            if ((*s)->parent != i->first) {
+                ++s;
+                continue;
+            }
+            WireRxShard* shard = *s;
+            shard->run = false;
+            shutdown(shard->fd, SHUT_RDWR);   // Wakes the thread blocked in recvmmsg()
+            Thread::join(shard->thread);
+            close(shard->fd);
+            delete[] shard->buf;
+            delete shard;
+            s = _wireRxShards.erase(s);
+        }
+        i = _wireRxShardedSockets.erase(i);
+    }
+}
+
+int NodeService::recvDatagrams(PhySocket* sock, int fd, char* buf, int flags, bool gro)
+{
+    // A coalesced datagram must fit its slot whole or the kernel truncates it
+    static_assert(
+        ZTS_WIRE_GRO_BATCH * ZTS_WIRE_GRO_SLOT_LEN <= ZTS_WIRE_BATCH * ZTS_WIRE_RX_SLOT_LEN,
+        "GRO slots must fit in the receive buffer");
+    const unsigned int batch = gro ? ZTS_WIRE_GRO_BATCH : ZTS_WIRE_BATCH;
+    const unsigned int slotLen = gro ? ZTS_WIRE_GRO_SLOT_LEN : ZTS_WIRE_RX_SLOT_LEN;
+    struct mmsghdr msgs[ZTS_WIRE_BATCH];
+    struct iovec iovs[ZTS_WIRE_BATCH];
+    struct sockaddr_storage from[ZTS_WIRE_BATCH];
+    char ctrl[ZTS_WIRE_BATCH][ZTS_WIRE_GRO_CTRL_LEN];
+    memset(msgs, 0, sizeof(msgs));
+    for (unsigned int i = 0; i < batch; ++i) {
+        iovs[i].iov_base = buf + (i * slotLen);
+        iovs[i].iov_len = slotLen;
+        msgs[i].msg_hdr.msg_name = &from[i];
+        msgs[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_storage);
+        msgs[i].msg_hdr.msg_iov = &iovs[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+        msgs[i].msg_hdr.msg_control = ctrl[i];
+        msgs[i].msg_hdr.msg_controllen = sizeof(ctrl[i]);
+    }
+    int n = recvmmsg(fd, msgs, batch, flags, NULL);
+    _wireRxSyscalls++;
+    for (int i = 0; i < n; ++i) {
+        if (msgs[i].msg_hdr.msg_flags & MSG_TRUNC) {
+            continue;
+        }
+        // With GRO the kernel may hand us several same-sized datagrams at once
+        unsigned int segSize = zts_wire_gro_size(&msgs[i].msg_hdr);
+        if (segSize && (msgs[i].msg_len > segSize)) {
+            handleCoalesced(sock, (const struct sockaddr*)&from[i], (char*)iovs[i].iov_base, msgs[i].msg_len, segSize);
+        }
+        else {
+            _wireRxPackets++;
+            handleDatagram(sock, (const struct sockaddr*)&from[i], iovs[i].iov_base, msgs[i].msg_len);
+        }
+    }
+    return n;
+}
+
+void NodeService::drainDatagrams(PhySocket* sock)
+{
+    // Phy reads a single datagram per readiness event. Where that was all
+    // there was, the first recvmmsg() is wasted, so on a socket where this
+    // keeps happening make it only every so often.
+    WireRxIdle& idle = _wireRxIdle[sock];
+    if (idle.skip) {
+        idle.skip--;
+        return;
+    }
+    int fd = (int)_phy.getDescriptor(sock);
+    for (int b = 0; b < ZTS_WIRE_RX_MAX_BATCHES && _run; ++b) {
+        int n = recvDatagrams(sock, fd, _wireRxBuf, MSG_DONTWAIT, false);
+        if (b == 0) {
+            idle.backoff = (n > 0) ? 0 : std::min(idle.backoff * 2 + 1, (unsigned int)ZTS_WIRE_RX_MAX_SKIP);
+            idle.skip = idle.backoff;
+        }
+        if (n < ZTS_WIRE_BATCH) {
+            break;
+        }
+    }
+}
+
+bool NodeService::queueWirePacket(
+    PhySocket* sock,
+    const struct sockaddr_storage* addr,
+    const void* data,
+    unsigned int len)
+{
+    // Packets from other threads (application, senders) are not held back
+    if ((len > ZTS_WIRE_TX_SLOT_LEN) || (std::this_thread::get_id() != _serviceThreadId)) {
+        return false;
+    }
+    WireTxSlot& slot = _wireTxQueue[_wireTxQueueLen++];
+    slot.sock = sock;
+    memcpy(&slot.addr, addr, sizeof(struct sockaddr_storage));
+    slot.len = len;
+    memcpy(slot.data, data, len);
+    if (_wireTxQueueLen == ZTS_WIRE_BATCH) {
+        flushWirePackets();
+    }
+    return true;
+}
+
+void NodeService::sendWireRun(PhySocket* sock, WireTxSlot* slots, unsigned int count)
+{
+    struct mmsghdr msgs[ZTS_WIRE_BATCH];
+    struct iovec iovs[ZTS_WIRE_BATCH];
+    char ctrl[ZTS_WIRE_BATCH][ZTS_WIRE_GSO_CTRL_LEN];
+    unsigned int first[ZTS_WIRE_BATCH];   // Index of the first packet in each message
+    int fd = (int)_phy.getDescriptor(sock);
+    unsigned int done = 0;
+    while (done < count) {
+        bool gso = _udpGso;
+        unsigned int nmsgs = 0;
+        memset(msgs, 0, sizeof(msgs));
+        for (unsigned int i = done; i < count;) {
+            // With GSO, consecutive packets to the same destination go out as
+            // one buffer that the kernel segments
+            unsigned int k = gso ? zts_wire_gso_run(slots + i, count - i) : 1;
+            struct msghdr* h = &msgs[nmsgs].msg_hdr;
+            h->msg_name = &slots[i].addr;
+            h->msg_namelen =
+                (slots[i].addr.ss_family == AF_INET6) ? sizeof(struct sockaddr_in6) : sizeof(struct sockaddr_in);
+            h->msg_iov = &iovs[i];
+            h->msg_iovlen = k;
+            for (unsigned int j = 0; j < k; ++j) {
+                iovs[i + j].iov_base = slots[i + j].data;
+                iovs[i + j].iov_len = slots[i + j].len;
+            }
+            if (k > 1) {
+                zts_wire_set_gso(h, ctrl[nmsgs], (uint16_t)slots[i].len);
+            }
+            first[nmsgs++] = i;
+            i += k;
+        }
+        unsigned int sent = 0;
+        while (sent < nmsgs) {
+#if ZTS_WIRE_URING
+            int r = (_uring && _uring->canSend()) ? _uring->sendmsgs(fd, msgs + sent, nmsgs - sent)
+                                                  : sendmmsg(fd, msgs + sent, nmsgs - sent, 0);
+#else
+            int r = sendmmsg(fd, msgs + sent, nmsgs - sent, 0);
+#endif
+            _wireTxSyscalls++;
+            if (r <= 0) {
+                break;
+            }
+            sent += r;
+        }
+        unsigned int next = (sent < nmsgs) ? first[sent] : count;
+        _wireTxPackets += (next - done);
+        if (sent < nmsgs) {
+            if (gso && (msgs[sent].msg_hdr.msg_iovlen > 1) && ((errno == EIO) || (errno == EINVAL) || (errno == ENOPROTOOPT))) {
+                // Kernel or device refused segmentation, fall back to plain sends for good
+                _udpGso = false;
+                done = next;
+                continue;
+            }
+            break;   // Dropped, just as a failed udpSend() would be
+        }
+        done = count;
+    }
+}
+#endif
+
+void NodeService::flushWirePackets()
+{
+#if ZTS_WIRE_MMSG
+    unsigned int i = 0;
+    while (i < _wireTxQueueLen) {
+        // Send each run of packets sharing a socket together
+        unsigned int start = i;
+        PhySocket* sock = _wireTxQueue[i].sock;
+        while ((i < _wireTxQueueLen) && (_wireTxQueue[i].sock == sock)) {
+            ++i;
+        }
+        if (_binder.isUdpSocketValid(sock)) {
+            sendWireRun(sock, _wireTxQueue + start, i - start);
+        }
+    }
+    _wireTxQueueLen = 0;
+#endif
+}
+
+void NodeService::getWireStats(zts_stats_wire_t* dst) const
+{
+    dst->wire_rx_packets = _wireRxPackets;
+    dst->wire_rx_syscalls = _wireRxSyscalls;
+    dst->wire_tx_packets = _wireTxPackets;
+    dst->wire_tx_syscalls = _wireTxSyscalls;
+}
+
+void NodeService::handleCoalesced(
+    PhySocket* sock,
+    const struct sockaddr* from,
+    char* data,
+    unsigned long len,
+    unsigned int segSize)
+{
+    zts_wire_split(data, len, segSize, [&](char* p, unsigned long n) {
+        _wireRxPackets++;
+        handleDatagram(sock, from, p, n);
+    });
+}
+
+void NodeService::updateBackgroundTaskDeadline(int64_t dl)
+{
+    int64_t cur = _nextBackgroundTaskDeadline;
+    while ((dl < cur) && ! _nextBackgroundTaskDeadline.compare_exchange_weak(cur, dl)) {
+    }
+}
+
+void NodeService::handleDatagram(PhySocket* sock, const struct sockaddr* from, void* data, unsigned long len)
+{
     if ((len >= 16) && (reinterpret_cast<const InetAddress*>(from)->ipScope() == InetAddress::IP_SCOPE_GLOBAL))
         _lastDirectReceiveFromGlobal = OSUtils::now();
+    // Receive shard threads only ever move the deadline earlier, and wake the
+    // service thread to act on it
+    const bool serviceThread = (std::this_thread::get_id() == _serviceThreadId);
+    const int64_t prev = _nextBackgroundTaskDeadline;
+    volatile int64_t dl = prev;
     const ZT_ResultCode rc = _node->processWirePacket(
         (void*)0,
         OSUtils::now(),
@@ -650,7 +1145,13 @@ void NodeService::phyOnDatagram(
                                                                   // it'll always be that big
         data,
         len,
-        &_nextBackgroundTaskDeadline);
+        &dl);
+    if (dl < prev) {
+        updateBackgroundTaskDeadline(dl);
+        if (! serviceThread) {
+            _phy.whack();
+        }
+    }
     if (ZT_ResultCode_isFatal(rc)) {
         char tmp[256] = { 0 };
         OSUtils::ztsnprintf(tmp, sizeof(tmp), "fatal error code from processWirePacket: %d", (int)rc);
@@ -773,6 +1274,7 @@ void NodeService::phyOnTcpData(PhySocket* sock, void** uptr, void* data, unsigne
 
                             if (from) {
                                 InetAddress fakeTcpLocalInterfaceAddress((uint32_t)0xffffffff, 0xffff);
+                                volatile int64_t dl = _nextBackgroundTaskDeadline;
                                 const ZT_ResultCode rc = _node->processWirePacket(
                                     (void*)0,
                                     OSUtils::now(),
@@ -780,7 +1282,8 @@ void NodeService::phyOnTcpData(PhySocket* sock, void** uptr, void* data, unsigne
                                     reinterpret_cast<struct sockaddr_storage*>(&from),
                                     data,
                                     plen,
-                                    &_nextBackgroundTaskDeadline);
+                                    &dl);
+                                updateBackgroundTaskDeadline(dl);
                                 if (ZT_ResultCode_isFatal(rc)) {
                                     char tmp[256];
                                     OSUtils::ztsnprintf(
@@ -856,6 +1359,7 @@ int NodeService::nodeVirtualNetworkConfigFunction(
     switch (op) {
         case ZT_VIRTUAL_NETWORK_CONFIG_OPERATION_UP:
             if (! n.tap) {
+                zts_lwip_wake_driver();
                 n.tap = new VirtualTap(
                     _homePath.c_str(),
                     MAC(nwc->mac),
@@ -866,6 +1370,7 @@ int NodeService::nodeVirtualNetworkConfigFunction(
                     (void*)this);
                 *nuptr = (void*)&n;
                 n.tap->setUserEventSystem(_events);
+                n.tap->setTrustedLink(_trustedLinks.count(net_id) > 0);
             }
             // After setting up tap, fall through to CONFIG_UPDATE since we
             // also want to do this...
@@ -890,6 +1395,9 @@ int NodeService::nodeVirtualNetworkConfigFunction(
                 *nuptr = (void*)0;
                 delete n.tap;
                 _nets.erase(net_id);
+                if (_nets.empty()) {
+                    zts_lwip_hibernate_driver();
+                }
                 if (_allowNetworkCaching) {
                     if (op == ZT_VIRTUAL_NETWORK_CONFIG_OPERATION_DESTROY) {
                         char nlcpath[256] = { 0 };
@@ -1798,6 +2306,13 @@ int NodeService::nodeWirePacketSendFunction(
     // proxy fallback, which is slow.
 
     if ((localSocket != -1) && (localSocket != 0) && (_binder.isUdpSocketValid((PhySocket*)((uintptr_t)localSocket)))) {
+#if ZTS_WIRE_MMSG
+        if ((! ttl) && queueWirePacket((PhySocket*)((uintptr_t)localSocket), addr, data, len)) {
+            return 0;
+        }
+#endif
+        _wireTxPackets++;
+        _wireTxSyscalls++;
         if ((ttl) && (addr->ss_family == AF_INET))
             _phy.setIp4UdpTtl((PhySocket*)((uintptr_t)localSocket), ttl);
         const bool r = _phy.udpSend((PhySocket*)((uintptr_t)localSocket), (const struct sockaddr*)addr, data, len);
@@ -1806,6 +2321,8 @@ int NodeService::nodeWirePacketSendFunction(
         return ((r) ? 0 : -1);
     }
     else {
+        _wireTxPackets++;
+        _wireTxSyscalls++;
         return ((_binder.udpSendAll(_phy, addr, data, len, ttl)) ? 0 : -1);
     }
 }
@@ -1923,6 +2440,7 @@ void NodeService::tapFrameHandler(
     const void* data,
     unsigned int len)
 {
+    volatile int64_t dl = _nextBackgroundTaskDeadline;
     _node->processVirtualNetworkFrame(
         (void*)0,
         OSUtils::now(),
@@ -1933,7 +2451,8 @@ void NodeService::tapFrameHandler(
         vlanId,
         data,
         len,
-        &_nextBackgroundTaskDeadline);
+        &dl);
+    updateBackgroundTaskDeadline(dl);
 }
 
 int NodeService::shouldBindInterface(const char* ifname, const InetAddress& ifaddr)
@@ -2132,6 +2651,42 @@ int NodeService::allowSecondaryPort(unsigned int allowed)
     return ZTS_ERR_OK;
 }
 
+int NodeService::allowUdpOffload(unsigned int allowed)
+{
+    Mutex::Lock _lr(_run_m);
+    if (_run) {
+        return ZTS_ERR_SERVICE;
+    }
+    _allowUdpOffload = allowed;
+    return ZTS_ERR_OK;
+}
+
+int NodeService::setWireRxThreads(unsigned int count)
+{
+    Mutex::Lock _lr(_run_m);
+    if (_run) {
+        return ZTS_ERR_SERVICE;
+    }
+    if (count > ZTS_WIRE_RX_THREADS_MAX) {
+        return ZTS_ERR_ARG;
+    }
+    _wireRxThreads = count;
+    return ZTS_ERR_OK;
+}
+
+int NodeService::setIoEngine(int engine)
+{
+    Mutex::Lock _lr(_run_m);
+    if (_run) {
+        return ZTS_ERR_SERVICE;
+    }
+    if ((engine != ZTS_IO_ENGINE_DEFAULT) && (engine != ZTS_IO_ENGINE_URING)) {
+        return ZTS_ERR_ARG;
+    }
+    _ioEngine = engine;
+    return ZTS_ERR_OK;
+}
+
 int NodeService::setUserEventSystem(Events* events)
 {
     Mutex::Lock _lr(_run_m);
@@ -2329,6 +2884,29 @@ int NodeService::getNetworkType(uint64_t net_id)
     return n->second.config.type;
 }
 
+int NodeService::setTrustedLink(uint64_t net_id, unsigned int enabled)
+{
+    if (net_id == 0) {
+        return ZTS_ERR_ARG;
+    }
+    Mutex::Lock _lr(_run_m);
+    if (! _run) {
+        return ZTS_ERR_SERVICE;
+    }
+    Mutex::Lock _ln(_nets_m);
+    if (enabled) {
+        _trustedLinks.insert(net_id);
+    }
+    else {
+        _trustedLinks.erase(net_id);
+    }
+    std::map<uint64_t, NetworkState>::iterator n(_nets.find(net_id));
+    if (n != _nets.end() && n->second.tap) {
+        n->second.tap->setTrustedLink(enabled);
+    }
+    return ZTS_ERR_OK;
+}
+
 int NodeService::getNetworkStatus(uint64_t net_id)
 {
     Mutex::Lock _lr(_run_m);
@@ -20,17 +20,23 @@
 #ifndef ZTS_NODE_SERVICE_HPP
 #define ZTS_NODE_SERVICE_HPP
 
-#define ZTS_UNUSED_ARG(x) (void)x
-
 #include "Binder.hpp"
+#include "Debug.hpp"
 #include "Mutex.hpp"
 #include "Node.hpp"
 #include "Phy.hpp"
 #include "PortMapper.hpp"
+#include "Thread.hpp"
+#include "WireOffload.hpp"
+#include "WireUring.hpp"
 #include "ZeroTierSockets.h"
 #include "version.h"
 
+#include <atomic>
+#include <map>
+#include <set>
 #include <string>
+#include <thread>
 #include <vector>
 
 #define ZTS_SERVICE_THREAD_NAME        "ZTServiceThread"
@@ -47,6 +53,22 @@
 // Attempt to engage TCP fallback after this many ms of no reply to packets sent to global-scope IPs
 #define ZT_TCP_FALLBACK_AFTER 30000
 
+// Number of datagrams per recvmmsg()/sendmmsg() call
+#define ZTS_WIRE_BATCH 64
+// Maximum number of recvmmsg() calls made while draining a socket in one pass
+#define ZTS_WIRE_RX_MAX_BATCHES 16
+// Most datagrams Phy may deliver on a quiet socket without a draining pass
+#define ZTS_WIRE_RX_MAX_SKIP 16
+// Largest datagram accepted by the batched receive path
+#define ZTS_WIRE_RX_SLOT_LEN 10240
+// Number of datagrams per recvmmsg() call on a GRO socket, each is given a
+// ZTS_WIRE_GRO_SLOT_LEN slot of the same receive buffer
+#define ZTS_WIRE_GRO_BATCH 8
+// Largest packet queued for batched transmission, larger ones are sent at once
+#define ZTS_WIRE_TX_SLOT_LEN 2048
+// Maximum number of sharded receive threads per primary port socket
+#define ZTS_WIRE_RX_THREADS_MAX 16
+
 // Fake TLS hello for TCP tunnel outgoing connections (TUNNELED mode)
 static const char ZT_TCP_TUNNEL_HELLO[9] = { 0x17,
                                              0x03,
@@ -91,10 +113,34 @@ struct TcpConnection {
     Mutex writeq_m;
 };
 
+#if ZTS_WIRE_MMSG
+/**
+ * Receive-only socket sharing the primary port with a binder socket via
+ * SO_REUSEPORT and read by its own thread. The kernel hashes each flow onto
+ * one socket of the group so a peer's packets stay in order. Replies are
+ * sent through the binder socket.
+ */
+struct WireRxShard {
+    NodeService* service;
+    PhySocket* parent;
+    int fd;
+    bool gro;
+    char* buf;
+    volatile bool run;
+    Thread thread;
+
+    void threadMain() throw();
+};
+#endif
+
 /**
  * ZeroTier node service
  */
 class NodeService {
+#if ZTS_WIRE_MMSG
+    friend struct WireRxShard;
+#endif
+
   public:
     /**
      * Returned by node main if/when it terminates
@@ -195,8 +241,9 @@ class NodeService {
     unsigned int _ports[3] = { 0 };
     Binder _binder;
 
-    // Time we last received a packet from a global address
-    uint64_t _lastDirectReceiveFromGlobal;
+    // Time we last received a packet from a global address, also written by
+    // receive shard threads
+    std::atomic<uint64_t> _lastDirectReceiveFromGlobal;
 
     InetAddress _fallbackRelayAddress;
     bool _allowTcpRelay;
@@ -211,8 +258,12 @@ class NodeService {
     // Last potential sleep/wake event
     uint64_t _lastRestart;
 
-    // Deadline for the next background task service function
-    volatile int64_t _nextBackgroundTaskDeadline;
+    // Deadline for the next background task service function. Only the
+    // service thread may move it later, see updateBackgroundTaskDeadline().
+    std::atomic<int64_t> _nextBackgroundTaskDeadline;
+
+    /** Move the background task deadline earlier to dl, from any thread */
+    void updateBackgroundTaskDeadline(int64_t dl);
 
     // Configured networks
     struct NetworkState {
@@ -231,6 +282,8 @@ class NodeService {
         NetworkSettings settings;
     };
     std::map<uint64_t, NetworkState> _nets;
+    /** Networks whose links are trusted (see setTrustedLink()), guarded by _nets_m */
+    std::set<uint64_t> _trustedLinks;
 
     /** Lock to control access to network configuration data */
     Mutex _nets_m;
@@ -278,6 +331,125 @@ class NodeService {
     /** System to ingest events from this class and emit them to the user */
     Events* _events;
 
+    /** Wire I/O counters (see zts_stats_get_wire()) */
+    std::atomic<uint64_t> _wireRxPackets { 0 };
+    std::atomic<uint64_t> _wireRxSyscalls { 0 };
+    std::atomic<uint64_t> _wireTxPackets { 0 };
+    std::atomic<uint64_t> _wireTxSyscalls { 0 };
+
+    /** Thread running the main I/O loop, wire packets it sends are batched */
+    std::thread::id _serviceThreadId;
+
+    /** Whether UDP segmentation/receive offload may be used (Linux only) */
+    bool _allowUdpOffload = false;
+
+    /** Number of sharded receive threads per primary port socket (Linux only) */
+    unsigned int _wireRxThreads = 0;
+
+    /** I/O engine used for wire sockets (see zts_io_engine_t) */
+    int _ioEngine = ZTS_IO_ENGINE_DEFAULT;
+
+#if ZTS_WIRE_URING
+    /** io_uring engine if selected and supported, and its completion eventfd */
+    WireUring* _uring = NULL;
+    PhySocket* _uringEventSock = NULL;
+
+    /** Binder sockets read through io_uring instead of Phy */
+    std::vector<std::pair<PhySocket*, int> > _uringSockets;
+
+    void startUring();
+    void stopUring();
+
+    /** Stop receiving on binder sockets that went away */
+    void pruneUringSockets();
+
+    /** Called by the engine for each datagram received */
+    static void uringRecvFunction(
+        void* arg,
+        uint64_t tag,
+        const struct sockaddr* from,
+        void* data,
+        unsigned int len,
+        unsigned int segSize);
+#endif
+
+#if ZTS_WIRE_MMSG
+    /** Outbound wire packet waiting for the next sendmmsg() */
+    struct WireTxSlot {
+        PhySocket* sock;
+        struct sockaddr_storage addr;
+        unsigned int len;
+        char data[ZTS_WIRE_TX_SLOT_LEN];
+    };
+    WireTxSlot* _wireTxQueue = NULL;
+    unsigned int _wireTxQueueLen = 0;
+
+    /** Receive buffers for recvmmsg() */
+    char* _wireRxBuf = NULL;
+
+    /** Draining passes to leave out on a socket whose last ones found it empty */
+    struct WireRxIdle {
+        unsigned int skip;
+        unsigned int backoff;
+    };
+    std::map<PhySocket*, WireRxIdle> _wireRxIdle;
+
+    /** Whether the kernel supports UDP GSO/GRO */
+    bool _udpGso = false;
+    bool _udpGro = false;
+
+    /** Probe the kernel for UDP GSO/GRO support */
+    void probeUdpOffload();
+
+    /**
+     * Enable GRO on a socket. Only for sockets Phy no longer reads, its
+     * recvfrom() would drop the segment size of a coalesced datagram.
+     */
+    bool enableUdpGro(int fd);
+
+    /** Receive sharded primary port sockets, and the binder sockets they were added to */
+    std::vector<WireRxShard*> _wireRxShards;
+    std::vector<std::pair<PhySocket*, int> > _wireRxShardedSockets;
+
+    /** Open receive shards alongside a binder socket on the primary port */
+    void addWireRxShards(PhySocket* sock, const struct sockaddr* localAddr);
+
+    /** Stop shards whose binder socket went away, or all of them */
+    void pruneWireRxShards(bool all);
+
+    /**
+     * Receive and process one batch of datagrams. With gro the batch is
+     * smaller and each slot holds a whole coalesced datagram. Returns the
+     * result of recvmmsg().
+     */
+    int recvDatagrams(PhySocket* sock, int fd, char* buf, int flags, bool gro);
+
+    /**
+     * Read any datagrams remaining on a socket in batches, after Phy has read
+     * one. Stops at the first short batch, and backs off on a socket where
+     * the first batch keeps coming back empty.
+     */
+    void drainDatagrams(PhySocket* sock);
+
+    /** Send a run of queued packets that share a socket */
+    void sendWireRun(PhySocket* sock, WireTxSlot* slots, unsigned int count);
+
+    /** Queue a packet sent from the service thread. Returns false if it must be sent immediately. */
+    bool queueWirePacket(PhySocket* sock, const struct sockaddr_storage* addr, const void* data, unsigned int len);
+#endif
+
+    /** Send all queued wire packets */
+    void flushWirePackets();
+
+    /** Feed one received wire packet into the node */
+    void handleDatagram(PhySocket* sock, const struct sockaddr* from, void* data, unsigned long len);
+
+    /** Split a GRO-coalesced buffer back into wire packets of segSize bytes */
+    void handleCoalesced(PhySocket* sock, const struct sockaddr* from, char* data, unsigned long len, unsigned int segSize);
+
+    /** Get wire I/O counters */
+    void getWireStats(zts_stats_wire_t* dst) const;
+
     NodeService();
     ~NodeService();
 
@@ -439,6 +611,15 @@ class NodeService {
     /** Allow or disallow backup port */
     int allowSecondaryPort(unsigned int allowed);
 
+    /** Allow or disallow UDP segmentation/receive offload (Linux) */
+    int allowUdpOffload(unsigned int allowed);
+
+    /** Set number of sharded receive threads for the primary port (Linux) */
+    int setWireRxThreads(unsigned int count);
+
+    /** Select the I/O engine for wire sockets */
+    int setIoEngine(int engine);
+
     /** Set the event system instance used to convey messages to the user */
     int setUserEventSystem(Events* events);
 
@@ -492,6 +673,9 @@ class NodeService {
     /** Return the status of the network join */
     int getNetworkStatus(uint64_t net_id);
 
+    /** Skip checksums the ZeroTier transport makes redundant on this network */
+    int setTrustedLink(uint64_t net_id, unsigned int enabled);
+
     /** Get the first address assigned by the network */
     int getFirstAssignedAddr(uint64_t net_id, unsigned int family, struct zts_sockaddr_storage* addr);
 
@@ -519,13 +703,8 @@ class NodeService {
 
     void phyOnTcpWritable(PhySocket* sock, void** uptr);
 
-    void phyOnFileDescriptorActivity(PhySocket* sock, void** uptr, bool readable, bool writable)
-    {
-        ZTS_UNUSED_ARG(sock);
-        ZTS_UNUSED_ARG(uptr);
-        ZTS_UNUSED_ARG(readable);
-        ZTS_UNUSED_ARG(writable);
-    }
+    void phyOnFileDescriptorActivity(PhySocket* sock, void** uptr, bool readable, bool writable);
+
     void phyOnUnixAccept(PhySocket* sockL, PhySocket* sockN, void** uptrL, void** uptrN)
     {
         ZTS_UNUSED_ARG(sockL);
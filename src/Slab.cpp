@@ -0,0 +1,292 @@
+/*
+ * Copyright (c)2013-2021 ZeroTier, Inc.
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file in the project's root directory.
+ *
+ * Change Date: 2026-01-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2.0 of the Apache License.
+ */
+/****/
+
+/**
+ * @file
+ *
+ * Size-class slab allocator backing lwIP's heap and memory pools
+ *
+ * Every object is preceded by a 16 byte header recording its size class so
+ * that it can be freed without a size. Objects are carved from large chunks
+ * which are never returned to the system, so once the working set has been
+ * reached (or reserved with zts_slab_configure()) the steady state does not
+ * allocate. Each thread keeps a small cache per class and only touches the
+ * shared free list, under its lock, once per batch. Once a class cannot grow
+ * past the limit, threads stop caching its objects: frees go straight back
+ * to the shared list and each thread's next free hands over its cache, so
+ * that objects are not stranded in threads that no longer allocate them.
+ */
+
+#include "Slab.hpp"
+
+#include "Mutex.hpp"
+
+#include <atomic>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Object sizes of each class, allocations larger than the last are passed
+// through to malloc(). Chosen around lwIP's pools, TCP segments and
+// PBUF_RAM buffers for LWIP_MTU sized frames.
+static const size_t _slab_sizes[ZTS_SLAB_CLASSES] = { 32, 64, 128, 256, 512, 1024, 2048, 4096 };
+
+#define ZTS_SLAB_HEADER_LEN 16
+#define ZTS_SLAB_LARGE      0xff
+
+namespace ZeroTier {
+
+struct zts_slab_header {
+    uint32_t cls;
+    uint32_t pad[3];
+};
+
+struct zts_slab_object {
+    zts_slab_object* next;
+};
+
+struct zts_slab_class {
+    Mutex m;
+    zts_slab_object* free;
+    uint64_t free_len;
+    uint64_t total;
+    // Outside the lock, counted as objects are handed out and given back
+    std::atomic<uint64_t> in_use;
+    std::atomic<uint64_t> peak;
+    std::atomic<bool> limited;   // Could not grow within the limit
+};
+
+static zts_slab_class _slab[ZTS_SLAB_CLASSES];
+static Mutex _slab_chunk_m;
+static std::atomic<uint64_t> _slab_reserved(0);
+static std::atomic<uint64_t> _slab_limit(0);
+static std::atomic<uint64_t> _slab_large(0);
+static std::atomic<uint64_t> _slab_failures(0);
+
+static inline unsigned int zts_slab_class_of(size_t size)
+{
+    for (unsigned int c = 0; c < ZTS_SLAB_CLASSES; ++c) {
+        if (size <= _slab_sizes[c]) {
+            return c;
+        }
+    }
+    return ZTS_SLAB_LARGE;
+}
+
+// Carve a new chunk into objects of class c and add them to its free list.
+// Must be called with the class lock held.
+static bool zts_slab_grow(unsigned int c)
+{
+    const uint64_t limit = _slab_limit;
+    if (limit && (_slab_reserved + ZTS_SLAB_CHUNK_LEN) > limit) {
+        _slab[c].limited.store(true, std::memory_order_relaxed);
+        return false;
+    }
+    char* chunk = (char*)malloc(ZTS_SLAB_CHUNK_LEN);
+    if (! chunk) {
+        return false;
+    }
+    _slab_reserved += ZTS_SLAB_CHUNK_LEN;
+    const size_t stride = _slab_sizes[c] + ZTS_SLAB_HEADER_LEN;
+    const size_t n = ZTS_SLAB_CHUNK_LEN / stride;
+    zts_slab_class& sc = _slab[c];
+    for (size_t i = 0; i < n; ++i) {
+        zts_slab_header* h = (zts_slab_header*)(chunk + (i * stride));
+        h->cls = c;
+        zts_slab_object* o = (zts_slab_object*)(h + 1);
+        o->next = sc.free;
+        sc.free = o;
+    }
+    sc.free_len += n;
+    sc.total += n;
+    return true;
+}
+
+/**
+ * Per-thread cache of free objects. Objects freed by a thread other than
+ * the one that allocated them simply join the freeing thread's cache.
+ */
+struct zts_slab_cache {
+    zts_slab_object* objs[ZTS_SLAB_CLASSES][ZTS_SLAB_CACHE_LEN];
+    unsigned int len[ZTS_SLAB_CLASSES];
+
+    zts_slab_cache()
+    {
+        memset(len, 0, sizeof(len));
+    }
+
+    ~zts_slab_cache()
+    {
+        for (unsigned int c = 0; c < ZTS_SLAB_CLASSES; ++c) {
+            release(c, len[c]);
+        }
+    }
+
+    // Take up to ZTS_SLAB_BATCH objects from the shared free list
+    bool refill(unsigned int c)
+    {
+        zts_slab_class& sc = _slab[c];
+        Mutex::Lock _l(sc.m);
+        if (! sc.free && ! zts_slab_grow(c)) {
+            return false;
+        }
+        while (sc.free && len[c] < ZTS_SLAB_BATCH) {
+            objs[c][len[c]++] = sc.free;
+            sc.free = sc.free->next;
+            sc.free_len--;
+        }
+        return true;
+    }
+
+    // Return the n most recently cached objects to the shared free list
+    void release(unsigned int c, unsigned int n)
+    {
+        zts_slab_class& sc = _slab[c];
+        Mutex::Lock _l(sc.m);
+        while (n--) {
+            zts_slab_object* o = objs[c][--len[c]];
+            o->next = sc.free;
+            sc.free = o;
+            sc.free_len++;
+        }
+    }
+};
+
+static thread_local zts_slab_cache _slab_cache;
+
+// Return a single object to the shared free list
+static void zts_slab_release_one(unsigned int c, zts_slab_object* o)
+{
+    zts_slab_class& sc = _slab[c];
+    Mutex::Lock _l(sc.m);
+    o->next = sc.free;
+    sc.free = o;
+    sc.free_len++;
+}
+
+int zts_slab_configure(unsigned int reserve, unsigned int limit_mb)
+{
+    if (reserve > ZTS_SLAB_RESERVE_MAX) {
+        return ZTS_ERR_ARG;
+    }
+    _slab_limit = (uint64_t)limit_mb * 1024 * 1024;
+    for (unsigned int c = 0; c < ZTS_SLAB_CLASSES; ++c) {
+        _slab[c].limited.store(false, std::memory_order_relaxed);
+    }
+    return zts_slab_reserve(reserve);
+}
+
+int zts_slab_reserve(unsigned int reserve)
+{
+    if (reserve > ZTS_SLAB_RESERVE_MAX) {
+        return ZTS_ERR_ARG;
+    }
+    for (unsigned int c = 0; c < ZTS_SLAB_CLASSES; ++c) {
+        zts_slab_class& sc = _slab[c];
+        Mutex::Lock _l(sc.m);
+        while (sc.total < reserve) {
+            if (! zts_slab_grow(c)) {
+                return ZTS_ERR_ARG;   // Reservation exceeds limit
+            }
+        }
+    }
+    return ZTS_ERR_OK;
+}
+
+void zts_slab_get_stats(zts_stats_slab_t* dst)
+{
+    for (unsigned int c = 0; c < ZTS_SLAB_CLASSES; ++c) {
+        zts_slab_class& sc = _slab[c];
+        // Read first, objects are counted in use only once carved
+        dst->objects_in_use[c] = sc.in_use.load(std::memory_order_relaxed);
+        dst->objects_peak[c] = sc.peak.load(std::memory_order_relaxed);
+        Mutex::Lock _l(sc.m);
+        dst->object_size[c] = (uint32_t)_slab_sizes[c];
+        dst->objects_total[c] = sc.total;
+        dst->objects_free[c] = sc.free_len;
+    }
+    dst->bytes_reserved = _slab_reserved;
+    dst->large_allocs = _slab_large;
+    dst->alloc_failures = _slab_failures;
+}
+
+}   // namespace ZeroTier
+
+using namespace ZeroTier;
+
+extern "C" void* zts_slab_malloc(size_t size)
+{
+    const unsigned int c = zts_slab_class_of(size);
+    if (c == ZTS_SLAB_LARGE) {
+        zts_slab_header* h = (zts_slab_header*)malloc(size + ZTS_SLAB_HEADER_LEN);
+        if (! h) {
+            _slab_failures++;
+            return NULL;
+        }
+        h->cls = ZTS_SLAB_LARGE;
+        _slab_large++;
+        return h + 1;
+    }
+    zts_slab_cache& cache = _slab_cache;
+    if (! cache.len[c] && ! cache.refill(c)) {
+        _slab_failures++;
+        return NULL;
+    }
+    zts_slab_class& sc = _slab[c];
+    const uint64_t out = sc.in_use.fetch_add(1, std::memory_order_relaxed) + 1;
+    uint64_t peak = sc.peak.load(std::memory_order_relaxed);
+    while (out > peak && ! sc.peak.compare_exchange_weak(peak, out, std::memory_order_relaxed)) {
+    }
+    return cache.objs[c][--cache.len[c]];
+}
+
+extern "C" void* zts_slab_calloc(size_t count, size_t size)
+{
+    if (size && count > ((size_t)-1 - ZTS_SLAB_HEADER_LEN) / size) {
+        return NULL;
+    }
+    void* p = zts_slab_malloc(count * size);
+    if (p) {
+        memset(p, 0, count * size);
+    }
+    return p;
+}
+
+extern "C" void zts_slab_free(void* ptr)
+{
+    if (! ptr) {
+        return;
+    }
+    zts_slab_header* h = (zts_slab_header*)ptr - 1;
+    const unsigned int c = h->cls;
+    if (c == ZTS_SLAB_LARGE) {
+        _slab_large--;
+        free(h);
+        return;
+    }
+    zts_slab_class& sc = _slab[c];
+    sc.in_use.fetch_sub(1, std::memory_order_relaxed);
+    zts_slab_cache& cache = _slab_cache;
+    if (sc.limited.load(std::memory_order_relaxed)) {
+        // Whichever thread allocates next finds it in the shared list
+        if (cache.len[c]) {
+            cache.release(c, cache.len[c]);
+        }
+        zts_slab_release_one(c, (zts_slab_object*)ptr);
+        return;
+    }
+    if (cache.len[c] == ZTS_SLAB_CACHE_LEN) {
+        cache.release(c, ZTS_SLAB_BATCH);
+    }
+    cache.objs[c][cache.len[c]++] = (zts_slab_object*)ptr;
+}
@@ -0,0 +1,78 @@
+/*
+ * Copyright (c)2013-2021 ZeroTier, Inc.
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file in the project's root directory.
+ *
+ * Change Date: 2026-01-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2.0 of the Apache License.
+ */
+/****/
+
+/**
+ * @file
+ *
+ * Size-class slab allocator backing lwIP's heap and memory pools
+ */
+
+#ifndef ZTS_SLAB_HPP
+#define ZTS_SLAB_HPP
+
+#include "ZeroTierSockets.h"
+
+#include <stddef.h>
+
+// Number of objects each thread keeps per size class before returning
+// half of them to the shared free list
+#ifndef ZTS_SLAB_CACHE_LEN
+#define ZTS_SLAB_CACHE_LEN 64
+#endif
+// Number of objects moved between a thread cache and the shared free list at once
+#define ZTS_SLAB_BATCH (ZTS_SLAB_CACHE_LEN / 2)
+// Size of each chunk of memory carved into objects
+#define ZTS_SLAB_CHUNK_LEN (256 * 1024)
+// Largest number of objects per class that may be reserved up front
+#define ZTS_SLAB_RESERVE_MAX 65536
+
+namespace ZeroTier {
+
+/**
+ * @brief Reserve memory and set limits for the allocator
+ *
+ * @param reserve Number of objects to preallocate in every size class
+ * @param limit_mb Largest amount of memory carved into objects, 0 for no limit
+ * @return `ZTS_ERR_OK` if successful, `ZTS_ERR_ARG` if invalid argument.
+ */
+int zts_slab_configure(unsigned int reserve, unsigned int limit_mb);
+
+/**
+ * @brief Grow every size class to at least reserve objects within the current limit
+ *
+ * @param reserve Number of objects to preallocate in every size class
+ * @return `ZTS_ERR_OK` if successful, `ZTS_ERR_ARG` if invalid argument.
+ */
+int zts_slab_reserve(unsigned int reserve);
+
+/**
+ * @brief Copy allocator statistics into dst
+ */
+void zts_slab_get_stats(zts_stats_slab_t* dst);
+
+}   // namespace ZeroTier
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Hooks for lwIP, see mem_clib_malloc in lwipopts.h */
+void* zts_slab_malloc(size_t size);
+void* zts_slab_calloc(size_t count, size_t size);
+void zts_slab_free(void* ptr);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -19,29 +19,534 @@
 
 #include "lwip/sockets.h"
 
+#include "Debug.hpp"
+#include "Epoll.hpp"
 #include "Events.hpp"
+#include "Sockets.hpp"
 #include "ZeroTierSockets.h"
 #include "lwip/dns.h"
 #include "lwip/netdb.h"
+#include "lwip/priv/sockets_priv.h"
+#include "lwip/priv/tcp_priv.h"
+#include "lwip/sys.h"
+#include "lwip/tcpip.h"
+#include "lwip/udp.h"
+#include "lwip_hooks.h"
 
 #if defined(__ANDROID__)
 #include <sys/endian.h>
 #endif
 
+#include <algorithm>
+#include <atomic>
+#include <deque>
+#include <mutex>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
 int zts_errno;
 
 namespace ZeroTier {
 
+/*
+ * Socket table. The descriptors handed to the application index a table of
+ * lwIP socket numbers, so that they are found in constant time and closed
+ * ones are reused from a free list rather than searched for. The table grows
+ * in chunks that never move, so looking a descriptor up takes no lock. How
+ * many sockets may be open at once is still bounded by lwIP's own table
+ * (ZTS_MAX_SOCKETS). The API functions translate descriptors on entry, the
+ * helpers they call and the per-socket maps work with lwIP's numbers.
+ */
+#define ZTS_FD_CHUNK  1024
+#define ZTS_FD_CHUNKS ((ZTS_MAX_SOCKETS + ZTS_FD_CHUNK - 1) / ZTS_FD_CHUNK)
+
+static std::atomic<std::atomic<int>*> _fd_chunks[ZTS_FD_CHUNKS];
+// Guards everything below, lookups only read the chunks
+static std::mutex _fd_m;
+static int _fd_count = 0;           // Descriptors ever handed out
+static std::vector<int> _fd_free;   // Closed descriptors, the last is reused first
+static unsigned int _fd_open = 0;
+static unsigned int _max_sockets = 0;   // 0 leaves it to lwIP's table
+
+int zts_sockets_set_max(unsigned int count)
+{
+    if (count > ZTS_MAX_SOCKETS) {
+        return ZTS_ERR_ARG;
+    }
+    _max_sockets = count;
+    return ZTS_ERR_OK;
+}
+
+void zts_sockets_reset()
+{
+    std::lock_guard<std::mutex> _l(_fd_m);
+    _fd_open = 0;
+}
+
+int zts_lwip_fd(int fd)
+{
+    if (fd < 0 || fd >= ZTS_FD_CHUNKS * ZTS_FD_CHUNK) {
+        return -1;
+    }
+    std::atomic<int>* chunk = _fd_chunks[fd / ZTS_FD_CHUNK].load(std::memory_order_acquire);
+    return chunk ? chunk[fd % ZTS_FD_CHUNK].load(std::memory_order_acquire) : -1;
+}
+
+// Take a descriptor for a new socket, -1 if the limit has been reached. It
+// refers to no socket until zts_fd_attach() is called.
+static int zts_fd_reserve()
+{
+    std::lock_guard<std::mutex> _l(_fd_m);
+    if ((_max_sockets && _fd_open >= _max_sockets) || (_fd_free.empty() && _fd_count >= ZTS_MAX_SOCKETS)) {
+        zts_errno = ZTS_ENFILE;
+        return -1;
+    }
+    int fd;
+    if (! _fd_free.empty()) {
+        fd = _fd_free.back();
+        _fd_free.pop_back();
+    }
+    else {
+        fd = _fd_count++;
+        if (! _fd_chunks[fd / ZTS_FD_CHUNK].load(std::memory_order_relaxed)) {
+            std::atomic<int>* chunk = new std::atomic<int>[ZTS_FD_CHUNK];
+            for (int i = 0; i < ZTS_FD_CHUNK; i++) {
+                chunk[i].store(-1, std::memory_order_relaxed);
+            }
+            _fd_chunks[fd / ZTS_FD_CHUNK].store(chunk, std::memory_order_release);
+        }
+    }
+    _fd_open++;
+    return fd;
+}
+
+static void zts_fd_attach(int fd, int s)
+{
+    std::atomic<int>* chunk = _fd_chunks[fd / ZTS_FD_CHUNK].load(std::memory_order_acquire);
+    chunk[fd % ZTS_FD_CHUNK].store(s, std::memory_order_release);
+}
+
+// Give a descriptor back. Sockets opened before zts_sockets_reset() are no
+// longer counted, so the count never drops below zero.
+static void zts_fd_release(int fd)
+{
+    zts_fd_attach(fd, -1);
+    std::lock_guard<std::mutex> _l(_fd_m);
+    _fd_free.push_back(fd);
+    if (_fd_open) {
+        _fd_open--;
+    }
+}
+
 #ifdef __cplusplus
 extern "C" {
 #endif
 
+/*
+ * lwIP does not implement SO_SNDBUF, and its SO_RCVBUF only bounds the data
+ * queued on UDP and raw sockets. For TCP sockets both are applied to the pcb
+ * instead, overriding the send buffer and receive window that otherwise come
+ * from the stack's tuning (see zts_tcp_tune()). Must be called with the core
+ * lock held.
+ */
+static struct tcp_pcb* zts_get_tcp_pcb(int fd)
+{
+    struct lwip_sock* sock = lwip_socket_dbg_get_socket(fd);
+    if (! sock || ! sock->conn || NETCONNTYPE_GROUP(netconn_type(sock->conn)) != NETCONN_TCP) {
+        return NULL;
+    }
+    struct tcp_pcb* pcb = sock->conn->pcb.tcp;
+    if (! pcb || pcb->state == LISTEN) {
+        return NULL;
+    }
+    return pcb;
+}
+
+// Limit the receive window of a connection, applied once it is established
+static void zts_set_tcp_recv_window(int fd, int size)
+{
+    LOCK_TCPIP_CORE();
+    struct tcp_pcb* pcb = zts_get_tcp_pcb(fd);
+    if (pcb) {
+        zts_tcp_set_rcv_window(pcb, (u32_t)size);
+    }
+    UNLOCK_TCPIP_CORE();
+}
+
+/*
+ * Zero-copy sends (zts_send_zc()). Their data is queued on the pcb without
+ * being copied and lwIP references it until it is acknowledged, so a send is
+ * complete once the pcb's lastack has passed its end, or once lwIP has freed
+ * the pcb. The queue of a socket is attached to its pcb through an ext arg so
+ * that the latter is noticed, and outlives the pcb until the socket is
+ * closed. Nothing could collect completions after that, so closing a socket
+ * with sends outstanding aborts its connection, which leaves lwIP holding
+ * none of the buffers once the close returns. Only accessed with the core
+ * lock held.
+ */
+struct zts_zc_send {
+    u32_t end;
+    uint64_t cookie;
+};
+
+struct zts_zc_queue {
+    struct tcp_pcb* pcb;      // NULL once freed by lwIP
+    struct netconn* conn;     // Whose epoll registrations are told of completions
+    std::deque<zts_zc_send> pending;
+    std::deque<uint64_t> done;
+};
+
+static u8_t _zc_ext_id = 0xff;   // Allocated on first use
+static std::unordered_map<int, zts_zc_queue*> _zc_queues;
+static tcp_sent_fn _netconn_sent;   // lwIP's own, found on the first zero-copy send
+
+static void zts_zc_pcb_destroy(u8_t id, void* data)
+{
+    ZTS_UNUSED_ARG(id);
+    zts_zc_queue* q = (zts_zc_queue*)data;
+    if (! q) {
+        return;
+    }
+    q->pcb = NULL;
+    for (const zts_zc_send& send : q->pending) {
+        q->done.push_back(send.cookie);
+    }
+    if (! q->pending.empty()) {
+        q->pending.clear();
+        zts_epoll_errqueue(q->conn, true);
+    }
+}
+
+static const struct tcp_ext_arg_callbacks _zc_callbacks = { zts_zc_pcb_destroy, NULL };
+
+// Move acknowledged sends over to the completed ones
+static void zts_zc_reap(zts_zc_queue* q)
+{
+    while (q->pcb && ! q->pending.empty() && TCP_SEQ_LEQ(q->pending.front().end, q->pcb->lastack)) {
+        q->done.push_back(q->pending.front().cookie);
+        q->pending.pop_front();
+    }
+}
+
+// Wraps the pcb's sent callback, so that completions are noticed (and epoll
+// told of them) as soon as the peer acknowledges the data
+static err_t zts_zc_sent(void* arg, struct tcp_pcb* pcb, u16_t len)
+{
+    // Taken first, lwIP's callback may close the pcb
+    zts_zc_queue* q = (zts_zc_queue*)tcp_ext_arg_get(pcb, _zc_ext_id);
+    const err_t err = _netconn_sent(arg, pcb, len);
+    if (q) {
+        const size_t done = q->done.size();
+        zts_zc_reap(q);
+        if (q->done.size() != done) {
+            zts_epoll_errqueue(q->conn, true);
+        }
+    }
+    return err;
+}
+
+static zts_zc_queue* zts_zc_get_queue(int fd, struct netconn* conn, struct tcp_pcb* pcb)
+{
+    zts_zc_queue*& q = _zc_queues[fd];
+    if (! q) {
+        q = new zts_zc_queue();
+    }
+    q->conn = conn;
+    if (q->pcb != pcb) {
+        if (_zc_ext_id == 0xff) {
+            _zc_ext_id = tcp_ext_arg_alloc_id();
+        }
+        q->pcb = pcb;
+        tcp_ext_arg_set_callbacks(pcb, _zc_ext_id, &_zc_callbacks);
+        tcp_ext_arg_set(pcb, _zc_ext_id, q);
+        if (pcb->sent && pcb->sent != zts_zc_sent) {
+            _netconn_sent = pcb->sent;
+            tcp_sent(pcb, zts_zc_sent);
+        }
+    }
+    return q;
+}
+
+bool zts_zc_has_completions(int fd)
+{
+    std::unordered_map<int, zts_zc_queue*>::iterator it = _zc_queues.find(fd);
+    if (it == _zc_queues.end()) {
+        return false;
+    }
+    zts_zc_reap(it->second);
+    return ! it->second->done.empty();
+}
+
+// Completions of a closed socket can't be collected, drop its queue and abort
+// the connection if lwIP still references any of its buffers. Must be called
+// with the core lock held.
+static void zts_zc_close(int fd)
+{
+    std::unordered_map<int, zts_zc_queue*>::iterator it = _zc_queues.find(fd);
+    if (it != _zc_queues.end()) {
+        zts_zc_queue* q = it->second;
+        _zc_queues.erase(it);
+        zts_zc_reap(q);
+        if (q->pcb && q->pending.empty()) {
+            tcp_ext_arg_set(q->pcb, _zc_ext_id, NULL);
+        }
+        else if (q->pcb) {
+            // Frees the pcb and its segments, the netconn is told through its error callback
+            tcp_abort(q->pcb);
+        }
+        delete q;
+    }
+}
+
+/*
+ * Loaned receive buffers (zts_recv_loan()). The pbufs taken off a socket go
+ * to the application as they are and the receive window only reopens once
+ * they are returned, so that a slow consumer holds back its peer just as
+ * unread data would. Loans may outlive their socket, they share a record of
+ * its netconn that the socket's closing clears. Only accessed with the core
+ * lock held.
+ */
+struct zts_loan_sock {
+    struct netconn* conn;   // NULL once the socket is closed
+    unsigned int loans;
+};
+
+struct zts_loan {
+    struct pbuf* p;
+    zts_loan_sock* sock;
+};
+
+static std::unordered_map<int, zts_loan_sock*> _loan_socks;
+
+// Must be called with the core lock held
+static void zts_loan_close(int fd)
+{
+    std::unordered_map<int, zts_loan_sock*>::iterator it = _loan_socks.find(fd);
+    if (it != _loan_socks.end()) {
+        zts_loan_sock* ls = it->second;
+        _loan_socks.erase(it);
+        ls->conn = NULL;
+        if (! ls->loans) {
+            delete ls;
+        }
+    }
+}
+
+/*
+ * Listener sharding (SO_REUSEPORT). lwIP allows only one listening pcb per
+ * address and port, so the first socket to listen on it owns the pcb and the
+ * others join its group with an accept queue of their own. The pcb's accept
+ * callback is wrapped to hand each new connection to a member picked by a
+ * hash of its remote address and port, moving on to the next member if that
+ * queue is full. When the owner closes, the pcb passes to the next member
+ * along with the connections still queued on the owner. Only accessed with
+ * the core lock held.
+ */
+struct zts_reuseport_group {
+    struct tcp_pcb_listen* lpcb;
+    std::vector<struct netconn*> members;   // The first owns lpcb
+};
+
+static std::unordered_set<int> _reuseport_socks;
+// Groups by their listening pcb, looked up for every connection accepted
+static std::unordered_map<const struct tcp_pcb_listen*, zts_reuseport_group*> _reuseport_groups;
+// Groups by member netconn
+static std::unordered_map<const struct netconn*, zts_reuseport_group*> _reuseport_members;
+static tcp_accept_fn _netconn_accept;   // lwIP's own, found on the first listener
+
+static zts_reuseport_group* zts_reuseport_find(const struct tcp_pcb_listen* lpcb)
+{
+    auto it = _reuseport_groups.find(lpcb);
+    return (it != _reuseport_groups.end()) ? it->second : NULL;
+}
+
+static u32_t zts_reuseport_hash(const struct tcp_pcb* pcb)
+{
+    u32_t h = pcb->remote_port;
+    if (IP_IS_V6_VAL(pcb->remote_ip)) {
+        for (int i = 0; i < 4; i++) {
+            h = h * 31 + ip_2_ip6(&pcb->remote_ip)->addr[i];
+        }
+    }
+    else {
+        h = h * 31 + ip_2_ip4(&pcb->remote_ip)->addr;
+    }
+    h ^= h >> 16;
+    h *= 0x45d9f3b;
+    h ^= h >> 16;
+    return h;
+}
+
+static err_t zts_reuseport_accept(void* arg, struct tcp_pcb* newpcb, err_t err)
+{
+    // Connections completing the handshake carry the argument their listener
+    // had when the SYN arrived, its owner may have closed since
+    zts_reuseport_group* g = newpcb ? zts_reuseport_find(newpcb->listener) : NULL;
+    if (! g) {
+        return _netconn_accept(arg, newpcb, err);
+    }
+    const size_t n = g->members.size();
+    const u32_t h = zts_reuseport_hash(newpcb);
+    err_t ret = ERR_VAL;
+    for (size_t i = 0; i < n && ret != ERR_OK; i++) {
+        ret = _netconn_accept(g->members[(h + i) % n], newpcb, err);
+    }
+    return ret;
+}
+
+// Join the group listening on the address and port fd is bound to, if any
+static bool zts_reuseport_join(int fd)
+{
+    if (! _reuseport_socks.count(fd)) {
+        return false;
+    }
+    struct lwip_sock* sock = lwip_socket_dbg_get_socket(fd);
+    if (! sock || ! sock->conn || NETCONNTYPE_GROUP(netconn_type(sock->conn)) != NETCONN_TCP) {
+        return false;
+    }
+    struct netconn* conn = sock->conn;
+    if (_reuseport_members.count(conn)) {
+        return true;
+    }
+    struct tcp_pcb* pcb = conn->pcb.tcp;
+    if (! pcb || pcb->state != CLOSED || ! pcb->local_port) {
+        return false;
+    }
+    for (auto& entry : _reuseport_groups) {
+        zts_reuseport_group* g = entry.second;
+        if (g->lpcb->local_port == pcb->local_port && ip_addr_cmp(&g->lpcb->local_ip, &pcb->local_ip)) {
+            if (sys_mbox_new(&conn->acceptmbox, DEFAULT_ACCEPTMBOX_SIZE) != ERR_OK) {
+                return false;
+            }
+            conn->state = NETCONN_LISTEN;
+            g->members.push_back(conn);
+            _reuseport_members[conn] = g;
+            return true;
+        }
+    }
+    return false;
+}
+
+// Start a group on the pcb fd has just begun listening with
+static void zts_reuseport_lead(int fd)
+{
+    if (! _reuseport_socks.count(fd)) {
+        return;
+    }
+    struct lwip_sock* sock = lwip_socket_dbg_get_socket(fd);
+    if (! sock || ! sock->conn || ! sock->conn->pcb.tcp || sock->conn->pcb.tcp->state != LISTEN) {
+        return;
+    }
+    struct tcp_pcb_listen* lpcb = (struct tcp_pcb_listen*)sock->conn->pcb.tcp;
+    if (zts_reuseport_find(lpcb)) {
+        return;
+    }
+    if (! _netconn_accept) {
+        _netconn_accept = lpcb->accept;
+    }
+    tcp_accept((struct tcp_pcb*)lpcb, zts_reuseport_accept);
+    zts_reuseport_group* g = new zts_reuseport_group();
+    g->lpcb = lpcb;
+    g->members.push_back(sock->conn);
+    _reuseport_groups[lpcb] = g;
+    _reuseport_members[sock->conn] = g;
+}
+
+// Whether fd is a member that shares another socket's listening pcb
+static bool zts_reuseport_is_member(int fd)
+{
+    struct lwip_sock* sock = lwip_socket_dbg_get_socket(fd);
+    if (! sock || ! sock->conn) {
+        return false;
+    }
+    auto it = _reuseport_members.find(sock->conn);
+    return it != _reuseport_members.end() && it->second->members.front() != sock->conn;
+}
+
+// Move the connections queued on a closing owner over to its heir, which
+// takes over the listening pcb. Whatever doesn't fit is dropped with the owner.
+static void zts_reuseport_hand_over(struct netconn* from, struct netconn* to)
+{
+    if (! sys_mbox_valid(&from->acceptmbox) || ! sys_mbox_valid(&to->acceptmbox)) {
+        return;
+    }
+    void* msg;
+    while (sys_arch_mbox_tryfetch(&from->acceptmbox, &msg) != SYS_MBOX_EMPTY) {
+        if (sys_mbox_trypost(&to->acceptmbox, msg) != ERR_OK) {
+            // Put back, netconn_drain() disposes of it along with the owner
+            sys_mbox_trypost(&from->acceptmbox, msg);
+            break;
+        }
+        // As accept_function() does for a new connection
+        if (to->callback) {
+            to->callback(to, NETCONN_EVT_RCVPLUS, 0);
+        }
+    }
+}
+
+// Leave fd's group before it is closed, handing the listening pcb on
+static void zts_reuseport_close(int fd)
+{
+    _reuseport_socks.erase(fd);
+    struct lwip_sock* sock = lwip_socket_dbg_get_socket(fd);
+    if (! sock || ! sock->conn) {
+        return;
+    }
+    auto m = _reuseport_members.find(sock->conn);
+    if (m == _reuseport_members.end()) {
+        return;
+    }
+    zts_reuseport_group* g = m->second;
+    _reuseport_members.erase(m);
+    auto it = std::find(g->members.begin(), g->members.end(), sock->conn);
+    const bool owner = (it == g->members.begin());
+    g->members.erase(it);
+    if (g->members.empty()) {
+        _reuseport_groups.erase(g->lpcb);
+        delete g;
+    }
+    else if (owner) {
+        // The heir's bound pcb gives way to the listening one
+        struct netconn* heir = g->members.front();
+        struct tcp_pcb* bound = heir->pcb.tcp;
+        if (bound) {
+            tcp_arg(bound, NULL);
+            tcp_recv(bound, NULL);
+            tcp_sent(bound, NULL);
+            tcp_poll(bound, NULL, 0);
+            tcp_err(bound, NULL);
+            tcp_close(bound);
+        }
+        heir->pcb.tcp = (struct tcp_pcb*)g->lpcb;
+        tcp_arg((struct tcp_pcb*)g->lpcb, heir);
+        sock->conn->pcb.tcp = NULL;
+        zts_reuseport_hand_over(sock->conn, heir);
+    }
+}
+
 int zts_bsd_socket(const int socket_family, const int socket_type, const int protocol)
 {
     if (! transport_ok()) {
         return ZTS_ERR_SERVICE;
     }
-    return lwip_socket(socket_family, socket_type, protocol);
+    const int fd = zts_fd_reserve();
+    if (fd < 0) {
+        return ZTS_ERR_SOCKET;
+    }
+    const int s = lwip_socket(socket_family, socket_type, protocol);
+    if (s < 0) {
+        zts_fd_release(fd);
+        return s;
+    }
+    LOCK_TCPIP_CORE();
+    struct tcp_pcb* pcb = zts_get_tcp_pcb(s);
+    if (pcb) {
+        zts_tcp_tune(pcb);
+    }
+    UNLOCK_TCPIP_CORE();
+    zts_fd_attach(fd, s);
+    return fd;
 }
 
 int zts_bsd_connect(int fd, const struct zts_sockaddr* addr, zts_socklen_t addrlen)
@@ -56,7 +561,7 @@ int zts_bsd_connect(int fd, const struct zts_sockaddr* addr, zts_socklen_t addrl
         || addrlen < (zts_socklen_t)sizeof(struct zts_sockaddr_in)) {
         return ZTS_ERR_ARG;
     }
-    return lwip_connect(fd, (sockaddr*)addr, addrlen);
+    return lwip_connect(zts_lwip_fd(fd), (sockaddr*)addr, addrlen);
 }
 
 int zts_bsd_bind(int fd, const struct zts_sockaddr* addr, zts_socklen_t addrlen)
@@ -70,7 +575,7 @@ int zts_bsd_bind(int fd, const struct zts_sockaddr* addr, zts_socklen_t addrlen)
     if (addrlen > (int)sizeof(struct zts_sockaddr_storage) || addrlen < (int)sizeof(struct zts_sockaddr_in)) {
         return ZTS_ERR_ARG;
     }
-    return lwip_bind(fd, (sockaddr*)addr, addrlen);
+    return lwip_bind(zts_lwip_fd(fd), (sockaddr*)addr, addrlen);
 }
 
 int zts_bsd_listen(int fd, int backlog)
@@ -78,7 +583,30 @@ int zts_bsd_listen(int fd, int backlog)
     if (! transport_ok()) {
         return ZTS_ERR_SERVICE;
     }
-    return lwip_listen(fd, backlog);
+    const int s = zts_lwip_fd(fd);
+    LOCK_TCPIP_CORE();
+    bool joined = zts_reuseport_join(s);
+    UNLOCK_TCPIP_CORE();
+    if (joined) {
+        return ZTS_ERR_OK;
+    }
+    int err = lwip_listen(s, backlog);
+    if (err == ZTS_ERR_OK) {
+        LOCK_TCPIP_CORE();
+        zts_reuseport_lead(s);
+        UNLOCK_TCPIP_CORE();
+    }
+    else if (zts_errno == ZTS_EADDRINUSE) {
+        // Another socket started listening on the same address first
+        LOCK_TCPIP_CORE();
+        joined = zts_reuseport_join(s);
+        UNLOCK_TCPIP_CORE();
+        if (joined) {
+            zts_errno = 0;
+            err = ZTS_ERR_OK;
+        }
+    }
+    return err;
 }
 
 int zts_bsd_accept(int fd, struct zts_sockaddr* addr, zts_socklen_t* addrlen)
@@ -86,7 +614,18 @@ int zts_bsd_accept(int fd, struct zts_sockaddr* addr, zts_socklen_t* addrlen)
     if (! transport_ok()) {
         return ZTS_ERR_SERVICE;
     }
-    return lwip_accept(fd, (sockaddr*)addr, (socklen_t*)addrlen);
+    // At the limit the connection stays queued on the listener
+    const int accepted = zts_fd_reserve();
+    if (accepted < 0) {
+        return ZTS_ERR_SOCKET;
+    }
+    const int s = lwip_accept(zts_lwip_fd(fd), (sockaddr*)addr, (socklen_t*)addrlen);
+    if (s < 0) {
+        zts_fd_release(accepted);
+        return s;
+    }
+    zts_fd_attach(accepted, s);
+    return accepted;
 }
 
 int zts_bsd_setsockopt(int fd, int level, int optname, const void* optval, zts_socklen_t optlen)
@@ -94,7 +633,33 @@ int zts_bsd_setsockopt(int fd, int level, int optname, const void* optval, zts_s
     if (! transport_ok()) {
         return ZTS_ERR_SERVICE;
     }
-    return lwip_setsockopt(fd, level, optname, optval, optlen);
+    if (level == ZTS_SOL_SOCKET && optname == ZTS_SO_REUSEPORT) {
+        if (! optval || optlen < (zts_socklen_t)sizeof(int)) {
+            zts_errno = ZTS_EINVAL;
+            return ZTS_ERR_SOCKET;
+        }
+        // Sharing the port also needs lwIP's own address reuse
+        const int s = zts_lwip_fd(fd);
+        const int on = *(const int*)optval != 0;
+        if (on && lwip_setsockopt(s, level, ZTS_SO_REUSEADDR, &on, sizeof(on)) < 0) {
+            return ZTS_ERR_SOCKET;
+        }
+        LOCK_TCPIP_CORE();
+        int err = ZTS_ERR_OK;
+        if (! lwip_socket_dbg_get_socket(s)) {
+            zts_errno = ZTS_EBADF;
+            err = ZTS_ERR_SOCKET;
+        }
+        else if (on) {
+            _reuseport_socks.insert(s);
+        }
+        else {
+            _reuseport_socks.erase(s);
+        }
+        UNLOCK_TCPIP_CORE();
+        return err;
+    }
+    return lwip_setsockopt(zts_lwip_fd(fd), level, optname, optval, optlen);
 }
 
 int zts_bsd_getsockopt(int fd, int level, int optname, void* optval, zts_socklen_t* optlen)
@@ -102,7 +667,29 @@ int zts_bsd_getsockopt(int fd, int level, int optname, void* optval, zts_socklen
     if (! transport_ok()) {
         return ZTS_ERR_SERVICE;
     }
-    return lwip_getsockopt(fd, level, optname, optval, (socklen_t*)optlen);
+    if (level == ZTS_SOL_SOCKET && (optname == ZTS_SO_REUSEPORT || optname == ZTS_SO_ACCEPTCONN)) {
+        if (! optval || ! optlen || *optlen < (zts_socklen_t)sizeof(int)) {
+            zts_errno = ZTS_EINVAL;
+            return ZTS_ERR_SOCKET;
+        }
+        const int s = zts_lwip_fd(fd);
+        LOCK_TCPIP_CORE();
+        const bool valid = lwip_socket_dbg_get_socket(s) != NULL;
+        const bool member = valid && zts_reuseport_is_member(s);
+        const bool on = valid && _reuseport_socks.count(s);
+        UNLOCK_TCPIP_CORE();
+        if (! valid) {
+            zts_errno = ZTS_EBADF;
+            return ZTS_ERR_SOCKET;
+        }
+        // Members listen without a listening pcb of their own
+        if (optname == ZTS_SO_REUSEPORT || member) {
+            *(int*)optval = (optname == ZTS_SO_REUSEPORT) ? on : 1;
+            *optlen = sizeof(int);
+            return ZTS_ERR_OK;
+        }
+    }
+    return lwip_getsockopt(zts_lwip_fd(fd), level, optname, optval, (socklen_t*)optlen);
 }
 
 int zts_bsd_getsockname(int fd, struct zts_sockaddr* addr, zts_socklen_t* addrlen)
@@ -116,7 +703,7 @@ int zts_bsd_getsockname(int fd, struct zts_sockaddr* addr, zts_socklen_t* addrle
     if (*addrlen > (int)sizeof(struct zts_sockaddr_storage) || *addrlen < (int)sizeof(struct zts_sockaddr_in)) {
         return ZTS_ERR_ARG;
     }
-    return lwip_getsockname(fd, (sockaddr*)addr, (socklen_t*)addrlen);
+    return lwip_getsockname(zts_lwip_fd(fd), (sockaddr*)addr, (socklen_t*)addrlen);
 }
 
 int zts_bsd_getpeername(int fd, struct zts_sockaddr* addr, zts_socklen_t* addrlen)
@@ -130,7 +717,7 @@ int zts_bsd_getpeername(int fd, struct zts_sockaddr* addr, zts_socklen_t* addrle
     if (*addrlen > (int)sizeof(struct zts_sockaddr_storage) || *addrlen < (int)sizeof(struct zts_sockaddr_in)) {
         return ZTS_ERR_ARG;
     }
-    return lwip_getpeername(fd, (sockaddr*)addr, (socklen_t*)addrlen);
+    return lwip_getpeername(zts_lwip_fd(fd), (sockaddr*)addr, (socklen_t*)addrlen);
 }
 
 int zts_bsd_close(int fd)
@@ -138,7 +725,23 @@ int zts_bsd_close(int fd)
     if (! transport_ok()) {
         return ZTS_ERR_SERVICE;
     }
-    return lwip_close(fd);
+    const int s = zts_lwip_fd(fd);
+    LOCK_TCPIP_CORE();
+    struct tcp_pcb* pcb = zts_get_tcp_pcb(s);
+    if (pcb) {
+        zts_tcp_untune(pcb);
+    }
+    // May abort the connection
+    zts_zc_close(s);
+    zts_loan_close(s);
+    zts_epoll_forget(s);
+    zts_reuseport_close(s);
+    UNLOCK_TCPIP_CORE();
+    const int err = lwip_close(s);
+    if (err == ZTS_ERR_OK) {
+        zts_fd_release(fd);
+    }
+    return err;
 }
 
 int zts_bsd_select(
@@ -151,7 +754,80 @@ int zts_bsd_select(
     if (! transport_ok()) {
         return ZTS_ERR_SERVICE;
     }
-    return lwip_select(nfds, (fd_set*)readfds, (fd_set*)writefds, (fd_set*)exceptfds, (timeval*)timeout);
+    if (nfds < 0 || nfds > ZTS_FD_SETSIZE) {
+        zts_errno = ZTS_EINVAL;
+        return ZTS_ERR_SOCKET;
+    }
+    if (timeout && (timeout->tv_sec < 0 || timeout->tv_usec < 0)) {
+        zts_errno = ZTS_EINVAL;
+        return ZTS_ERR_SOCKET;
+    }
+    // Done with lwIP's poll() over the descriptors in the sets, so that the
+    // work follows those rather than nfds, and lwIP's fd_set (the platform's,
+    // whose size and layout need not match) is not involved
+    // The arrays are kept per thread so that their capacity is reused
+    zts_fd_set* sets[3] = { readfds, writefds, exceptfds };
+    static thread_local std::vector<struct zts_pollfd> pfds;
+    static thread_local std::vector<int> fds;
+    pfds.clear();
+    fds.clear();
+    for (int base = 0; base < nfds; base += 8) {
+        // Whole bytes with nothing set in any of the sets are skipped
+        unsigned char any = 0;
+        for (int i = 0; i < 3; i++) {
+            any |= sets[i] ? sets[i]->fd_bits[base / 8] : 0;
+        }
+        for (int fd = base; any && fd < base + 8 && fd < nfds; fd++) {
+            short events = 0;
+            bool wanted = false;
+            for (int i = 0; i < 3; i++) {
+                if (sets[i] && ZTS_FD_ISSET(fd, sets[i])) {
+                    events |= (i == 0) ? ZTS_POLLIN : (i == 1) ? ZTS_POLLOUT : 0;
+                    wanted = true;
+                }
+            }
+            if (wanted) {
+                const int s = zts_lwip_fd(fd);
+                if (s < 0) {
+                    zts_errno = ZTS_EBADF;
+                    return ZTS_ERR_SOCKET;
+                }
+                struct zts_pollfd pfd = { s, events, 0 };
+                pfds.push_back(pfd);
+                fds.push_back(fd);
+            }
+        }
+    }
+    int ms = -1;
+    if (timeout) {
+        const long long t = (long long)timeout->tv_sec * 1000 + (timeout->tv_usec + 999) / 1000;
+        ms = (int)LWIP_MIN(t, (long long)INT_MAX);
+    }
+    int err = lwip_poll((pollfd*)pfds.data(), (nfds_t)pfds.size(), ms);
+    if (err < 0) {
+        return err;
+    }
+    // Errors are reported as readable and writable as well, as by lwIP's select()
+    const short ready[3] = { ZTS_POLLIN | ZTS_POLLHUP | ZTS_POLLERR, ZTS_POLLOUT | ZTS_POLLERR, ZTS_POLLERR };
+    int count = 0;
+    for (size_t k = 0; k < pfds.size(); k++) {
+        if (pfds[k].revents & ZTS_POLLNVAL) {
+            zts_errno = ZTS_EBADF;
+            return ZTS_ERR_SOCKET;
+        }
+        for (int i = 0; i < 3; i++) {
+            if (! sets[i] || ! ZTS_FD_ISSET(fds[k], sets[i])) {
+                continue;
+            }
+            if (pfds[k].revents & ready[i]) {
+                count++;
+            }
+            else {
+                ZTS_FD_CLR(fds[k], sets[i]);
+            }
+        }
+    }
+    return count;
 }
 
 int zts_bsd_fcntl(int fd, int cmd, int flags)
@@ -159,7 +835,7 @@ int zts_bsd_fcntl(int fd, int cmd, int flags)
     if (! transport_ok()) {
         return ZTS_ERR_SERVICE;
     }
-    return lwip_fcntl(fd, cmd, flags);
+    return lwip_fcntl(zts_lwip_fd(fd), cmd, flags);
 }
 
 int zts_bsd_poll(struct zts_pollfd* fds, nfds_t nfds, int timeout)
@@ -167,7 +843,28 @@ int zts_bsd_poll(struct zts_pollfd* fds, nfds_t nfds, int timeout)
     if (! transport_ok()) {
         return ZTS_ERR_SERVICE;
     }
-    return lwip_poll((pollfd*)fds, nfds, timeout);
+    if (nfds && ! fds) {
+        return ZTS_ERR_ARG;
+    }
+    // lwIP polls a copy holding its own numbers. Unknown descriptors are
+    // reported here, lwIP skips negative ones.
+    static thread_local std::vector<struct zts_pollfd> pfds;
+    pfds.assign(fds, fds + nfds);
+    int invalid = 0;
+    for (nfds_t i = 0; i < nfds; i++) {
+        if (fds[i].fd >= 0 && (pfds[i].fd = zts_lwip_fd(fds[i].fd)) < 0) {
+            invalid++;
+        }
+    }
+    const int n = lwip_poll((pollfd*)pfds.data(), nfds, invalid ? 0 : timeout);
+    if (n < 0) {
+        return n;
+    }
+    for (nfds_t i = 0; i < nfds; i++) {
+        const bool nval = fds[i].fd >= 0 && pfds[i].fd < 0;
+        fds[i].revents = nval ? ZTS_POLLNVAL : pfds[i].revents;
+    }
+    return n + invalid;
 }
 
 int zts_bsd_ioctl(int fd, unsigned long request, void* argp)
@@ -178,7 +875,7 @@ int zts_bsd_ioctl(int fd, unsigned long request, void* argp)
     if (! argp) {
         return ZTS_ERR_ARG;
     }
-    return lwip_ioctl(fd, request, argp);
+    return lwip_ioctl(zts_lwip_fd(fd), request, argp);
 }
 
 ssize_t zts_bsd_send(int fd, const void* buf, size_t len, int flags)
@@ -189,7 +886,7 @@ ssize_t zts_bsd_send(int fd, const void* buf, size_t len, int flags)
     if (! buf) {
         return ZTS_ERR_ARG;
     }
-    return lwip_send(fd, buf, len, flags);
+    return lwip_send(zts_lwip_fd(fd), buf, len, flags);
 }
 
 ssize_t
@@ -204,7 +901,7 @@ zts_bsd_sendto(int fd, const void* buf, size_t len, int flags, const struct zts_
     if (addrlen > (int)sizeof(struct zts_sockaddr_storage) || addrlen < (int)sizeof(struct zts_sockaddr_in)) {
         return ZTS_ERR_ARG;
     }
-    return lwip_sendto(fd, buf, len, flags, (sockaddr*)addr, addrlen);
+    return lwip_sendto(zts_lwip_fd(fd), buf, len, flags, (sockaddr*)addr, addrlen);
 }
 
 ssize_t zts_bsd_sendmsg(int fd, const struct zts_msghdr* msg, int flags)
@@ -212,7 +909,7 @@ ssize_t zts_bsd_sendmsg(int fd, const struct zts_msghdr* msg, int flags)
     if (! transport_ok()) {
         return ZTS_ERR_SERVICE;
     }
-    return lwip_sendmsg(fd, (const struct msghdr*)msg, flags);
+    return lwip_sendmsg(zts_lwip_fd(fd), (const struct msghdr*)msg, flags);
 }
 
 ssize_t zts_bsd_recv(int fd, void* buf, size_t len, int flags)
@@ -223,7 +920,7 @@ ssize_t zts_bsd_recv(int fd, void* buf, size_t len, int flags)
     if (! buf) {
         return ZTS_ERR_ARG;
     }
-    return lwip_recv(fd, buf, len, flags);
+    return lwip_recv(zts_lwip_fd(fd), buf, len, flags);
 }
 
 ssize_t zts_bsd_recvfrom(int fd, void* buf, size_t len, int flags, struct zts_sockaddr* addr, zts_socklen_t* addrlen)
@@ -234,7 +931,7 @@ ssize_t zts_bsd_recvfrom(int fd, void* buf, size_t len, int flags, struct zts_so
     if (! buf) {
         return ZTS_ERR_ARG;
     }
-    return lwip_recvfrom(fd, buf, len, flags, (sockaddr*)addr, (socklen_t*)addrlen);
+    return lwip_recvfrom(zts_lwip_fd(fd), buf, len, flags, (sockaddr*)addr, (socklen_t*)addrlen);
 }
 
 ssize_t zts_bsd_recvmsg(int fd, struct zts_msghdr* msg, int flags)
@@ -245,7 +942,210 @@ ssize_t zts_bsd_recvmsg(int fd, struct zts_msghdr* msg, int flags)
     if (! msg) {
         return ZTS_ERR_ARG;
     }
-    return lwip_recvmsg(fd, (struct msghdr*)msg, flags);
+    return lwip_recvmsg(zts_lwip_fd(fd), (struct msghdr*)msg, flags);
+}
+
+// Destination of a batched send, read as lwip_sendto() reads it
+static bool zts_sockaddr_to_ipaddr(const struct zts_sockaddr* addr, zts_socklen_t addrlen, ip_addr_t* ip, u16_t* port)
+{
+    if (addr->sa_family == ZTS_AF_INET && addrlen >= sizeof(struct zts_sockaddr_in)) {
+        const struct sockaddr_in* in4 = (const struct sockaddr_in*)addr;
+        inet_addr_to_ip4addr(ip_2_ip4(ip), &in4->sin_addr);
+        IP_SET_TYPE_VAL(*ip, IPADDR_TYPE_V4);
+        *port = lwip_ntohs(in4->sin_port);
+        return true;
+    }
+    if (addr->sa_family == ZTS_AF_INET6 && addrlen >= sizeof(struct zts_sockaddr_in6)) {
+        const struct sockaddr_in6* in6 = (const struct sockaddr_in6*)addr;
+        inet6_addr_to_ip6addr(ip_2_ip6(ip), &in6->sin6_addr);
+        ip6_addr_set_zone(ip_2_ip6(ip), (u8_t)in6->sin6_scope_id);
+        IP_SET_TYPE_VAL(*ip, IPADDR_TYPE_V6);
+        if (ip6_addr_isipv4mappedipv6(ip_2_ip6(ip))) {
+            // Dual-stack: IPv4-mapped destinations are sent over IPv4
+            unmap_ipv4_mapped_ipv6(ip_2_ip4(ip), ip_2_ip6(ip));
+            IP_SET_TYPE_VAL(*ip, IPADDR_TYPE_V4);
+        }
+        *port = lwip_ntohs(in6->sin6_port);
+        return true;
+    }
+    return false;
+}
+
+// Source of a batched receive, IPv6 sockets see IPv4 peers as IPv4-mapped
+static zts_socklen_t
+zts_ipaddr_to_sockaddr(struct netconn* conn, const ip_addr_t* from, u16_t port, struct zts_sockaddr_storage* ss)
+{
+    ip_addr_t ip = *from;
+    memset(ss, 0, sizeof(*ss));
+    if (NETCONNTYPE_ISIPV6(netconn_type(conn)) && IP_IS_V4(&ip)) {
+        ip4_2_ipv4_mapped_ipv6(ip_2_ip6(&ip), ip_2_ip4(from));
+        IP_SET_TYPE_VAL(ip, IPADDR_TYPE_V6);
+    }
+    if (IP_IS_V6(&ip)) {
+        struct sockaddr_in6* in6 = (struct sockaddr_in6*)ss;
+        in6->sin6_len = sizeof(struct sockaddr_in6);
+        in6->sin6_family = AF_INET6;
+        in6->sin6_port = lwip_htons(port);
+        inet6_addr_from_ip6addr(&in6->sin6_addr, ip_2_ip6(&ip));
+        in6->sin6_scope_id = ip6_addr_zone(ip_2_ip6(&ip));
+        return sizeof(struct zts_sockaddr_in6);
+    }
+    struct sockaddr_in* in4 = (struct sockaddr_in*)ss;
+    in4->sin_len = sizeof(struct sockaddr_in);
+    in4->sin_family = AF_INET;
+    in4->sin_port = lwip_htons(port);
+    inet_addr_from_ip4addr(&in4->sin_addr, ip_2_ip4(&ip));
+    return sizeof(struct zts_sockaddr_in);
+}
+
+int zts_bsd_sendmmsg(int fd, struct zts_mmsghdr* msgvec, unsigned int vlen, int flags)
+{
+    if (! transport_ok()) {
+        return ZTS_ERR_SERVICE;
+    }
+    if (! msgvec || ! vlen) {
+        return ZTS_ERR_ARG;
+    }
+    // UDP sends never wait, so ZTS_MSG_DONTWAIT changes nothing. lwIP does not
+    // cork datagrams (ZTS_MSG_MORE).
+    if (flags & ~ZTS_MSG_DONTWAIT) {
+        zts_errno = ZTS_EINVAL;
+        return ZTS_ERR_SOCKET;
+    }
+    int err = 0;
+    unsigned int n = 0;
+    // Each datagram goes straight to udp_sendto(), all under one core lock
+    LOCK_TCPIP_CORE();
+    struct lwip_sock* sock = lwip_socket_dbg_get_socket(zts_lwip_fd(fd));
+    if (! sock || ! sock->conn) {
+        err = ZTS_EBADF;
+    }
+    else if (NETCONNTYPE_GROUP(netconn_type(sock->conn)) != NETCONN_UDP || ! sock->conn->pcb.udp) {
+        err = ZTS_EOPNOTSUPP;
+    }
+    for (; ! err && n < vlen; n++) {
+        const struct zts_msghdr* msg = &msgvec[n].msg_hdr;
+        struct udp_pcb* pcb = sock->conn->pcb.udp;
+        ip_addr_t ip;
+        u16_t port = 0;
+        size_t len = 0;
+        if (msg->msg_iovlen < 0 || (msg->msg_iovlen && ! msg->msg_iov)) {
+            err = ZTS_EINVAL;
+            break;
+        }
+        for (int i = 0; i < msg->msg_iovlen; i++) {
+            len += msg->msg_iov[i].iov_len;
+        }
+        if (len > 0xffff) {
+            err = ZTS_EMSGSIZE;
+            break;
+        }
+        if (msg->msg_name) {
+            if (! zts_sockaddr_to_ipaddr((const struct zts_sockaddr*)msg->msg_name, msg->msg_namelen, &ip, &port)) {
+                err = ZTS_EINVAL;
+                break;
+            }
+        }
+        else if (! (pcb->flags & UDP_FLAGS_CONNECTED)) {
+            err = ZTS_EDESTADDRREQ;
+            break;
+        }
+        struct pbuf* p = pbuf_alloc(PBUF_TRANSPORT, (u16_t)len, PBUF_RAM);
+        if (! p) {
+            err = ZTS_ENOMEM;
+            break;
+        }
+        u16_t off = 0;
+        for (int i = 0; i < msg->msg_iovlen; i++) {
+            pbuf_take_at(p, msg->msg_iov[i].iov_base, (u16_t)msg->msg_iov[i].iov_len, off);
+            off += (u16_t)msg->msg_iov[i].iov_len;
+        }
+        err_t e = msg->msg_name ? udp_sendto(pcb, p, &ip, port) : udp_send(pcb, p);
+        pbuf_free(p);
+        if (e != ERR_OK) {
+            err = err_to_errno(e);
+            break;
+        }
+        msgvec[n].msg_len = (unsigned int)len;
+    }
+    UNLOCK_TCPIP_CORE();
+    if (err && ! n) {
+        zts_errno = err;
+        return ZTS_ERR_SOCKET;
+    }
+    // As with sendmmsg(2), an error after the first message only shortens the count
+    return (int)n;
+}
+
+int zts_bsd_recvmmsg(int fd, struct zts_mmsghdr* msgvec, unsigned int vlen, int flags)
+{
+    if (! transport_ok()) {
+        return ZTS_ERR_SERVICE;
+    }
+    if (! msgvec || ! vlen) {
+        return ZTS_ERR_ARG;
+    }
+    // Every datagram read is consumed, so ZTS_MSG_PEEK can not be honoured
+    if (flags & ~ZTS_MSG_DONTWAIT) {
+        zts_errno = ZTS_EINVAL;
+        return ZTS_ERR_SOCKET;
+    }
+    // Like lwip_recvfrom(), the socket is read without the core lock
+    struct lwip_sock* sock = lwip_socket_dbg_get_socket(zts_lwip_fd(fd));
+    if (! sock || ! sock->conn) {
+        zts_errno = ZTS_EBADF;
+        return ZTS_ERR_SOCKET;
+    }
+    if (NETCONNTYPE_GROUP(netconn_type(sock->conn)) != NETCONN_UDP) {
+        zts_errno = ZTS_EOPNOTSUPP;
+        return ZTS_ERR_SOCKET;
+    }
+    unsigned int n = 0;
+    for (; n < vlen; n++) {
+        struct zts_msghdr* msg = &msgvec[n].msg_hdr;
+        if (msg->msg_iovlen < 0 || (msg->msg_iovlen && ! msg->msg_iov)) {
+            if (! n) {
+                zts_errno = ZTS_EINVAL;
+                return ZTS_ERR_SOCKET;
+            }
+            break;
+        }
+        // A datagram left behind by a peeking read goes first
+        struct netbuf* buf = sock->lastdata.netbuf;
+        if (buf) {
+            sock->lastdata.netbuf = NULL;
+        }
+        else {
+            // Only the first datagram is waited for, the rest are what is already queued
+            const u8_t apiflags = (n || (flags & ZTS_MSG_DONTWAIT)) ? NETCONN_DONTBLOCK : 0;
+            err_t err = netconn_recv_udp_raw_netbuf_flags(sock->conn, &buf, apiflags);
+            if (err != ERR_OK) {
+                if (! n) {
+                    zts_errno = err_to_errno(err);
+                    return ZTS_ERR_SOCKET;
+                }
+                break;
+            }
+        }
+        const u16_t len = netbuf_len(buf);
+        u16_t off = 0;
+        for (int i = 0; i < msg->msg_iovlen && off < len; i++) {
+            const u16_t chunk = (u16_t)LWIP_MIN((size_t)(len - off), msg->msg_iov[i].iov_len);
+            pbuf_copy_partial(buf->p, msg->msg_iov[i].iov_base, chunk, off);
+            off += chunk;
+        }
+        msg->msg_flags = (off < len) ? ZTS_MSG_TRUNC : 0;
+        msg->msg_controllen = 0;
+        if (msg->msg_name && msg->msg_namelen) {
+            struct zts_sockaddr_storage ss;
+            zts_socklen_t sslen = zts_ipaddr_to_sockaddr(sock->conn, netbuf_fromaddr(buf), netbuf_fromport(buf), &ss);
+            memcpy(msg->msg_name, &ss, LWIP_MIN(msg->msg_namelen, sslen));
+            msg->msg_namelen = sslen;
+        }
+        msgvec[n].msg_len = off;
+        netbuf_delete(buf);
+    }
+    return (int)n;
 }
 
 ssize_t zts_bsd_read(int fd, void* buf, size_t len)
@@ -256,7 +1156,7 @@ ssize_t zts_bsd_read(int fd, void* buf, size_t len)
     if (! buf) {
         return ZTS_ERR_ARG;
     }
-    return lwip_read(fd, buf, len);
+    return lwip_read(zts_lwip_fd(fd), buf, len);
 }
 
 ssize_t zts_bsd_readv(int fd, const struct zts_iovec* iov, int iovcnt)
@@ -264,7 +1164,7 @@ ssize_t zts_bsd_readv(int fd, const struct zts_iovec* iov, int iovcnt)
     if (! transport_ok()) {
         return ZTS_ERR_SERVICE;
     }
-    return lwip_readv(fd, (iovec*)iov, iovcnt);
+    return lwip_readv(zts_lwip_fd(fd), (iovec*)iov, iovcnt);
 }
 
 ssize_t zts_bsd_write(int fd, const void* buf, size_t len)
@@ -275,7 +1175,7 @@ ssize_t zts_bsd_write(int fd, const void* buf, size_t len)
     if (! buf) {
         return ZTS_ERR_ARG;
     }
-    return lwip_write(fd, buf, len);
+    return lwip_write(zts_lwip_fd(fd), buf, len);
 }
 
 ssize_t zts_bsd_writev(int fd, const struct zts_iovec* iov, int iovcnt)
@@ -283,7 +1183,7 @@ ssize_t zts_bsd_writev(int fd, const struct zts_iovec* iov, int iovcnt)
     if (! transport_ok()) {
         return ZTS_ERR_SERVICE;
     }
-    return lwip_writev(fd, (iovec*)iov, iovcnt);
+    return lwip_writev(zts_lwip_fd(fd), (iovec*)iov, iovcnt);
 }
 
 int zts_bsd_shutdown(int fd, int how)
@@ -291,7 +1191,12 @@ int zts_bsd_shutdown(int fd, int how)
     if (! transport_ok()) {
         return ZTS_ERR_SERVICE;
     }
-    return lwip_shutdown(fd, how);
+    const int lfd = zts_lwip_fd(fd);
+    const int ret = lwip_shutdown(lfd, how);
+    if (ret == 0) {
+        zts_epoll_shutdown(lfd);
+    }
+    return ret;
 }
 
 struct zts_hostent* zts_bsd_gethostbyname(const char* name)
@@ -398,43 +1303,262 @@ int zts_socket(int family, int type, int protocol)
     return zts_bsd_socket(family, type, protocol);
 }
 
+// Outcome of a non-blocking connect that has polled writable: 0 or an errno
+static int zts_connect_result(int fd)
+{
+    int err = 0;
+    zts_socklen_t len = sizeof(err);
+    if (zts_bsd_getsockopt(fd, ZTS_SOL_SOCKET, ZTS_SO_ERROR, &err, &len) < 0) {
+        return zts_errno ? zts_errno : ZTS_EBADF;
+    }
+    return err;
+}
+
+// Wait for a non-blocking connect to complete, or for sys_now() to pass deadline
+static int zts_connect_wait(int fd, u32_t deadline)
+{
+    struct zts_pollfd pfd = { fd, ZTS_POLLOUT, 0 };
+    for (;;) {
+        const s32_t remaining = (s32_t)(deadline - sys_now());
+        if (remaining <= 0) {
+            zts_errno = ZTS_ETIMEDOUT;
+            return ZTS_ERR_SOCKET;
+        }
+        const int n = zts_bsd_poll(&pfd, 1, remaining);
+        if (n < 0) {
+            return n;
+        }
+        if (n > 0) {
+            const int err = zts_connect_result(fd);
+            if (err) {
+                zts_errno = err;
+                return ZTS_ERR_SOCKET;
+            }
+            return ZTS_ERR_OK;
+        }
+    }
+}
+
+// Interval between attempts while there is no route to the host yet
+#define ZTS_CONNECT_RETRY_DELAY_MS 250
+
 int zts_connect(int fd, const char* ipstr, unsigned short port, int timeout_ms)
 {
     if (! transport_ok()) {
         return ZTS_ERR_SERVICE;
     }
-    if (timeout_ms < 0) {
+    if (timeout_ms < 0 || ! ipstr) {
         return ZTS_ERR_ARG;
     }
     if (timeout_ms == 0) {
         timeout_ms = 30000;   // Default
     }
-    int div = 4;   // Must be > 0, Four connection attempts per second
-    int n_tries = (timeout_ms / 1000) * div;
-    int connect_delay = 1000 / div;
-    int err = ZTS_ERR_SOCKET;
-
-    zts_socklen_t addrlen = 0;
     struct zts_sockaddr_storage ss;
-    struct zts_sockaddr* sa = NULL;
+    zts_socklen_t addrlen = sizeof(ss);
+    if (zts_util_ipstr_to_saddr(ipstr, port, (struct zts_sockaddr*)&ss, &addrlen) != ZTS_ERR_OK) {
+        return ZTS_ERR_ARG;
+    }
+    const int blocking = zts_get_blocking(fd);
+    if (blocking < 0) {
+        return blocking;
+    }
+    if (! blocking) {
+        return zts_bsd_connect(fd, (struct zts_sockaddr*)&ss, addrlen);
+    }
+    // The SYN is retransmitted by the stack while the handshake is awaited
+    // here, so this returns as soon as it completes or the timeout expires. A
+    // handshake still under way when it does is picked up again by the next
+    // call on the same socket.
+    const u32_t deadline = sys_now() + (u32_t)timeout_ms;
+    zts_set_blocking(fd, 0);
+    int err;
+    for (;;) {
+        err = zts_bsd_connect(fd, (struct zts_sockaddr*)&ss, addrlen);
+        if (err == ZTS_ERR_OK) {
+            break;
+        }
+        if (zts_errno == ZTS_EINPROGRESS || zts_errno == ZTS_EALREADY) {
+            err = zts_connect_wait(fd, deadline);
+            break;
+        }
+        if (zts_errno == ZTS_EISCONN) {
+            // Completed after an earlier call gave up waiting
+            err = ZTS_ERR_OK;
+            break;
+        }
+        // There may be no route to the host until shortly after joining
+        if (zts_errno != ZTS_EHOSTUNREACH || (s32_t)(deadline - sys_now()) <= ZTS_CONNECT_RETRY_DELAY_MS) {
+            break;
+        }
+        zts_util_delay(ZTS_CONNECT_RETRY_DELAY_MS);
+    }
+    const int saved_errno = (err == ZTS_ERR_OK) ? 0 : zts_errno;
+    zts_set_blocking(fd, 1);
+    zts_errno = saved_errno;
+    return err;
+}
 
-    // Convert to standard address structure
+// Start a non-blocking connect to one candidate of zts_connect_multi()
+static int zts_connect_start(const char* ipstr, unsigned short port, int* err)
+{
+    struct zts_sockaddr_storage ss;
+    zts_socklen_t addrlen = sizeof(ss);
+    if (zts_util_ipstr_to_saddr(ipstr, port, (struct zts_sockaddr*)&ss, &addrlen) != ZTS_ERR_OK) {
+        *err = ZTS_EINVAL;
+        return -1;
+    }
+    const int fd = zts_bsd_socket(ss.ss_family, ZTS_SOCK_STREAM, 0);
+    if (fd < 0) {
+        *err = zts_errno;
+        return -1;
+    }
+    zts_set_blocking(fd, 0);
+    if (zts_bsd_connect(fd, (struct zts_sockaddr*)&ss, addrlen) < 0 && zts_errno != ZTS_EINPROGRESS) {
+        *err = zts_errno;
+        zts_bsd_close(fd);
+        return -1;
+    }
+    return fd;
+}
 
-    addrlen = sizeof(ss);
-    zts_util_ipstr_to_saddr(ipstr, port, (struct zts_sockaddr*)&ss, &addrlen);
-    sa = (struct zts_sockaddr*)&ss;
+// Head start given to each attempt before the next address is tried (RFC 8305)
+#define ZTS_CONNECT_ATTEMPT_DELAY_MS 250
 
-    if (addrlen > 0 && sa != NULL) {
-        if (zts_get_blocking(fd)) {
-            do {
-                err = zts_bsd_connect(fd, sa, addrlen);
-                zts_util_delay(connect_delay);
-                n_tries--;
-            } while ((err < 0) && (zts_errno != 0) && (n_tries > 0));
+int zts_connect_multi(const char** ipstrs, unsigned int count, unsigned short port, int timeout_ms)
+{
+    if (! transport_ok()) {
+        return ZTS_ERR_SERVICE;
+    }
+    if (! ipstrs || ! count || timeout_ms < 0) {
+        return ZTS_ERR_ARG;
+    }
+    if (timeout_ms == 0) {
+        timeout_ms = 30000;   // Default
+    }
+    // Alternate between address families, starting with that of the first address
+    std::deque<unsigned int> v4, v6;
+    for (unsigned int i = 0; i < count; i++) {
+        const int family = zts_util_get_ip_family(ipstrs[i]);
+        if (family == ZTS_AF_INET) {
+            v4.push_back(i);
+        }
+        else if (family == ZTS_AF_INET6) {
+            v6.push_back(i);
+        }
+        else {
+            return ZTS_ERR_ARG;
         }
-        return err;
     }
-    return ZTS_ERR_ARG;
+    std::vector<unsigned int> order;
+    bool six = ! v6.empty() && v6.front() == 0;
+    while (! v4.empty() || ! v6.empty()) {
+        std::deque<unsigned int>* q = six ? &v6 : &v4;
+        if (q->empty()) {
+            q = six ? &v4 : &v6;
+        }
+        order.push_back(q->front());
+        q->pop_front();
+        six = ! six;
+    }
+    const u32_t deadline = sys_now() + (u32_t)timeout_ms;
+    u32_t next_attempt = sys_now();
+    size_t next = 0;
+    int winner = -1;
+    int last_err = ZTS_ETIMEDOUT;
+    std::vector<struct zts_pollfd> pending;
+    std::vector<unsigned int> pending_idx;   // Address of each pending attempt
+    // Addresses there was no route to yet, tried again as zts_connect() does,
+    // with the time from which they are due
+    std::deque<std::pair<u32_t, unsigned int> > unreachable;
+    while (winner < 0) {
+        const u32_t now = sys_now();
+        if ((s32_t)(deadline - now) <= 0) {
+            last_err = ZTS_ETIMEDOUT;
+            break;
+        }
+        // The next address is tried once the last attempt has had its head
+        // start, or straight away if nothing else is still in flight. Fresh
+        // addresses come before unreachable ones that are due again.
+        if (pending.empty() || (s32_t)(next_attempt - now) <= 0) {
+            int idx = -1;
+            if (next < order.size()) {
+                idx = (int)order[next++];
+            }
+            else if (! unreachable.empty() && (s32_t)(unreachable.front().first - now) <= 0) {
+                idx = (int)unreachable.front().second;
+                unreachable.pop_front();
+            }
+            if (idx >= 0) {
+                const int fd = zts_connect_start(ipstrs[idx], port, &last_err);
+                if (fd >= 0) {
+                    struct zts_pollfd pfd = { fd, ZTS_POLLOUT, 0 };
+                    pending.push_back(pfd);
+                    pending_idx.push_back((unsigned int)idx);
+                    next_attempt = now + ZTS_CONNECT_ATTEMPT_DELAY_MS;
+                }
+                else if (last_err == ZTS_EHOSTUNREACH && (s32_t)(deadline - now) > ZTS_CONNECT_RETRY_DELAY_MS) {
+                    unreachable.push_back(std::make_pair(now + ZTS_CONNECT_RETRY_DELAY_MS, (unsigned int)idx));
+                }
+                continue;
+            }
+        }
+        if (pending.empty() && unreachable.empty()) {
+            break;   // Every address has failed
+        }
+        u32_t wait = deadline - now;
+        if (next < order.size()) {
+            wait = LWIP_MIN(wait, next_attempt - now);
+        }
+        else if (! unreachable.empty()) {
+            u32_t due = unreachable.front().first;
+            if (! pending.empty() && (s32_t)(next_attempt - due) > 0) {
+                due = next_attempt;
+            }
+            wait = LWIP_MIN(wait, ((s32_t)(due - now) > 0) ? due - now : 0);
+        }
+        if (pending.empty()) {
+            zts_util_delay(wait);
+            continue;
+        }
+        if (zts_bsd_poll(pending.data(), (nfds_t)pending.size(), (int)wait) < 0) {
+            last_err = zts_errno;
+            break;
+        }
+        for (size_t i = 0; i < pending.size();) {
+            if (! pending[i].revents) {
+                i++;
+                continue;
+            }
+            const int fd = pending[i].fd;
+            const unsigned int idx = pending_idx[i];
+            const int err = zts_connect_result(fd);
+            pending.erase(pending.begin() + i);
+            pending_idx.erase(pending_idx.begin() + i);
+            if (! err && winner < 0) {
+                winner = fd;
+                continue;
+            }
+            if (err) {
+                // A failed attempt hands over to the next address at once
+                last_err = err;
+                next_attempt = sys_now();
+                if (err == ZTS_EHOSTUNREACH && (s32_t)(deadline - next_attempt) > ZTS_CONNECT_RETRY_DELAY_MS) {
+                    unreachable.push_back(std::make_pair(next_attempt + ZTS_CONNECT_RETRY_DELAY_MS, idx));
+                }
+            }
+            zts_bsd_close(fd);
+        }
+    }
+    for (size_t i = 0; i < pending.size(); i++) {
+        zts_bsd_close(pending[i].fd);
+    }
+    if (winner < 0) {
+        zts_errno = last_err;
+        return ZTS_ERR_SOCKET;
+    }
+    zts_set_blocking(winner, 1);
+    zts_errno = 0;
+    return winner;
 }
 
 int zts_bind(int fd, const char* ipstr, unsigned short port)
@@ -499,6 +1623,184 @@ ssize_t zts_write(int fd, const void* buf, size_t len)
     return zts_bsd_write(fd, buf, len);
 }
 
+ssize_t zts_send_zc(int fd, const void* buf, size_t len, uint64_t cookie)
+{
+    if (! transport_ok()) {
+        return ZTS_ERR_SERVICE;
+    }
+    if (! buf || ! len) {
+        return ZTS_ERR_ARG;
+    }
+    int err = 0;
+    size_t queued = 0;
+    const int s = zts_lwip_fd(fd);
+    LOCK_TCPIP_CORE();
+    struct lwip_sock* sock = lwip_socket_dbg_get_socket(s);
+    struct tcp_pcb* pcb = zts_get_tcp_pcb(s);
+    if (! sock || ! sock->conn) {
+        err = ZTS_EBADF;
+    }
+    else if (NETCONNTYPE_GROUP(netconn_type(sock->conn)) != NETCONN_TCP) {
+        err = ZTS_EOPNOTSUPP;
+    }
+    else if (! pcb || (pcb->state != ESTABLISHED && pcb->state != CLOSE_WAIT)) {
+        err = ZTS_ENOTCONN;
+    }
+    else if (sock->conn->state == NETCONN_WRITE) {
+        // A blocking send is part way through, its data goes first
+        err = ZTS_EWOULDBLOCK;
+    }
+    else {
+        while (queued < len) {
+            const u16_t n = (u16_t)LWIP_MIN(LWIP_MIN(len - queued, (size_t)tcp_sndbuf(pcb)), (size_t)0xffff);
+            // Without TCP_WRITE_FLAG_COPY the segments point into buf
+            if (! n || tcp_write(pcb, (const u8_t*)buf + queued, n, 0) != ERR_OK) {
+                break;
+            }
+            queued += n;
+        }
+        if (queued) {
+            zts_zc_get_queue(s, sock->conn, pcb)->pending.push_back({ pcb->snd_lbb, cookie });
+            tcp_output(pcb);
+        }
+        if (tcp_sndbuf(pcb) <= TCP_SNDLOWAT || tcp_sndqueuelen(pcb) >= TCP_SNDQUEUELOWAT) {
+            // As lwIP's own sends do, so that the socket polls writable once space is freed
+            netconn_set_flags(sock->conn, NETCONN_FLAG_CHECK_WRITESPACE);
+            if (sock->conn->callback) {
+                sock->conn->callback(sock->conn, NETCONN_EVT_SENDMINUS, 0);
+            }
+        }
+        if (! queued) {
+            err = ZTS_EWOULDBLOCK;
+        }
+    }
+    UNLOCK_TCPIP_CORE();
+    if (err) {
+        zts_errno = err;
+        return ZTS_ERR_SOCKET;
+    }
+    return (ssize_t)queued;
+}
+
+int zts_send_zc_complete(int fd, uint64_t* cookies, unsigned int max)
+{
+    if (! transport_ok()) {
+        return ZTS_ERR_SERVICE;
+    }
+    if (! cookies || ! max) {
+        return ZTS_ERR_ARG;
+    }
+    unsigned int n = 0;
+    LOCK_TCPIP_CORE();
+    std::unordered_map<int, zts_zc_queue*>::iterator it = _zc_queues.find(zts_lwip_fd(fd));
+    if (it != _zc_queues.end()) {
+        zts_zc_queue* q = it->second;
+        zts_zc_reap(q);
+        while (n < max && ! q->done.empty()) {
+            cookies[n++] = q->done.front();
+            q->done.pop_front();
+        }
+        if (q->done.empty()) {
+            zts_epoll_errqueue(q->conn, false);
+        }
+    }
+    UNLOCK_TCPIP_CORE();
+    return (int)n;
+}
+
+ssize_t zts_recv_loan(int fd, struct zts_iovec* iov, unsigned int* count, void** token)
+{
+    if (! transport_ok()) {
+        return ZTS_ERR_SERVICE;
+    }
+    if (! iov || ! count || ! *count || ! token) {
+        return ZTS_ERR_ARG;
+    }
+    *token = NULL;
+    // Like lwip_recv(), the socket is read without the core lock
+    const int s = zts_lwip_fd(fd);
+    struct lwip_sock* sock = lwip_socket_dbg_get_socket(s);
+    if (! sock || ! sock->conn) {
+        zts_errno = ZTS_EBADF;
+        return ZTS_ERR_SOCKET;
+    }
+    if (NETCONNTYPE_GROUP(netconn_type(sock->conn)) != NETCONN_TCP) {
+        zts_errno = ZTS_EOPNOTSUPP;
+        return ZTS_ERR_SOCKET;
+    }
+    // Data left over by an earlier read goes first
+    struct pbuf* p = sock->lastdata.pbuf;
+    if (p) {
+        sock->lastdata.pbuf = NULL;
+    }
+    else {
+        err_t err = netconn_recv_tcp_pbuf_flags(sock->conn, &p, NETCONN_NOAUTORCVD);
+        if (err == ERR_CLSD) {
+            *count = 0;
+            return 0;
+        }
+        if (err != ERR_OK) {
+            zts_errno = err_to_errno(err);
+            return ZTS_ERR_SOCKET;
+        }
+    }
+    unsigned int n = 0;
+    struct pbuf* q = p;
+    struct pbuf* last = NULL;
+    for (; q && n < *count; last = q, q = q->next) {
+        iov[n].iov_base = q->payload;
+        iov[n].iov_len = q->len;
+        n++;
+    }
+    if (q) {
+        // More buffers than iovecs, the rest stays queued for the next read
+        last->next = NULL;
+        for (struct pbuf* r = p; r; r = r->next) {
+            r->tot_len -= q->tot_len;
+        }
+        sock->lastdata.pbuf = q;
+    }
+    *count = n;
+    zts_loan* loan = new zts_loan();
+    loan->p = p;
+    LOCK_TCPIP_CORE();
+    zts_loan_sock*& ls = _loan_socks[s];
+    if (! ls) {
+        ls = new zts_loan_sock();
+        ls->conn = sock->conn;
+    }
+    ls->loans++;
+    loan->sock = ls;
+    UNLOCK_TCPIP_CORE();
+    *token = loan;
+    return (ssize_t)p->tot_len;
+}
+
+int zts_recv_return(void* token)
+{
+    if (! token) {
+        return ZTS_ERR_ARG;
+    }
+    zts_loan* loan = (zts_loan*)token;
+    LOCK_TCPIP_CORE();
+    zts_loan_sock* ls = loan->sock;
+    if (ls->conn && ls->conn->pcb.tcp) {
+        // Reopen the receive window by what was loaned
+        for (u32_t len = loan->p->tot_len; len;) {
+            const u16_t n = (u16_t)LWIP_MIN(len, 0xffffU);
+            tcp_recved(ls->conn->pcb.tcp, n);
+            len -= n;
+        }
+    }
+    if (! --ls->loans && ! ls->conn) {
+        delete ls;
+    }
+    UNLOCK_TCPIP_CORE();
+    pbuf_free(loan->p);
+    delete loan;
+    return ZTS_ERR_OK;
+}
+
 int zts_shutdown_rd(int fd)
 {
     return zts_bsd_shutdown(fd, ZTS_SHUT_RD);
@@ -747,6 +2049,30 @@ int zts_get_reuse_addr(int fd)
     return optval != 0;
 }
 
+int zts_set_reuse_port(int fd, int enabled)
+{
+    if (! transport_ok()) {
+        return ZTS_ERR_SERVICE;
+    }
+    if (enabled != 0 && enabled != 1) {
+        return ZTS_ERR_ARG;
+    }
+    return zts_bsd_setsockopt(fd, ZTS_SOL_SOCKET, ZTS_SO_REUSEPORT, (void*)&enabled, sizeof(enabled));
+}
+
+int zts_get_reuse_port(int fd)
+{
+    if (! transport_ok()) {
+        return ZTS_ERR_SERVICE;
+    }
+    int err, optval = 0;
+    zts_socklen_t optlen = sizeof(optval);
+    if ((err = zts_bsd_getsockopt(fd, ZTS_SOL_SOCKET, ZTS_SO_REUSEPORT, (void*)&optval, &optlen)) < 0) {
+        return err;
+    }
+    return optval != 0;
+}
+
 int zts_set_recv_timeout(int fd, int seconds, int microseconds)
 {
     if (! transport_ok()) {
@@ -811,6 +2137,17 @@ int zts_set_send_buf_size(int fd, int size)
     if (size < 0) {
         return ZTS_ERR_ARG;
     }
+    LOCK_TCPIP_CORE();
+    struct tcp_pcb* pcb = zts_get_tcp_pcb(zts_lwip_fd(fd));
+    if (pcb) {
+        // Data written but not yet acknowledged keeps its share of the buffer
+        const u32_t queued = pcb->snd_lbb - pcb->lastack;
+        pcb->snd_buf = ((u32_t)size > queued) ? (tcpwnd_size_t)(size - queued) : 0;
+    }
+    UNLOCK_TCPIP_CORE();
+    if (pcb) {
+        return ZTS_ERR_OK;
+    }
     return zts_bsd_setsockopt(fd, SOL_SOCKET, SO_SNDBUF, (void*)&size, sizeof(int));
 }
 
@@ -819,6 +2156,13 @@ int zts_get_send_buf_size(int fd)
     if (! transport_ok()) {
         return ZTS_ERR_SERVICE;
     }
+    LOCK_TCPIP_CORE();
+    struct tcp_pcb* pcb = zts_get_tcp_pcb(zts_lwip_fd(fd));
+    const int size = pcb ? (int)(pcb->snd_buf + (u32_t)(pcb->snd_lbb - pcb->lastack)) : 0;
+    UNLOCK_TCPIP_CORE();
+    if (pcb) {
+        return size;
+    }
     int err, optval = 0;
     zts_socklen_t optlen = sizeof(optval);
     if ((err = zts_bsd_getsockopt(fd, SOL_SOCKET, SO_SNDBUF, (char*)&optval, &optlen)) < 0) {
@@ -835,7 +2179,12 @@ int zts_set_recv_buf_size(int fd, int size)
     if (size < 0) {
         return ZTS_ERR_ARG;
     }
-    return zts_bsd_setsockopt(fd, SOL_SOCKET, SO_RCVBUF, (void*)&size, sizeof(int));
+    int err;
+    if ((err = zts_bsd_setsockopt(fd, SOL_SOCKET, SO_RCVBUF, (void*)&size, sizeof(int))) < 0) {
+        return err;
+    }
+    zts_set_tcp_recv_window(zts_lwip_fd(fd), size);
+    return ZTS_ERR_OK;
 }
 
 int zts_get_recv_buf_size(int fd)
@@ -0,0 +1,64 @@
+/*
+ * Copyright (c)2013-2021 ZeroTier, Inc.
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file in the project's root directory.
+ *
+ * Change Date: 2026-01-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2.0 of the Apache License.
+ */
+/****/
+
+/**
+ * @file
+ *
+ * Socket table limits and per-socket state shared with epoll
+ */
+
+#ifndef ZTS_SOCKETS_HPP
+#define ZTS_SOCKETS_HPP
+
+namespace ZeroTier {
+
+/**
+ * @brief Limit how many sockets may be open at once
+ *
+ * @param count Largest number of open sockets, 0 for as many as lwIP's socket
+ *     table holds (`ZTS_MAX_SOCKETS`)
+ * @return `ZTS_ERR_OK` if successful, `ZTS_ERR_ARG` if invalid argument.
+ */
+int zts_sockets_set_max(unsigned int count);
+
+/**
+ * @brief Forget the sockets counted against the limit, called when the node stops
+ */
+void zts_sockets_reset();
+
+/**
+ * @brief lwIP's socket number for a descriptor handed to the application
+ *
+ * @return The socket number, or -1 (which lwIP rejects with EBADF) if the
+ *     descriptor is not open
+ */
+int zts_lwip_fd(int fd);
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Whether zero-copy sends of a socket (by lwIP's socket number) have
+ * completed and wait to be collected by `zts_send_zc_complete()`. Must be
+ * called with the core lock held.
+ */
+bool zts_zc_has_completions(int fd);
+
+#ifdef __cplusplus
+}
+#endif
+
+}   // namespace ZeroTier
+
+#endif
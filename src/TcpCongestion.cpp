@@ -0,0 +1,388 @@
+/*
+ * Copyright (c)2013-2021 ZeroTier, Inc.
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file in the project's root directory.
+ *
+ * Change Date: 2026-01-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2.0 of the Apache License.
+ */
+/****/
+
+/**
+ * @file
+ *
+ * TCP congestion control algorithms
+ *
+ * Reno is lwIP's own behaviour and serves as the baseline. CUBIC follows
+ * RFC 9438. BBR is a window-based rendition of BBR v1: lwIP has no pacing,
+ * so the model (bottleneck bandwidth times minimum RTT) bounds the window
+ * instead of the sending rate, and probing cycles the window gain.
+ */
+
+#include "TcpCongestion.hpp"
+
+#include <math.h>
+#include <string.h>
+
+namespace ZeroTier {
+
+static inline uint32_t zts_cc_max(uint32_t a, uint32_t b)
+{
+    return a > b ? a : b;
+}
+
+static inline uint32_t zts_cc_min(uint32_t a, uint32_t b)
+{
+    return a < b ? a : b;
+}
+
+/**
+ * NewReno with appropriate byte counting (RFC 5681, RFC 3465 with L=2)
+ */
+class TcpReno : public TcpCongestion {
+  public:
+    TcpReno(uint32_t mss, uint32_t cwnd) : TcpCongestion(mss, cwnd), _acc(0)
+    {
+    }
+
+    const char* name() const
+    {
+        return "reno";
+    }
+
+    void onAck(int64_t now, uint32_t acked, int32_t rtt, uint32_t inflight)
+    {
+        ZTS_UNUSED_ARG(now);
+        ZTS_UNUSED_ARG(rtt);
+        ZTS_UNUSED_ARG(inflight);
+        if (cwnd < ssthresh) {
+            cwnd += zts_cc_min(acked, 2 * mss);
+            return;
+        }
+        _acc += acked;
+        if (_acc >= cwnd) {
+            _acc -= cwnd;
+            cwnd += mss;
+        }
+    }
+
+    void onLoss(int64_t now, uint32_t inflight)
+    {
+        ZTS_UNUSED_ARG(now);
+        ssthresh = zts_cc_max(inflight / 2, 2 * mss);
+        cwnd = ssthresh;
+        _acc = 0;
+    }
+
+    void onTimeout(int64_t now)
+    {
+        ZTS_UNUSED_ARG(now);
+        ssthresh = zts_cc_max(cwnd / 2, 2 * mss);
+        cwnd = mss;
+        _acc = 0;
+    }
+
+  private:
+    uint32_t _acc;
+};
+
+/**
+ * CUBIC (RFC 9438). Window arithmetic is done in segments.
+ */
+class TcpCubic : public TcpCongestion {
+  public:
+    TcpCubic(uint32_t mss, uint32_t cwnd)
+        : TcpCongestion(mss, cwnd)
+        , _w(0)
+        , _w_max(0)
+        , _w_est(0)
+        , _k(0)
+        , _epoch(-1)
+        , _min_rtt(-1)
+    {
+    }
+
+    const char* name() const
+    {
+        return "cubic";
+    }
+
+    void onAck(int64_t now, uint32_t acked, int32_t rtt, uint32_t inflight)
+    {
+        ZTS_UNUSED_ARG(inflight);
+        if (rtt >= 0 && (_min_rtt < 0 || rtt < _min_rtt)) {
+            _min_rtt = rtt;
+        }
+        if (cwnd < ssthresh) {
+            cwnd += zts_cc_min(acked, 2 * mss);
+            return;
+        }
+        const double segs = (double)acked / mss;
+        if (_epoch < 0) {
+            _epoch = now;
+            _w = (double)cwnd / mss;
+            if (_w < _w_max) {
+                _k = cbrt((_w_max - _w) / C);
+            }
+            else {
+                _k = 0;
+                _w_max = _w;
+            }
+            _w_est = _w;
+        }
+        const double t = (double)(now - _epoch + (_min_rtt > 0 ? _min_rtt : 0)) / 1000.0;
+        double target = C * (t - _k) * (t - _k) * (t - _k) + _w_max;
+        if (target < _w) {
+            target = _w;
+        }
+        else if (target > 1.5 * _w) {
+            target = 1.5 * _w;
+        }
+        // Reno-friendly region
+        _w_est += ALPHA * segs / _w;
+        if (target < _w_est) {
+            _w = _w_est;
+        }
+        else {
+            _w += (target - _w) / _w * segs;
+        }
+        cwnd = (uint32_t)(_w * mss);
+    }
+
+    void onLoss(int64_t now, uint32_t inflight)
+    {
+        ZTS_UNUSED_ARG(now);
+        ZTS_UNUSED_ARG(inflight);
+        reduce();
+        cwnd = ssthresh;
+    }
+
+    void onTimeout(int64_t now)
+    {
+        ZTS_UNUSED_ARG(now);
+        reduce();
+        cwnd = mss;
+    }
+
+  private:
+    void reduce()
+    {
+        const double w = (double)cwnd / mss;
+        // Fast convergence, release bandwidth to newer flows
+        _w_max = (w < _w_max) ? w * (1.0 + BETA) / 2.0 : w;
+        ssthresh = zts_cc_max((uint32_t)(cwnd * BETA), 2 * mss);
+        _epoch = -1;
+    }
+
+    static constexpr double C = 0.4;
+    static constexpr double BETA = 0.7;
+    static constexpr double ALPHA = 3.0 * (1.0 - BETA) / (1.0 + BETA);
+
+    double _w;
+    double _w_max;
+    double _w_est;
+    double _k;
+    int64_t _epoch;
+    int32_t _min_rtt;
+};
+
+// Rounds over which the bottleneck bandwidth maximum is kept
+#define ZTS_BBR_BW_ROUNDS 10
+// Lifetime of the minimum RTT, and time spent re-measuring it (ms)
+#define ZTS_BBR_MIN_RTT_WIN  10000
+#define ZTS_BBR_PROBE_RTT_MS 200
+
+/**
+ * BBR, see the top of this file
+ */
+class TcpBbr : public TcpCongestion {
+  public:
+    TcpBbr(uint32_t mss, uint32_t cwnd) : TcpCongestion(mss, cwnd)
+    {
+        _state = STARTUP;
+        _delivered = 0;
+        _round = 0;
+        _round_start = -1;
+        _round_delivered = 0;
+        _next_round = 0;
+        memset(_bw, 0, sizeof(_bw));
+        _full_bw = 0;
+        _full_cnt = 0;
+        _min_rtt = -1;
+        _min_rtt_stamp = 0;
+        _probe_rtt_done = 0;
+        _cycle = 0;
+    }
+
+    const char* name() const
+    {
+        return "bbr";
+    }
+
+    void onAck(int64_t now, uint32_t acked, int32_t rtt, uint32_t inflight)
+    {
+        _delivered += acked;
+        if (rtt >= 0) {
+            const bool expired = (now - _min_rtt_stamp) > ZTS_BBR_MIN_RTT_WIN;
+            if (_min_rtt < 0 || rtt <= _min_rtt || expired) {
+                _min_rtt = rtt;
+                _min_rtt_stamp = now;
+            }
+            if (expired && _state != PROBE_RTT && _state != STARTUP) {
+                _state = PROBE_RTT;
+                _probe_rtt_done = now + ZTS_BBR_PROBE_RTT_MS;
+            }
+        }
+        if (_round_start < 0) {
+            startRound(now, inflight);
+        }
+        else if (_delivered >= _next_round) {
+            endRound(now, inflight);
+        }
+        updateCwnd(acked, inflight);
+    }
+
+    void onLoss(int64_t now, uint32_t inflight)
+    {
+        ZTS_UNUSED_ARG(now);
+        // The model is unaffected by loss, only hold the window at what is
+        // in flight until the next acknowledgement recomputes it
+        cwnd = zts_cc_max(zts_cc_min(cwnd, inflight), 4 * mss);
+        ssthresh = cwnd;
+    }
+
+    void onTimeout(int64_t now)
+    {
+        ZTS_UNUSED_ARG(now);
+        cwnd = 4 * mss;
+        ssthresh = cwnd;
+    }
+
+  private:
+    enum State { STARTUP, DRAIN, PROBE_BW, PROBE_RTT };
+
+    // Bytes per millisecond
+    double maxBw() const
+    {
+        double bw = 0;
+        for (unsigned int i = 0; i < ZTS_BBR_BW_ROUNDS; ++i) {
+            if (_bw[i] > bw) {
+                bw = _bw[i];
+            }
+        }
+        return bw;
+    }
+
+    uint32_t bdp() const
+    {
+        return (uint32_t)(maxBw() * (_min_rtt > 0 ? _min_rtt : 1));
+    }
+
+    void startRound(int64_t now, uint32_t inflight)
+    {
+        _round_start = now;
+        _round_delivered = _delivered;
+        _next_round = _delivered + zts_cc_max(inflight, mss);
+        _round++;
+        _bw[_round % ZTS_BBR_BW_ROUNDS] = 0;
+    }
+
+    void endRound(int64_t now, uint32_t inflight)
+    {
+        const int64_t elapsed = now - _round_start;
+        if (elapsed > 0) {
+            double& slot = _bw[_round % ZTS_BBR_BW_ROUNDS];
+            const double bw = (double)(_delivered - _round_delivered) / elapsed;
+            if (bw > slot) {
+                slot = bw;
+            }
+        }
+        const double bw = maxBw();
+        switch (_state) {
+            case STARTUP:
+                if (bw >= _full_bw * 1.25) {
+                    _full_bw = bw;
+                    _full_cnt = 0;
+                }
+                else if (++_full_cnt >= 3) {
+                    _state = DRAIN;
+                }
+                break;
+            case DRAIN:
+                if (inflight <= bdp()) {
+                    _state = PROBE_BW;
+                    _cycle = (unsigned int)(_round % 8);
+                }
+                break;
+            case PROBE_BW:
+                _cycle = (_cycle + 1) % 8;
+                break;
+            case PROBE_RTT:
+                if (now >= _probe_rtt_done) {
+                    _min_rtt_stamp = now;
+                    _state = (_full_cnt >= 3) ? PROBE_BW : STARTUP;
+                }
+                break;
+        }
+        startRound(now, inflight);
+    }
+
+    void updateCwnd(uint32_t acked, uint32_t inflight)
+    {
+        ZTS_UNUSED_ARG(inflight);
+        static const double gains[8] = { 1.25, 0.75, 1, 1, 1, 1, 1, 1 };
+        const uint32_t floor = 4 * mss;
+        switch (_state) {
+            case STARTUP:
+                cwnd += acked;
+                break;
+            case DRAIN:
+                cwnd = zts_cc_max(bdp(), floor);
+                break;
+            case PROBE_BW:
+                // Headroom for delayed and stretched acknowledgements
+                cwnd = zts_cc_max((uint32_t)(gains[_cycle] * bdp()) + 2 * mss, floor);
+                break;
+            case PROBE_RTT:
+                cwnd = floor;
+                break;
+        }
+        ssthresh = cwnd;
+    }
+
+    State _state;
+    uint64_t _delivered;
+    uint64_t _round;
+    int64_t _round_start;
+    uint64_t _round_delivered;
+    uint64_t _next_round;
+    double _bw[ZTS_BBR_BW_ROUNDS];
+    double _full_bw;
+    unsigned int _full_cnt;
+    int32_t _min_rtt;
+    int64_t _min_rtt_stamp;
+    int64_t _probe_rtt_done;
+    unsigned int _cycle;
+};
+
+TcpCongestion* zts_tcp_cc_create(const char* name, uint32_t mss, uint32_t cwnd)
+{
+    if (! name) {
+        return NULL;
+    }
+    if (strcmp(name, "reno") == 0) {
+        return new TcpReno(mss, cwnd);
+    }
+    if (strcmp(name, "cubic") == 0) {
+        return new TcpCubic(mss, cwnd);
+    }
+    if (strcmp(name, "bbr") == 0) {
+        return new TcpBbr(mss, cwnd);
+    }
+    return NULL;
+}
+
+}   // namespace ZeroTier
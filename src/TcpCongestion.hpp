@@ -0,0 +1,81 @@
+/*
+ * Copyright (c)2013-2021 ZeroTier, Inc.
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file in the project's root directory.
+ *
+ * Change Date: 2026-01-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2.0 of the Apache License.
+ */
+/****/
+
+/**
+ * @file
+ *
+ * TCP congestion control algorithms
+ */
+
+#ifndef ZTS_TCP_CONGESTION_HPP
+#define ZTS_TCP_CONGESTION_HPP
+
+#include "Debug.hpp"
+
+#include <stdint.h>
+
+// Longest algorithm name, including the terminator (as TCP_CA_NAME_MAX on Linux)
+#define ZTS_TCP_CC_NAME_MAX 16
+
+namespace ZeroTier {
+
+/**
+ * A congestion control algorithm for one connection. Driven by the stack
+ * with acknowledgements, losses and timeouts, and owns the congestion window
+ * and slow start threshold (in bytes) that the stack then applies.
+ *
+ * Independent of lwIP so that it can be exercised by bench-tcp-cc.
+ */
+class TcpCongestion {
+  public:
+    TcpCongestion(uint32_t mss, uint32_t cwnd) : cwnd(cwnd), ssthresh(0xffffffff), mss(mss)
+    {
+    }
+
+    virtual ~TcpCongestion()
+    {
+    }
+
+    virtual const char* name() const = 0;
+
+    /**
+     * New data was acknowledged
+     *
+     * @param now Current time (ms)
+     * @param acked Number of newly acknowledged bytes
+     * @param rtt Round trip time sample (ms), or -1 if none was taken
+     * @param inflight Bytes still unacknowledged
+     */
+    virtual void onAck(int64_t now, uint32_t acked, int32_t rtt, uint32_t inflight) = 0;
+
+    /** Loss detected from duplicate acknowledgements, once per window */
+    virtual void onLoss(int64_t now, uint32_t inflight) = 0;
+
+    /** Retransmission timeout */
+    virtual void onTimeout(int64_t now) = 0;
+
+    uint32_t cwnd;
+    uint32_t ssthresh;
+    uint32_t mss;
+};
+
+/**
+ * @brief Create an algorithm by name ("reno", "cubic" or "bbr")
+ *
+ * @return New algorithm, or NULL if the name is unknown
+ */
+TcpCongestion* zts_tcp_cc_create(const char* name, uint32_t mss, uint32_t cwnd);
+
+}   // namespace ZeroTier
+
+#endif
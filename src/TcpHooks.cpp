@@ -0,0 +1,967 @@
+/*
+ * Copyright (c)2013-2021 ZeroTier, Inc.
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file in the project's root directory.
+ *
+ * Change Date: 2026-01-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2.0 of the Apache License.
+ */
+/****/
+
+/**
+ * @file
+ *
+ * lwIP TCP hooks, extending lwIP's sender with pluggable congestion control
+ * and SACK based loss recovery
+ *
+ * Congestion control: lwIP has no interface for it, so the algorithms in
+ * TcpCongestion.cpp are driven from the input hook and their window written
+ * back to the pcb. The hook runs before each segment is processed, so it
+ * accounts for the acknowledgement, fast retransmit or timeout that
+ * followed the previous segment, timestamped when that segment arrived.
+ * lwIP's own adjustment for a segment is therefore overridden at the next.
+ * The algorithm is selected with the TCP_CONGESTION socket option, which is
+ * also handled here as lwIP does not know it.
+ *
+ * Loss recovery: lwIP advertises SACK to its peers but ignores the blocks
+ * they send, and only ever retransmits the first unacknowledged segment
+ * before falling back to a retransmission timeout. Here the output hook
+ * records every transmission and the input hook builds a scoreboard from
+ * the SACK blocks of each acknowledgement. Segments are declared lost by
+ * RACK (RFC 8985): once a segment sent later has been delivered and the
+ * reordering window has passed. Lost segments are moved back from the
+ * unacknowledged to the unsent queue and lwIP sends them again, once the
+ * segment has been processed (never from the hook itself). A tail loss
+ * probe retransmits the last segment when acknowledgements stop, so that
+ * losses at the end of a flight are found by RACK rather than by lwIP's
+ * retransmission timer. After a timeout the scoreboard is discarded, as the
+ * receiver may have reneged on what it selectively acknowledged.
+ *
+ * Buffer tuning: lwIP's TCP_WND and TCP_SND_BUF are fixed at build time, as
+ * the largest values allowed. Pcbs get the stack's tuned send buffer and
+ * receive window, or their socket's overrides, from here.
+ */
+
+#include "lwip_hooks.h"
+
+#include "TcpCongestion.hpp"
+#include "ZeroTierSockets.h"
+#include "lwip/def.h"
+#include "lwip/priv/sockets_priv.h"
+#include "lwip/priv/tcp_priv.h"
+#include "lwip/sys.h"
+#include "lwip/tcp.h"
+#include "lwip/timeouts.h"
+
+#include <deque>
+#include <set>
+#include <stdint.h>
+#include <string.h>
+
+#define ZTS_TCP_EXT_ID_NONE 0xff
+
+// Flags of a transmission record
+#define ZTS_TCP_XMIT_SACKED  0x01
+#define ZTS_TCP_XMIT_LOST    0x02
+#define ZTS_TCP_XMIT_RETRANS 0x04
+
+#define ZTS_TCP_OPT_SACK 5
+
+// Lower bound of the tail loss probe timeout, and allowance for a delayed
+// acknowledgement when a single segment is outstanding (ms)
+#define ZTS_TCP_TLP_MIN      10
+#define ZTS_TCP_TLP_WCDELACK 200
+
+namespace ZeroTier {
+
+// Index 0 is lwIP's own congestion control, which needs no state
+static const char* _cc_names[] = { "reno", "cubic", "bbr" };
+
+#define ZTS_TCP_CC_COUNT (sizeof(_cc_names) / sizeof(_cc_names[0]))
+
+/**
+ * One transmission of a segment. Sequence numbers are those of the segment's
+ * data, and ts the time (ms) it was last sent.
+ */
+struct zts_tcp_xmit {
+    u32_t seq;
+    u32_t end;
+    u32_t ts;
+    u8_t flags;
+};
+
+/**
+ * State of a synchronized connection. Before that the ext arg of a pcb only
+ * records the congestion control selected, tagged as (index << 1) | 1, which
+ * tcp_listen() can copy and accepted connections inherit without sharing.
+ */
+struct zts_tcp_ext {
+    struct tcp_pcb* pcb;
+    TcpCongestion* cc;   // NULL when lwIP's own is used
+    // Congestion control, as of the previous segment
+    u32_t lastack;
+    u32_t last_input;
+    int32_t rtt;
+    u8_t nrtx;
+    bool in_recovery;
+    // Outstanding transmissions in sequence order
+    std::deque<zts_tcp_xmit> xmits;
+    u32_t snd_max;
+    u32_t ackno;
+    unsigned int lost;   // Records marked lost and not yet sent again
+    // RACK, the most recently sent segment known to be delivered
+    bool rack_valid;
+    u32_t rack_ts;
+    u32_t rack_end;
+    u32_t rack_rtt;
+    u32_t reo_timeout;
+    u32_t min_rtt;
+    u32_t srtt;
+    // One reduction per window of data, until snd_max at the loss is acknowledged
+    bool recovering;
+    u32_t recover;
+    bool tlp_out;
+    uint64_t deadline;   // Of the RACK or TLP timer, 0 if it is not armed
+    bool rexmit_scheduled;
+};
+
+static u8_t _ext_id = ZTS_TCP_EXT_ID_NONE;
+
+static void zts_tcp_rack_timeout(zts_tcp_ext* ext);
+static void zts_tcp_timer_cancel(zts_tcp_ext* ext);
+static void zts_tcp_rexmit_deferred(void* arg);
+
+static inline bool zts_tcp_ext_tagged(const void* arg)
+{
+    return ((uintptr_t)arg & 1) != 0;
+}
+
+static inline void* zts_tcp_ext_tag(unsigned int algo)
+{
+    return algo ? (void*)(((uintptr_t)algo << 1) | 1) : NULL;
+}
+
+static inline unsigned int zts_tcp_ext_algo(const void* arg)
+{
+    return (unsigned int)((uintptr_t)arg >> 1);
+}
+
+static void zts_tcp_ext_destroy(u8_t id, void* data)
+{
+    ZTS_UNUSED_ARG(id);
+    if (data && ! zts_tcp_ext_tagged(data)) {
+        zts_tcp_ext* ext = (zts_tcp_ext*)data;
+        zts_tcp_timer_cancel(ext);
+        sys_untimeout(zts_tcp_rexmit_deferred, ext);
+        delete ext->cc;
+        delete ext;
+    }
+}
+
+static err_t zts_tcp_ext_passive_open(u8_t id, struct tcp_pcb_listen* lpcb, struct tcp_pcb* cpcb);
+
+static const struct tcp_ext_arg_callbacks _ext_callbacks = { zts_tcp_ext_destroy, zts_tcp_ext_passive_open };
+
+static err_t zts_tcp_ext_passive_open(u8_t id, struct tcp_pcb_listen* lpcb, struct tcp_pcb* cpcb)
+{
+    void* arg = tcp_ext_arg_get((struct tcp_pcb*)lpcb, id);
+    if (arg && zts_tcp_ext_tagged(arg)) {
+        tcp_ext_arg_set_callbacks(cpcb, id, &_ext_callbacks);
+        tcp_ext_arg_set(cpcb, id, arg);
+    }
+    return ERR_OK;
+}
+
+static inline tcpwnd_size_t zts_tcp_wnd_clamp(u32_t wnd)
+{
+    return (tcpwnd_size_t)LWIP_MIN(wnd, (u32_t)((tcpwnd_size_t)-1));
+}
+
+static inline bool zts_tcp_synchronized(const struct tcp_pcb* pcb)
+{
+    return pcb->state >= ESTABLISHED && pcb->state <= LAST_ACK;
+}
+
+// State of a synchronized pcb, created on first use
+static zts_tcp_ext* zts_tcp_ext_get(struct tcp_pcb* pcb)
+{
+    if (_ext_id == ZTS_TCP_EXT_ID_NONE) {
+        _ext_id = tcp_ext_arg_alloc_id();
+    }
+    void* arg = tcp_ext_arg_get(pcb, _ext_id);
+    if (arg && ! zts_tcp_ext_tagged(arg)) {
+        return (zts_tcp_ext*)arg;
+    }
+    zts_tcp_ext* ext = new zts_tcp_ext();
+    ext->pcb = pcb;
+    if (arg) {
+        ext->cc = zts_tcp_cc_create(_cc_names[zts_tcp_ext_algo(arg)], pcb->mss, pcb->cwnd);
+    }
+    ext->lastack = pcb->lastack;
+    ext->last_input = sys_now();
+    ext->rtt = -1;
+    ext->nrtx = pcb->nrtx;
+    ext->in_recovery = (pcb->flags & TF_INFR) != 0;
+    ext->snd_max = pcb->snd_nxt;
+    ext->ackno = pcb->lastack;
+    tcp_ext_arg_set_callbacks(pcb, _ext_id, &_ext_callbacks);
+    tcp_ext_arg_set(pcb, _ext_id, ext);
+    return ext;
+}
+
+//----------------------------------------------------------------------------//
+// Buffer tuning                                                              //
+//----------------------------------------------------------------------------//
+
+/*
+ * The receive window a pcb is limited to is kept in its own ext arg, as
+ * (wnd << 1) | applied. lwIP opens the window to TCP_WND when window scaling
+ * is negotiated, so the limit is applied once that is done: to an accepted
+ * pcb before its SYN|ACK is sent, and to a connecting one from the output
+ * hook, as the ACK of the peer's SYN|ACK is sent. Until then it only records
+ * the window, which tcp_listen() copies and accepted connections inherit.
+ */
+static u8_t _tune_id = ZTS_TCP_EXT_ID_NONE;
+
+static err_t zts_tcp_tune_passive_open(u8_t id, struct tcp_pcb_listen* lpcb, struct tcp_pcb* cpcb);
+
+static const struct tcp_ext_arg_callbacks _tune_callbacks = { NULL, zts_tcp_tune_passive_open };
+
+static inline uintptr_t zts_tcp_tune_get(const struct tcp_pcb* pcb)
+{
+    return (_tune_id == ZTS_TCP_EXT_ID_NONE) ? 0 : (uintptr_t)tcp_ext_arg_get(pcb, _tune_id);
+}
+
+static void zts_tcp_tune_set(struct tcp_pcb* pcb, u32_t wnd, bool applied)
+{
+    if (_tune_id == ZTS_TCP_EXT_ID_NONE) {
+        _tune_id = tcp_ext_arg_alloc_id();
+    }
+    tcp_ext_arg_set_callbacks(pcb, _tune_id, &_tune_callbacks);
+    tcp_ext_arg_set(pcb, _tune_id, (void*)(((uintptr_t)wnd << 1) | (applied ? 1 : 0)));
+}
+
+// Move the receive window of a pcb from one limit to another. lwIP trims
+// what arrives to rcv_wnd, so shrinking it drops data beyond it that the
+// peer was already allowed to send, and it will have to send it again.
+static void zts_tcp_rcv_wnd_move(struct tcp_pcb* pcb, u32_t from, u32_t to)
+{
+    const tcpwnd_size_t wnd_max = TCP_WND_MAX(pcb);
+    from = LWIP_MIN(from, (u32_t)wnd_max);
+    to = LWIP_MIN(to, (u32_t)wnd_max);
+    if (to < from) {
+        const u32_t d = from - to;
+        pcb->rcv_wnd = (pcb->rcv_wnd > d) ? pcb->rcv_wnd - d : 0;
+        pcb->rcv_ann_wnd = LWIP_MIN(pcb->rcv_ann_wnd, pcb->rcv_wnd);
+    }
+    for (u32_t d = (to > from) ? to - from : 0; d;) {
+        const u16_t n = (u16_t)LWIP_MIN(d, 0xffffU);
+        tcp_recved(pcb, n);
+        d -= n;
+    }
+}
+
+static void zts_tcp_tune_apply(struct tcp_pcb* pcb, uintptr_t v)
+{
+    zts_tcp_rcv_wnd_move(pcb, TCP_WND_MAX(pcb), (u32_t)(v >> 1));
+    tcp_ext_arg_set(pcb, _tune_id, (void*)(v | 1));
+}
+
+static err_t zts_tcp_tune_passive_open(u8_t id, struct tcp_pcb_listen* lpcb, struct tcp_pcb* cpcb)
+{
+    const uintptr_t v = (uintptr_t)tcp_ext_arg_get((struct tcp_pcb*)lpcb, id);
+    if (! v) {
+        return ERR_OK;
+    }
+    const u32_t wnd = (u32_t)(v >> 1);
+    cpcb->snd_buf = zts_tcp_snd_buf;
+    zts_tcp_tune_set(cpcb, wnd, true);
+    zts_tcp_rcv_wnd_move(cpcb, TCP_WND_MAX(cpcb), wnd);
+    return ERR_OK;
+}
+
+//----------------------------------------------------------------------------//
+// Congestion control                                                         //
+//----------------------------------------------------------------------------//
+
+static void zts_tcp_cc_input(struct tcp_pcb* pcb, zts_tcp_ext* ext, u32_t at, bool entered, bool timeout)
+{
+    TcpCongestion* cc = ext->cc;
+    const u32_t acked = TCP_SEQ_GT(pcb->lastack, ext->lastack) ? pcb->lastack - ext->lastack : 0;
+    const u32_t inflight = pcb->snd_nxt - pcb->lastack;
+    ext->lastack = pcb->lastack;
+    cc->mss = pcb->mss;
+    if (acked) {
+        cc->onAck(at, acked, ext->rtt, inflight);
+    }
+    ext->rtt = -1;
+    if (entered) {
+        cc->onLoss(at, inflight);
+    }
+    else if (timeout) {
+        cc->onTimeout(at);
+    }
+    // lwIP inflates the window for each duplicate acknowledgement during
+    // fast recovery and deflates it to ssthresh at the end, leave it to that
+    pcb->ssthresh = zts_tcp_wnd_clamp(cc->ssthresh);
+    if (! (pcb->flags & TF_INFR)) {
+        pcb->cwnd = zts_tcp_wnd_clamp(cc->cwnd);
+    }
+    else if (entered) {
+        pcb->cwnd = zts_tcp_wnd_clamp(cc->ssthresh + 3 * pcb->mss);
+    }
+}
+
+// Connections accepted from a listening pcb inherit its algorithm
+static int zts_tcp_set_congestion(struct tcp_pcb* pcb, const char* name)
+{
+    unsigned int algo = 0;
+    while (algo < ZTS_TCP_CC_COUNT && strcmp(_cc_names[algo], name) != 0) {
+        algo++;
+    }
+    if (algo == ZTS_TCP_CC_COUNT) {
+        return ENOENT;
+    }
+    if (_ext_id == ZTS_TCP_EXT_ID_NONE) {
+        _ext_id = tcp_ext_arg_alloc_id();
+    }
+    void* arg = tcp_ext_arg_get(pcb, _ext_id);
+    if (arg && ! zts_tcp_ext_tagged(arg)) {
+        // Switch a synchronized connection over from its current window
+        zts_tcp_ext* ext = (zts_tcp_ext*)arg;
+        delete ext->cc;
+        ext->cc = algo ? zts_tcp_cc_create(_cc_names[algo], pcb->mss, pcb->cwnd) : NULL;
+        ext->lastack = pcb->lastack;
+        return 0;
+    }
+    tcp_ext_arg_set_callbacks(pcb, _ext_id, &_ext_callbacks);
+    tcp_ext_arg_set(pcb, _ext_id, zts_tcp_ext_tag(algo));
+    return 0;
+}
+
+static const char* zts_tcp_get_congestion(const struct tcp_pcb* pcb)
+{
+    void* arg = (_ext_id == ZTS_TCP_EXT_ID_NONE) ? NULL : tcp_ext_arg_get(pcb, _ext_id);
+    if (! arg) {
+        return _cc_names[0];
+    }
+    if (zts_tcp_ext_tagged(arg)) {
+        return _cc_names[zts_tcp_ext_algo(arg)];
+    }
+    TcpCongestion* cc = ((zts_tcp_ext*)arg)->cc;
+    return cc ? cc->name() : _cc_names[0];
+}
+
+//----------------------------------------------------------------------------//
+// SACK scoreboard and RACK-TLP                                               //
+//----------------------------------------------------------------------------//
+
+// Index of the first record at or after seq
+static size_t zts_tcp_xmit_lower_bound(const zts_tcp_ext* ext, u32_t seq)
+{
+    const std::deque<zts_tcp_xmit>& q = ext->xmits;
+    if (q.empty()) {
+        return 0;
+    }
+    const u32_t base = q.front().seq;
+    size_t lo = 0, hi = q.size();
+    while (lo < hi) {
+        const size_t mid = (lo + hi) / 2;
+        if (q[mid].seq - base < seq - base) {
+            lo = mid + 1;
+        }
+        else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+static zts_tcp_xmit* zts_tcp_xmit_find(zts_tcp_ext* ext, u32_t seq)
+{
+    const size_t i = zts_tcp_xmit_lower_bound(ext, seq);
+    return (i < ext->xmits.size() && ext->xmits[i].seq == seq) ? &ext->xmits[i] : NULL;
+}
+
+// A record was delivered, cumulatively or selectively
+static void zts_tcp_rack_update(zts_tcp_ext* ext, const zts_tcp_xmit& x, u32_t now)
+{
+    const u32_t rtt = now - x.ts;
+    if (x.flags & ZTS_TCP_XMIT_RETRANS) {
+        if (rtt < ext->min_rtt) {
+            return;   // Too soon, this acknowledges an earlier transmission
+        }
+    }
+    else {
+        ext->min_rtt = (! ext->min_rtt || rtt < ext->min_rtt) ? LWIP_MAX(rtt, 1) : ext->min_rtt;
+        ext->srtt = ext->srtt ? (7 * ext->srtt + rtt) / 8 : rtt;
+        ext->rtt = (int32_t)rtt;
+    }
+    if (! ext->rack_valid || (int32_t)(x.ts - ext->rack_ts) > 0
+        || (x.ts == ext->rack_ts && TCP_SEQ_GT(x.end, ext->rack_end))) {
+        ext->rack_valid = true;
+        ext->rack_ts = x.ts;
+        ext->rack_end = x.end;
+        ext->rack_rtt = rtt;
+    }
+}
+
+static void zts_tcp_sack_block(zts_tcp_ext* ext, u32_t left, u32_t right, u32_t now)
+{
+    // Ignore D-SACK and anything not outstanding
+    if (! TCP_SEQ_LT(left, right) || TCP_SEQ_LT(left, ext->ackno) || TCP_SEQ_GT(right, ext->snd_max)) {
+        return;
+    }
+    std::deque<zts_tcp_xmit>& q = ext->xmits;
+    for (size_t i = zts_tcp_xmit_lower_bound(ext, left); i < q.size() && TCP_SEQ_LEQ(q[i].end, right); ++i) {
+        zts_tcp_xmit& x = q[i];
+        if (x.flags & ZTS_TCP_XMIT_SACKED) {
+            continue;
+        }
+        if (x.flags & ZTS_TCP_XMIT_LOST) {
+            ext->lost--;
+        }
+        x.flags = (x.flags & ~ZTS_TCP_XMIT_LOST) | ZTS_TCP_XMIT_SACKED;
+        zts_tcp_rack_update(ext, x, now);
+    }
+}
+
+// Mark segments sent before the most recently delivered one as lost once the
+// reordering window has passed, and set reo_timeout to when the next may be
+static void zts_tcp_rack_detect(zts_tcp_ext* ext, u32_t now)
+{
+    ext->reo_timeout = 0;
+    if (! ext->rack_valid) {
+        return;
+    }
+    const u32_t reo_wnd = ext->min_rtt / 4;
+    for (zts_tcp_xmit& x : ext->xmits) {
+        if (! TCP_SEQ_LT(x.seq, ext->rack_end)) {
+            break;
+        }
+        if ((x.flags & (ZTS_TCP_XMIT_SACKED | ZTS_TCP_XMIT_LOST)) || (int32_t)(x.ts - ext->rack_ts) > 0) {
+            continue;
+        }
+        const int32_t remaining = (int32_t)(ext->rack_rtt + reo_wnd) - (int32_t)(now - x.ts);
+        if (remaining <= 0) {
+            x.flags |= ZTS_TCP_XMIT_LOST;
+            ext->lost++;
+        }
+        else if (! ext->reo_timeout || (u32_t)remaining < ext->reo_timeout) {
+            ext->reo_timeout = (u32_t)remaining;
+        }
+    }
+}
+
+// Discard what the receiver selectively acknowledged, after a timeout
+static void zts_tcp_sack_reset(zts_tcp_ext* ext)
+{
+    for (zts_tcp_xmit& x : ext->xmits) {
+        x.flags &= ~(ZTS_TCP_XMIT_SACKED | ZTS_TCP_XMIT_LOST);
+    }
+    ext->lost = 0;
+    ext->rack_valid = false;
+    ext->reo_timeout = 0;
+    ext->recovering = false;
+    ext->tlp_out = false;
+}
+
+/*
+ * The RACK and TLP timers of all connections share one lwIP timeout. Their
+ * deadlines move on nearly every acknowledgement, and lwIP keeps timeouts in
+ * a list, so one timeout per connection made each move cost a walk past all
+ * the others. Deadlines are kept in order here instead, and the shared
+ * timeout is only moved when the earliest one comes forward. If it moves
+ * back, the timeout fires early, finds nothing due and is set again.
+ */
+static std::set<std::pair<uint64_t, zts_tcp_ext*> > _timers;
+static uint64_t _timers_due = 0;   // Of the shared timeout, 0 if it is not armed
+static bool _timers_firing = false;
+
+// sys_now() extended to 64 bits, so that deadlines sort across its wrap
+static uint64_t zts_tcp_now()
+{
+    static u32_t last = 0;
+    static uint64_t now = 0;
+    const u32_t t = sys_now();
+    now += (u32_t)(t - last);
+    last = t;
+    return now;
+}
+
+static void zts_tcp_timers_fire(void* arg);
+
+static void zts_tcp_timers_schedule()
+{
+    if (_timers_firing || _timers.empty()) {
+        return;
+    }
+    const uint64_t due = _timers.begin()->first;
+    if (_timers_due && _timers_due <= due) {
+        return;
+    }
+    if (_timers_due) {
+        sys_untimeout(zts_tcp_timers_fire, NULL);
+    }
+    const uint64_t now = zts_tcp_now();
+    sys_timeout((due > now) ? (u32_t)(due - now) : 0, zts_tcp_timers_fire, NULL);
+    _timers_due = due;
+}
+
+static void zts_tcp_timers_fire(void* arg)
+{
+    ZTS_UNUSED_ARG(arg);
+    _timers_due = 0;
+    _timers_firing = true;
+    const uint64_t now = zts_tcp_now();
+    while (! _timers.empty() && _timers.begin()->first <= now) {
+        zts_tcp_ext* ext = _timers.begin()->second;
+        _timers.erase(_timers.begin());
+        ext->deadline = 0;
+        zts_tcp_rack_timeout(ext);
+    }
+    _timers_firing = false;
+    zts_tcp_timers_schedule();
+}
+
+static void zts_tcp_timer_cancel(zts_tcp_ext* ext)
+{
+    if (ext->deadline) {
+        _timers.erase(std::make_pair(ext->deadline, ext));
+        ext->deadline = 0;
+    }
+}
+
+// Arm the reordering timer if RACK is waiting on one, otherwise the tail loss probe
+static void zts_tcp_arm_timer(zts_tcp_ext* ext)
+{
+    u32_t ms = ext->reo_timeout;
+    if (! ms) {
+        if (ext->xmits.empty() || ext->tlp_out || ext->recovering || ! ext->srtt) {
+            zts_tcp_timer_cancel(ext);
+            return;
+        }
+        ms = 2 * ext->srtt + (ext->xmits.size() == 1 ? ZTS_TCP_TLP_WCDELACK : 0);
+        ms = LWIP_MAX(ms, ZTS_TCP_TLP_MIN);
+    }
+    const uint64_t deadline = zts_tcp_now() + ms;
+    if (deadline != ext->deadline) {
+        zts_tcp_timer_cancel(ext);
+        ext->deadline = deadline;
+        _timers.insert(std::make_pair(deadline, ext));
+    }
+    zts_tcp_timers_schedule();
+}
+
+// Move an unacknowledged segment to the unsent queue, keeping it sorted, as tcp_rexmit()
+static void zts_tcp_seg_to_unsent(struct tcp_pcb* pcb, struct tcp_seg* seg)
+{
+    // Karn's algorithm, as tcp_rexmit(): the acknowledgement of a segment sent
+    // more than once can't be told apart, so the pending RTT sample is dropped
+    pcb->rttest = 0;
+    struct tcp_seg** cur = &pcb->unsent;
+    while (*cur && TCP_SEQ_LT(lwip_ntohl((*cur)->tcphdr->seqno), lwip_ntohl(seg->tcphdr->seqno))) {
+        cur = &((*cur)->next);
+    }
+    seg->next = *cur;
+    *cur = seg;
+#if TCP_OVERSIZE
+    if (seg->next == NULL) {
+        pcb->unsent_oversize = 0;
+    }
+#endif
+}
+
+// Send the unsent queue, retransmissions included, regardless of Nagle
+static void zts_tcp_output_now(struct tcp_pcb* pcb)
+{
+    const bool nodelay = (pcb->flags & TF_NODELAY) != 0;
+    tcp_set_flags(pcb, TF_NODELAY);
+    tcp_output(pcb);
+    if (! nodelay) {
+        tcp_clear_flags(pcb, TF_NODELAY);
+    }
+}
+
+// Reduce the window once per window of data, as a fast retransmit would
+static void zts_tcp_enter_recovery(struct tcp_pcb* pcb, zts_tcp_ext* ext, u32_t pipe, u32_t now)
+{
+    if (ext->recovering) {
+        return;
+    }
+    ext->recovering = true;
+    ext->recover = ext->snd_max;
+    if (pcb->flags & TF_INFR) {
+        return;   // lwIP's own fast retransmit already did
+    }
+    if (ext->cc) {
+        ext->cc->onLoss(now, pipe);
+        pcb->ssthresh = zts_tcp_wnd_clamp(ext->cc->ssthresh);
+    }
+    else {
+        const tcpwnd_size_t wnd = LWIP_MIN(pcb->cwnd, pcb->snd_wnd);
+        pcb->ssthresh = LWIP_MAX(wnd / 2, (tcpwnd_size_t)(2 * pcb->mss));
+    }
+    pcb->cwnd = pcb->ssthresh;
+    // Also keeps lwIP from reducing the window again on duplicate acknowledgements
+    tcp_set_flags(pcb, TF_INFR);
+    ext->in_recovery = true;
+}
+
+// Send the segments marked lost again, as far as the window allows
+static void zts_tcp_rexmit_lost(struct tcp_pcb* pcb, zts_tcp_ext* ext)
+{
+    if (! ext->lost || ! zts_tcp_synchronized(pcb)) {
+        return;
+    }
+    u32_t pipe = 0;
+    for (const zts_tcp_xmit& x : ext->xmits) {
+        if (! (x.flags & (ZTS_TCP_XMIT_SACKED | ZTS_TCP_XMIT_LOST))) {
+            pipe += x.end - x.seq;
+        }
+    }
+    zts_tcp_enter_recovery(pcb, ext, pipe, sys_now());
+    // At least one segment, as a fast retransmit
+    u32_t room = LWIP_MAX(pcb->cwnd > pipe ? pcb->cwnd - pipe : 0, pcb->mss);
+    bool moved = false;
+    struct tcp_seg** link = &pcb->unacked;
+    while (*link && room) {
+        struct tcp_seg* seg = *link;
+        const zts_tcp_xmit* x = zts_tcp_xmit_find(ext, lwip_ntohl(seg->tcphdr->seqno));
+        // Segments still referenced by the driver can't be sent again yet
+        if (x && (x->flags & ZTS_TCP_XMIT_LOST) && seg->p->ref == 1) {
+            *link = seg->next;
+            zts_tcp_seg_to_unsent(pcb, seg);
+            room = room > seg->len ? room - seg->len : 0;
+            moved = true;
+            continue;
+        }
+        link = &seg->next;
+    }
+    if (moved) {
+        zts_tcp_output_now(pcb);
+    }
+}
+
+// Tail loss probe: new data if the window allows, otherwise the last segment again
+static void zts_tcp_probe(struct tcp_pcb* pcb, zts_tcp_ext* ext)
+{
+    if (ext->tlp_out || ext->recovering || ! pcb->unacked) {
+        return;
+    }
+    ext->tlp_out = true;
+    const u32_t wnd = LWIP_MIN(pcb->snd_wnd, pcb->cwnd);
+    struct tcp_seg* seg = pcb->unsent;
+    if (seg && lwip_ntohl(seg->tcphdr->seqno) - pcb->lastack + seg->len <= wnd) {
+        zts_tcp_output_now(pcb);
+        return;
+    }
+    struct tcp_seg** link = &pcb->unacked;
+    while ((*link)->next) {
+        link = &((*link)->next);
+    }
+    seg = *link;
+    if (seg->p->ref != 1) {
+        return;
+    }
+    *link = NULL;
+    zts_tcp_seg_to_unsent(pcb, seg);
+    zts_tcp_output_now(pcb);
+}
+
+static void zts_tcp_rexmit_deferred(void* arg)
+{
+    zts_tcp_ext* ext = (zts_tcp_ext*)arg;
+    ext->rexmit_scheduled = false;
+    zts_tcp_rexmit_lost(ext->pcb, ext);
+    zts_tcp_arm_timer(ext);
+}
+
+static void zts_tcp_rack_timeout(zts_tcp_ext* ext)
+{
+    struct tcp_pcb* pcb = ext->pcb;
+    if (! zts_tcp_synchronized(pcb)) {
+        return;
+    }
+    const bool reordering = ext->reo_timeout != 0;
+    zts_tcp_rack_detect(ext, sys_now());
+    if (ext->lost) {
+        zts_tcp_rexmit_lost(pcb, ext);
+    }
+    else if (! reordering) {
+        zts_tcp_probe(pcb, ext);
+    }
+    zts_tcp_arm_timer(ext);
+}
+
+static inline u8_t zts_tcp_opt_byte(const struct tcp_hdr* hdr, u16_t opt1len, const u8_t* opt2, u16_t i)
+{
+    return (i < opt1len) ? ((const u8_t*)(hdr + 1))[i] : opt2[i - opt1len];
+}
+
+static u32_t zts_tcp_opt_u32(const struct tcp_hdr* hdr, u16_t opt1len, const u8_t* opt2, u16_t i)
+{
+    u32_t v = 0;
+    for (u16_t k = 0; k < 4; ++k) {
+        v = (v << 8) | zts_tcp_opt_byte(hdr, opt1len, opt2, i + k);
+    }
+    return v;
+}
+
+// Update the scoreboard from the acknowledgement and SACK blocks of a segment
+static void zts_tcp_sack_input(
+    zts_tcp_ext* ext,
+    const struct tcp_hdr* hdr,
+    u16_t optlen,
+    u16_t opt1len,
+    const u8_t* opt2,
+    u32_t now)
+{
+    const u16_t flags = TCPH_FLAGS(hdr);
+    const u32_t ackno = lwip_ntohl(hdr->ackno);
+    // The peer acknowledges a FIN one past the data
+    if (! (flags & TCP_ACK) || (flags & TCP_RST) || TCP_SEQ_LT(ackno, ext->ackno)
+        || TCP_SEQ_GT(ackno, ext->snd_max + 1)) {
+        return;
+    }
+    if (TCP_SEQ_GT(ackno, ext->ackno)) {
+        ext->ackno = ackno;
+        ext->tlp_out = false;
+    }
+    std::deque<zts_tcp_xmit>& q = ext->xmits;
+    while (! q.empty() && TCP_SEQ_LEQ(q.front().end, ackno)) {
+        const zts_tcp_xmit& x = q.front();
+        if (x.flags & ZTS_TCP_XMIT_LOST) {
+            ext->lost--;
+        }
+        if (! (x.flags & ZTS_TCP_XMIT_SACKED)) {
+            zts_tcp_rack_update(ext, x, now);
+        }
+        q.pop_front();
+    }
+    for (u16_t i = 0; i < optlen;) {
+        const u8_t kind = zts_tcp_opt_byte(hdr, opt1len, opt2, i);
+        if (kind == LWIP_TCP_OPT_EOL) {
+            break;
+        }
+        if (kind == LWIP_TCP_OPT_NOP) {
+            i++;
+            continue;
+        }
+        if (i + 1 >= optlen) {
+            break;
+        }
+        const u8_t len = zts_tcp_opt_byte(hdr, opt1len, opt2, i + 1);
+        if (len < 2 || i + len > optlen) {
+            break;
+        }
+        if (kind == ZTS_TCP_OPT_SACK) {
+            for (u16_t b = i + 2; b + 8 <= i + len; b += 8) {
+                zts_tcp_sack_block(
+                    ext,
+                    zts_tcp_opt_u32(hdr, opt1len, opt2, b),
+                    zts_tcp_opt_u32(hdr, opt1len, opt2, b + 4),
+                    now);
+            }
+        }
+        i += len;
+    }
+    if (ext->recovering && TCP_SEQ_GEQ(ackno, ext->recover)) {
+        ext->recovering = false;
+    }
+    zts_tcp_rack_detect(ext, now);
+    if (ext->lost && ! ext->rexmit_scheduled) {
+        // Retransmit once lwIP is done with this segment
+        sys_timeout(0, zts_tcp_rexmit_deferred, ext);
+        ext->rexmit_scheduled = true;
+    }
+    zts_tcp_arm_timer(ext);
+}
+
+// TCP pcb of a socket, listening or not
+static struct tcp_pcb* zts_tcp_sock_pcb(struct lwip_sock* sock)
+{
+    if (! sock || ! sock->conn || NETCONNTYPE_GROUP(netconn_type(sock->conn)) != NETCONN_TCP) {
+        return NULL;
+    }
+    return sock->conn->pcb.tcp;
+}
+
+}   // namespace ZeroTier
+
+using namespace ZeroTier;
+
+extern "C" err_t
+zts_tcp_hook_input(struct tcp_pcb* pcb, struct tcp_hdr* hdr, u16_t optlen, u16_t opt1len, u8_t* opt2, struct pbuf* p)
+{
+    ZTS_UNUSED_ARG(p);
+    if (! zts_tcp_synchronized(pcb)) {
+        return ERR_OK;
+    }
+    const uintptr_t tune = zts_tcp_tune_get(pcb);
+    if (tune && ! (tune & 1)) {
+        zts_tcp_tune_apply(pcb, tune);
+    }
+    zts_tcp_ext* ext = zts_tcp_ext_get(pcb);
+    const u32_t now = sys_now();
+    const u32_t at = ext->last_input;
+    ext->last_input = now;
+    // What lwIP made of the previous segment, and its timers since
+    const bool infr = (pcb->flags & TF_INFR) != 0;
+    const bool entered = infr && ! ext->in_recovery;
+    const bool timeout = ! entered && pcb->nrtx > ext->nrtx && pcb->cwnd <= pcb->mss;
+    ext->nrtx = pcb->nrtx;
+    ext->in_recovery = infr;
+    if (entered && ! ext->recovering) {
+        ext->recovering = true;
+        ext->recover = ext->snd_max;
+    }
+    if (timeout) {
+        zts_tcp_sack_reset(ext);
+    }
+    if (ext->cc) {
+        zts_tcp_cc_input(pcb, ext, at, entered, timeout);
+    }
+    zts_tcp_sack_input(ext, hdr, optlen, opt1len, opt2, now);
+    return ERR_OK;
+}
+
+extern "C" u32_t* zts_tcp_hook_output(struct pbuf* p, struct tcp_hdr* hdr, const struct tcp_pcb* pcb, u32_t* opts)
+{
+    if (! pcb || ! zts_tcp_synchronized(pcb)) {
+        return opts;
+    }
+    // A connecting pcb that was just synchronized, limit its window before it is first announced
+    const uintptr_t tune = zts_tcp_tune_get(pcb);
+    if (tune && ! (tune & 1)) {
+        struct tcp_pcb* tpcb = (struct tcp_pcb*)pcb;
+        zts_tcp_tune_apply(tpcb, tune);
+        tpcb->rcv_ann_right_edge = pcb->rcv_nxt + pcb->rcv_ann_wnd;
+        hdr->wnd = lwip_htons(TCPWND_MIN16(RCV_WND_SCALE(pcb, pcb->rcv_ann_wnd)));
+    }
+    // The payload may still start ahead of the header on retransmission
+    const u32_t hdr_end = (u32_t)((u8_t*)hdr - (u8_t*)p->payload) + TCPH_HDRLEN_BYTES(hdr);
+    if (p->tot_len <= hdr_end) {
+        return opts;
+    }
+    // Only the ext arg is written, not the pcb itself
+    zts_tcp_ext* ext = zts_tcp_ext_get((struct tcp_pcb*)pcb);
+    const u32_t now = sys_now();
+    const u32_t seq = lwip_ntohl(hdr->seqno);
+    const u32_t end = seq + (p->tot_len - hdr_end);
+    if (TCP_SEQ_GEQ(seq, ext->snd_max)) {
+        ext->xmits.push_back({ seq, end, now, 0 });
+        ext->snd_max = end;
+    }
+    else {
+        zts_tcp_xmit* x = zts_tcp_xmit_find(ext, seq);
+        if (x) {
+            if (x->flags & ZTS_TCP_XMIT_LOST) {
+                ext->lost--;
+            }
+            x->flags = (x->flags & ~(ZTS_TCP_XMIT_LOST | ZTS_TCP_XMIT_SACKED)) | ZTS_TCP_XMIT_RETRANS;
+            x->ts = now;
+            if (TCP_SEQ_GT(end, ext->snd_max) && x == &ext->xmits.back()) {
+                x->end = end;
+                ext->snd_max = end;
+            }
+        }
+    }
+    if (! ext->deadline) {
+        zts_tcp_arm_timer(ext);
+    }
+    return opts;
+}
+
+extern "C" void zts_tcp_tune(struct tcp_pcb* pcb)
+{
+    pcb->snd_buf = zts_tcp_snd_buf;
+    zts_tcp_tune_set(pcb, zts_tcp_wnd, false);
+}
+
+extern "C" void zts_tcp_set_rcv_window(struct tcp_pcb* pcb, u32_t wnd)
+{
+    const uintptr_t v = zts_tcp_tune_get(pcb);
+    wnd = LWIP_MIN(wnd, (u32_t)TCP_WND);
+    // Pcbs that were not tuned have the full window once synchronized
+    const bool applied = v ? (v & 1) != 0 : zts_tcp_synchronized(pcb);
+    if (applied) {
+        zts_tcp_rcv_wnd_move(pcb, v ? (u32_t)(v >> 1) : (u32_t)TCP_WND, wnd);
+    }
+    zts_tcp_tune_set(pcb, wnd, applied);
+}
+
+extern "C" void zts_tcp_untune(struct tcp_pcb* pcb)
+{
+    const uintptr_t v = zts_tcp_tune_get(pcb);
+    if (v & 1) {
+        const tcpwnd_size_t wnd_max = TCP_WND_MAX(pcb);
+        const u32_t withheld = wnd_max - LWIP_MIN((u32_t)(v >> 1), (u32_t)wnd_max);
+        pcb->rcv_wnd = (tcpwnd_size_t)LWIP_MIN(pcb->rcv_wnd + withheld, (u32_t)wnd_max);
+    }
+    if (v) {
+        tcp_ext_arg_set(pcb, _tune_id, NULL);
+    }
+}
+
+extern "C" int zts_sockets_hook_setsockopt(
+    int s,
+    struct lwip_sock* sock,
+    int level,
+    int optname,
+    const void* optval,
+    socklen_t optlen,
+    int* err)
+{
+    ZTS_UNUSED_ARG(s);
+    if (level != ZTS_IPPROTO_TCP || optname != ZTS_TCP_CONGESTION) {
+        return 0;
+    }
+    struct tcp_pcb* pcb = zts_tcp_sock_pcb(sock);
+    if (! pcb) {
+        *err = ENOPROTOOPT;
+    }
+    else if (! optval || optlen == 0) {
+        *err = EINVAL;
+    }
+    else {
+        // Not necessarily terminated, as on Linux
+        char name[ZTS_TCP_CC_NAME_MAX] = { 0 };
+        memcpy(name, optval, LWIP_MIN((size_t)optlen, sizeof(name) - 1));
+        *err = zts_tcp_set_congestion(pcb, name);
+    }
+    return 1;
+}
+
+extern "C" int zts_sockets_hook_getsockopt(
+    int s,
+    struct lwip_sock* sock,
+    int level,
+    int optname,
+    void* optval,
+    socklen_t* optlen,
+    int* err)
+{
+    ZTS_UNUSED_ARG(s);
+    if (level != ZTS_IPPROTO_TCP || optname != ZTS_TCP_CONGESTION) {
+        return 0;
+    }
+    struct tcp_pcb* pcb = zts_tcp_sock_pcb(sock);
+    if (! pcb) {
+        *err = ENOPROTOOPT;
+    }
+    else if (! optval || ! optlen) {
+        *err = EINVAL;
+    }
+    else {
+        const char* name = zts_tcp_get_congestion(pcb);
+        const size_t len = LWIP_MIN((size_t)*optlen, strlen(name) + 1);
+        memcpy(optval, name, len);
+        *optlen = (socklen_t)len;
+        *err = 0;
+    }
+    return 1;
+}
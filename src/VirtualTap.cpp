@@ -24,9 +24,14 @@
 #include "OSUtils.hpp"
 #include "lwip/etharp.h"
 #include "lwip/ethip6.h"
+#include "lwip/inet_chksum.h"
+#include "lwip/ip.h"
 #include "lwip/netif.h"
+#include "lwip/pbuf.h"
+#include "lwip/priv/tcp_priv.h"
 #include "lwip/sys.h"
 #include "lwip/tcpip.h"
+#include "lwip/timeouts.h"
 #include "netif/ethernet.h"
 
 #ifdef LWIP_STATS
@@ -34,21 +39,63 @@
 #endif
 
 #include "Events.hpp"
+#include "Slab.hpp"
 #include "VirtualTap.hpp"
 
+#include <new>
+
 #if defined(__WINDOWS__)
 #include "synchapi.h"
 
 #include <time.h>
 #endif
 
-#define ZTS_TAP_THREAD_POLLING_INTERVAL 50
-#define LWIP_DRIVER_LOOP_INTERVAL       100
+// TCP tuning applied to each pcb (see zts_tcp_tune() and lwipopts.h). Only
+// written by zts_lwip_driver_init() before the stack starts.
+extern "C" {
+unsigned int zts_tcp_wnd = 0xffff0;
+unsigned int zts_tcp_snd_buf = 64 * TCP_MSS;
+unsigned int zts_tcp_ooseq_max_bytes = 0;
+unsigned int zts_tcp_ooseq_max_pbufs = 0;
+}
 
 namespace ZeroTier {
 
 extern Events* zts_events;
 
+struct zts_tuning {
+    unsigned int tcp_wnd;
+    unsigned int tcp_snd_buf;
+    unsigned int tcp_ooseq_max_bytes;
+    unsigned int tcp_ooseq_max_pbufs;
+    unsigned int mem_reserve;   // Objects preallocated per allocator size class
+};
+
+// Indexed by zts_tuning_profile_t
+static const zts_tuning _tuning_profiles[] = {
+    // ZTS_TUNING_DEFAULT
+    { 0xffff0, 64 * TCP_MSS, 0, 0, 0 },
+    // ZTS_TUNING_HIGH_BDP: 8 MB window and send buffer, e.g. 10 Gbps at 6 ms
+    { 0xffff << 7, 8 * 1024 * 1024, 0, 0, 1024 },
+    // ZTS_TUNING_SMALL_FOOTPRINT: a few segments in flight, bounded reassembly
+    { 8 * TCP_MSS, 4 * TCP_MSS, 8 * TCP_MSS, 8, 0 },
+};
+
+// Tuning applied by zts_lwip_driver_init()
+static zts_tuning _tuning = _tuning_profiles[ZTS_TUNING_DEFAULT];
+
+// Inbound frame batching parameters (see zts_lwip_set_rx_burst())
+static unsigned int _rx_burst = ZTS_TAP_RX_BURST_DEFAULT;
+static unsigned int _rx_flush_latency = ZTS_TAP_RX_FLUSH_LATENCY_DEFAULT;
+
+// Length of each tap's outbound frame queue, 0 disables queuing
+static unsigned int _tx_queue_len = 0;
+// Number of sender threads per tap (see zts_lwip_set_tx_threads())
+static unsigned int _tx_threads = 0;
+
+static void zts_tap_rx_drain(VirtualTap* tap);
+static err_t zts_lwip_eth_send(VirtualTap* tap, struct pbuf* p);
+
 /**
  * Virtual tap device. ZeroTier will create one per joined network. It will
  * then be destroyed upon leaving the network.
@@ -82,9 +129,11 @@ VirtualTap::VirtualTap(
     , _phy(this, false, true)
 {
     OSUtils::ztsnprintf(vtap_full_name, VTAP_NAME_LEN, "libzt-vtap-%llx", _net_id);
-#ifndef __WINDOWS__
-    ::pipe(_shutdownSignalPipe);
-#endif
+    // Start sender threads if outbound frames are to be queued
+    unsigned int workers = _tx_threads ? _tx_threads : (_tx_queue_len ? 1 : 0);
+    for (unsigned int i = 0; i < workers; i++) {
+        _txWorkers.push_back(new VirtualTapTxWorker(this));
+    }
     // Start virtual tap thread and stack I/O loops
     _thread = Thread::start(this);
 }
@@ -92,19 +141,32 @@ VirtualTap::VirtualTap(
 VirtualTap::~VirtualTap()
 {
     _run = false;
-#ifndef __WINDOWS__
-    ::write(_shutdownSignalPipe[1], "\0", 1);
-#endif
     _phy.whack();
+    // Stop accepting frames, so that none still point at the netifs once
+    // they are removed
+    {
+        Mutex::Lock _l(_rxq_m);
+        _rxq_closed = true;
+    }
+    flush();
     zts_lwip_remove_netif(netif4);
     netif4 = NULL;
     zts_lwip_remove_netif(netif6);
     netif6 = NULL;
+    wake();
     Thread::join(_thread);
-#ifndef __WINDOWS__
-    ::close(_shutdownSignalPipe[0]);
-    ::close(_shutdownSignalPipe[1]);
-#endif
+    // Nothing can have been queued since, but free whatever the last flush missed
+    {
+        Mutex::Lock _l(_rxq_m);
+        for (unsigned int i = 0; i < _rxq_len; i++) {
+            pbuf_free((struct pbuf*)_rxq[i].p);
+        }
+        _rxq_len = 0;
+    }
+    for (size_t i = 0; i < _txWorkers.size(); i++) {
+        delete _txWorkers[i];
+    }
+    _txWorkers.clear();
 }
 
 void VirtualTap::lastConfigUpdate(uint64_t lastConfigUpdateTime)
@@ -209,6 +271,51 @@ void VirtualTap::put(const MAC& from, const MAC& to, unsigned int etherType, con
     }
 }
 
+void VirtualTap::enqueue(void* p, void* netif)
+{
+    bool queued = false;
+    bool notify = false;
+    {
+        Mutex::Lock _l(_rxq_m);
+        if (! _rxq_closed && _rxq_len < ZTS_TAP_RX_QUEUE_LEN) {
+            if (! _rxq_len) {
+                _rxq_first = OSUtils::now();
+            }
+            _rxq[_rxq_len].p = p;
+            _rxq[_rxq_len].netif = netif;
+            _rxq_len++;
+            queued = true;
+            // The stack's own replies are queued from within ethernet_input()
+            // with the core lock held, so a full burst is left to the tap thread
+            notify = (_rxq_len == 1) || (_rxq_len == _rx_burst);
+        }
+    }
+    if (! queued) {
+        // The tap thread is a whole queue behind, or the tap is being destroyed
+        pbuf_free((struct pbuf*)p);
+        return;
+    }
+    // The tap thread sleeps without a deadline while nothing is queued, give
+    // it one, or have it flush a full burst. Checked after queuing, see threadMain().
+    if (notify && _sleeping) {
+        wake();
+    }
+}
+
+void VirtualTap::flush()
+{
+    zts_tap_rx_drain(this);
+}
+
+void VirtualTap::wake()
+{
+    {
+        std::lock_guard<std::mutex> _l(_wake_m);
+        _wake_pending = true;
+    }
+    _wake_cv.notify_one();
+}
+
 void VirtualTap::scanMulticastGroups(std::vector<MulticastGroup>& added, std::vector<MulticastGroup>& removed)
 {
     std::vector<MulticastGroup> newGroups;
@@ -236,35 +343,158 @@ void VirtualTap::setMtu(unsigned int mtu)
     _mtu = mtu;
 }
 
+// Checksums left to zts_lwip_eth_tx() on a trusted link. An IPv4 UDP checksum
+// of zero means none, so fragmented datagrams stay valid without one. IPv6
+// requires it and can't be computed from a fragment, so IPv6 UDP keeps it.
+#define ZTS_TRUSTED_CHKSUM_CTRL4                                                                                       \
+    (NETIF_CHECKSUM_ENABLE_ALL & ~(NETIF_CHECKSUM_GEN_IP | NETIF_CHECKSUM_GEN_UDP | NETIF_CHECKSUM_GEN_TCP))
+#define ZTS_TRUSTED_CHKSUM_CTRL6 (NETIF_CHECKSUM_ENABLE_ALL & ~NETIF_CHECKSUM_GEN_TCP)
+
+void VirtualTap::setTrustedLink(bool trusted)
+{
+    if (! netif4 && ! netif6) {
+        // Applied by zts_netif_init4/6() once addresses are assigned
+        _trustedLink = trusted;
+        return;
+    }
+    LOCK_TCPIP_CORE();
+    _trustedLink = trusted;
+    if (netif4) {
+        NETIF_SET_CHECKSUM_CTRL((struct netif*)netif4, trusted ? ZTS_TRUSTED_CHKSUM_CTRL4 : NETIF_CHECKSUM_ENABLE_ALL);
+    }
+    if (netif6) {
+        NETIF_SET_CHECKSUM_CTRL((struct netif*)netif6, trusted ? ZTS_TRUSTED_CHKSUM_CTRL6 : NETIF_CHECKSUM_ENABLE_ALL);
+    }
+    UNLOCK_TCPIP_CORE();
+}
+
 void VirtualTap::threadMain() throw()
 {
-    fd_set readfds, nullfds;
-    struct timeval tv;
-    tv.tv_sec = 0;
-    tv.tv_usec = 0;
-    FD_ZERO(&readfds);
-    FD_ZERO(&nullfds);
-    int nfds = (int)std::max(_shutdownSignalPipe[0], 0) + 1;
 #if defined(__linux__)
     // pthread_setname_np(pthread_self(), vtap_full_name);
 #endif
 #if defined(__APPLE__)
     // pthread_setname_np(vtap_full_name);
 #endif
-    while (true) {
-        FD_SET(_shutdownSignalPipe[0], &readfds);
-        select(nfds, &readfds, &nullfds, &nullfds, &tv);
-        // writes to shutdown pipe terminate thread
-        if (FD_ISSET(_shutdownSignalPipe[0], &readfds)) {
-            break;
+    while (_run) {
+        // Announce the sleep before looking at the queue so that a frame
+        // queued after the check always finds _sleeping set and wakes us
+        _sleeping = true;
+        // Frames are normally flushed by the service thread after each poll.
+        // Flush full bursts here, and make sure none of them wait longer
+        // than the configured latency.
+        int64_t deadline = 0;
+        bool drain = false;
+        {
+            Mutex::Lock _l(_rxq_m);
+            if (_rxq_len) {
+                int64_t age = OSUtils::now() - _rxq_first;
+                if (_rxq_len >= _rx_burst || age >= (int64_t)_rx_flush_latency) {
+                    drain = true;
+                }
+                else {
+                    deadline = (int64_t)_rx_flush_latency - age;
+                }
+            }
         }
-#if defined(__WINDOWS__)
-        Sleep(ZTS_TAP_THREAD_POLLING_INTERVAL);
-#else
-        struct timespec sleepValue = { 0, 0 };
-        sleepValue.tv_nsec = ZTS_TAP_THREAD_POLLING_INTERVAL * 500000;
-        nanosleep(&sleepValue, NULL);
-#endif
+        if (drain) {
+            _sleeping = false;
+            zts_tap_rx_drain(this);
+            continue;
+        }
+        // Block until shutdown, the first queued frame, or the flush deadline
+        std::unique_lock<std::mutex> _l(_wake_m);
+        if (! _wake_pending && _run) {
+            if (deadline) {
+                _wake_cv.wait_for(_l, std::chrono::milliseconds(deadline));
+            }
+            else {
+                _wake_cv.wait(_l);
+            }
+        }
+        _sleeping = false;
+        _wake_pending = false;
+    }
+}
+
+VirtualTapTxWorker::VirtualTapTxWorker(VirtualTap* tap) : _tap(tap), _run(true)
+{
+    _thread = Thread::start(this);
+}
+
+VirtualTapTxWorker::~VirtualTapTxWorker()
+{
+    _run = false;
+    {
+        std::lock_guard<std::mutex> _l(_wake_m);
+        _wake_pending = true;
+    }
+    _wake_cv.notify_one();
+    Thread::join(_thread);
+    // Release frames that were never transmitted
+    void* p = NULL;
+    while (_q.try_dequeue(p)) {
+        pbuf_free((struct pbuf*)p);
+    }
+}
+
+bool VirtualTapTxWorker::enqueue(void* p, unsigned int max_len)
+{
+    const bool queued = _len < max_len && _q.enqueue(p);
+    if (queued) {
+        _len++;
+    }
+    else {
+        _stalled = true;
+    }
+    if (_sleeping) {
+        {
+            std::lock_guard<std::mutex> _l(_wake_m);
+            _wake_pending = true;
+        }
+        _wake_cv.notify_one();
+    }
+    return queued;
+}
+
+// Resume TCP output refused while a sender's queue was full. lwIP would
+// otherwise only retry on the next ACK or retransmission timeout.
+static void zts_tap_tx_resume(void* arg)
+{
+    ZTS_UNUSED_ARG(arg);
+    for (struct tcp_pcb* pcb = tcp_active_pcbs; pcb; pcb = pcb->next) {
+        if (pcb->unsent) {
+            tcp_output(pcb);
+        }
+    }
+}
+
+void VirtualTapTxWorker::threadMain() throw()
+{
+    void* frames[ZTS_TAP_TX_BURST];
+    while (_run) {
+        // Encrypt and send frames queued by the stack
+        size_t count;
+        while ((count = _q.try_dequeue_bulk(frames, ZTS_TAP_TX_BURST)) > 0) {
+            _len -= (unsigned int)count;
+            for (size_t i = 0; i < count; i++) {
+                zts_lwip_eth_send(_tap, (struct pbuf*)frames[i]);
+                pbuf_free((struct pbuf*)frames[i]);
+            }
+        }
+        if (_stalled.exchange(false)) {
+            tcpip_callback(zts_tap_tx_resume, NULL);
+        }
+        // Sleep until more frames arrive. The queue is re-checked after
+        // announcing that we are asleep so that a frame enqueued concurrently
+        // cannot be missed.
+        std::unique_lock<std::mutex> _l(_wake_m);
+        _sleeping = true;
+        if (! _wake_pending && ! _len && ! _stalled && _run) {
+            _wake_cv.wait(_l);
+        }
+        _sleeping = false;
+        _wake_pending = false;
     }
 }
 
@@ -292,6 +522,10 @@ static void zts_tcpip_init_done(void* arg)
     sys_sem_signal(sem);
 }
 
+// Signals the driver thread to exit, and waiters that it has
+static std::mutex _driver_m;
+static std::condition_variable _driver_cv;
+
 static void zts_main_lwip_driver_loop(void* arg)
 {
 #if defined(__linux__)
@@ -307,24 +541,76 @@ static void zts_main_lwip_driver_loop(void* arg)
     }
     tcpip_init(zts_tcpip_init_done, &sem);
     sys_sem_wait(&sem);
-    // Main loop
-    while (zts_events->getState(ZTS_STATE_STACK_RUNNING)) {
-        zts_util_delay(LWIP_DRIVER_LOOP_INTERVAL);
+    // Nothing to do here until shutdown, the stack runs in its own thread
+    {
+        std::unique_lock<std::mutex> _l(_driver_m);
+        while (zts_events->getState(ZTS_STATE_STACK_RUNNING)) {
+            _driver_cv.wait(_l);
+        }
+        _has_exited = true;
     }
-    _has_exited = true;
-    
+    _driver_cv.notify_all();
+
     //
     // no need to check if event was enqueued since NULL is being passed
     //
     zts_events->enqueue(ZTS_EVENT_STACK_DOWN, NULL);
 }
 
+int zts_lwip_set_rx_burst(unsigned int burst_size, unsigned int flush_latency_ms)
+{
+    if (burst_size < 1 || burst_size > ZTS_TAP_RX_QUEUE_LEN) {
+        return ZTS_ERR_ARG;
+    }
+    _rx_burst = burst_size;
+    _rx_flush_latency = flush_latency_ms;
+    return ZTS_ERR_OK;
+}
+
 bool zts_lwip_is_up()
 {
     Mutex::Lock _l(lwip_state_m);
     return zts_events->getState(ZTS_STATE_STACK_RUNNING);
 }
 
+int zts_lwip_set_tuning_profile(int profile)
+{
+    if (profile < ZTS_TUNING_DEFAULT || profile > ZTS_TUNING_SMALL_FOOTPRINT) {
+        return ZTS_ERR_ARG;
+    }
+    _tuning = _tuning_profiles[profile];
+    return ZTS_ERR_OK;
+}
+
+int zts_lwip_set_tcp_window(unsigned int size, unsigned int scale)
+{
+    // The shift announced to peers is fixed, it bounds the window
+    if (scale > TCP_RCV_SCALE || size < (2 * TCP_MSS) || size > (0xffffU << scale)) {
+        return ZTS_ERR_ARG;
+    }
+    _tuning.tcp_wnd = size;
+    return ZTS_ERR_OK;
+}
+
+int zts_lwip_set_tcp_send_buf(unsigned int size)
+{
+    if (size < (2 * TCP_MSS) || size > ZTS_TCP_SND_BUF_MAX) {
+        return ZTS_ERR_ARG;
+    }
+    _tuning.tcp_snd_buf = size;
+    return ZTS_ERR_OK;
+}
+
+int zts_lwip_set_tcp_ooseq_limit(unsigned int max_bytes, unsigned int max_pbufs)
+{
+    if ((max_bytes && max_bytes < TCP_MSS) || max_pbufs > 0xffff) {
+        return ZTS_ERR_ARG;
+    }
+    _tuning.tcp_ooseq_max_bytes = max_bytes;
+    _tuning.tcp_ooseq_max_pbufs = max_pbufs;
+    return ZTS_ERR_OK;
+}
+
 void zts_lwip_driver_init()
 {
     if (zts_lwip_is_up()) {
@@ -334,6 +620,12 @@ void zts_lwip_driver_init()
         return;
     }
     Mutex::Lock _l(lwip_state_m);
+    zts_tcp_wnd = _tuning.tcp_wnd;
+    zts_tcp_snd_buf = _tuning.tcp_snd_buf;
+    zts_tcp_ooseq_max_bytes = _tuning.tcp_ooseq_max_bytes;
+    zts_tcp_ooseq_max_pbufs = _tuning.tcp_ooseq_max_pbufs;
+    // Best effort, a reservation beyond the allocator's limit stops at the limit
+    zts_slab_reserve(_tuning.mem_reserve);
 #if defined(__WINDOWS__)
     sys_init();   // Required for win32 init of critical sections
 #endif
@@ -352,12 +644,74 @@ void zts_lwip_driver_shutdown()
     }
     Mutex::Lock _l(lwip_state_m);
     // Set flag to stop sending frames into the core
-    zts_events->clrState(ZTS_STATE_STACK_RUNNING);
+    {
+        std::lock_guard<std::mutex> _dl(_driver_m);
+        zts_events->clrState(ZTS_STATE_STACK_RUNNING);
+    }
+    _driver_cv.notify_all();
     // Wait until the main lwIP thread has exited
     if (_has_started) {
+        std::unique_lock<std::mutex> _dl(_driver_m);
         while (! _has_exited) {
-            zts_util_delay(LWIP_DRIVER_LOOP_INTERVAL);
+            _driver_cv.wait(_dl);
+        }
+    }
+}
+
+/*
+ * Hibernation takes lwIP's cyclic timers (ARP, ND, MLD, IGMP, reassembly,
+ * DNS) off the timer list, so with nothing else pending the tcpip thread
+ * sleeps in its mailbox until a message arrives. The TCP timer is not among
+ * them, lwIP runs it only while there are active or TIME_WAIT pcbs, so
+ * connections still close and expire. timeouts.c is built with LWIP_TESTMODE
+ * (see CMakeLists.txt) so that lwip_cyclic_timer() can be named here.
+ */
+extern "C" void lwip_cyclic_timer(void* arg);
+
+static bool _hibernating = false;   // Guarded by the core lock
+
+static void zts_lwip_nop(void* arg)
+{
+    LWIP_UNUSED_ARG(arg);
+}
+
+void zts_lwip_hibernate_driver()
+{
+    if (! zts_events->getState(ZTS_STATE_STACK_RUNNING)) {
+        return;
+    }
+    LOCK_TCPIP_CORE();
+    if (! _hibernating) {
+        _hibernating = true;
+        // Entry 0 is the TCP timer, which lwIP starts and stops on its own
+        for (int i = LWIP_TCP ? 1 : 0; i < lwip_num_cyclic_timers; ++i) {
+            sys_untimeout(lwip_cyclic_timer, LWIP_CONST_CAST(void*, &lwip_cyclic_timers[i]));
+        }
+    }
+    UNLOCK_TCPIP_CORE();
+}
+
+void zts_lwip_wake_driver()
+{
+    if (! zts_events->getState(ZTS_STATE_STACK_RUNNING)) {
+        return;
+    }
+    bool rearmed = false;
+    LOCK_TCPIP_CORE();
+    if (_hibernating) {
+        _hibernating = false;
+        for (int i = LWIP_TCP ? 1 : 0; i < lwip_num_cyclic_timers; ++i) {
+            sys_timeout(
+                lwip_cyclic_timers[i].interval_ms,
+                lwip_cyclic_timer,
+                LWIP_CONST_CAST(void*, &lwip_cyclic_timers[i]));
         }
+        rearmed = true;
+    }
+    UNLOCK_TCPIP_CORE();
+    if (rearmed) {
+        // The thread may be waiting without a deadline, have it look again
+        tcpip_try_callback(zts_lwip_nop, NULL);
     }
 }
 
@@ -374,39 +728,321 @@ void zts_lwip_remove_netif(void* netif)
     UNLOCK_TCPIP_CORE();
 }
 
+int zts_lwip_set_tx_queue(unsigned int len)
+{
+    _tx_queue_len = len;
+    return ZTS_ERR_OK;
+}
+
+int zts_lwip_set_tx_threads(unsigned int count)
+{
+    if (count > ZTS_TAP_TX_THREADS_MAX) {
+        return ZTS_ERR_ARG;
+    }
+    _tx_threads = count;
+    return ZTS_ERR_OK;
+}
+
+/**
+ * Fill in the checksums that a trusted link left out when the frame leaves
+ * the ZeroTier network: unicast to a bridged host, or multicast that a bridge
+ * may forward. ZeroTier endpoints are recognized by the first octet ZeroTier
+ * gives every MAC it derives for the network.
+ */
+static void zts_lwip_fill_chksums(VirtualTap* tap, struct netif* n, struct pbuf* p)
+{
+    u8_t* frame = (u8_t*)p->payload;
+    const struct eth_hdr* eh = (const struct eth_hdr*)frame;
+    if (eh->dest.addr[0] == MAC::firstOctetForNetwork(tap->_net_id)) {
+        return;
+    }
+    // lwIP builds the Ethernet, IP and transport headers in the first pbuf
+    u16_t hdr_len = 0;
+    u16_t proto_len = 0;
+    u8_t proto = 0;
+    ip_addr_t src, dest;
+    if (eh->type == PP_HTONS(ETHTYPE_IP)) {
+        struct ip_hdr* iph = (struct ip_hdr*)(frame + SIZEOF_ETH_HDR);
+        if (p->len < SIZEOF_ETH_HDR + IP_HLEN || p->len < SIZEOF_ETH_HDR + IPH_HL_BYTES(iph)) {
+            return;
+        }
+        hdr_len = IPH_HL_BYTES(iph);
+        if (! IF__NETIF_CHECKSUM_ENABLED(n, NETIF_CHECKSUM_GEN_IP)) {
+            IPH_CHKSUM_SET(iph, 0);
+            IPH_CHKSUM_SET(iph, inet_chksum(iph, hdr_len));
+        }
+        if (IPH_OFFSET(iph) & PP_HTONS(IP_OFFMASK | IP_MF)) {
+            return;   // TCP segments fit the MTU, a fragmented UDP datagram carries no checksum
+        }
+        proto = IPH_PROTO(iph);
+        proto_len = lwip_ntohs(IPH_LEN(iph)) - hdr_len;
+        ip_addr_copy_from_ip4(src, iph->src);
+        ip_addr_copy_from_ip4(dest, iph->dest);
+    }
+    else if (eh->type == PP_HTONS(ETHTYPE_IPV6)) {
+        struct ip6_hdr* ip6h = (struct ip6_hdr*)(frame + SIZEOF_ETH_HDR);
+        if (p->len < SIZEOF_ETH_HDR + IP6_HLEN) {
+            return;
+        }
+        hdr_len = IP6_HLEN;
+        proto = IP6H_NEXTH(ip6h);
+        proto_len = IP6H_PLEN(ip6h);
+        ip_addr_copy_from_ip6_packed(src, ip6h->src);
+        ip_addr_copy_from_ip6_packed(dest, ip6h->dest);
+    }
+    else {
+        return;
+    }
+    u16_t offset;
+    if (proto == IP_PROTO_TCP && ! IF__NETIF_CHECKSUM_ENABLED(n, NETIF_CHECKSUM_GEN_TCP)) {
+        offset = 16;
+    }
+    else if (proto == IP_PROTO_UDP && ! IF__NETIF_CHECKSUM_ENABLED(n, NETIF_CHECKSUM_GEN_UDP)) {
+        offset = 6;
+    }
+    else {
+        return;
+    }
+    const u16_t skip = SIZEOF_ETH_HDR + hdr_len;
+    if (p->len < skip + offset + 2) {
+        return;
+    }
+    u8_t* field = frame + skip + offset;
+    field[0] = field[1] = 0;
+    pbuf_remove_header(p, skip);
+    u16_t chksum = ip_chksum_pseudo(p, proto, proto_len, &src, &dest);
+    pbuf_add_header(p, skip);
+    if (proto == IP_PROTO_UDP && chksum == 0) {
+        chksum = 0xffff;
+    }
+    memcpy(field, &chksum, sizeof(chksum));
+}
+
+// Whether any part of a frame lives in memory owned by the application (PBUF_ROM, PBUF_REF)
+static bool zts_lwip_pbuf_borrowed(struct pbuf* p)
+{
+    for (; p; p = p->next) {
+        if ((p->type_internal & PBUF_TYPE_ALLOC_SRC_MASK) == PBUF_TYPE_ALLOC_SRC_MASK_STD_MEMP_PBUF) {
+            return true;
+        }
+    }
+    return false;
+}
+
 signed char zts_lwip_eth_tx(struct netif* n, struct pbuf* p)
 {
-    if (! n) {
+    if (! n || ! p) {
         return ERR_IF;
     }
-    struct pbuf* q;
-    char buf[ZT_MAX_MTU + 32] = { 0 };
-    char* bufptr;
-    int totalLength = 0;
-
+    if (p->tot_len < sizeof(struct eth_hdr) || p->tot_len > ZT_MAX_MTU + 32) {
+        return ERR_BUF;
+    }
     VirtualTap* tap = (VirtualTap*)n->state;
-    bufptr = buf;
-    for (q = p; q != NULL; q = q->next) {
-        memcpy(bufptr, q->payload, q->len);
-        bufptr += q->len;
-        totalLength += q->len;
+    if (tap->_trustedLink && p->len >= sizeof(struct eth_hdr)) {
+        zts_lwip_fill_chksums(tap, n, p);
+    }
+    size_t workers = tap->_txWorkers.size();
+    if (! workers) {
+        return zts_lwip_eth_send(tap, p);
+    }
+    // Pick a sender by destination MAC so that each peer's frames stay in order
+    size_t shard = 0;
+    if (workers > 1 && p->len >= ETH_HWADDR_LEN) {
+        const uint8_t* dest = (const uint8_t*)p->payload;
+        uint32_t h = 2166136261u;
+        for (int i = 0; i < ETH_HWADDR_LEN; i++) {
+            h = (h ^ dest[i]) * 16777619u;
+        }
+        shard = h % workers;
+    }
+    // Hold a reference until the sender has handed the frame to ZeroTier.
+    // lwIP will not rewrite a TCP segment while its pbuf is still referenced.
+    // Data lwIP merely points to (zts_send_zc()) may be reused as soon as it is
+    // acknowledged, possibly while a retransmission is still queued, so it is
+    // gathered into a frame of our own.
+    struct pbuf* q = p;
+    if (zts_lwip_pbuf_borrowed(p)) {
+        if (! (q = pbuf_clone(PBUF_RAW, PBUF_RAM, p))) {
+            return ERR_MEM;
+        }
+    }
+    else {
+        pbuf_ref(p);
+    }
+    if (! tap->_txWorkers[shard]->enqueue(q, _tx_queue_len ? _tx_queue_len : ZTS_TAP_TX_QUEUE_LEN_DEFAULT)) {
+        // Queue is full: push back on the stack, the sender has TCP retry
+        // the segment once it has drained the queue
+        pbuf_free(q);
+        return ERR_MEM;
+    }
+    return ERR_OK;
+}
+
+/**
+ * Hand an outbound Ethernet frame to ZeroTier
+ */
+static err_t zts_lwip_eth_send(VirtualTap* tap, struct pbuf* p)
+{
+    struct eth_hdr ethhdr;
+    const char* data = NULL;
+    int len = p->tot_len - sizeof(struct eth_hdr);
+    // Only filled (without zeroing) when the frame has to be gathered
+    char buf[ZT_MAX_MTU + 32];
+
+    if (p->len >= sizeof(struct eth_hdr) && p->len == p->tot_len) {
+        // Whole frame in one pbuf: hand it over in place
+        memcpy(&ethhdr, p->payload, sizeof(struct eth_hdr));
+        data = (const char*)p->payload + sizeof(struct eth_hdr);
+    }
+    else if (
+        p->len == sizeof(struct eth_hdr) && p->next && p->next->len == p->next->tot_len) {
+        // Header prepended in its own pbuf ahead of a contiguous payload
+        memcpy(&ethhdr, p->payload, sizeof(struct eth_hdr));
+        data = (const char*)p->next->payload;
+    }
+    else {
+        // Scattered chain: gather the payload once, directly after the header
+        pbuf_copy_partial(p, &ethhdr, sizeof(struct eth_hdr), 0);
+        pbuf_copy_partial(p, buf, (u16_t)len, sizeof(struct eth_hdr));
+        data = buf;
     }
-    struct eth_hdr* ethhdr;
-    ethhdr = (struct eth_hdr*)buf;
 
     MAC src_mac;
     MAC dest_mac;
-    src_mac.setTo(ethhdr->src.addr, 6);
-    dest_mac.setTo(ethhdr->dest.addr, 6);
+    src_mac.setTo(ethhdr.src.addr, 6);
+    dest_mac.setTo(ethhdr.dest.addr, 6);
 
-    char* data = buf + sizeof(struct eth_hdr);
-    int len = totalLength - sizeof(struct eth_hdr);
-    int proto = Utils::ntoh((uint16_t)ethhdr->type);
+    int proto = Utils::ntoh((uint16_t)ethhdr.type);
     tap->_handler(tap->_arg, NULL, tap->_net_id, src_mac, dest_mac, proto, 0, data, len);
 
     return ERR_OK;
 }
 
+#if ZTS_LWIP_RX_FRAME_POOL
+
+// Bytes placed in front of the Ethernet header so that the IP header which
+// follows it lands on a 4-byte boundary
+#define ZTS_RX_FRAME_ALIGN_PAD 2
+
+/**
+ * Inbound frame buffer. The Ethernet header is synthesized directly into the
+ * reserved headroom in front of the payload so the whole frame is presented
+ * to lwIP as a single contiguous custom pbuf.
+ */
+struct zts_rx_frame {
+    struct pbuf_custom pc;   // Must be first, lwIP hands us back this pointer
+    struct zts_rx_frame* next;
+    char buf[ZTS_RX_FRAME_ALIGN_PAD + sizeof(struct eth_hdr) + LWIP_MTU];
+};
+
+// Idle frames ready for reuse
+static struct zts_rx_frame* _rx_frame_pool = NULL;
+static unsigned int _rx_frame_pool_len = 0;
+static Mutex _rx_frame_pool_m;
+
+/**
+ * Called by lwIP (from whichever thread drops the last reference) once it
+ * is done with a frame. Return the buffer to the pool.
+ */
+static void zts_rx_frame_free(struct pbuf* p)
+{
+    struct zts_rx_frame* f = (struct zts_rx_frame*)p;
+    {
+        Mutex::Lock _l(_rx_frame_pool_m);
+        if (_rx_frame_pool_len < ZTS_LWIP_RX_FRAME_POOL_MAX) {
+            f->next = _rx_frame_pool;
+            _rx_frame_pool = f;
+            _rx_frame_pool_len++;
+            return;
+        }
+    }
+    delete f;
+}
+
+static struct zts_rx_frame* zts_rx_frame_alloc()
+{
+    {
+        Mutex::Lock _l(_rx_frame_pool_m);
+        if (_rx_frame_pool) {
+            struct zts_rx_frame* f = _rx_frame_pool;
+            _rx_frame_pool = f->next;
+            _rx_frame_pool_len--;
+            return f;
+        }
+    }
+    struct zts_rx_frame* f = new (std::nothrow) struct zts_rx_frame;
+    if (f) {
+        f->pc.custom_free_function = zts_rx_frame_free;
+    }
+    return f;
+}
+
+/**
+ * Wrap an inbound frame in a pooled custom pbuf. The payload is written once
+ * into its final position behind the headroom, the Ethernet header is built
+ * in place and no pbuf chain has to be walked.
+ */
+static struct pbuf* zts_rx_frame_pbuf(const struct eth_hdr* ethhdr, const void* data, unsigned int len)
+{
+    if (len > LWIP_MTU) {
+        return NULL;
+    }
+    struct zts_rx_frame* f = zts_rx_frame_alloc();
+    if (! f) {
+        return NULL;
+    }
+    char* frame = f->buf + ZTS_RX_FRAME_ALIGN_PAD;
+    memcpy(frame, ethhdr, sizeof(struct eth_hdr));
+    memcpy(frame + sizeof(struct eth_hdr), data, len);
+    struct pbuf* p = pbuf_alloced_custom(
+        PBUF_RAW,
+        (u16_t)(len + sizeof(struct eth_hdr)),
+        PBUF_REF,
+        &f->pc,
+        frame,
+        (u16_t)(sizeof(f->buf) - ZTS_RX_FRAME_ALIGN_PAD));
+    if (! p) {
+        zts_rx_frame_free((struct pbuf*)f);
+    }
+    return p;
+}
+
+#endif   // ZTS_LWIP_RX_FRAME_POOL
+
+/**
+ * Copy an inbound frame into a newly allocated PBUF_RAM chain
+ */
+static struct pbuf* zts_rx_copy_pbuf(const struct eth_hdr* ethhdr, const void* data, unsigned int len)
+{
+    struct pbuf *p, *q;
+    p = pbuf_alloc(PBUF_RAW, (uint16_t)len + sizeof(struct eth_hdr), PBUF_RAM);
+    if (! p) {
+        // DEBUG_ERROR("dropped packet: unable to allocate memory for
+        // pbuf");
+        return NULL;
+    }
+    // First pbuf gets Ethernet header at start
+    q = p;
+    if (q->len < sizeof(struct eth_hdr)) {
+        pbuf_free(p);
+        // DEBUG_ERROR("dropped packet: first pbuf smaller than Ethernet
+        // header");
+        return NULL;
+    }
+    // Copy frame data into pbuf
+    const char* dataptr = reinterpret_cast<const char*>(data);
+    memcpy(q->payload, ethhdr, sizeof(struct eth_hdr));
+    int remainingPayloadSpace = q->len - sizeof(struct eth_hdr);
+    memcpy((char*)q->payload + sizeof(struct eth_hdr), dataptr, remainingPayloadSpace);
+    dataptr += remainingPayloadSpace;
+    // Remaining pbufs (if any) get rest of data
+    while ((q = q->next)) {
+        memcpy(q->payload, dataptr, q->len);
+        dataptr += q->len;
+    }
+    return p;
+}
+
 void zts_lwip_eth_rx(
     VirtualTap* tap,
     const MAC& from,
@@ -421,57 +1057,84 @@ void zts_lwip_eth_rx(
     if (! zts_events->getState(ZTS_STATE_STACK_RUNNING)) {
         return;
     }
-    struct pbuf *p, *q;
+    struct netif* n = NULL;
+    if (etherType == 0x800 || etherType == 0x806) {
+        n = (struct netif*)tap->netif4;
+    }
+    if (etherType == 0x86DD) {
+        n = (struct netif*)tap->netif6;
+    }
+    if (! n) {
+        return;
+    }
+    struct pbuf* p = NULL;
     struct eth_hdr ethhdr;
     from.copyTo(ethhdr.src.addr, 6);
     to.copyTo(ethhdr.dest.addr, 6);
     ethhdr.type = Utils::hton((uint16_t)etherType);
 
-    p = pbuf_alloc(PBUF_RAW, (uint16_t)len + sizeof(struct eth_hdr), PBUF_RAM);
+#if ZTS_LWIP_RX_FRAME_POOL
+    p = zts_rx_frame_pbuf(&ethhdr, data, len);
+#endif
+    // Oversized frames (or pool disabled) fall back to a copied chain
     if (! p) {
-        // DEBUG_ERROR("dropped packet: unable to allocate memory for
-        // pbuf");
-        return;
+        p = zts_rx_copy_pbuf(&ethhdr, data, len);
     }
-    // First pbuf gets Ethernet header at start
-    q = p;
-    if (q->len < sizeof(ethhdr)) {
-        pbuf_free(p);
-        p = NULL;
-        // DEBUG_ERROR("dropped packet: first pbuf smaller than Ethernet
-        // header");
+    if (! p) {
         return;
     }
-    // Copy frame data into pbuf
-    const char* dataptr = reinterpret_cast<const char*>(data);
-    memcpy(q->payload, &ethhdr, sizeof(ethhdr));
-    int remainingPayloadSpace = q->len - sizeof(ethhdr);
-    memcpy((char*)q->payload + sizeof(ethhdr), dataptr, remainingPayloadSpace);
-    dataptr += remainingPayloadSpace;
-    // Remaining pbufs (if any) get rest of data
-    while ((q = q->next)) {
-        memcpy(q->payload, dataptr, q->len);
-        dataptr += q->len;
-    }
-    // Feed packet into stack
-    int err;
+    tap->enqueue(p, n);
+}
 
-    if (Utils::ntoh(ethhdr.type) == 0x800 || Utils::ntoh(ethhdr.type) == 0x806) {
-        if (tap->netif4) {
-            if ((err = ((struct netif*)tap->netif4)->input(p, (struct netif*)tap->netif4)) != ERR_OK) {
-                // DEBUG_ERROR("packet input error (%d)", err);
-                pbuf_free(p);
-            }
+/**
+ * Feed every queued frame of a tap into the stack. The queue is swapped out
+ * under _rxq_m, which is released before the core lock is taken: replies
+ * sent by the stack may be queued again from within ethernet_input().
+ * _rxfeed_m keeps bursts in order, and lets flush() wait for one in progress
+ * before a netif is removed.
+ */
+static void zts_tap_rx_drain(VirtualTap* tap)
+{
+    Mutex::Lock _f(tap->_rxfeed_m);
+    VirtualTap::RxFrame batch[ZTS_TAP_RX_QUEUE_LEN];
+    unsigned int count = 0;
+    {
+        Mutex::Lock _l(tap->_rxq_m);
+        count = tap->_rxq_len;
+        memcpy(batch, tap->_rxq, count * sizeof(batch[0]));
+        tap->_rxq_len = 0;
+    }
+    if (! count) {
+        return;
+    }
+    if (! zts_events->getState(ZTS_STATE_STACK_RUNNING)) {
+        for (unsigned int i = 0; i < count; i++) {
+            pbuf_free((struct pbuf*)batch[i].p);
         }
+        return;
     }
-    if (Utils::ntoh(ethhdr.type) == 0x86DD) {
-        if (tap->netif6) {
-            if ((err = ((struct netif*)tap->netif6)->input(p, (struct netif*)tap->netif6)) != ERR_OK) {
-                // DEBUG_ERROR("packet input error (%d)", err);
-                pbuf_free(p);
-            }
+#if LWIP_TCPIP_CORE_LOCKING_INPUT
+    // Take the core lock once for the whole burst and call the Ethernet input
+    // function directly, as tcpip_input() would otherwise lock per frame
+    LOCK_TCPIP_CORE();
+#endif
+    for (unsigned int i = 0; i < count; i++) {
+        struct pbuf* p = (struct pbuf*)batch[i].p;
+        struct netif* n = (struct netif*)batch[i].netif;
+        int err;
+#if LWIP_TCPIP_CORE_LOCKING_INPUT
+        err = ethernet_input(p, n);
+#else
+        err = n->input(p, n);
+#endif
+        if (err != ERR_OK) {
+            // DEBUG_ERROR("packet input error (%d)", err);
+            pbuf_free(p);
         }
     }
+#if LWIP_TCPIP_CORE_LOCKING_INPUT
+    UNLOCK_TCPIP_CORE();
+#endif
 }
 
 bool zts_lwip_is_netif_up(void* n)
@@ -502,6 +1165,7 @@ static err_t zts_netif_init4(struct netif* n)
                | NETIF_FLAG_LINK_UP | NETIF_FLAG_UP;
     n->hwaddr_len = sizeof(n->hwaddr);
     tap->_mac.copyTo(n->hwaddr, n->hwaddr_len);
+    NETIF_SET_CHECKSUM_CTRL(n, tap->_trustedLink ? ZTS_TRUSTED_CHKSUM_CTRL4 : NETIF_CHECKSUM_ENABLE_ALL);
     return ERR_OK;
 }
 
@@ -522,6 +1186,7 @@ static err_t zts_netif_init6(struct netif* n)
     n->mtu = std::min(LWIP_MTU, (int)tap->_mtu);
     n->flags = NETIF_FLAG_BROADCAST | NETIF_FLAG_ETHARP | NETIF_FLAG_ETHERNET | NETIF_FLAG_IGMP | NETIF_FLAG_MLD6
                | NETIF_FLAG_LINK_UP | NETIF_FLAG_UP;
+    NETIF_SET_CHECKSUM_CTRL(n, tap->_trustedLink ? ZTS_TRUSTED_CHKSUM_CTRL6 : NETIF_CHECKSUM_ENABLE_ALL);
     return ERR_OK;
 }
 
@@ -635,6 +1300,8 @@ void zts_lwip_remove_address_from_netif(void* tapref, const InetAddress& ip)
     if (! n) {
         return;
     }
+    // Do not leave queued frames pointing at the netif being removed
+    vtap->flush();
     zts_lwip_remove_netif(n);
 }
 
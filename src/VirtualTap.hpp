@@ -23,12 +23,72 @@
 #define ZTS_LWIP_THREAD_NAME "ZTNetworkStackThread"
 #define VTAP_NAME_LEN        64
 
-#define ZTS_UNUSED_ARG(x) (void)x
+/**
+ * Deliver inbound frames to lwIP in pooled custom pbufs that reserve headroom
+ * for the Ethernet header instead of allocating and filling a fresh PBUF_RAM
+ * chain per frame. Frames are returned to the pool when lwIP frees them.
+ */
+#ifndef ZTS_LWIP_RX_FRAME_POOL
+#define ZTS_LWIP_RX_FRAME_POOL 1
+#endif
+
+/**
+ * Maximum number of idle receive frame buffers kept for reuse. Buffers freed
+ * by lwIP beyond this count are released to the system allocator.
+ */
+#ifndef ZTS_LWIP_RX_FRAME_POOL_MAX
+#define ZTS_LWIP_RX_FRAME_POOL_MAX 512
+#endif
+
+/**
+ * Capacity of each tap's receive queue. Inbound frames are collected here and
+ * handed to the stack in bursts under a single acquisition of the core lock.
+ */
+#define ZTS_TAP_RX_QUEUE_LEN 256
+
+/**
+ * Default number of queued frames that triggers an immediate flush
+ */
+#define ZTS_TAP_RX_BURST_DEFAULT 32
+
+/**
+ * Default maximum time (ms) a frame may wait in a receive queue before the
+ * tap thread flushes it
+ */
+#define ZTS_TAP_RX_FLUSH_LATENCY_DEFAULT 2
+
+/**
+ * Maximum number of outbound frames the tap thread hands to ZeroTier per
+ * pass over its transmit queue
+ */
+#define ZTS_TAP_TX_BURST 64
+
+/**
+ * Per-worker outbound queue length used when sender threads are enabled
+ * without an explicit transmit queue length
+ */
+#define ZTS_TAP_TX_QUEUE_LEN_DEFAULT 1024
+
+/**
+ * Upper bound on the number of sender (crypto) threads per tap
+ */
+#define ZTS_TAP_TX_THREADS_MAX 64
+
+/**
+ * Largest TCP send buffer that may be configured for the stack
+ */
+#define ZTS_TCP_SND_BUF_MAX (64 * 1024 * 1024)
 
+#include "Debug.hpp"
 #include "Events.hpp"
 #include "MAC.hpp"
 #include "Phy.hpp"
 #include "Thread.hpp"
+#include "concurrentqueue.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
 
 namespace ZeroTier {
 
@@ -39,6 +99,45 @@ class MulticastGroup;
 class Events;
 struct InetAddress;
 
+class VirtualTap;
+
+/**
+ * Sender thread that drains one shard of a tap's outbound frames into
+ * ZeroTier, where they are encrypted and authenticated. All frames for a
+ * given destination are mapped to the same worker which preserves per-flow
+ * ordering while work for different peers proceeds in parallel.
+ */
+class VirtualTapTxWorker {
+  public:
+    VirtualTapTxWorker(VirtualTap* tap);
+
+    ~VirtualTapTxWorker();
+
+    /**
+     * Queue a frame (struct pbuf*) for transmission. The caller must
+     * already hold a reference to it. Returns false if the queue is full.
+     */
+    bool enqueue(void* p, unsigned int max_len);
+
+    void threadMain() throw();
+
+    VirtualTap* _tap;
+    volatile bool _run;
+
+    moodycamel::ConcurrentQueue<void*> _q;
+    std::atomic<unsigned int> _len { 0 };
+    // Set when a frame was refused, so that output is resumed once drained
+    std::atomic<bool> _stalled { false };
+
+    // Lets producers wake the worker without a syscall per frame
+    std::mutex _wake_m;
+    std::condition_variable _wake_cv;
+    std::atomic<bool> _sleeping { false };
+    bool _wake_pending = false;
+
+    Thread _thread;
+};
+
 /**
  * Virtual tap device. ZeroTier will create one per joined network. It will
  * then be destroyed upon leaving the network.
@@ -111,6 +210,23 @@ class VirtualTap {
      */
     void put(const MAC& from, const MAC& to, unsigned int etherType, const void* data, unsigned int len);
 
+    /**
+     * Queue an inbound frame (already wrapped in a pbuf) for the given netif.
+     * Wakes the tap thread to flush the queue once the configured burst size
+     * has been reached. Drops the frame if the queue is full.
+     */
+    void enqueue(void* p, void* netif);
+
+    /**
+     * Hand all queued inbound frames to the stack under one core lock
+     */
+    void flush();
+
+    /**
+     * Wake the tap thread if it is waiting for work
+     */
+    void wake();
+
     /**
      * Scan multicast groups
      */
@@ -121,6 +237,12 @@ class VirtualTap {
      */
     void setMtu(unsigned int mtu);
 
+    /**
+     * Leave checksums out of frames sent to other ZeroTier endpoints on this
+     * network, whose frames are already authenticated by ZeroTier
+     */
+    void setTrustedLink(bool trusted);
+
     /**
      * Calls main network stack loops
      */
@@ -164,15 +286,35 @@ class VirtualTap {
     MAC _mac;
     unsigned int _mtu;
     uint64_t _net_id;
+    bool _trustedLink = false;   // Only changed with the core lock held once netifs exist
     Phy<VirtualTap*> _phy;
 
     Thread _thread;
 
-    int _shutdownSignalPipe[2] = { 0 };
-
     std::vector<MulticastGroup> _multicastGroups;
     Mutex _multicastGroups_m;
 
+    // Inbound frames waiting to be flushed into the stack
+    struct RxFrame {
+        void* p;
+        void* netif;
+    } _rxq[ZTS_TAP_RX_QUEUE_LEN];
+    unsigned int _rxq_len = 0;
+    int64_t _rxq_first = 0;     // Time at which the oldest queued frame arrived
+    bool _rxq_closed = false;   // Frames are dropped instead, the tap is going away
+    Mutex _rxq_m;
+    Mutex _rxfeed_m;   // Held while a burst is fed into the stack
+
+    // Sender threads for outbound frames. Empty when frames are transmitted
+    // synchronously by the thread holding the core lock.
+    std::vector<VirtualTapTxWorker*> _txWorkers;
+
+    // Wakes the tap thread on shutdown
+    std::mutex _wake_m;
+    std::condition_variable _wake_cv;
+    std::atomic<bool> _sleeping { false };
+    bool _wake_pending = false;
+
     void phyOnTcpConnect(PhySocket* sock, void** uptr, bool success)
     {
         ZTS_UNUSED_ARG(sock);
@@ -207,20 +349,84 @@ class VirtualTap {
 bool zts_lwip_is_netif_up(void* netif);
 
 /**
- * @brief Increase the delay multiplier for the main driver loop
+ * @brief Stop the stack's timers until zts_lwip_wake_driver() is called
  *
- * @usage This should be called when we know the stack won't be used by any
- * virtual taps
+ * @usage Called once no network is joined, so that an idle node does not wake
+ *     up. Only lwIP's cyclic timers are stopped, the tcpip thread keeps
+ *     handling messages and the TCP timer runs while connections remain.
  */
 void zts_lwip_hibernate_driver();
 
 /**
- * @brief Decrease the delay multiplier for the main driver loop
+ * @brief Resume the stack's timers after zts_lwip_hibernate_driver()
  *
- * @usage This should be called when at least one virtual tap is active
+ * @usage Called before a network's tap is created
  */
 void zts_lwip_wake_driver();
 
+/**
+ * @brief Set how inbound frames are batched before being handed to the stack
+ *
+ * @param burst_size Number of queued frames that triggers a flush (1 disables batching)
+ * @param flush_latency_ms Longest time a frame may remain queued
+ * @return `ZTS_ERR_OK` if successful, `ZTS_ERR_ARG` if invalid argument.
+ */
+int zts_lwip_set_rx_burst(unsigned int burst_size, unsigned int flush_latency_ms);
+
+/**
+ * @brief Set the length of each tap's outbound frame queue
+ *
+ * @param len Maximum number of queued frames, or 0 to transmit synchronously
+ * from the thread holding the stack's core lock
+ * @return `ZTS_ERR_OK` if successful, `ZTS_ERR_ARG` if invalid argument.
+ */
+int zts_lwip_set_tx_queue(unsigned int len);
+
+/**
+ * @brief Set the number of sender threads that encrypt outbound frames for
+ * each tap
+ *
+ * @param count Number of threads, 0 to only use a sender thread when a
+ * transmit queue length has been set
+ * @return `ZTS_ERR_OK` if successful, `ZTS_ERR_ARG` if invalid argument.
+ */
+int zts_lwip_set_tx_threads(unsigned int count);
+
+/**
+ * @brief Select a named set of TCP and memory tuning values. Replaces any
+ * values set individually before it. Applied when the stack starts.
+ *
+ * @param profile One of `zts_tuning_profile_t`
+ * @return `ZTS_ERR_OK` if successful, `ZTS_ERR_ARG` if invalid argument.
+ */
+int zts_lwip_set_tuning_profile(int profile);
+
+/**
+ * @brief Set the TCP receive window and window scale shift
+ *
+ * @param size Receive window in bytes
+ * @param scale Window scale shift, no more than the TCP_RCV_SCALE announced to
+ * peers. size must fit in 16 bits once shifted.
+ * @return `ZTS_ERR_OK` if successful, `ZTS_ERR_ARG` if invalid argument.
+ */
+int zts_lwip_set_tcp_window(unsigned int size, unsigned int scale);
+
+/**
+ * @brief Set the TCP send buffer size in bytes
+ *
+ * @return `ZTS_ERR_OK` if successful, `ZTS_ERR_ARG` if invalid argument.
+ */
+int zts_lwip_set_tcp_send_buf(unsigned int size);
+
+/**
+ * @brief Set the limits on out-of-order data queued per TCP connection
+ *
+ * @param max_bytes Largest number of bytes queued, 0 for no limit
+ * @param max_pbufs Largest number of buffers queued, 0 for no limit
+ * @return `ZTS_ERR_OK` if successful, `ZTS_ERR_ARG` if invalid argument.
+ */
+int zts_lwip_set_tcp_ooseq_limit(unsigned int max_bytes, unsigned int max_pbufs);
+
 /**
  * Returns whether the lwIP network stack is up and ready to process traffic
  */
@@ -0,0 +1,80 @@
+/*
+ * Copyright (c)2013-2021 ZeroTier, Inc.
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file in the project's root directory.
+ *
+ * Change Date: 2026-01-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2.0 of the Apache License.
+ */
+/****/
+
+/**
+ * @file
+ *
+ * UDP segmentation (GSO) and receive coalescing (GRO) for wire datagrams
+ */
+
+#include "WireOffload.hpp"
+
+#if ZTS_WIRE_MMSG
+
+#include <string.h>
+
+namespace ZeroTier {
+
+bool zts_wire_gso_supported(int fd)
+{
+    int val = 0;
+    socklen_t vlen = sizeof(val);
+    return getsockopt(fd, SOL_UDP, UDP_SEGMENT, &val, &vlen) == 0;
+}
+
+bool zts_wire_gro_enable(int fd)
+{
+    int val = 1;
+    return setsockopt(fd, SOL_UDP, UDP_GRO, &val, sizeof(val)) == 0;
+}
+
+bool zts_wire_same_addr(const struct sockaddr_storage* a, const struct sockaddr_storage* b)
+{
+    if (a->ss_family != b->ss_family) {
+        return false;
+    }
+    if (a->ss_family == AF_INET6) {
+        return ! memcmp(a, b, sizeof(struct sockaddr_in6));
+    }
+    const struct sockaddr_in* a4 = (const struct sockaddr_in*)a;
+    const struct sockaddr_in* b4 = (const struct sockaddr_in*)b;
+    return (a4->sin_port == b4->sin_port) && (a4->sin_addr.s_addr == b4->sin_addr.s_addr);
+}
+
+void zts_wire_set_gso(struct msghdr* h, char* ctrl, uint16_t segSize)
+{
+    h->msg_control = ctrl;
+    h->msg_controllen = ZTS_WIRE_GSO_CTRL_LEN;
+    struct cmsghdr* c = CMSG_FIRSTHDR(h);
+    c->cmsg_level = SOL_UDP;
+    c->cmsg_type = UDP_SEGMENT;
+    c->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+    memcpy(CMSG_DATA(c), &segSize, sizeof(segSize));
+}
+
+unsigned int zts_wire_gro_size(struct msghdr* h)
+{
+    unsigned int segSize = 0;
+    for (struct cmsghdr* c = CMSG_FIRSTHDR(h); c; c = CMSG_NXTHDR(h, c)) {
+        if ((c->cmsg_level == SOL_UDP) && (c->cmsg_type == UDP_GRO)) {
+            int gso = 0;
+            memcpy(&gso, CMSG_DATA(c), sizeof(gso));
+            segSize = (unsigned int)gso;
+        }
+    }
+    return segSize;
+}
+
+}   // namespace ZeroTier
+
+#endif   // ZTS_WIRE_MMSG
@@ -0,0 +1,131 @@
+/*
+ * Copyright (c)2013-2021 ZeroTier, Inc.
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file in the project's root directory.
+ *
+ * Change Date: 2026-01-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2.0 of the Apache License.
+ */
+/****/
+
+/**
+ * @file
+ *
+ * UDP segmentation (GSO) and receive coalescing (GRO) for wire datagrams
+ */
+
+#ifndef ZTS_WIRE_OFFLOAD_HPP
+#define ZTS_WIRE_OFFLOAD_HPP
+
+// Read and write wire datagrams in batches with recvmmsg()/sendmmsg()
+#if defined(__linux__) && ! defined(ZTS_DISABLE_WIRE_MMSG)
+#define ZTS_WIRE_MMSG 1
+#else
+#define ZTS_WIRE_MMSG 0
+#endif
+
+#include <algorithm>
+
+namespace ZeroTier {
+
+/**
+ * @brief Split a GRO-coalesced buffer back into datagrams of segSize bytes
+ * (the last may be shorter), calling f(data, len) for each
+ */
+template <typename F> void zts_wire_split(char* data, unsigned long len, unsigned int segSize, F f)
+{
+    const unsigned long step = segSize ? segSize : len;
+    for (unsigned long off = 0; off < len; off += step) {
+        f(data + off, std::min(step, len - off));
+    }
+}
+
+}   // namespace ZeroTier
+
+#if ZTS_WIRE_MMSG
+
+#include <netinet/in.h>
+#include <netinet/udp.h>
+#include <stdint.h>
+#include <sys/socket.h>
+
+#ifndef SOL_UDP
+#define SOL_UDP 17
+#endif
+#ifndef UDP_SEGMENT
+#define UDP_SEGMENT 103
+#endif
+#ifndef UDP_GRO
+#define UDP_GRO 104
+#endif
+
+// Largest payload the kernel accepts in one UDP GSO send
+#define ZTS_WIRE_GSO_MAX_BYTES 65000
+// Receive space for one GRO-coalesced datagram, the kernel stops coalescing at 64 KB
+#define ZTS_WIRE_GRO_SLOT_LEN 65536
+// Receive space for one GRO-coalesced datagram, the kernel stops coalescing at 64 KB
+#define ZTS_WIRE_GRO_SLOT_LEN 65536
+// Control buffer space needed by zts_wire_set_gso() and zts_wire_gro_size()
+#define ZTS_WIRE_GSO_CTRL_LEN CMSG_SPACE(sizeof(uint16_t))
+#define ZTS_WIRE_GRO_CTRL_LEN CMSG_SPACE(sizeof(int))
+
+namespace ZeroTier {
+
+/**
+ * @brief Whether the kernel can segment sends on this UDP socket
+ */
+bool zts_wire_gso_supported(int fd);
+
+/**
+ * @brief Ask the kernel to coalesce datagrams received on this UDP socket.
+ * Returns false if it can't.
+ */
+bool zts_wire_gro_enable(int fd);
+
+/**
+ * @brief Whether two addresses are the same destination
+ */
+bool zts_wire_same_addr(const struct sockaddr_storage* a, const struct sockaddr_storage* b);
+
+/**
+ * @brief Attach a UDP_SEGMENT control message to an outbound message
+ *
+ * @param h Message whose iovecs hold the segments
+ * @param ctrl Buffer of ZTS_WIRE_GSO_CTRL_LEN bytes, must outlive the send
+ * @param segSize Size of every segment but the last
+ */
+void zts_wire_set_gso(struct msghdr* h, char* ctrl, uint16_t segSize);
+
+/**
+ * @brief Segment size of a received message, 0 unless the kernel coalesced
+ * several datagrams into it
+ */
+unsigned int zts_wire_gro_size(struct msghdr* h);
+
+/**
+ * @brief Number of packets at the start of slots that can be sent as one GSO
+ * buffer. They share a destination, all but the last are of equal size and
+ * together they fit in ZTS_WIRE_GSO_MAX_BYTES. Slot needs addr and len members.
+ */
+template <typename Slot> unsigned int zts_wire_gso_run(const Slot* slots, unsigned int count)
+{
+    unsigned int k = 1;
+    unsigned int bytes = slots[0].len;
+    while ((k < count) && zts_wire_same_addr(&slots[0].addr, &slots[k].addr) && (slots[k].len <= slots[0].len)
+           && (bytes + slots[k].len <= ZTS_WIRE_GSO_MAX_BYTES)) {
+        bytes += slots[k].len;
+        if (slots[k++].len < slots[0].len) {
+            break;
+        }
+    }
+    return k;
+}
+
+}   // namespace ZeroTier
+
+#endif   // ZTS_WIRE_MMSG
+
+#endif
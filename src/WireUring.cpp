@@ -0,0 +1,395 @@
+/*
+ * Copyright (c)2013-2021 ZeroTier, Inc.
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file in the project's root directory.
+ *
+ * Change Date: 2026-01-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2.0 of the Apache License.
+ */
+/****/
+
+/**
+ * @file
+ *
+ * io_uring engine for wire (UDP) I/O
+ */
+
+#include "WireUring.hpp"
+
+#include "WireOffload.hpp"
+
+#if ZTS_WIRE_URING
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace ZeroTier {
+
+WireUring::WireUring() : _txUsable(false), _eventFd(-1), _bufRing(NULL), _bufs(NULL), _bufCount(0), _bufLen(0), _bufTail(0)
+{
+    memset(&_rx, 0, sizeof(_rx));
+    memset(&_tx, 0, sizeof(_tx));
+    _rx.fd = -1;
+    _tx.fd = -1;
+    memset(&_recvTemplate, 0, sizeof(_recvTemplate));
+    memset(_recvs, 0, sizeof(_recvs));
+}
+
+WireUring::~WireUring()
+{
+    // Closing the ring cancels any outstanding receives
+    teardownRing(_rx);
+    teardownRing(_tx);
+    free(_bufRing);
+    delete[] _bufs;
+}
+
+bool WireUring::setupRing(Ring& r, unsigned int entries, unsigned int cqEntries)
+{
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    if (cqEntries) {
+        p.flags |= IORING_SETUP_CQSIZE;
+        p.cq_entries = cqEntries;
+    }
+    r.fd = (int)syscall(__NR_io_uring_setup, entries, &p);
+    if (r.fd < 0) {
+        return false;
+    }
+    r.sqMapLen = p.sq_off.array + (p.sq_entries * sizeof(unsigned int));
+    r.cqMapLen = p.cq_off.cqes + (p.cq_entries * sizeof(struct io_uring_cqe));
+    const bool single = (p.features & IORING_FEAT_SINGLE_MMAP);
+    if (single) {
+        r.sqMapLen = r.cqMapLen = (r.sqMapLen > r.cqMapLen) ? r.sqMapLen : r.cqMapLen;
+    }
+    r.sqMap = mmap(NULL, r.sqMapLen, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, r.fd, IORING_OFF_SQ_RING);
+    if (r.sqMap == MAP_FAILED) {
+        r.sqMap = NULL;
+        return false;
+    }
+    if (single) {
+        r.cqMap = r.sqMap;
+    }
+    else {
+        r.cqMap = mmap(NULL, r.cqMapLen, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, r.fd, IORING_OFF_CQ_RING);
+        if (r.cqMap == MAP_FAILED) {
+            r.cqMap = NULL;
+            return false;
+        }
+    }
+    r.sqesLen = p.sq_entries * sizeof(struct io_uring_sqe);
+    void* sqes = mmap(NULL, r.sqesLen, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, r.fd, IORING_OFF_SQES);
+    if (sqes == MAP_FAILED) {
+        return false;
+    }
+    r.sqes = (struct io_uring_sqe*)sqes;
+    char* sq = (char*)r.sqMap;
+    char* cq = (char*)r.cqMap;
+    r.sqHead = (unsigned int*)(sq + p.sq_off.head);
+    r.sqTail = (unsigned int*)(sq + p.sq_off.tail);
+    r.sqMask = (unsigned int*)(sq + p.sq_off.ring_mask);
+    r.sqArray = (unsigned int*)(sq + p.sq_off.array);
+    r.sqEntries = p.sq_entries;
+    r.sqLocalTail = *r.sqTail;
+    r.cqHead = (unsigned int*)(cq + p.cq_off.head);
+    r.cqTail = (unsigned int*)(cq + p.cq_off.tail);
+    r.cqMask = (unsigned int*)(cq + p.cq_off.ring_mask);
+    r.cqes = (struct io_uring_cqe*)(cq + p.cq_off.cqes);
+    return true;
+}
+
+void WireUring::teardownRing(Ring& r)
+{
+    if (r.sqes) {
+        munmap(r.sqes, r.sqesLen);
+    }
+    if (r.cqMap && (r.cqMap != r.sqMap)) {
+        munmap(r.cqMap, r.cqMapLen);
+    }
+    if (r.sqMap) {
+        munmap(r.sqMap, r.sqMapLen);
+    }
+    if (r.fd >= 0) {
+        close(r.fd);
+    }
+    memset(&r, 0, sizeof(r));
+    r.fd = -1;
+}
+
+struct io_uring_sqe* WireUring::getSqe(Ring& r)
+{
+    const unsigned int head = __atomic_load_n(r.sqHead, __ATOMIC_ACQUIRE);
+    if ((r.sqLocalTail - head) >= r.sqEntries) {
+        return NULL;
+    }
+    const unsigned int idx = r.sqLocalTail & *r.sqMask;
+    r.sqArray[idx] = idx;
+    r.sqLocalTail++;
+    struct io_uring_sqe* sqe = &r.sqes[idx];
+    memset(sqe, 0, sizeof(*sqe));
+    return sqe;
+}
+
+int WireUring::submit(Ring& r, unsigned int toSubmit, unsigned int minComplete)
+{
+    __atomic_store_n(r.sqTail, r.sqLocalTail, __ATOMIC_RELEASE);
+    const unsigned int flags = minComplete ? IORING_ENTER_GETEVENTS : 0;
+    int ret;
+    do {
+        ret = (int)syscall(__NR_io_uring_enter, r.fd, toSubmit, minComplete, flags, NULL, 0);
+    } while ((ret < 0) && (errno == EINTR));
+    return ret;
+}
+
+bool WireUring::init(int eventFd, bool gro)
+{
+    _bufCount = gro ? ZTS_URING_RX_GRO_BUFS : ZTS_URING_RX_BUFS;
+    _bufLen = gro ? ZTS_URING_RX_GRO_BUF_LEN : ZTS_URING_RX_BUF_LEN;
+    if (! setupRing(_rx, 64, 4096) || ! setupRing(_tx, 128, 0)) {
+        return false;
+    }
+    _eventFd = eventFd;
+    if (syscall(__NR_io_uring_register, _rx.fd, IORING_REGISTER_EVENTFD, &_eventFd, 1) != 0) {
+        return false;
+    }
+    // Receive buffers are handed to the kernel once through a provided buffer
+    // ring and recycled in place, no per-receive buffer setup is needed
+    void* mem = NULL;
+    if (posix_memalign(&mem, 4096, _bufCount * sizeof(struct io_uring_buf)) != 0) {
+        return false;
+    }
+    memset(mem, 0, _bufCount * sizeof(struct io_uring_buf));
+    _bufRing = (struct io_uring_buf_ring*)mem;
+    struct io_uring_buf_reg reg;
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = (uint64_t)(uintptr_t)_bufRing;
+    reg.ring_entries = _bufCount;
+    reg.bgid = 0;
+    if (syscall(__NR_io_uring_register, _rx.fd, IORING_REGISTER_PBUF_RING, &reg, 1) != 0) {
+        return false;
+    }
+    _bufs = new char[_bufCount * _bufLen];
+    for (unsigned int i = 0; i < _bufCount; ++i) {
+        recycle(i);
+    }
+    // Only the name and control lengths of the template are used, each
+    // received buffer is laid out as io_uring_recvmsg_out, name, control, payload
+    _recvTemplate.msg_namelen = sizeof(struct sockaddr_storage);
+    _recvTemplate.msg_controllen = CMSG_SPACE(sizeof(int));
+    _txUsable = true;
+    return true;
+}
+
+void WireUring::recycle(unsigned int bid)
+{
+    // Not &_bufRing->bufs[], the flexible array is misplaced when the
+    // kernel header is compiled as C++
+    struct io_uring_buf* b = (struct io_uring_buf*)_bufRing + (_bufTail & (_bufCount - 1));
+    b->addr = (uint64_t)(uintptr_t)(_bufs + (bid * _bufLen));
+    b->len = _bufLen;
+    b->bid = (uint16_t)bid;
+    _bufTail++;
+    __atomic_store_n(&_bufRing->tail, _bufTail, __ATOMIC_RELEASE);
+}
+
+bool WireUring::submitRecv(unsigned int slot)
+{
+    struct io_uring_sqe* sqe = getSqe(_rx);
+    if (! sqe) {
+        return false;
+    }
+    sqe->opcode = IORING_OP_RECVMSG;
+    sqe->fd = _recvs[slot].fd;
+    sqe->addr = (uint64_t)(uintptr_t)&_recvTemplate;
+    sqe->len = 1;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = 0;
+    sqe->user_data = slot + 1;
+    _recvs[slot].inflight = true;
+    return true;
+}
+
+bool WireUring::armRecv(int fd, uint64_t tag)
+{
+    for (unsigned int i = 0; i < ZTS_URING_MAX_RECV; ++i) {
+        if (! _recvs[i].active && ! _recvs[i].inflight) {
+            _recvs[i].fd = fd;
+            _recvs[i].tag = tag;
+            _recvs[i].active = true;
+            if (! submitRecv(i) || (submit(_rx, 1, 0) < 0)) {
+                _recvs[i].active = false;
+                _recvs[i].inflight = false;
+                return false;
+            }
+            return true;
+        }
+    }
+    return false;
+}
+
+void WireUring::cancelRecv(uint64_t tag)
+{
+    for (unsigned int i = 0; i < ZTS_URING_MAX_RECV; ++i) {
+        if (_recvs[i].active && (_recvs[i].tag == tag)) {
+            _recvs[i].active = false;
+            struct io_uring_sqe* sqe = getSqe(_rx);
+            if (sqe) {
+                sqe->opcode = IORING_OP_ASYNC_CANCEL;
+                sqe->addr = i + 1;
+                sqe->user_data = 0;
+                submit(_rx, 1, 0);
+            }
+        }
+    }
+}
+
+bool WireUring::isArmed(uint64_t tag) const
+{
+    for (unsigned int i = 0; i < ZTS_URING_MAX_RECV; ++i) {
+        if (_recvs[i].active && (_recvs[i].tag == tag)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+unsigned int WireUring::reap(WireUringRecvFunction fn, void* arg)
+{
+    unsigned int count = 0;
+    bool rearm[ZTS_URING_MAX_RECV] = { false };
+    unsigned int head = *_rx.cqHead;
+    const unsigned int tail = __atomic_load_n(_rx.cqTail, __ATOMIC_ACQUIRE);
+    for (; head != tail; ++head) {
+        const struct io_uring_cqe* cqe = &_rx.cqes[head & *_rx.cqMask];
+        const uint64_t ud = cqe->user_data;
+        if ((ud == 0) || (ud > ZTS_URING_MAX_RECV)) {
+            continue;   // Cancellation result
+        }
+        Recv& rv = _recvs[ud - 1];
+        if (cqe->flags & IORING_CQE_F_BUFFER) {
+            const unsigned int bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+            char* buf = _bufs + (bid * _bufLen);
+            const struct io_uring_recvmsg_out* out = (const struct io_uring_recvmsg_out*)buf;
+            char* name = buf + sizeof(struct io_uring_recvmsg_out);
+            char* control = name + _recvTemplate.msg_namelen;
+            char* payload = control + _recvTemplate.msg_controllen;
+            if ((cqe->res > 0) && rv.active && ! (out->flags & MSG_TRUNC)
+                && ((payload + out->payloadlen) <= (buf + cqe->res))) {
+                unsigned int segSize = 0;
+                struct msghdr h;
+                memset(&h, 0, sizeof(h));
+                h.msg_control = control;
+                h.msg_controllen = out->controllen;
+                for (struct cmsghdr* c = CMSG_FIRSTHDR(&h); c; c = CMSG_NXTHDR(&h, c)) {
+                    if ((c->cmsg_level == SOL_UDP) && (c->cmsg_type == UDP_GRO)) {
+                        int gso = 0;
+                        memcpy(&gso, CMSG_DATA(c), sizeof(gso));
+                        segSize = (unsigned int)gso;
+                    }
+                }
+                fn(arg, rv.tag, (const struct sockaddr*)name, payload, out->payloadlen, segSize);
+                count++;
+            }
+            recycle(bid);
+        }
+        if (! (cqe->flags & IORING_CQE_F_MORE)) {
+            // Multishot receive ended: cancelled, out of buffers, or an error
+            rv.inflight = false;
+            if (rv.active && (cqe->res != -ECANCELED) && (cqe->res != -EBADF)) {
+                rearm[ud - 1] = true;
+            }
+            else {
+                rv.active = false;
+            }
+        }
+    }
+    __atomic_store_n(_rx.cqHead, head, __ATOMIC_RELEASE);
+    unsigned int n = 0;
+    for (unsigned int i = 0; i < ZTS_URING_MAX_RECV; ++i) {
+        if (rearm[i] && submitRecv(i)) {
+            n++;
+        }
+    }
+    if (n) {
+        submit(_rx, n, 0);
+    }
+    return count;
+}
+
+int WireUring::sendmsgs(int fd, struct mmsghdr* msgs, unsigned int count)
+{
+    if (count > _tx.sqEntries) {
+        count = _tx.sqEntries;
+    }
+    // Linked so that they leave in order, and a failure cancels the rest
+    // just as sendmmsg() stops at the first one that fails. A full
+    // submission queue ends the batch, the caller sends the rest later.
+    struct io_uring_sqe* prev = NULL;
+    unsigned int queued = 0;
+    for (; queued < count; ++queued) {
+        struct io_uring_sqe* sqe = getSqe(_tx);
+        if (! sqe) {
+            break;
+        }
+        if (prev) {
+            prev->flags = IOSQE_IO_LINK;
+        }
+        sqe->opcode = IORING_OP_SENDMSG;
+        sqe->fd = fd;
+        sqe->addr = (uint64_t)(uintptr_t)&msgs[queued].msg_hdr;
+        sqe->len = 1;
+        sqe->user_data = queued;
+        prev = sqe;
+    }
+    if (! queued) {
+        errno = EAGAIN;
+        return -1;
+    }
+    count = queued;
+    if (submit(_tx, count, count) < 0) {
+        // Entries may still be queued and refer to the caller's messages,
+        // the ring must not be entered again
+        _txUsable = false;
+        return -1;
+    }
+    int res[ZTS_URING_MAX_SEND];
+    unsigned int seen = 0;
+    unsigned int head = *_tx.cqHead;
+    while (seen < count) {
+        const unsigned int tail = __atomic_load_n(_tx.cqTail, __ATOMIC_ACQUIRE);
+        for (; head != tail; ++head) {
+            const struct io_uring_cqe* cqe = &_tx.cqes[head & *_tx.cqMask];
+            if (cqe->user_data < count) {
+                res[cqe->user_data] = cqe->res;
+                seen++;
+            }
+        }
+        __atomic_store_n(_tx.cqHead, head, __ATOMIC_RELEASE);
+        if ((seen < count) && (submit(_tx, 0, count - seen) < 0)) {
+            _txUsable = false;
+            return -1;
+        }
+    }
+    for (unsigned int i = 0; i < count; ++i) {
+        if (res[i] < 0) {
+            if (i == 0) {
+                errno = -res[i];
+                return -1;
+            }
+            return (int)i;
+        }
+    }
+    return (int)count;
+}
+
+}   // namespace ZeroTier
+
+#endif   // ZTS_WIRE_URING
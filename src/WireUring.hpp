@@ -0,0 +1,174 @@
+/*
+ * Copyright (c)2013-2021 ZeroTier, Inc.
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file in the project's root directory.
+ *
+ * Change Date: 2026-01-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2.0 of the Apache License.
+ */
+/****/
+
+/**
+ * @file
+ *
+ * io_uring engine for wire (UDP) I/O
+ */
+
+#ifndef ZTS_WIRE_URING_HPP
+#define ZTS_WIRE_URING_HPP
+
+#if defined(__linux__) && ! defined(ZTS_DISABLE_WIRE_URING) && ! defined(ZTS_DISABLE_WIRE_MMSG)                     \
+    && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#endif
+#endif
+
+// Multishot receive and provided buffer rings need Linux 6.0 headers
+#if defined(IORING_RECV_MULTISHOT)
+#define ZTS_WIRE_URING 1
+#else
+#define ZTS_WIRE_URING 0
+#endif
+
+#if ZTS_WIRE_URING
+
+#include <netinet/in.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/socket.h>
+
+// Number of sockets that may have a receive armed at once
+#define ZTS_URING_MAX_RECV 32
+// Number of provided receive buffers (power of two)
+#define ZTS_URING_RX_BUFS 256
+// Size of each provided receive buffer, room for the recvmsg header,
+// source address and control data in front of the datagram
+#define ZTS_URING_RX_BUF_LEN 10496
+// Number and size of provided receive buffers when the sockets coalesce
+// with UDP_GRO, each must hold a 64 KB datagram
+#define ZTS_URING_RX_GRO_BUFS 32
+#define ZTS_URING_RX_GRO_BUF_LEN 65792
+// Largest number of messages in one send submission
+#define ZTS_URING_MAX_SEND 128
+
+namespace ZeroTier {
+
+/**
+ * Called for each datagram received on an armed socket. segSize is the GRO
+ * segment size if the kernel coalesced several datagrams, zero otherwise.
+ */
+typedef void (*WireUringRecvFunction)(
+    void* arg,
+    uint64_t tag,
+    const struct sockaddr* from,
+    void* data,
+    unsigned int len,
+    unsigned int segSize);
+
+/**
+ * Minimal io_uring wrapper driving wire UDP sockets without liburing.
+ *
+ * Receives use one multishot recvmsg per socket, drawing from a registered
+ * ring of provided buffers, and signal completions through an eventfd that
+ * the caller polls alongside its other descriptors. Sends are submitted as a
+ * batch of linked sendmsg operations on a second ring so that they can be
+ * reaped synchronously without disturbing receive completions.
+ */
+class WireUring {
+  public:
+    WireUring();
+
+    ~WireUring();
+
+    /**
+     * Create the rings. eventFd (owned by the caller) becomes readable when
+     * receive completions are pending. gro sizes the receive buffers for
+     * sockets with UDP_GRO enabled. Returns false if io_uring is unavailable.
+     */
+    bool init(int eventFd, bool gro);
+
+    /** Whether sends may be submitted, false after a submission failed */
+    bool canSend() const
+    {
+        return _txUsable;
+    }
+
+    /** Start receiving on fd. tag is passed back with each datagram. */
+    bool armRecv(int fd, uint64_t tag);
+
+    /** Stop receiving for tag */
+    void cancelRecv(uint64_t tag);
+
+    /** Whether a receive is armed for tag */
+    bool isArmed(uint64_t tag) const;
+
+    /** Process all pending receive completions. Returns number of datagrams. */
+    unsigned int reap(WireUringRecvFunction fn, void* arg);
+
+    /**
+     * Send count messages on fd in one submission, or as many as fit in the
+     * submission queue. Like sendmmsg() returns the number of messages sent
+     * before the first failure, or -1 with errno set if none were.
+     */
+    int sendmsgs(int fd, struct mmsghdr* msgs, unsigned int count);
+
+  private:
+    struct Ring {
+        int fd;
+        unsigned int* sqHead;
+        unsigned int* sqTail;
+        unsigned int* sqMask;
+        unsigned int* sqArray;
+        unsigned int sqEntries;
+        unsigned int sqLocalTail;
+        struct io_uring_sqe* sqes;
+        unsigned int* cqHead;
+        unsigned int* cqTail;
+        unsigned int* cqMask;
+        struct io_uring_cqe* cqes;
+        void* sqMap;
+        size_t sqMapLen;
+        void* cqMap;
+        size_t cqMapLen;
+        size_t sqesLen;
+    };
+
+    struct Recv {
+        int fd;
+        uint64_t tag;
+        bool active;     // Wanted by the caller
+        bool inflight;   // Kernel still holds a multishot receive
+    };
+
+    static bool setupRing(Ring& r, unsigned int entries, unsigned int cqEntries);
+    static void teardownRing(Ring& r);
+    static struct io_uring_sqe* getSqe(Ring& r);
+    static int submit(Ring& r, unsigned int toSubmit, unsigned int minComplete);
+
+    bool submitRecv(unsigned int slot);
+    void recycle(unsigned int bid);
+
+    Ring _rx;
+    Ring _tx;
+    bool _txUsable;
+    int _eventFd;
+
+    struct io_uring_buf_ring* _bufRing;
+    char* _bufs;
+    unsigned int _bufCount;
+    unsigned int _bufLen;
+    unsigned short _bufTail;
+
+    struct msghdr _recvTemplate;
+    Recv _recvs[ZTS_URING_MAX_RECV];
+};
+
+}   // namespace ZeroTier
+
+#endif   // ZTS_WIRE_URING
+
+#endif
@@ -27,6 +27,7 @@
 #include "lwip/stats.h"
 
 #include <jni.h>
+#include <vector>
 
 extern int zts_errno;
 
@@ -222,6 +223,140 @@ JNIEXPORT jint JNICALL Java_com_zerotier_sockets_ZeroTierNative_zts_1bsd_1sendto
     return retval > -1 ? retval : -(zts_errno);
 }
 
+/*
+ * Check that each message's offset and length lie within its Java array, and
+ * that the offset, length and address arrays have an entry for each message
+ */
+static bool mmsg_bounds_ok(
+    JNIEnv* env,
+    jobjectArray bufs,
+    jintArray offsets,
+    jintArray lens,
+    jobjectArray addrs,
+    jsize n)
+{
+    if (env->GetArrayLength(offsets) < n || env->GetArrayLength(lens) < n || env->GetArrayLength(addrs) < n) {
+        return false;
+    }
+    jint* off = env->GetIntArrayElements(offsets, NULL);
+    jint* len = env->GetIntArrayElements(lens, NULL);
+    bool ok = true;
+    for (jsize i = 0; ok && i < n; i++) {
+        jbyteArray arr = (jbyteArray)env->GetObjectArrayElement(bufs, i);
+        ok = arr && off[i] >= 0 && len[i] >= 0 && (jlong)off[i] + len[i] <= env->GetArrayLength(arr);
+        env->DeleteLocalRef(arr);
+    }
+    env->ReleaseIntArrayElements(offsets, off, JNI_ABORT);
+    env->ReleaseIntArrayElements(lens, len, JNI_ABORT);
+    return ok;
+}
+
+/*
+ * Each message's bytes are pinned with GetByteArrayElements() rather than the
+ * critical variant since the whole batch is held across further JNI calls.
+ * Local references are dropped as soon as each message is set up, so that
+ * large batches don't overflow the local reference table. The arrays stay
+ * reachable through the caller's array of buffers meanwhile.
+ */
+JNIEXPORT jint JNICALL Java_com_zerotier_sockets_ZeroTierNative_zts_1bsd_1sendmmsg(
+    JNIEnv* env,
+    jclass clazz,
+    jint fd,
+    jobjectArray bufs,
+    jintArray offsets,
+    jintArray lens,
+    jobjectArray addrs,
+    jint flags)
+{
+    jsize n = env->GetArrayLength(bufs);
+    if (n <= 0 || ! mmsg_bounds_ok(env, bufs, offsets, lens, addrs, n)) {
+        return ZTS_ERR_ARG;
+    }
+    std::vector<jbyte*> data(n);
+    std::vector<struct zts_sockaddr_storage> ss(n);
+    std::vector<struct zts_iovec> iov(n);
+    std::vector<struct zts_mmsghdr> msgs(n);
+    jint* off = env->GetIntArrayElements(offsets, NULL);
+    jint* len = env->GetIntArrayElements(lens, NULL);
+    for (jsize i = 0; i < n; i++) {
+        jbyteArray arr = (jbyteArray)env->GetObjectArrayElement(bufs, i);
+        data[i] = env->GetByteArrayElements(arr, NULL);
+        env->DeleteLocalRef(arr);
+        iov[i].iov_base = data[i] + off[i];
+        iov[i].iov_len = len[i];
+        memset(&msgs[i], 0, sizeof(msgs[i]));
+        msgs[i].msg_hdr.msg_iov = &iov[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+        jobject addr = env->GetObjectArrayElement(addrs, i);
+        if (addr) {
+            memset(&ss[i], 0, sizeof(ss[i]));
+            zta2ss(env, &ss[i], addr);
+            msgs[i].msg_hdr.msg_name = &ss[i];
+            msgs[i].msg_hdr.msg_namelen =
+                ss[i].ss_family == ZTS_AF_INET ? sizeof(struct zts_sockaddr_in) : sizeof(struct zts_sockaddr_in6);
+            env->DeleteLocalRef(addr);
+        }
+    }
+    int retval = zts_bsd_sendmmsg(fd, msgs.data(), n, flags);
+    for (jsize i = 0; i < n; i++) {
+        jbyteArray arr = (jbyteArray)env->GetObjectArrayElement(bufs, i);
+        env->ReleaseByteArrayElements(arr, data[i], JNI_ABORT);
+        env->DeleteLocalRef(arr);
+    }
+    env->ReleaseIntArrayElements(offsets, off, JNI_ABORT);
+    env->ReleaseIntArrayElements(lens, len, JNI_ABORT);
+    return retval > -1 ? retval : -(zts_errno);
+}
+
+JNIEXPORT jint JNICALL Java_com_zerotier_sockets_ZeroTierNative_zts_1bsd_1recvmmsg(
+    JNIEnv* env,
+    jclass clazz,
+    jint fd,
+    jobjectArray bufs,
+    jintArray offsets,
+    jintArray lens,
+    jobjectArray addrs,
+    jint flags)
+{
+    jsize n = env->GetArrayLength(bufs);
+    if (n <= 0 || ! mmsg_bounds_ok(env, bufs, offsets, lens, addrs, n)) {
+        return ZTS_ERR_ARG;
+    }
+    std::vector<jbyte*> data(n);
+    std::vector<struct zts_sockaddr_storage> ss(n);
+    std::vector<struct zts_iovec> iov(n);
+    std::vector<struct zts_mmsghdr> msgs(n);
+    jint* off = env->GetIntArrayElements(offsets, NULL);
+    jint* len = env->GetIntArrayElements(lens, NULL);
+    for (jsize i = 0; i < n; i++) {
+        jbyteArray arr = (jbyteArray)env->GetObjectArrayElement(bufs, i);
+        data[i] = env->GetByteArrayElements(arr, NULL);
+        env->DeleteLocalRef(arr);
+        iov[i].iov_base = data[i] + off[i];
+        iov[i].iov_len = len[i];
+        memset(&msgs[i], 0, sizeof(msgs[i]));
+        msgs[i].msg_hdr.msg_iov = &iov[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+        msgs[i].msg_hdr.msg_name = &ss[i];
+        msgs[i].msg_hdr.msg_namelen = sizeof(struct zts_sockaddr_storage);
+    }
+    int retval = zts_bsd_recvmmsg(fd, msgs.data(), n, flags);
+    for (jsize i = 0; i < n; i++) {
+        jbyteArray arr = (jbyteArray)env->GetObjectArrayElement(bufs, i);
+        env->ReleaseByteArrayElements(arr, data[i], 0);
+        env->DeleteLocalRef(arr);
+        if (i < retval) {
+            len[i] = msgs[i].msg_len;
+            jobject addr = env->GetObjectArrayElement(addrs, i);
+            ss2zta(env, &ss[i], addr);
+            env->DeleteLocalRef(addr);
+        }
+    }
+    env->ReleaseIntArrayElements(offsets, off, JNI_ABORT);
+    env->ReleaseIntArrayElements(lens, len, 0);
+    return retval > -1 ? retval : -(zts_errno);
+}
+
 JNIEXPORT jint JNICALL Java_com_zerotier_sockets_ZeroTierNative_zts_1bsd_1recv(
     JNIEnv* env,
     jclass clazz,
@@ -341,6 +476,8 @@ void ztfdset2fdset(JNIEnv* env, int nfds, jobject src_ztfd_set, zts_fd_set* dest
     jobject fdData = env->GetObjectField(src_ztfd_set, fid);
     jbyteArray* arr = reinterpret_cast<jbyteArray*>(&fdData);
     char* data = (char*)env->GetByteArrayElements(*arr, NULL);
+    // Descriptors may outnumber the Java set
+    nfds = LWIP_MIN(nfds, (int)env->GetArrayLength(*arr));
     for (int i = 0; i < nfds; i++) {
         if (data[i] == 0x01) {
             ZTS_FD_SET(i, dest_fd_set);
@@ -360,6 +497,8 @@ void fdset2ztfdset(JNIEnv* env, int nfds, zts_fd_set* src_fd_set, jobject dest_z
     jobject fdData = env->GetObjectField(dest_ztfd_set, fid);
     jbyteArray* arr = reinterpret_cast<jbyteArray*>(&fdData);
     char* data = (char*)env->GetByteArrayElements(*arr, NULL);
+    // Descriptors may outnumber the Java set
+    nfds = LWIP_MIN(nfds, (int)env->GetArrayLength(*arr));
     for (int i = 0; i < nfds; i++) {
         if (ZTS_FD_ISSET(i, src_fd_set)) {
             data[i] = 0x01;
@@ -169,6 +169,70 @@ public class ZeroTierDatagramSocket {
         }
     }
 
+    /**
+     * Send several DatagramPackets in one call. Packets without an address go to
+     * the connected remote host.
+     * @param packets The packets to send
+     * @return Number of packets sent, which may be fewer than requested
+     *
+     * @exception IOException when an I/O error occurs
+     */
+    public int send(DatagramPacket[] packets) throws IOException
+    {
+        int n = packets.length;
+        byte[][] bufs = new byte[n][];
+        int[] offsets = new int[n];
+        int[] lens = new int[n];
+        ZeroTierSocketAddress[] addrs = new ZeroTierSocketAddress[n];
+        for (int i = 0; i < n; i++) {
+            bufs[i] = packets[i].getData();
+            offsets[i] = packets[i].getOffset();
+            lens[i] = packets[i].getLength();
+            if (packets[i].getAddress() != null) {
+                addrs[i] = new ZeroTierSocketAddress(packets[i].getAddress().getHostAddress(), packets[i].getPort());
+            }
+        }
+        int sent = ZeroTierNative.zts_bsd_sendmmsg(_socket.getNativeFileDescriptor(), bufs, offsets, lens, addrs, 0);
+        if (sent < 0) {
+            throw new IOException("send(DatagramPacket[]), errno=" + sent);
+        }
+        return sent;
+    }
+
+    /**
+     * Receive several DatagramPackets in one call. Waits for the first packet only,
+     * the rest are filled from what has already arrived.
+     * @param packets The packets to fill. Each length is set to the size received
+     * @return Number of packets received
+     *
+     * @exception IOException when an I/O error occurs
+     */
+    public int receive(DatagramPacket[] packets) throws IOException
+    {
+        int n = packets.length;
+        byte[][] bufs = new byte[n][];
+        int[] offsets = new int[n];
+        int[] lens = new int[n];
+        ZeroTierSocketAddress[] addrs = new ZeroTierSocketAddress[n];
+        for (int i = 0; i < n; i++) {
+            bufs[i] = packets[i].getData();
+            offsets[i] = packets[i].getOffset();
+            lens[i] = packets[i].getLength();
+            addrs[i] = new ZeroTierSocketAddress();
+        }
+        int received =
+            ZeroTierNative.zts_bsd_recvmmsg(_socket.getNativeFileDescriptor(), bufs, offsets, lens, addrs, 0);
+        if (received <= 0) {
+            throw new IOException("receive(DatagramPacket[]), errno=" + received);
+        }
+        for (int i = 0; i < received; i++) {
+            packets[i].setLength(lens[i]);
+            packets[i].setAddress(InetAddress.getByName(addrs[i].ipString()));
+            packets[i].setPort(addrs[i].getPort());
+        }
+        return received;
+    }
+
     /**
      * Close the ZeroTierSocket.
      *
@@ -230,7 +230,7 @@ public class ZeroTierNative {
     public static int ZTS_SO_LINGER = 0x00000080;
     public static int ZTS_SO_DONTLINGER = (~ZTS_SO_LINGER);
     public static int ZTS_SO_OOBINLINE = 0x00000100;   // NOT YET SUPPORTED
-    public static int ZTS_SO_REUSEPORT = 0x00000200;   // NOT YET SUPPORTED
+    public static int ZTS_SO_REUSEPORT = 0x00000200;
     public static int ZTS_SO_SNDBUF = 0x00001001;      // NOT YET SUPPORTED
     public static int ZTS_SO_RCVBUF = 0x00001002;
     public static int ZTS_SO_SNDLOWAT = 0x00001003;   // NOT YET SUPPORTED
@@ -534,6 +534,10 @@ public class ZeroTierNative {
     public static native int zts_bsd_write_offset(int fd, byte[] buf, int offset, int len);
     public static native int zts_bsd_sendto(int fd, byte[] buf, int flags, ZeroTierSocketAddress addr);
     public static native int zts_bsd_send(int fd, byte[] buf, int flags);
+    public static native int
+    zts_bsd_sendmmsg(int fd, byte[][] bufs, int[] offsets, int[] lens, ZeroTierSocketAddress[] addrs, int flags);
+    public static native int
+    zts_bsd_recvmmsg(int fd, byte[][] bufs, int[] offsets, int[] lens, ZeroTierSocketAddress[] addrs, int flags);
     public static native int zts_bsd_shutdown(int fd, int how);
     public static native int zts_bsd_close(int fd);
     public static native boolean zts_bsd_getsockname(int fd, ZeroTierSocketAddress addr);
@@ -17431,7 +17431,7 @@ SWIG_init(void) {
   SWIG_Python_SetConstant(d, "ZTS_IPTOS_PREC_PRIORITY",SWIG_From_int(static_cast< int >(0x20)));
   SWIG_Python_SetConstant(d, "ZTS_IPTOS_PREC_ROUTINE",SWIG_From_int(static_cast< int >(0x00)));
   SWIG_Python_SetConstant(d, "LWIP_SOCKET_OFFSET",SWIG_From_int(static_cast< int >(0)));
-  SWIG_Python_SetConstant(d, "MEMP_NUM_NETCONN",SWIG_From_int(static_cast< int >(1024)));
+  SWIG_Python_SetConstant(d, "ZTS_MAX_SOCKETS",SWIG_From_int(static_cast< int >(65536)));
   SWIG_Python_SetConstant(d, "ZTS_FD_SETSIZE",SWIG_From_int(static_cast< int >(1024)));
   SWIG_Python_SetConstant(d, "ZTS_F_GETFL",SWIG_From_int(static_cast< int >(0x0003)));
   SWIG_Python_SetConstant(d, "ZTS_F_SETFL",SWIG_From_int(static_cast< int >(0x0004)));
@@ -0,0 +1,95 @@
+/*
+ * Copyright (c)2013-2021 ZeroTier, Inc.
+ *
+ * Use of this software is governed by the Business Source License included
+ * in the LICENSE.TXT file in the project's root directory.
+ *
+ * Change Date: 2026-01-01
+ *
+ * On the date above, in accordance with the Business Source License, use
+ * of this software will be governed by version 2.0 of the Apache License.
+ */
+/****/
+
+/**
+ * @file
+ *
+ * lwIP hooks (LWIP_HOOK_FILENAME), implemented in TcpHooks.cpp
+ */
+
+#ifndef ZTS_LWIP_HOOKS_H
+#define ZTS_LWIP_HOOKS_H
+
+#include "lwip/arch.h"
+#include "lwip/err.h"
+#include "lwip/sockets.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct lwip_sock;
+struct pbuf;
+struct tcp_hdr;
+struct tcp_pcb;
+
+/* Called for each segment received on a pcb, before it is processed */
+err_t zts_tcp_hook_input(
+    struct tcp_pcb* pcb,
+    struct tcp_hdr* hdr,
+    u16_t optlen,
+    u16_t opt1len,
+    u8_t* opt2,
+    struct pbuf* p);
+
+/*
+ * Called for each segment sent with its options in place, before its checksum,
+ * returns the end of the options. May lower the window the segment announces.
+ */
+u32_t* zts_tcp_hook_output(struct pbuf* p, struct tcp_hdr* hdr, const struct tcp_pcb* pcb, u32_t* opts);
+
+/*
+ * TCP buffer tuning, set before the stack starts (see zts_lwip_driver_init()).
+ * lwIP's TCP_WND and TCP_SND_BUF are the largest values these may take.
+ */
+extern unsigned int zts_tcp_wnd;
+extern unsigned int zts_tcp_snd_buf;
+
+/* Give a new pcb the tuned send buffer and receive window, called with the core lock held */
+void zts_tcp_tune(struct tcp_pcb* pcb);
+
+/* Override the receive window of a pcb (SO_RCVBUF), called with the core lock held */
+void zts_tcp_set_rcv_window(struct tcp_pcb* pcb, u32_t wnd);
+
+/*
+ * Give back the receive window withheld from a pcb by its tuning, before it is
+ * closed, so that lwIP sends a FIN rather than a RST. Called with the core lock held.
+ */
+void zts_tcp_untune(struct tcp_pcb* pcb);
+
+/*
+ * Options lwIP does not implement (TCP_CONGESTION), called with the core lock
+ * held. Return 0 if the option was not consumed, otherwise the result is err.
+ */
+int zts_sockets_hook_setsockopt(
+    int s,
+    struct lwip_sock* sock,
+    int level,
+    int optname,
+    const void* optval,
+    socklen_t optlen,
+    int* err);
+int zts_sockets_hook_getsockopt(
+    int s,
+    struct lwip_sock* sock,
+    int level,
+    int optname,
+    void* optval,
+    socklen_t* optlen,
+    int* err);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
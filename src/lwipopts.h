@@ -73,6 +73,61 @@
 // TCP
 #define LWIP_TCP_KEEPALIVE              1
 #define TCP_LISTEN_BACKLOG              1
+// Heap and pools (MEMP_MEM_MALLOC) are served by libzt's slab allocator
+#include <stddef.h>
+#ifdef __cplusplus
+extern "C" {
+#endif
+void* zts_slab_malloc(size_t size);
+void* zts_slab_calloc(size_t count, size_t size);
+void zts_slab_free(void* ptr);
+#ifdef __cplusplus
+}
+#endif
+#define mem_clib_malloc                 zts_slab_malloc
+#define mem_clib_calloc                 zts_slab_calloc
+#define mem_clib_free                   zts_slab_free
+// Checksums use vector instructions when the CPU has them, see Checksum.cpp.
+// Data copied from the application is summed in the same pass.
+#ifdef __cplusplus
+extern "C" {
+#endif
+unsigned short zts_chksum(const void* data, int len);
+unsigned short zts_chksum_copy(void* dst, const void* src, unsigned short len);
+#ifdef __cplusplus
+}
+#endif
+#define LWIP_CHKSUM                     zts_chksum
+#define LWIP_CHKSUM_COPY(dst, src, len) zts_chksum_copy(dst, src, len)
+#define LWIP_CHECKSUM_ON_COPY           1
+// Trusted links skip generating some checksums per netif, see VirtualTap::setTrustedLink()
+#define LWIP_CHECKSUM_CTRL_PER_NETIF    1
+// Out-of-order queue limits, set before the stack starts (see
+// zts_lwip_set_tcp_ooseq_limit()). The TCP window and send buffer below are
+// maximums, each pcb gets the tuned values from the TCP hooks.
+#ifdef __cplusplus
+extern "C" {
+#endif
+extern unsigned int zts_tcp_ooseq_max_bytes;
+extern unsigned int zts_tcp_ooseq_max_pbufs;
+#ifdef __cplusplus
+}
+#endif
+#define TCP_OOSEQ_BYTES_LIMIT(pcb)      (zts_tcp_ooseq_max_bytes ? zts_tcp_ooseq_max_bytes : 0xffffffffU)
+#define TCP_OOSEQ_PBUFS_LIMIT(pcb)      (zts_tcp_ooseq_max_pbufs ? zts_tcp_ooseq_max_pbufs : 0xffffU)
+// Congestion control is selected per socket (TCP_CONGESTION) and applied from
+// the TCP hooks, which also act on the SACK blocks of peers, see TcpHooks.cpp.
+// The second ext arg tracks zero-copy sends, see zts_send_zc(), and the
+// third the receive window of each pcb, see zts_tcp_tune().
+#define LWIP_TCP_PCB_NUM_EXT_ARGS       3
+#define LWIP_HOOK_FILENAME              "lwip_hooks.h"
+#define LWIP_HOOK_TCP_INPACKET_PCB(pcb, hdr, optlen, opt1len, opt2, p)                                                 \
+    zts_tcp_hook_input(pcb, hdr, optlen, opt1len, opt2, p)
+#define LWIP_HOOK_TCP_OUT_ADD_TCPOPTS(p, hdr, pcb, opts) zts_tcp_hook_output(p, hdr, pcb, opts)
+#define LWIP_HOOK_SOCKETS_SETSOCKOPT(s, sock, level, optname, optval, optlen, err)                                     \
+    zts_sockets_hook_setsockopt(s, sock, level, optname, optval, optlen, err)
+#define LWIP_HOOK_SOCKETS_GETSOCKOPT(s, sock, level, optname, optval, optlen, err)                                     \
+    zts_sockets_hook_getsockopt(s, sock, level, optname, optval, optlen, err)
 // netif
 #define LWIP_NETIF_STATUS_CALLBACK      0
 #define LWIP_NETIF_EXT_STATUS_CALLBACK  0
@@ -86,7 +141,21 @@
 #define LWIP_MTU                        2800
 #define LWIP_CHKSUM_ALGORITHM           2
 // memory
-#define MEMP_NUM_NETCONN                1024
+// lwIP's socket table holds ZTS_MAX_SOCKETS slots. Applications see descriptors
+// from libzt's own table (Sockets.cpp), which map onto these, so the size is not
+// part of the API. lwIP's select() is not built, zts_bsd_select() runs over lwIP's
+// poll(), so the table is not bounded by the platform's FD_SETSIZE. Its pages are
+// only touched once a slot is used, and pools are heap-backed (MEMP_MEM_MALLOC) so
+// nothing is reserved per pcb, the number of open sockets is limited at runtime by
+// zts_init_set_max_sockets().
+#ifndef ZTS_MAX_SOCKETS
+#define ZTS_MAX_SOCKETS                 65536
+#endif
+#define MEMP_NUM_NETCONN                ZTS_MAX_SOCKETS
+#define LWIP_SOCKET_SELECT              0
+// Multicast memberships would otherwise get one slot per socket, and every
+// close scans all of them
+#define LWIP_SOCKET_MAX_MEMBERSHIPS     1024
 #define MEMP_NUM_NETBUF                 2
 #define MEMP_NUM_TCPIP_MSG_API          1024
 #define MEMP_NUM_TCPIP_MSG_INPKT        1024
@@ -102,19 +171,23 @@
 #define IP_REASS_MAX_PBUFS              32
 // tcp
 #define TCP_TMR_INTERVAL                250
-#define TCP_WND                         0xffff0
+// Largest receive window that may be tuned, 8 MB
+#define TCP_WND                         (0xffff << TCP_RCV_SCALE)
 #define TCP_MAXRTX                      12
 #define TCP_SYNMAXRTX                   12
+// lwIP only sends SACK, received blocks are handled by the TCP hooks
 #define LWIP_TCP_SACK_OUT               1
 #define LWIP_TCP_MAX_SACK_NUM           4
 #define TCP_MSS                         (LWIP_MTU - 40)
-#define TCP_SND_BUF                     (64 * TCP_MSS)
-#define TCP_SND_QUEUELEN                (64 * (2 * (TCP_SND_BUF/TCP_MSS)))
-#define TCP_SNDLOWAT                    (0xffff - (4*TCP_MSS) - 1)
+// Largest send buffer that may be tuned (ZTS_TCP_SND_BUF_MAX)
+#define TCP_SND_BUF                     (64 * 1024 * 1024)
+#define TCP_SND_QUEUELEN                0xffff
+// Low enough for the smallest tuned send buffer and window (two segments)
+#define TCP_SNDLOWAT                    TCP_MSS
 #define TCP_SNDQUEUELOWAT               LWIP_MAX(((TCP_SND_QUEUELEN)/2), 5)
-#define TCP_WND_UPDATE_THRESHOLD        LWIP_MIN((TCP_WND / 4), (TCP_MSS * 4))
+#define TCP_WND_UPDATE_THRESHOLD        (TCP_MSS * 2)
 #define LWIP_WND_SCALE                  1
-#define TCP_RCV_SCALE                   4
+#define TCP_RCV_SCALE                   7
 // tcpip
 #define TCPIP_MBOX_SIZE                 0
 #define LWIP_TCPIP_CORE_LOCKING         1
@@ -532,7 +605,7 @@ happening sooner than they should.
  * (requires the LWIP_UDP option)
  */
 #if !defined MEMP_NUM_UDP_PCB || defined __DOXYGEN__
-#define MEMP_NUM_UDP_PCB                1024
+#define MEMP_NUM_UDP_PCB                ZTS_MAX_SOCKETS
 #endif
 
 /**
@@ -540,7 +613,7 @@ happening sooner than they should.
  * (requires the LWIP_TCP option)
  */
 #if !defined MEMP_NUM_TCP_PCB || defined __DOXYGEN__
-#define MEMP_NUM_TCP_PCB                1024
+#define MEMP_NUM_TCP_PCB                ZTS_MAX_SOCKETS
 #endif
 
 /**
@@ -548,7 +621,7 @@ happening sooner than they should.
  * (requires the LWIP_TCP option)
  */
 #if !defined MEMP_NUM_TCP_PCB_LISTEN || defined __DOXYGEN__
-#define MEMP_NUM_TCP_PCB_LISTEN         1024
+#define MEMP_NUM_TCP_PCB_LISTEN         ZTS_MAX_SOCKETS
 #endif
 
 /**
@@ -684,9 +757,10 @@ happening sooner than they should.
 
 /**
  * PBUF_POOL_SIZE: the number of buffers in the pbuf pool.
+ * (libzt: set in Presets above)
  */
 #if !defined PBUF_POOL_SIZE || defined __DOXYGEN__
-#define PBUF_POOL_SIZE                  128
+#define PBUF_POOL_SIZE                  16
 #endif
 
 /** MEMP_NUM_API_MSG: the number of concurrently active calls to various
@@ -1343,7 +1417,7 @@ happening sooner than they should.
  * will be TCP_WND >> TCP_RCV_SCALE
  */
 #if !defined TCP_WND || defined __DOXYGEN__
-#define TCP_WND                         (1 * 0xffff) // *1024 //0xFFFF // (4 * TCP_MSS)
+#define TCP_WND                         (4 * TCP_MSS)   // libzt: see Presets above
 #endif
 
 /**
@@ -1418,7 +1492,7 @@ happening sooner than they should.
  * To achieve good performance, this should be at least 2 * TCP_MSS.
  */
 #if !defined TCP_SND_BUF || defined __DOXYGEN__
-#define TCP_SND_BUF                     (32 * TCP_MSS)
+#define TCP_SND_BUF                     (2 * TCP_MSS)   // libzt: see Presets above
 #endif
 
 /**
@@ -1575,7 +1649,7 @@ happening sooner than they should.
  * send window while having a small receive window only.
  */
 #if !defined LWIP_WND_SCALE || defined __DOXYGEN__
-#define LWIP_WND_SCALE                  1
+#define LWIP_WND_SCALE                  0   // libzt: enabled in Presets above
 #define TCP_RCV_SCALE                   0
 #endif
 
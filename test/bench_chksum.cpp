@@ -0,0 +1,84 @@
+/**
+ * Microbenchmark for the Internet checksum routines handed to lwIP
+ *
+ * Checks the selected implementation (and its fused copy variant) against the
+ * portable one over a range of lengths and alignments, then reports the
+ * throughput of each. Exits non-zero on a mismatch.
+ *
+ * Usage: bench-chksum [iterations]
+ */
+
+#include "Checksum.hpp"
+
+#include <chrono>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+using namespace ZeroTier;
+
+static volatile uint16_t sink;
+
+static bool verify(const uint8_t* buf, uint8_t* dst)
+{
+    for (int len = 0; len <= 4096 + 64; len = (len < 128) ? len + 1 : len + 61) {
+        for (int off = 0; off < 4; ++off) {
+            const uint16_t expect = zts_chksum_portable(buf + off, len);
+            if (zts_chksum(buf + off, len) != expect) {
+                fprintf(stderr, "zts_chksum mismatch len=%d off=%d\n", len, off);
+                return false;
+            }
+            if (zts_chksum_copy(dst + (3 - off), buf + off, (uint16_t)len) != expect
+                || memcmp(dst + (3 - off), buf + off, len) != 0) {
+                fprintf(stderr, "zts_chksum_copy mismatch len=%d off=%d\n", len, off);
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+template <typename F> static double mbps(F f, unsigned int len, unsigned int iterations)
+{
+    auto start = std::chrono::steady_clock::now();
+    for (unsigned int i = 0; i < iterations; ++i) {
+        f();
+    }
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    return ((double)len * iterations) / elapsed.count() / 1e6;
+}
+
+int main(int argc, char** argv)
+{
+    const unsigned int iterations = argc > 1 ? (unsigned int)atoi(argv[1]) : 200000;
+    std::vector<uint8_t> src(65536 + 64), dst(65536 + 64);
+    srand(1);
+    for (size_t i = 0; i < src.size(); ++i) {
+        src[i] = (uint8_t)rand();
+    }
+    if (! verify(src.data(), dst.data())) {
+        return 1;
+    }
+    printf("implementation: %s\n", zts_chksum_impl());
+    printf("%8s %14s %14s %14s %14s\n", "bytes", "portable MB/s", "selected MB/s", "copy+sum MB/s", "fused MB/s");
+    const unsigned int lens[] = { 40, 576, 1460, 2760, 9000, 65535 };
+    for (unsigned int len : lens) {
+        // Keep the total amount of data per measurement roughly constant
+        const unsigned int n = (unsigned int)(((unsigned long long)iterations * 1460) / len) + 1;
+        const uint8_t* s = src.data() + 1;
+        uint8_t* d = dst.data() + 3;
+        double portable = mbps([&] { sink = zts_chksum_portable(s, len); }, len, n);
+        double selected = mbps([&] { sink = zts_chksum(s, len); }, len, n);
+        double copy = mbps(
+            [&] {
+                memcpy(d, s, len);
+                sink = zts_chksum_portable(d, len);
+            },
+            len,
+            n);
+        double fused = mbps([&] { sink = zts_chksum_copy(d, s, (uint16_t)len); }, len, n);
+        printf("%8u %14.0f %14.0f %14.0f %14.0f\n", len, portable, selected, copy, fused);
+    }
+    return 0;
+}
@@ -0,0 +1,201 @@
+/**
+ * Congestion control benchmark under emulated loss and latency
+ *
+ * Runs each algorithm in TcpCongestion.cpp through a discrete event model of
+ * a single bulk transfer over a bottleneck link with a drop-tail buffer of
+ * one bandwidth-delay product and random loss, as seen on long or lossy
+ * paths between ZeroTier peers. Losses are detected once three later
+ * transmissions have been acknowledged or on retransmission timeout, and the
+ * sender keeps no more than cwnd bytes in flight. Reports goodput.
+ *
+ * The model stands in for lwIP: the "reno" row is the Reno in
+ * TcpCongestion.cpp, not lwIP's own window handling, so the figures compare
+ * the algorithms with each other rather than predict the stack's throughput.
+ *
+ * Usage: bench-tcp-cc [seconds] [bottleneck Mbit/s]
+ */
+
+#include "TcpCongestion.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <deque>
+#include <queue>
+#include <random>
+#include <stdio.h>
+#include <stdlib.h>
+#include <vector>
+
+using namespace ZeroTier;
+
+#define MSS 1400
+
+struct Segment {
+    double sent;
+    unsigned int xmits;
+    uint64_t last_xmit;
+    bool delivered;
+    bool lost;
+};
+
+struct Ack {
+    double at;
+    uint64_t seg;
+    uint64_t xmit;
+    bool operator>(const Ack& o) const
+    {
+        return at > o.at;
+    }
+};
+
+struct Xmit {
+    uint64_t seg;
+    uint64_t xmit;
+};
+
+/**
+ * Goodput in Mbit/s of one transfer lasting the given time (s), over a
+ * bottleneck of the given rate (Mbit/s), round trip time (ms) and random
+ * loss probability.
+ */
+static double run(const char* cc_name, double seconds, double mbps, double rtt, double loss)
+{
+    const double rate = mbps * 1e6 / 8 / 1000;   // Bytes per ms
+    const double buffer = rate * rtt;
+    const double end = seconds * 1000;
+    std::mt19937_64 rng(7);
+    std::uniform_real_distribution<double> uniform(0, 1);
+    TcpCongestion* cc = zts_tcp_cc_create(cc_name, MSS, 4 * MSS);
+
+    std::vector<Segment> segs;
+    std::deque<Xmit> order;
+    std::deque<uint64_t> retx;
+    std::priority_queue<Ack, std::vector<Ack>, std::greater<Ack> > acks;
+    uint64_t next_xmit = 0, cum = 0, recover = 0;
+    uint32_t inflight = 0;
+    double now = 0, link_free = 0, last_progress = 0;
+    double srtt = -1, rttvar = 0, rto = 1000;
+
+    auto transmit = [&](uint64_t s) {
+        Segment& seg = segs[s];
+        seg.sent = now;
+        seg.xmits++;
+        seg.lost = false;
+        inflight += MSS;
+        const uint64_t x = next_xmit++;
+        seg.last_xmit = x;
+        order.push_back({ s, x });
+        const double queued = (link_free > now ? link_free - now : 0) * rate;
+        if (queued + MSS > buffer || uniform(rng) < loss) {
+            return;
+        }
+        link_free = std::max(link_free, now) + MSS / rate;
+        acks.push({ link_free + rtt, s, x });
+    };
+
+    while (now < end) {
+        // Retransmissions go ahead of new data
+        while (inflight + MSS <= cc->cwnd) {
+            if (! retx.empty()) {
+                const uint64_t s = retx.front();
+                retx.pop_front();
+                if (! segs[s].delivered && segs[s].lost) {
+                    transmit(s);
+                }
+                continue;
+            }
+            segs.push_back({ 0, 0, 0, false, false });
+            transmit(segs.size() - 1);
+        }
+        const double timeout = last_progress + rto;
+        if (acks.empty() || acks.top().at > timeout) {
+            now = timeout;
+            last_progress = now;
+            rto = std::min(rto * 2, 60000.0);
+            cc->onTimeout((int64_t)now);
+            order.clear();
+            retx.clear();
+            inflight = 0;
+            for (uint64_t s = cum; s < segs.size(); ++s) {
+                if (! segs[s].delivered) {
+                    segs[s].lost = true;
+                    retx.push_back(s);
+                }
+            }
+            recover = segs.size();
+            continue;
+        }
+        const Ack a = acks.top();
+        acks.pop();
+        now = a.at;
+        Segment& seg = segs[a.seg];
+        if (seg.delivered) {
+            continue;
+        }
+        seg.delivered = true;
+        if (! seg.lost) {
+            inflight -= MSS;
+        }
+        int32_t sample = -1;
+        if (seg.xmits == 1) {
+            sample = (int32_t)(now - seg.sent);
+            srtt = srtt < 0 ? sample : (7 * srtt + sample) / 8;
+            rttvar = (3 * rttvar + std::abs(sample - srtt)) / 4;
+        }
+        rto = std::max(200.0, srtt + 4 * rttvar);
+        last_progress = now;
+        while (cum < segs.size() && segs[cum].delivered) {
+            cum++;
+        }
+        // Earlier transmissions still outstanding three transmissions later
+        // were lost, react once per window
+        bool lost = false;
+        while (! order.empty() && order.front().xmit + 3 < a.xmit) {
+            const Xmit x = order.front();
+            order.pop_front();
+            Segment& o = segs[x.seg];
+            if (o.delivered || o.lost || o.last_xmit != x.xmit) {
+                continue;
+            }
+            o.lost = true;
+            inflight -= MSS;
+            retx.push_back(x.seg);
+            if (x.seg >= recover) {
+                lost = true;
+            }
+        }
+        cc->onAck((int64_t)now, MSS, sample, inflight);
+        if (lost) {
+            cc->onLoss((int64_t)now, inflight);
+            recover = segs.size();
+        }
+    }
+    delete cc;
+    return (double)cum * MSS * 8 / (seconds * 1e6);
+}
+
+int main(int argc, char** argv)
+{
+    const double seconds = argc > 1 ? atof(argv[1]) : 60;
+    const double mbps = argc > 2 ? atof(argv[2]) : 100;
+    const char* algorithms[] = { "reno", "cubic", "bbr" };
+    struct {
+        double rtt;
+        double loss;
+    } scenarios[] = { { 20, 0 }, { 20, 0.001 }, { 100, 0 }, { 100, 0.001 }, { 100, 0.01 }, { 200, 0.01 }, { 300, 0.02 } };
+
+    printf("bottleneck %.0f Mbit/s, buffer 1 BDP, %.0f s per run\n", mbps, seconds);
+    printf("%8s %8s", "rtt ms", "loss %");
+    for (const char* a : algorithms) {
+        printf(" %10s", a);
+    }
+    printf("   (goodput Mbit/s)\n");
+    for (const auto& s : scenarios) {
+        printf("%8.0f %8.1f", s.rtt, s.loss * 100);
+        for (const char* a : algorithms) {
+            printf(" %10.1f", run(a, seconds, mbps, s.rtt, s.loss));
+        }
+        printf("\n");
+    }
+    return 0;
+}
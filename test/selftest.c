@@ -597,6 +597,9 @@ void api_value_arg_test(int tid, uint8_t num, int8_t i8, int16_t i16, int32_t i3
         case 60:
             assert(zts_net_get_type(i64) == ZTS_ERR_SERVICE);
             break;
+        case 61:
+            assert(zts_net_set_trusted_link(i64, i32) == ZTS_ERR_SERVICE);
+            break;
         // Route
         case 80:
             assert(zts_route_is_assigned(i64, i32) == ZTS_ERR_SERVICE);
@@ -819,6 +822,57 @@ void api_value_arg_test(int tid, uint8_t num, int8_t i8, int16_t i16, int32_t i3
             assert(zts_util_ipstr_to_saddr(i32, NULL, i32, null_addr, NULL) == ZTS_ERR_SERVICE);
             break;
             */
+        case 177:
+            assert(zts_send_zc(i32, NULL, i32, i64) == ZTS_ERR_SERVICE);
+            break;
+        case 178:
+            assert(zts_send_zc_complete(i32, NULL, i32) == ZTS_ERR_SERVICE);
+            break;
+        case 179:
+            assert(zts_recv_loan(i32, NULL, NULL, NULL) == ZTS_ERR_SERVICE);
+            break;
+        case 180:
+            assert(zts_epoll_create() == ZTS_ERR_SERVICE);
+            break;
+        case 181:
+            assert(zts_epoll_ctl(i32, i32, i32, NULL) == ZTS_ERR_SERVICE);
+            break;
+        case 182:
+            assert(zts_epoll_wait(i32, NULL, i32, i32) == ZTS_ERR_SERVICE);
+            break;
+        case 183:
+            assert(zts_epoll_get_os_fd(i32) == ZTS_ERR_SERVICE);
+            break;
+        case 184:
+            assert(zts_bsd_sendmmsg(i32, NULL, i32, i32) == ZTS_ERR_SERVICE);
+            break;
+        case 185:
+            assert(zts_bsd_recvmmsg(i32, NULL, i32, i32) == ZTS_ERR_SERVICE);
+            break;
+        case 186:
+            assert(zts_connect_multi(NULL, i32, i32, i32) == ZTS_ERR_SERVICE);
+            break;
+        case 187:
+            assert(zts_async_tcp_listen(NULL, i16, i32, NULL, NULL) == ZTS_ERR_SERVICE);
+            break;
+        case 188:
+            assert(zts_async_tcp_connect(NULL, i16, NULL, NULL) == ZTS_ERR_SERVICE);
+            break;
+        case 189:
+            assert(zts_async_tcp_write(i32, NULL, i32, i32) == ZTS_ERR_SERVICE);
+            break;
+        case 190:
+            assert(zts_async_tcp_close(i32) == ZTS_ERR_SERVICE);
+            break;
+        case 191:
+            assert(zts_set_reuse_port(i32, i32) == ZTS_ERR_SERVICE);
+            break;
+        case 192:
+            assert(zts_get_reuse_port(i32) == ZTS_ERR_SERVICE);
+            break;
+        case 193:
+            assert(zts_async_tcp_recved(i32, i32) == ZTS_ERR_SERVICE);
+            break;
         default:
             break;
     }
@@ -963,6 +1017,19 @@ void test_sockets()
     assert(zts_set_reuse_addr(s4, 0) == ZTS_ERR_OK);
     assert(zts_get_reuse_addr(s4) == ZTS_ERR_OK);
 
+    // SO_REUSEPORT
+
+    // Check value before doing anything
+    assert(zts_get_reuse_port(s4) == 0);
+    // Turn on, which also turns on SO_REUSEADDR
+    assert(zts_set_reuse_port(s4, 1) == ZTS_ERR_OK);
+    assert(zts_get_reuse_port(s4) == 1);
+    assert(zts_get_reuse_addr(s4) == 1);
+    // Turn off
+    assert(zts_set_reuse_port(s4, 0) == ZTS_ERR_OK);
+    assert(zts_get_reuse_port(s4) == 0);
+    assert(zts_set_reuse_addr(s4, 0) == ZTS_ERR_OK);
+
     // SO_RCVTIMEO
 
     // Check value before doing anything
@@ -1103,6 +1170,305 @@ void test_sockets()
 #define BUFLEN           128
 char* msg = "welcome to the machine";
 
+// State of one side of the asynchronous TCP echo test
+struct async_test {
+    volatile int done;   // 1 once the whole message was seen, -1 on failure
+    volatile int len;
+    char buf[BUFLEN];
+};
+
+size_t async_server_on_data(int conn, const void* data, size_t len, void* arg)
+{
+    struct async_test* t = (struct async_test*)arg;
+    if (! len) {
+        zts_async_tcp_close(conn);
+        return 0;
+    }
+    // Echo from the stack thread
+    assert(zts_async_tcp_write(conn, data, len, 0) == (int)len);
+    t->len += len;
+    if (t->len >= (int)strlen(msg)) {
+        t->done = 1;
+    }
+    return len;
+}
+
+void async_client_on_connect(int conn, int err, void* arg)
+{
+    struct async_test* t = (struct async_test*)arg;
+    if (err || zts_async_tcp_write(conn, msg, strlen(msg), 0) != (int)strlen(msg)) {
+        t->done = -1;
+    }
+}
+
+size_t async_client_on_data(int conn, const void* data, size_t len, void* arg)
+{
+    struct async_test* t = (struct async_test*)arg;
+    if (len && t->len + len <= BUFLEN) {
+        memcpy(t->buf + t->len, data, len);
+        t->len += len;
+    }
+    if (t->len >= (int)strlen(msg)) {
+        t->done = 1;
+    }
+    // Acknowledged separately, as an application that consumes data later would
+    assert(zts_async_tcp_recved(conn, len) == ZTS_ERR_OK);
+    return 0;
+}
+
+void async_on_error(int conn, int err, void* arg)
+{
+    ((struct async_test*)arg)->done = -1;
+}
+
+// Wait up to MAX_CONNECT_TIME for an asynchronous test to finish
+void async_wait(struct async_test* t)
+{
+    struct timespec start, now;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    do {
+        zts_util_delay(50);
+        clock_gettime(CLOCK_MONOTONIC, &now);
+    } while (! t->done && (now.tv_sec - start.tv_sec) < MAX_CONNECT_TIME);
+}
+
+/*
+ * Extensions of the BSD socket API, run by the server against the client
+ * below once the plain IPv4 and IPv6 tests have passed. Uses the three ports
+ * following port4:
+ *
+ * - port4 + 1: two SO_REUSEPORT listeners sharing a port, waited on with
+ *   zts_epoll_*. The client connects with zts_connect_multi() and sends with
+ *   zts_send_zc(), the server reads with zts_recv_loan() and echoes back.
+ * - port4 + 2: UDP datagrams batched with zts_bsd_sendmmsg()/recvmmsg()
+ * - port4 + 3: an asynchronous TCP echo server (zts_async_tcp_*)
+ *
+ * Each port is listened on before the server answers on the previous one.
+ */
+void test_server_extended_usage(uint16_t port4)
+{
+    int err = ZTS_ERR_OK;
+    int msglen = strlen(msg);
+    char dstbuf[BUFLEN] = { 0 };
+
+    // Sharded listener
+
+    int ls[2];
+    int ep = zts_epoll_create();
+    assert(ep >= 0);
+    for (int i = 0; i < 2; i++) {
+        ls[i] = zts_bsd_socket(ZTS_AF_INET, ZTS_SOCK_STREAM, 0);
+        assert(ls[i] >= 0);
+        assert(zts_set_reuse_port(ls[i], 1) == ZTS_ERR_OK);
+        assert(zts_get_reuse_port(ls[i]) == 1);
+        err = zts_bind(ls[i], "0.0.0.0", port4 + 1);
+        assert(err == ZTS_ERR_OK);
+        err = zts_bsd_listen(ls[i], 1);
+        assert(err == ZTS_ERR_OK);
+        struct zts_epoll_event ev = { ZTS_EPOLLIN, { 0 } };
+        ev.data.fd = ls[i];
+        assert(zts_epoll_ctl(ep, ZTS_EPOLL_CTL_ADD, ls[i], &ev) == ZTS_ERR_OK);
+    }
+    DEBUG_INFO("server-ext: listening twice on: 0.0.0.0:%d", port4 + 1);
+
+    // Whichever listener the connection hashed to reports it
+    struct zts_epoll_event evs[4];
+    int n = zts_epoll_wait(ep, evs, 4, MAX_CONNECT_TIME * 1000);
+    assert(n >= 1 && (evs[0].events & ZTS_EPOLLIN));
+    assert(evs[0].data.fd == ls[0] || evs[0].data.fd == ls[1]);
+    int acc = zts_bsd_accept(evs[0].data.fd, NULL, NULL);
+    assert(acc >= 0);
+    DEBUG_INFO("server-ext: accepted connection (fd=%d)", acc);
+
+    struct zts_epoll_event ev = { ZTS_EPOLLIN, { 0 } };
+    ev.data.fd = acc;
+    assert(zts_epoll_ctl(ep, ZTS_EPOLL_CTL_ADD, acc, &ev) == ZTS_ERR_OK);
+
+    // Read the client's zero-copy send through loaned buffers
+    int bytes_read = 0;
+    while (bytes_read < msglen) {
+        n = zts_epoll_wait(ep, evs, 4, MAX_CONNECT_TIME * 1000);
+        assert(n >= 1);
+        struct zts_iovec iov[4];
+        unsigned int count = 4;
+        void* token = NULL;
+        ssize_t len = zts_recv_loan(acc, iov, &count, &token);
+        assert(len > 0 && token != NULL && count >= 1);
+        for (unsigned int i = 0; i < count; i++) {
+            assert(bytes_read + iov[i].iov_len <= BUFLEN);
+            memcpy(dstbuf + bytes_read, iov[i].iov_base, iov[i].iov_len);
+            bytes_read += iov[i].iov_len;
+        }
+        assert(zts_recv_return(token) == ZTS_ERR_OK);
+    }
+    DEBUG_INFO("server-ext: loaned (%d) bytes", bytes_read);
+    assert(bytes_read == msglen && ! memcmp(dstbuf, msg, msglen));
+
+    // Open the next two ports before answering
+
+    int u = zts_bsd_socket(ZTS_AF_INET, ZTS_SOCK_DGRAM, 0);
+    assert(u >= 0);
+    err = zts_bind(u, "0.0.0.0", port4 + 2);
+    assert(err == ZTS_ERR_OK);
+
+    struct async_test at;
+    memset(&at, 0, sizeof(at));
+    struct zts_async_tcp_callbacks cb = { NULL, NULL, async_server_on_data, NULL, async_on_error };
+    int al = zts_async_tcp_listen(NULL, port4 + 3, 0, &cb, &at);
+    assert(al >= 0);
+
+    int bytes_sent = zts_bsd_write(acc, msg, msglen);
+    assert(bytes_sent == msglen);
+
+    // Batched UDP, echo the datagrams of the first batch in one call
+
+    char dgrams[4][BUFLEN];
+    struct zts_iovec iovs[4];
+    struct zts_mmsghdr msgs[4];
+    struct zts_sockaddr_in from;
+    memset(msgs, 0, sizeof(msgs));
+    for (int i = 0; i < 4; i++) {
+        iovs[i].iov_base = dgrams[i];
+        iovs[i].iov_len = BUFLEN;
+        msgs[i].msg_hdr.msg_iov = &iovs[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+    msgs[0].msg_hdr.msg_name = &from;
+    msgs[0].msg_hdr.msg_namelen = sizeof(from);
+    n = zts_bsd_recvmmsg(u, msgs, 4, 0);
+    DEBUG_INFO("server-ext: received (%d) datagrams", n);
+    assert(n >= 1);
+    for (int i = 0; i < n; i++) {
+        assert(msgs[i].msg_len == (unsigned int)msglen && ! memcmp(dgrams[i], msg, msglen));
+        iovs[i].iov_len = msgs[i].msg_len;
+        msgs[i].msg_hdr.msg_name = &from;
+        msgs[i].msg_hdr.msg_namelen = sizeof(from);
+    }
+    assert(zts_bsd_sendmmsg(u, msgs, n, 0) == n);
+
+    // Asynchronous echo
+
+    async_wait(&at);
+    DEBUG_INFO("server-ext: echoed (%d) bytes asynchronously", at.len);
+    assert(at.done == 1 && at.len == msglen);
+
+    zts_async_tcp_close(al);
+    zts_bsd_close(u);
+    zts_bsd_close(acc);
+    zts_bsd_close(ls[0]);
+    zts_bsd_close(ls[1]);
+    assert(zts_epoll_close(ep) == ZTS_ERR_OK);
+    DEBUG_INFO("server-ext: Test OK");
+}
+
+void test_client_extended_usage(char* ip4, char* ip6, uint16_t port4)
+{
+    int msglen = strlen(msg);
+    char dstbuf[BUFLEN] = { 0 };
+
+    struct timespec start, now;
+    int time_diff = 0;
+
+    // Sharded listener, reached over whichever address answers first
+
+    const char* ips[2] = { ip6, ip4 };
+    int s = -1;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    do {
+        DEBUG_INFO("client-ext: connecting to: %s or %s:%d", ip6, ip4, port4 + 1);
+        s = zts_connect_multi(ips, 2, port4 + 1, CONNECT_TIMEOUT * 1000);
+        if (s < 0) {
+            zts_util_delay(500);
+        }
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        time_diff = (now.tv_sec - start.tv_sec);
+    } while (s < 0 && time_diff < MAX_CONNECT_TIME);
+    assert(s >= 0);
+
+    // Zero-copy send, msg is static so it outlives the send
+    int bytes_sent = 0;
+    while (bytes_sent < msglen) {
+        ssize_t len = zts_send_zc(s, msg + bytes_sent, msglen - bytes_sent, bytes_sent);
+        if (len < 0) {
+            assert(zts_errno == ZTS_EWOULDBLOCK);
+            zts_util_delay(50);
+            continue;
+        }
+        bytes_sent += len;
+    }
+    uint64_t cookie = UINT64_MAX;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    do {
+        if (zts_send_zc_complete(s, &cookie, 1) == 1 && cookie == 0) {
+            break;
+        }
+        zts_util_delay(50);
+        clock_gettime(CLOCK_MONOTONIC, &now);
+    } while ((now.tv_sec - start.tv_sec) < MAX_CONNECT_TIME);
+    DEBUG_INFO("client-ext: sent (%d) bytes without copying", bytes_sent);
+    assert(cookie == 0);
+
+    int bytes_read = zts_bsd_read(s, dstbuf, BUFLEN);
+    assert(bytes_read == msglen && ! memcmp(dstbuf, msg, msglen));
+
+    // Batched UDP, resent until the echo arrives
+
+    int u = zts_bsd_socket(ZTS_AF_INET, ZTS_SOCK_DGRAM, 0);
+    assert(u >= 0);
+    struct zts_sockaddr_in to;
+    zts_socklen_t tolen = sizeof(to);
+    assert(zts_util_ipstr_to_saddr(ip4, port4 + 2, (struct zts_sockaddr*)&to, &tolen) == ZTS_ERR_OK);
+    char dgrams[2][BUFLEN];
+    struct zts_iovec iovs[2];
+    struct zts_mmsghdr msgs[2];
+    int n = 0;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    do {
+        memset(msgs, 0, sizeof(msgs));
+        for (int i = 0; i < 2; i++) {
+            iovs[i].iov_base = msg;
+            iovs[i].iov_len = msglen;
+            msgs[i].msg_hdr.msg_name = &to;
+            msgs[i].msg_hdr.msg_namelen = tolen;
+            msgs[i].msg_hdr.msg_iov = &iovs[i];
+            msgs[i].msg_hdr.msg_iovlen = 1;
+        }
+        assert(zts_bsd_sendmmsg(u, msgs, 2, 0) == 2);
+        assert(msgs[0].msg_len == (unsigned int)msglen && msgs[1].msg_len == (unsigned int)msglen);
+        zts_util_delay(250);
+        memset(msgs, 0, sizeof(msgs));
+        for (int i = 0; i < 2; i++) {
+            iovs[i].iov_base = dgrams[i];
+            iovs[i].iov_len = BUFLEN;
+            msgs[i].msg_hdr.msg_iov = &iovs[i];
+            msgs[i].msg_hdr.msg_iovlen = 1;
+        }
+        n = zts_bsd_recvmmsg(u, msgs, 2, ZTS_MSG_DONTWAIT);
+        clock_gettime(CLOCK_MONOTONIC, &now);
+    } while (n <= 0 && (now.tv_sec - start.tv_sec) < MAX_CONNECT_TIME);
+    DEBUG_INFO("client-ext: received (%d) datagrams", n);
+    assert(n >= 1);
+    for (int i = 0; i < n; i++) {
+        assert(msgs[i].msg_len == (unsigned int)msglen && ! memcmp(dgrams[i], msg, msglen));
+    }
+
+    // Asynchronous echo
+
+    struct async_test at;
+    memset(&at, 0, sizeof(at));
+    struct zts_async_tcp_callbacks cb = { NULL, async_client_on_connect, async_client_on_data, NULL, async_on_error };
+    int conn = zts_async_tcp_connect(ip4, port4 + 3, &cb, &at);
+    assert(conn >= 0);
+    async_wait(&at);
+    DEBUG_INFO("client-ext: read (%d) bytes asynchronously", at.len);
+    assert(at.done == 1 && at.len == msglen && ! memcmp(at.buf, msg, msglen));
+    zts_async_tcp_close(conn);
+
+    zts_bsd_close(u);
+    zts_bsd_close(s);
+    DEBUG_INFO("client-ext: Test OK");
+}
+
 void test_server_socket_usage(uint16_t port4, uint16_t port6)
 {
     int err = ZTS_ERR_OK;
@@ -1224,6 +1590,8 @@ void test_server_socket_usage(uint16_t port4, uint16_t port6)
     zts_bsd_close(acc6);
     assert(err == ZTS_ERR_OK && zts_errno == 0);
 
+    test_server_extended_usage(port4);
+
     zts_node_stop();
     assert(err == ZTS_ERR_OK && zts_errno == 0);
     int s = zts_bsd_socket(ZTS_AF_INET, ZTS_SOCK_STREAM, 0);
@@ -1335,6 +1703,8 @@ void test_client_socket_usage(char* ip4, uint16_t port4, char* ip6, uint16_t por
     zts_bsd_close(s6);
     assert(err == ZTS_ERR_OK && zts_errno == 0);
 
+    test_client_extended_usage(ip4, ip6, port4);
+
     zts_node_stop();
     assert(err == ZTS_ERR_OK && zts_errno == 0);
     int s = zts_bsd_socket(ZTS_AF_INET, ZTS_SOCK_STREAM, 0);
@@ -1678,6 +2048,44 @@ void test_roots_handling()
     // TODO: Test setting when node is already running
 }
 
+void test_init_tuning()
+{
+    DEBUG_INFO("\n\n***\ttest_init_tuning");
+
+    assert(zts_init_set_rx_burst(0, 2) == ZTS_ERR_ARG);
+    assert(zts_init_set_rx_burst(257, 2) == ZTS_ERR_ARG);
+    assert(zts_init_set_rx_burst(1, 0) == ZTS_ERR_OK);
+    assert(zts_init_set_rx_burst(32, 2) == ZTS_ERR_OK);
+    assert(zts_init_set_tx_queue(1024) == ZTS_ERR_OK);
+    assert(zts_init_set_tx_queue(0) == ZTS_ERR_OK);
+    assert(zts_init_set_crypto_threads(65) == ZTS_ERR_ARG);
+    assert(zts_init_set_crypto_threads(4) == ZTS_ERR_OK);
+    assert(zts_init_set_crypto_threads(0) == ZTS_ERR_OK);
+    assert(zts_init_allow_udp_offload(1) == ZTS_ERR_OK);
+    assert(zts_init_allow_udp_offload(0) == ZTS_ERR_OK);
+    assert(zts_init_set_wire_rx_threads(17) == ZTS_ERR_ARG);
+    assert(zts_init_set_wire_rx_threads(4) == ZTS_ERR_OK);
+    assert(zts_init_set_wire_rx_threads(0) == ZTS_ERR_OK);
+    assert(zts_init_set_io_engine(2) == ZTS_ERR_ARG);
+    assert(zts_init_set_io_engine(ZTS_IO_ENGINE_URING) == ZTS_ERR_OK);
+    assert(zts_init_set_io_engine(ZTS_IO_ENGINE_DEFAULT) == ZTS_ERR_OK);
+    assert(zts_init_set_mem_slab(65537, 0) == ZTS_ERR_ARG);
+    assert(zts_init_set_mem_slab(64, 0) == ZTS_ERR_OK);
+    assert(zts_init_set_tuning_profile(3) == ZTS_ERR_ARG);
+    assert(zts_init_set_tuning_profile(ZTS_TUNING_HIGH_BDP) == ZTS_ERR_OK);
+    assert(zts_init_set_tcp_window(0x20000, 0) == ZTS_ERR_ARG);
+    assert(zts_init_set_tcp_window(0xffff0, 15) == ZTS_ERR_ARG);
+    assert(zts_init_set_tcp_window(0xffff0, 8) == ZTS_ERR_ARG);
+    assert(zts_init_set_tcp_send_buf(0) == ZTS_ERR_ARG);
+    assert(zts_init_set_tcp_ooseq_limit(0, 0x10000) == ZTS_ERR_ARG);
+    assert(zts_init_set_tuning_profile(ZTS_TUNING_DEFAULT) == ZTS_ERR_OK);
+    assert(zts_init_set_tcp_window(0xffff0, 4) == ZTS_ERR_OK);
+    assert(zts_init_set_tcp_ooseq_limit(0, 0) == ZTS_ERR_OK);
+    assert(zts_init_set_max_sockets(ZTS_MAX_SOCKETS + 1) == ZTS_ERR_ARG);
+    assert(zts_init_set_max_sockets(ZTS_MAX_SOCKETS) == ZTS_ERR_OK);
+    assert(zts_init_set_max_sockets(0) == ZTS_ERR_OK);
+}
+
 void test_start_sequences()
 {
     DEBUG_INFO("\n\n***\ttest_start_sequences");
@@ -1826,6 +2234,25 @@ int test_stats()
         s.nd6_rx,
         s.nd6_drop,
         s.nd6_err);
+
+    zts_stats_wire_t w = { 0 };
+    assert(zts_stats_get_wire(NULL) == ZTS_ERR_ARG);
+    if (zts_stats_get_wire(&w) == ZTS_ERR_OK) {
+        printf(
+            "  wire_rx=%9llu (%llu syscalls), wire_tx=%9llu (%llu syscalls)\n",
+            (unsigned long long)w.wire_rx_packets,
+            (unsigned long long)w.wire_rx_syscalls,
+            (unsigned long long)w.wire_tx_packets,
+            (unsigned long long)w.wire_tx_syscalls);
+    }
+
+    zts_stats_slab_t sl;
+    assert(zts_stats_get_slab(NULL) == ZTS_ERR_ARG);
+    assert(zts_stats_get_slab(&sl) == ZTS_ERR_OK);
+    for (int i = 0; i < ZTS_SLAB_CLASSES; i++) {
+        assert(sl.objects_peak[i] <= sl.objects_total[i]);
+        assert(sl.objects_in_use[i] <= sl.objects_total[i]);
+    }
     return 0;
 }
 
@@ -1891,6 +2318,7 @@ int main(int argc, char** argv)
         test_identity_key_handling();
         test_addr_computation();
         test_roots_handling();
+        test_init_tuning();
         test_start_sequences();
         test_api_abuse();
         test_stats();
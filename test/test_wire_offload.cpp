@@ -0,0 +1,162 @@
+/**
+ * Loopback test for the UDP GSO/GRO wire path
+ *
+ * Sends a run of packets to a loopback socket as one UDP_SEGMENT buffer, the
+ * way NodeService::sendWireRun() does, receives them with UDP_GRO enabled and
+ * splits the coalesced datagrams back up as NodeService::handleCoalesced()
+ * does. Checks that every packet arrives whole and in order, and that the
+ * receive side actually saw coalesced datagrams.
+ *
+ * Exits with 77 (skipped) when the kernel lacks UDP GSO or GRO.
+ */
+
+#include "WireOffload.hpp"
+
+#include <stdio.h>
+
+#if ZTS_WIRE_MMSG
+
+#include <arpa/inet.h>
+#include <string.h>
+#include <sys/time.h>
+#include <unistd.h>
+#include <vector>
+
+using namespace ZeroTier;
+
+#define SKIPPED 77
+
+struct Slot {
+    struct sockaddr_storage addr;
+    unsigned int len;
+    char data[2048];
+};
+
+static int fail(const char* msg)
+{
+    fprintf(stderr, "test-wire-offload: %s\n", msg);
+    return 1;
+}
+
+int main()
+{
+    int rx = socket(AF_INET, SOCK_DGRAM, 0);
+    int tx = socket(AF_INET, SOCK_DGRAM, 0);
+    if (rx < 0 || tx < 0) {
+        return fail("socket() failed");
+    }
+    struct sockaddr_in in4;
+    memset(&in4, 0, sizeof(in4));
+    in4.sin_family = AF_INET;
+    in4.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t alen = sizeof(in4);
+    if (bind(rx, (struct sockaddr*)&in4, sizeof(in4)) < 0 || getsockname(rx, (struct sockaddr*)&in4, &alen) < 0) {
+        return fail("bind() failed");
+    }
+    if (! zts_wire_gso_supported(tx) || ! zts_wire_gro_enable(rx)) {
+        printf("test-wire-offload: UDP GSO/GRO not supported, skipped\n");
+        return SKIPPED;
+    }
+    struct timeval tv = { 2, 0 };
+    setsockopt(rx, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
+    // Equal-sized packets with a short tail, each filled with its own index
+    const unsigned int count = 12;
+    const unsigned int size = 1200;
+    std::vector<Slot> slots(count);
+    for (unsigned int i = 0; i < count; ++i) {
+        memcpy(&slots[i].addr, &in4, sizeof(in4));
+        slots[i].len = (i == count - 1) ? 500 : size;
+        memset(slots[i].data, (int)i, slots[i].len);
+    }
+    if (zts_wire_gso_run(slots.data(), count) != count) {
+        return fail("zts_wire_gso_run() split a run of packets to one destination");
+    }
+    // A longer packet or another destination ends a run
+    slots[3].len = size + 1;
+    if (zts_wire_gso_run(slots.data(), count) != 3) {
+        return fail("zts_wire_gso_run() took a packet longer than the segment size");
+    }
+    slots[3].len = size;
+    ((struct sockaddr_in*)&slots[5].addr)->sin_port = htons(ntohs(in4.sin_port) + 1);
+    if (zts_wire_gso_run(slots.data(), count) != 5) {
+        return fail("zts_wire_gso_run() took a packet for another destination");
+    }
+    memcpy(&slots[5].addr, &in4, sizeof(in4));
+
+    struct iovec iovs[count];
+    for (unsigned int i = 0; i < count; ++i) {
+        iovs[i].iov_base = slots[i].data;
+        iovs[i].iov_len = slots[i].len;
+    }
+    char txctrl[ZTS_WIRE_GSO_CTRL_LEN];
+    struct msghdr h;
+    memset(&h, 0, sizeof(h));
+    h.msg_name = &slots[0].addr;
+    h.msg_namelen = sizeof(struct sockaddr_in);
+    h.msg_iov = iovs;
+    h.msg_iovlen = count;
+    zts_wire_set_gso(&h, txctrl, (uint16_t)size);
+    ssize_t total = (ssize_t)((count - 1) * size + slots[count - 1].len);
+    if (sendmsg(tx, &h, 0) != total) {
+        return fail("sendmsg() with UDP_SEGMENT failed");
+    }
+
+    // Collect what arrives, splitting coalesced datagrams
+    std::vector<std::vector<char> > packets;
+    unsigned int datagrams = 0;
+    unsigned int coalesced = 0;
+    // Same slot size as the receive shards use
+    std::vector<char> buf(ZTS_WIRE_GRO_SLOT_LEN);
+    while (packets.size() < count) {
+        struct iovec iov = { buf.data(), buf.size() };
+        char rxctrl[ZTS_WIRE_GRO_CTRL_LEN];
+        memset(&h, 0, sizeof(h));
+        h.msg_iov = &iov;
+        h.msg_iovlen = 1;
+        h.msg_control = rxctrl;
+        h.msg_controllen = sizeof(rxctrl);
+        ssize_t n = recvmsg(rx, &h, 0);
+        if (n < 0) {
+            return fail("timed out waiting for packets");
+        }
+        if (h.msg_flags & MSG_TRUNC) {
+            return fail("coalesced datagram did not fit a receive slot");
+        }
+        datagrams++;
+        unsigned int segSize = zts_wire_gro_size(&h);
+        if (segSize && ((unsigned long)n > segSize)) {
+            coalesced++;
+        }
+        zts_wire_split(buf.data(), (unsigned long)n, segSize, [&](char* p, unsigned long len) {
+            packets.push_back(std::vector<char>(p, p + len));
+        });
+    }
+    for (unsigned int i = 0; i < count; ++i) {
+        if (packets[i].size() != slots[i].len) {
+            return fail("packet arrived with the wrong length");
+        }
+        for (unsigned int j = 0; j < slots[i].len; ++j) {
+            if (packets[i][j] != (char)i) {
+                return fail("packet arrived out of order or corrupted");
+            }
+        }
+    }
+    if (! coalesced) {
+        return fail("no coalesced datagrams were received");
+    }
+    printf("test-wire-offload: %u packets in %u datagrams (%u coalesced)\n", count, datagrams, coalesced);
+    close(rx);
+    close(tx);
+    return 0;
+}
+
+#else
+
+int main()
+{
+    printf("test-wire-offload: UDP GSO/GRO is Linux only, skipped\n");
+    return 77;
+}
+
+#endif